@@ -0,0 +1,169 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "MemoryMappedFile.h"
+#include "Debug.h"
+#include "Utils.h" // min
+
+#if NV_OS_WIN32
+#include <windows.h> // CreateFileMapping, MapViewOfFile
+#else
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open
+#include <unistd.h> // pread, close
+#endif
+#include <string.h> // memcpy
+
+using namespace nv;
+
+
+MemoryMappedFile::MemoryMappedFile() :
+#if NV_OS_WIN32
+    m_file(INVALID_HANDLE_VALUE), m_mapping(NULL),
+#else
+    m_fd(-1),
+#endif
+    m_data(NULL), m_size(0), m_mapFailed(false)
+{
+}
+
+MemoryMappedFile::MemoryMappedFile(const char * fileName) :
+#if NV_OS_WIN32
+    m_file(INVALID_HANDLE_VALUE), m_mapping(NULL),
+#else
+    m_fd(-1),
+#endif
+    m_data(NULL), m_size(0), m_mapFailed(false)
+{
+    open(fileName);
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    close();
+}
+
+bool MemoryMappedFile::open(const char * fileName)
+{
+    nvCheck(fileName != NULL);
+
+    close();
+
+#if NV_OS_WIN32
+    m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        close();
+        return false;
+    }
+    m_size = uint64(size.QuadPart);
+#else
+    m_fd = ::open(fileName, O_RDONLY);
+    if (m_fd == -1) {
+        return false;
+    }
+
+    struct stat buf;
+    if (fstat(m_fd, &buf) != 0) {
+        close();
+        return false;
+    }
+    m_size = uint64(buf.st_size);
+#endif
+
+    return true;
+}
+
+void MemoryMappedFile::close()
+{
+#if NV_OS_WIN32
+    if (m_data != NULL) UnmapViewOfFile(m_data);
+    if (m_mapping != NULL) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#else
+    if (m_data != NULL) munmap((void *)m_data, size_t(m_size));
+    if (m_fd != -1) ::close(m_fd);
+    m_fd = -1;
+#endif
+
+    m_data = NULL;
+    m_size = 0;
+    m_mapFailed = false;
+}
+
+bool MemoryMappedFile::isOpen() const
+{
+#if NV_OS_WIN32
+    return m_file != INVALID_HANDLE_VALUE;
+#else
+    return m_fd != -1;
+#endif
+}
+
+uint64 MemoryMappedFile::read(uint64 offset, void * data, uint64 size) const
+{
+    nvDebugCheck(data != NULL);
+
+    if (!isOpen() || offset >= m_size) return 0;
+    if (size > m_size - offset) size = m_size - offset;
+
+    // Use the mapping if it's already there.
+    if (m_data != NULL) {
+        memcpy(data, m_data + offset, size_t(size));
+        return size;
+    }
+
+    uint64 total = 0;
+    while (total < size)
+    {
+        // Read at most 1 GB at a time, the native calls take 32 bit sizes.
+        const uint64 chunk = min(size - total, uint64(1) << 30);
+
+#if NV_OS_WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = DWORD(offset + total);
+        overlapped.OffsetHigh = DWORD((offset + total) >> 32);
+
+        DWORD count = 0;
+        if (!ReadFile(m_file, (uint8 *)data + total, DWORD(chunk), &count, &overlapped) || count == 0) break;
+#else
+        ssize_t count = pread(m_fd, (uint8 *)data + total, size_t(chunk), off_t(offset + total));
+        if (count <= 0) break;
+#endif
+        total += uint64(count);
+    }
+
+    return total;
+}
+
+const uint8 * MemoryMappedFile::data()
+{
+    if (m_data != NULL || m_mapFailed || !isOpen()) return m_data;
+
+    // Files that don't fit in the address space can't be mapped.
+    if (m_size == 0 || m_size != uint64(size_t(m_size))) {
+        m_mapFailed = true;
+        return NULL;
+    }
+
+#if NV_OS_WIN32
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping != NULL) {
+        m_data = (const uint8 *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    void * ptr = mmap(NULL, size_t(m_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (ptr != MAP_FAILED) {
+        m_data = (const uint8 *)ptr;
+    }
+#endif
+
+    m_mapFailed = (m_data == NULL);
+    return m_data;
+}
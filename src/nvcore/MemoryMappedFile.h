@@ -0,0 +1,52 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_CORE_MEMORYMAPPEDFILE_H
+#define NV_CORE_MEMORYMAPPEDFILE_H
+
+#include "nvcore.h"
+
+namespace nv
+{
+
+    /// Read only memory mapped file.
+    ///
+    /// The file is opened by open(), but it's not mapped until data() is called for the first time, so reading a few
+    /// bytes with read() doesn't touch the address space. Pages of the mapping are only loaded when they are accessed.
+    class NVCORE_CLASS MemoryMappedFile
+    {
+        NV_FORBID_COPY(MemoryMappedFile);
+    public:
+        MemoryMappedFile();
+        MemoryMappedFile(const char * fileName);
+        ~MemoryMappedFile();
+
+        bool open(const char * fileName);
+        void close();
+
+        bool isOpen() const;
+        uint64 size() const { return m_size; }
+
+        /// Read size bytes at the given offset without mapping the file. Returns the number of bytes read.
+        uint64 read(uint64 offset, void * data, uint64 size) const;
+
+        /// Pointer to the contents of the file, maps the file if needed. NULL on error.
+        const uint8 * data();
+
+    private:
+
+#if NV_OS_WIN32
+        void * m_file;
+        void * m_mapping;
+#else
+        int m_fd;
+#endif
+        const uint8 * m_data;
+        uint64 m_size;
+        bool m_mapFailed;
+    };
+
+} // nv namespace
+
+
+#endif // NV_CORE_MEMORYMAPPEDFILE_H
@@ -7,6 +7,7 @@
 #include "nvcore.h"
 #include "Stream.h"
 #include "Array.h"
+#include "Utils.h" // NV_UINT32_MAX
 
 #include <stdio.h> // fopen
 #include <string.h> // memcpy
@@ -30,6 +31,26 @@ namespace nv
     }
 
 
+    // Portable versions of fseek and ftell with 64 bit offsets.
+    inline int fileSeek(FILE * fp, uint64 offset, int origin)
+    {
+#if NV_OS_WIN32
+        return _fseeki64_nolock(fp, int64(offset), origin);
+#else
+        return fseeko(fp, off_t(offset), origin);
+#endif
+    }
+
+    inline uint64 fileTell(FILE * fp)
+    {
+#if NV_OS_WIN32
+        return uint64(_ftelli64_nolock(fp));
+#else
+        return uint64(ftello(fp));
+#endif
+    }
+
+
     /// Base stdio stream.
     class NVCORE_CLASS StdStream : public Stream
     {
@@ -54,41 +75,26 @@ namespace nv
 
         /** @name Stream implementation. */
         //@{
-        virtual void seek( uint pos )
+        virtual void seek( uint64 pos )
         {
             nvDebugCheck(m_fp != NULL);
             nvDebugCheck(pos <= size());
-#if NV_OS_WIN32
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            fseek(m_fp, pos, SEEK_SET);
-#endif
+            fileSeek(m_fp, pos, SEEK_SET);
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             nvDebugCheck(m_fp != NULL);
-#if NV_OS_WIN32
-            return _ftell_nolock(m_fp);
-#else
-            return (uint)ftell(m_fp);
-#endif
+            return fileTell(m_fp);
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             nvDebugCheck(m_fp != NULL);
-#if NV_OS_WIN32
-            uint pos = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, 0, SEEK_END);
-            uint end = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            uint pos = (uint)ftell(m_fp);
-            fseek(m_fp, 0, SEEK_END);
-            uint end = (uint)ftell(m_fp);
-            fseek(m_fp, pos, SEEK_SET);
-#endif
+            uint64 pos = fileTell(m_fp);
+            fileSeek(m_fp, 0, SEEK_END);
+            uint64 end = fileTell(m_fp);
+            fileSeek(m_fp, pos, SEEK_SET);
             return end;
         }
 
@@ -110,17 +116,10 @@ namespace nv
         {
             nvDebugCheck(m_fp != NULL);
             //return feof( m_fp ) != 0;
-#if NV_OS_WIN32
-            uint pos = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, 0, SEEK_END);
-            uint end = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            uint pos = (uint)ftell(m_fp);
-            fseek(m_fp, 0, SEEK_END);
-            uint end = (uint)ftell(m_fp);
-            fseek(m_fp, pos, SEEK_SET);
-#endif
+            uint64 pos = fileTell(m_fp);
+            fileSeek(m_fp, 0, SEEK_END);
+            uint64 end = fileTell(m_fp);
+            fileSeek(m_fp, pos, SEEK_SET);
             return pos == end;
         }
 
@@ -128,6 +127,8 @@ namespace nv
         virtual bool isSeekable() const { return true; }
         //@}
 
+        FILE * fileHandle() const { return m_fp; }
+
     protected:
 
         FILE * m_fp;
@@ -153,22 +154,23 @@ namespace nv
         /** @name Stream implementation. */
         //@{
         /// Write data.
-        virtual uint serialize( void * data, uint len )
+        virtual uint64 serialize( void * data, uint64 len )
         {
             nvDebugCheck(data != NULL);
             nvDebugCheck(m_fp != NULL);
+            nvDebugCheck(len == uint64(size_t(len)));
 #if NV_OS_WIN32
-            return (uint)_fwrite_nolock(data, 1, len, m_fp);
+            return _fwrite_nolock(data, 1, size_t(len), m_fp);
 #elif NV_OS_LINUX
-            return (uint)fwrite_unlocked(data, 1, len, m_fp);
+            return fwrite_unlocked(data, 1, size_t(len), m_fp);
 #elif NV_OS_DARWIN
             // @@ No error checking, always returns len.
-            for (uint i = 0; i < len; i++) {
+            for (uint64 i = 0; i < len; i++) {
                 putc_unlocked(((char *)data)[i], m_fp);
             }
             return len;
 #else
-            return (uint)fwrite(data, 1, len, m_fp);
+            return fwrite(data, 1, size_t(len), m_fp);
 #endif
         }
 
@@ -203,22 +205,23 @@ namespace nv
         /** @name Stream implementation. */
         //@{
         /// Read data.
-        virtual uint serialize( void * data, uint len )
+        virtual uint64 serialize( void * data, uint64 len )
         {
             nvDebugCheck(data != NULL);
             nvDebugCheck(m_fp != NULL);
+            nvDebugCheck(len == uint64(size_t(len)));
 #if NV_OS_WIN32
-            return (uint)_fread_nolock(data, 1, len, m_fp);
+            return _fread_nolock(data, 1, size_t(len), m_fp);
 #elif NV_OS_LINUX
-            return (uint)fread_unlocked(data, 1, len, m_fp);
+            return fread_unlocked(data, 1, size_t(len), m_fp);
 #elif NV_OS_DARWIN
             // @@ No error checking, always returns len.
-            for (uint i = 0; i < len; i++) {
+            for (uint64 i = 0; i < len; i++) {
                 ((char *)data)[i] = getc_unlocked(m_fp);
             }
             return len;
 #else
-            return (uint)fread(data, 1, len, m_fp);
+            return fread(data, 1, size_t(len), m_fp);
 #endif
             
         }
@@ -244,39 +247,39 @@ namespace nv
     public:
 
         /// Ctor.
-        MemoryInputStream( const uint8 * mem, uint size ) : m_mem(mem), m_ptr(mem), m_size(size) { }
+        MemoryInputStream( const uint8 * mem, uint64 size ) : m_mem(mem), m_ptr(mem), m_size(size) { }
 
         /** @name Stream implementation. */
         //@{
         /// Read data.
-        virtual uint serialize( void * data, uint len )
+        virtual uint64 serialize( void * data, uint64 len )
         {
             nvDebugCheck(data != NULL);
             nvDebugCheck(!isError());
 
-            uint left = m_size - tell();
+            uint64 left = m_size - tell();
             if (len > left) len = left;
 
-            memcpy( data, m_ptr, len );
+            memcpy( data, m_ptr, size_t(len) );
             m_ptr += len;
 
             return len;
         }
 
-        virtual void seek( uint pos )
+        virtual void seek( uint64 pos )
         {
             nvDebugCheck(!isError());
             m_ptr = m_mem + pos;
             nvDebugCheck(!isError());
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             nvDebugCheck(m_ptr >= m_mem);
-            return uint(m_ptr - m_mem);
+            return uint64(m_ptr - m_mem);
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             return m_size;
         }
@@ -320,7 +323,7 @@ namespace nv
 
         const uint8 * m_mem;
         const uint8 * m_ptr;
-        uint m_size;
+        uint64 m_size;
 
     };
 
@@ -333,16 +336,18 @@ namespace nv
 
         BufferOutputStream(Array<uint8> & buffer) : m_buffer(buffer) { }
 
-        virtual uint serialize( void * data, uint len )
+        virtual uint64 serialize( void * data, uint64 len )
         {
             nvDebugCheck(data != NULL);
-            m_buffer.append((uint8 *)data, len);
+            // Arrays have 32 bit sizes.
+            nvCheck(m_buffer.size() + len <= NV_UINT32_MAX);
+            m_buffer.append((uint8 *)data, uint(len));
             return len;
         }
 
-        virtual void seek( uint /*pos*/ ) { /*Not implemented*/ }
-        virtual uint tell() const { return m_buffer.size(); }
-        virtual uint size() const { return m_buffer.size(); }
+        virtual void seek( uint64 /*pos*/ ) { /*Not implemented*/ }
+        virtual uint64 tell() const { return m_buffer.size(); }
+        virtual uint64 size() const { return m_buffer.size(); }
 
         virtual bool isError() const { return false; }
         virtual void clearError() {}
@@ -386,7 +391,7 @@ namespace nv
         /** @name Stream implementation. */
         //@{
         /// Read data.
-        virtual uint serialize( void * data, uint len )
+        virtual uint64 serialize( void * data, uint64 len )
         {
             nvDebugCheck(data != NULL);
             len = m_s->serialize( data, len );
@@ -398,7 +403,7 @@ namespace nv
             return len;
         }
 
-        virtual void seek( uint pos )
+        virtual void seek( uint64 pos )
         {
             m_s->seek( pos );
 
@@ -407,12 +412,12 @@ namespace nv
             }
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             return m_s->tell();
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             return m_s->size();
         }
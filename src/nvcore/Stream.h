@@ -42,17 +42,17 @@ namespace nv
         ByteOrder byteOrder() const { return m_byteOrder; }
 
 
-        /// Serialize the given data.
-        virtual uint serialize( void * data, uint len ) = 0;
+        /// Serialize the given data. Offsets and sizes are 64 bits, so that archives can be larger than 4 GB.
+        virtual uint64 serialize( void * data, uint64 len ) = 0;
 
         /// Move to the given position in the archive.
-        virtual void seek( uint pos ) = 0;
+        virtual void seek( uint64 pos ) = 0;
 
         /// Return the current position in the archive.
-        virtual uint tell() const = 0;
+        virtual uint64 tell() const = 0;
 
         /// Return the current size of the archive.
-        virtual uint size() const = 0;
+        virtual uint64 size() const = 0;
 
         /// Determine if there has been any error.
         virtual bool isError() const = 0;
@@ -73,7 +73,7 @@ namespace nv
         virtual bool isSaving() const = 0;
 
 
-        void advance(uint offset) { seek(tell() + offset); }
+        void advance(uint64 offset) { seek(tell() + offset); }
 
 
         // friends	
@@ -0,0 +1,163 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#include "BatchImageLoader.h"
+#include "Image.h"
+#include "FloatImage.h"
+#include "ImageIO.h"
+
+#include "nvthread/Thread.h"
+#include "nvthread/nvthread.h" // hardwareThreadCount
+
+#include "nvcore/Utils.h" // max
+#include "nvcore/Array.inl"
+
+using namespace nv;
+
+
+BatchImageLoader::BatchImageLoader(uint threadCount/*= 0*/, uint windowSize/*= 0*/) : m_nextLoad(0), m_nextReturn(0), m_exit(false)
+{
+    if (threadCount == 0) {
+        threadCount = hardwareThreadCount();
+    }
+    m_threadCount = max(threadCount, 1U);
+    m_windowSize = windowSize != 0 ? windowSize : 2 * m_threadCount;
+
+    m_wakeup = new Event[m_threadCount];
+    m_workers = new Worker[m_threadCount];
+    m_threads = new Thread[m_threadCount];
+    for (uint i = 0; i < m_threadCount; i++) {
+        m_workers[i].loader = this;
+        m_workers[i].id = i;
+        m_threads[i].start(threadFunc, m_workers + i);
+    }
+}
+
+BatchImageLoader::~BatchImageLoader()
+{
+    m_mutex.lock();
+    m_exit = true;
+    m_mutex.unlock();
+
+    Event::post(m_wakeup, m_threadCount);
+    Thread::wait(m_threads, m_threadCount);
+
+    delete [] m_threads;
+    delete [] m_workers;
+    delete [] m_wakeup;
+
+    // Images that were never returned.
+    for (uint i = m_nextReturn; i < m_entries.count(); i++) {
+        delete m_entries[i].image;
+        delete m_entries[i].fimage;
+    }
+}
+
+void BatchImageLoader::add(const char * fileName, bool floatImage/*= false*/)
+{
+    Entry entry;
+    entry.fileName = fileName;
+    entry.floatImage = floatImage;
+    entry.done = false;
+    entry.image = NULL;
+    entry.fimage = NULL;
+
+    m_mutex.lock();
+    m_entries.append(entry);
+    m_mutex.unlock();
+
+    Event::post(m_wakeup, m_threadCount);
+}
+
+uint BatchImageLoader::count() const
+{
+    Lock<Mutex> lock(m_mutex);
+    return m_entries.count();
+}
+
+Image * BatchImageLoader::nextImage()
+{
+    waitNext(false);
+
+    Lock<Mutex> lock(m_mutex);
+    Image * image = m_entries[m_nextReturn].image;
+    m_entries[m_nextReturn].image = NULL;
+    m_nextReturn++;
+
+    // The window moved, there may be another image to load.
+    Event::post(m_wakeup, m_threadCount);
+
+    return image;
+}
+
+FloatImage * BatchImageLoader::nextFloatImage()
+{
+    waitNext(true);
+
+    Lock<Mutex> lock(m_mutex);
+    FloatImage * fimage = m_entries[m_nextReturn].fimage;
+    m_entries[m_nextReturn].fimage = NULL;
+    m_nextReturn++;
+
+    Event::post(m_wakeup, m_threadCount);
+
+    return fimage;
+}
+
+void BatchImageLoader::waitNext(bool floatImage)
+{
+    m_mutex.lock();
+    nvCheck(m_nextReturn < m_entries.count());
+    nvCheck(m_entries[m_nextReturn].floatImage == floatImage);
+
+    while (!m_entries[m_nextReturn].done) {
+        m_mutex.unlock();
+        m_ready.wait();
+        m_mutex.lock();
+    }
+    m_mutex.unlock();
+}
+
+/*static*/ void BatchImageLoader::threadFunc(void * arg)
+{
+    Worker * worker = (Worker *)arg;
+    worker->loader->run(worker->id);
+}
+
+void BatchImageLoader::run(uint id)
+{
+    for (;;) {
+        m_mutex.lock();
+        while (!m_exit && !(m_nextLoad < m_entries.count() && m_nextLoad < m_nextReturn + m_windowSize)) {
+            m_mutex.unlock();
+            m_wakeup[id].wait();
+            m_mutex.lock();
+        }
+
+        if (m_exit) {
+            m_mutex.unlock();
+            break;
+        }
+
+        const uint i = m_nextLoad++;
+        const bool floatImage = m_entries[i].floatImage;
+        StringBuilder fileName(m_entries[i].fileName.str());   // The entries may be reallocated while loading.
+        m_mutex.unlock();
+
+        Image * image = NULL;
+        FloatImage * fimage = NULL;
+        if (floatImage) {
+            fimage = ImageIO::loadFloat(fileName.str());
+        }
+        else {
+            image = ImageIO::load(fileName.str());
+        }
+
+        m_mutex.lock();
+        m_entries[i].image = image;
+        m_entries[i].fimage = fimage;
+        m_entries[i].done = true;
+        m_mutex.unlock();
+
+        m_ready.post();
+    }
+}
@@ -0,0 +1,82 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_BATCHIMAGELOADER_H
+#define NV_IMAGE_BATCHIMAGELOADER_H
+
+#include "nvimage.h"
+
+#include "nvthread/Mutex.h"
+#include "nvthread/Event.h"
+
+#include "nvcore/Array.h"
+#include "nvcore/StrLib.h"
+
+namespace nv
+{
+    class Image;
+    class FloatImage;
+    class Thread;
+
+    // Loads a list of images on a set of worker threads and returns them in the order they were added.
+    //
+    // The workers stay at most windowSize images ahead of the consumer, so that the memory used by the images that
+    // are loaded, but not returned yet, is bounded. The workers are not the ones of the ThreadPool, so that the
+    // images can be loaded while the pool is busy processing the previous ones.
+    class NVIMAGE_CLASS BatchImageLoader
+    {
+        NV_FORBID_COPY(BatchImageLoader);
+    public:
+        // By default there is a thread per hardware thread, and a window of twice that many images.
+        BatchImageLoader(uint threadCount = 0, uint windowSize = 0);
+        ~BatchImageLoader();
+
+        void add(const char * fileName, bool floatImage = false);
+
+        uint count() const;
+
+        // Wait for the next image in submission order. The caller owns the image, that is NULL when the file could
+        // not be loaded. Use nextFloatImage for the files that were added as float images.
+        Image * nextImage();
+        FloatImage * nextFloatImage();
+
+    private:
+
+        struct Worker
+        {
+            BatchImageLoader * loader;
+            uint id;
+        };
+
+        struct Entry
+        {
+            String fileName;
+            bool floatImage;
+            bool done;
+            Image * image;
+            FloatImage * fimage;
+        };
+
+        static void threadFunc(void * arg);
+        void run(uint id);
+        void waitNext(bool floatImage);
+
+        Thread * m_threads;
+        Worker * m_workers;
+        Event * m_wakeup;               // One per worker.
+        uint m_threadCount;
+        uint m_windowSize;
+
+        // Shared state, protected by the mutex.
+        mutable Mutex m_mutex;
+        Array<Entry> m_entries;
+        uint m_nextLoad;                // Next entry that is not taken by a worker.
+        uint m_nextReturn;              // Next entry returned to the caller.
+        bool m_exit;
+
+        Event m_ready;
+    };
+
+} // nv namespace
+
+#endif // NV_IMAGE_BATCHIMAGELOADER_H
@@ -30,6 +30,7 @@
 #include "nvcore/Debug.h"
 #include "nvcore/Utils.h" // max
 #include "nvcore/StdStream.h"
+#include "nvcore/MemoryMappedFile.h"
 
 #include <string.h> // memset
 
@@ -874,16 +875,16 @@ bool DDSHeader::isBlockFormat() const
 
 
 
-DirectDrawSurface::DirectDrawSurface() : stream(NULL)
+DirectDrawSurface::DirectDrawSurface() : stream(NULL), file(NULL)
 {
 }
 
-DirectDrawSurface::DirectDrawSurface(const char * name) : stream(NULL)
+DirectDrawSurface::DirectDrawSurface(const char * name) : stream(NULL), file(NULL)
 {
     load(name);
 }
 
-DirectDrawSurface::DirectDrawSurface(Stream * s) : stream(NULL)
+DirectDrawSurface::DirectDrawSurface(Stream * s) : stream(NULL), file(NULL)
 {
     load(s);
 }
@@ -891,15 +892,42 @@ DirectDrawSurface::DirectDrawSurface(Stream * s) : stream(NULL)
 DirectDrawSurface::~DirectDrawSurface()
 {
     delete stream;
+    delete file;
 }
 
 bool DirectDrawSurface::load(const char * filename)
 {
-    return load(new StdInputStream(filename));
+    delete stream;
+    stream = NULL;
+    delete file;
+    file = new MemoryMappedFile;
+
+    // Only read the header, the file is mapped when a surface is accessed.
+    uint8 buffer[148]; // sizeof(DDSHeader)
+    uint64 size = 0;
+    if (file->open(filename)) {
+        size = file->read(0, buffer, sizeof(buffer));
+    }
+
+    MemoryInputStream headerStream(buffer, uint(size));
+    if (size >= 4) {
+        headerStream << header;
+    }
+
+    const uint64 headerSize = header.hasDX10Header() ? 148 : 128;
+    if (size < headerSize) {
+        delete file;
+        file = NULL;
+        return false;
+    }
+
+    return true;
 }
 
 bool DirectDrawSurface::load(Stream * stream)
 {
+    delete file;
+    file = NULL;
     delete this->stream;
     this->stream = stream;
 
@@ -914,7 +942,7 @@ bool DirectDrawSurface::load(Stream * stream)
 
 bool DirectDrawSurface::isValid() const
 {
-    if (stream == NULL || stream->isError())
+    if (file == NULL && (stream == NULL || stream->isError()))
     {
         return false;
     }
@@ -1126,47 +1154,76 @@ void DirectDrawSurface::mipmap(Image * img, uint face, uint mipmap)
 {
     nvDebugCheck(isValid());
 
-    stream->seek(offset(face, mipmap));
-
-    uint w = width();
-    uint h = height();
-	uint d = depth();
+    img->allocate(surfaceWidth(mipmap), surfaceHeight(mipmap), surfaceDepth(mipmap));
 
-    // Compute width and height.
-    for (uint m = 0; m < mipmap; m++)
+    if (hasAlpha())
     {
-        w = max(1U, w / 2);
-        h = max(1U, h / 2);
-		d = max(1U, d / 2);
+        img->setFormat(Image::Format_ARGB);
+    }
+    else
+    {
+        img->setFormat(Image::Format_RGB);
     }
 
-    img->allocate(w, h, d);
+    // Decode straight from the mapped file, or from a copy of the surface when reading from a stream. Small surfaces
+    // are cheaper to read than to map.
+    const uint size = surfaceSize(mipmap);
+    const uint8 * data = NULL;
+    uint8 * buffer = NULL;
 
-    if (hasAlpha())
+    if (file != NULL && size >= 64 * 1024)
     {
-        img->setFormat(Image::Format_ARGB);
+        data = surfaceData(face, mipmap);
     }
     else
     {
-        img->setFormat(Image::Format_RGB);
+        buffer = new uint8[size];
+        if (readSurface(face, mipmap, buffer, size)) data = buffer;
+    }
+
+    if (data == NULL)
+    {
+        // Truncated file.
+        img->fill(Color32(0, 0, 0, 0xFF));
+        delete [] buffer;
+        return;
     }
 
+    MemoryInputStream surface(data, size);
+
     if (header.hasDX10Header())
     {
         // So far only block formats supported.
-        readBlockImage(img);
+        readBlockImage(surface, img);
     }
     else
     {
         if (header.pf.flags & DDPF_RGB) 
         {
-            readLinearImage(img);
+            readLinearImage(surface, img);
         }
         else if (header.pf.flags & DDPF_FOURCC)
         {
-            readBlockImage(img);
+            readBlockImage(surface, img);
         }
     }
+
+    delete [] buffer;
+}
+
+uint DirectDrawSurface::smallestMipmap(uint minExtent) const
+{
+    nvDebugCheck(isValid());
+
+    const uint count = mipmapCount();
+
+    uint m = 0;
+    while (m + 1 < count && max(surfaceWidth(m + 1), surfaceHeight(m + 1)) >= minExtent)
+    {
+        m++;
+    }
+
+    return m;
 }
 
 /*void * DirectDrawSurface::readData(uint * sizePtr)
@@ -1231,16 +1288,33 @@ bool DirectDrawSurface::readSurface(uint face, uint mipmap, void * data, uint si
 {
     if (size != surfaceSize(mipmap)) return false;
 
+    if (file != NULL)
+    {
+        return file->read(offset(face, mipmap), data, size) == size;
+    }
+
     stream->seek(offset(face, mipmap));
     if (stream->isError()) return false;
 
     return stream->serialize(data, size) == size;
 }
 
+const uint8 * DirectDrawSurface::surfaceData(uint face, uint mipmap)
+{
+    if (file == NULL) return NULL;
+
+    const uint8 * data = file->data();
+    if (data == NULL) return NULL;
+
+    const uint64 pos = offset(face, mipmap);
+    if (pos + surfaceSize(mipmap) > file->size()) return NULL;
+
+    return data + pos;
+}
+
 
-void DirectDrawSurface::readLinearImage(Image * img)
+void DirectDrawSurface::readLinearImage(Stream & s, Image * img)
 {
-    nvDebugCheck(stream != NULL);
     nvDebugCheck(img != NULL);
 
     const uint w = img->width();
@@ -1271,7 +1345,7 @@ void DirectDrawSurface::readLinearImage(Image * img)
             for (uint x = 0; x < w; x++)
             {
                 uint c = 0;
-                stream->serialize(&c, byteCount);
+                s.serialize(&c, byteCount);
 
                 Color32 pixel(0, 0, 0, 0xFF);
                 pixel.r = PixelFormat::convert((c & header.pf.rmask) >> rshift, rsize, 8);
@@ -1285,9 +1359,8 @@ void DirectDrawSurface::readLinearImage(Image * img)
     }
 }
 
-void DirectDrawSurface::readBlockImage(Image * img)
+void DirectDrawSurface::readBlockImage(Stream & s, Image * img)
 {
-    nvDebugCheck(stream != NULL);
     nvDebugCheck(img != NULL);
 
     const uint w = img->width();
@@ -1303,7 +1376,7 @@ void DirectDrawSurface::readBlockImage(Image * img)
             ColorBlock block;
 
             // Read color block.
-            readBlock(&block);
+            readBlock(s, &block);
 
             // Write color block.
             for (uint y = 0; y < min(4U, h-4*by); y++)
@@ -1329,9 +1402,8 @@ static Color32 buildNormal(uint8 x, uint8 y)
 }
 
 
-void DirectDrawSurface::readBlock(ColorBlock * rgba)
+void DirectDrawSurface::readBlock(Stream & s, ColorBlock * rgba)
 {
-    nvDebugCheck(stream != NULL);
     nvDebugCheck(rgba != NULL);
 
     uint fourcc = header.pf.fourcc;
@@ -1350,19 +1422,19 @@ void DirectDrawSurface::readBlock(ColorBlock * rgba)
     if (fourcc == FOURCC_DXT1)
     {
         BlockDXT1 block;
-        *stream << block;
+        s << block;
         block.decodeBlock(rgba);
     }
     else if (fourcc == FOURCC_DXT2 || fourcc == FOURCC_DXT3)
     {
         BlockDXT3 block;
-        *stream << block;
+        s << block;
         block.decodeBlock(rgba);
     }
     else if (fourcc == FOURCC_DXT4 || fourcc == FOURCC_DXT5 || fourcc == FOURCC_RXGB)
     {
         BlockDXT5 block;
-        *stream << block;
+        s << block;
         block.decodeBlock(rgba);
 
         if (fourcc == FOURCC_RXGB)
@@ -1380,13 +1452,13 @@ void DirectDrawSurface::readBlock(ColorBlock * rgba)
     else if (fourcc == FOURCC_ATI1)
     {
         BlockATI1 block;
-        *stream << block;
+        s << block;
         block.decodeBlock(rgba);
     }
     else if (fourcc == FOURCC_ATI2)
     {
         BlockATI2 block;
-        *stream << block;
+        s << block;
         block.decodeBlock(rgba);
     }
 
@@ -1457,10 +1529,10 @@ uint DirectDrawSurface::surfaceSize(uint mipmap) const
     }
 }
 
-uint DirectDrawSurface::faceSize() const
+uint64 DirectDrawSurface::faceSize() const
 {
     const uint count = mipmapCount();
-    uint size = 0;
+    uint64 size = 0;
 
     for (uint m = 0; m < count; m++)
     {
@@ -1470,9 +1542,9 @@ uint DirectDrawSurface::faceSize() const
     return size;
 }
 
-uint DirectDrawSurface::offset(const uint face, const uint mipmap)
+uint64 DirectDrawSurface::offset(const uint face, const uint mipmap)
 {
-    uint size = 128; // sizeof(DDSHeader);
+    uint64 size = 128; // sizeof(DDSHeader);
 
     if (header.hasDX10Header())
     {
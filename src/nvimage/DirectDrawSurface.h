@@ -37,6 +37,7 @@ namespace nv
 {
     class Image;
     class Stream;
+    class MemoryMappedFile;
     struct ColorBlock;
 
     enum DDPF
@@ -387,12 +388,20 @@ namespace nv
 
         void mipmap(Image * img, uint f, uint m);
 
+        // Smallest mipmap whose width or height is at least minExtent, or the first one if none is that large. Use it
+        // to decode only the level that is needed for a preview.
+        uint smallestMipmap(uint minExtent) const;
+
         uint surfaceWidth(uint mipmap) const;
         uint surfaceHeight(uint mipmap) const;
         uint surfaceDepth(uint mipmap) const;
         uint surfaceSize(uint mipmap) const;
         bool readSurface(uint face, uint mipmap, void * data, uint size);
 
+        // Pointer to the given surface in the memory mapped file, without copying it. Only available when the surface was
+        // loaded from a file, returns NULL otherwise or if the file is truncated.
+        const uint8 * surfaceData(uint face, uint mipmap);
+
         void printInfo() const;
 
         // Only initialized after loading.
@@ -400,16 +409,17 @@ namespace nv
 
     private:
 
-        uint faceSize() const;
-        uint offset(uint face, uint mipmap);
+        uint64 faceSize() const;
+        uint64 offset(uint face, uint mipmap);
 
-        void readLinearImage(Image * img);
-        void readBlockImage(Image * img);
-        void readBlock(ColorBlock * rgba);
+        void readLinearImage(Stream & s, Image * img);
+        void readBlockImage(Stream & s, Image * img);
+        void readBlock(Stream & s, ColorBlock * rgba);
 
 
     private:
-        Stream * stream;
+        Stream * stream;            // When loaded from a stream.
+        MemoryMappedFile * file;    // When loaded from a file.
     };
 
 } // nv namespace
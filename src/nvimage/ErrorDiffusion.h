@@ -0,0 +1,127 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_ERRORDIFFUSION_H
+#define NV_IMAGE_ERRORDIFFUSION_H
+
+#include "nvimage.h"
+
+#include "nvthread/ParallelFor.h"
+#include "nvthread/Atomic.h"
+#include "nvthread/Thread.h"
+
+#include "nvcore/Utils.h" // min
+
+#include <string.h> // memset
+
+namespace nv
+{
+    /// Floyd-Steinberg error diffusion of several channels in a single pass.
+    ///
+    /// Rows are dithered in parallel in a wavefront: a row only needs the error of the pixels of the previous row
+    /// that are up to one pixel ahead, so it starts as soon as the previous row is a few pixels ahead. The error of
+    /// each pixel is accumulated in the same order as in a serial scan, so the result is identical.
+    ///
+    /// The quantizer is called as:
+    ///
+    ///     float quantize(uint c, uint x, uint y, float error);
+    ///
+    /// It quantizes channel c of pixel (x, y) after adding the diffused error, stores the result and returns the
+    /// error to propagate. Different pixels may be quantized from different threads at the same time.
+    template <class Quantizer>
+    void floydSteinberg(Quantizer & quantizer, uint w, uint h, uint channelCount);
+
+
+    namespace ErrorDiffusion
+    {
+        // Pixels processed between progress updates.
+        const uint GroupSize = 16;
+
+        // Rows of error that are kept. Row y + 2 can't get to a pixel before row y + 1 is done reading the error of row y around it, so 2 would be enough.
+        const uint RingSize = 4;
+
+        template <class Quantizer>
+        struct Context
+        {
+            Quantizer * quantizer;
+            uint width;
+            uint channelCount;
+            float * error;          // Error of the last RingSize rows, one row of each channel per row.
+            uint32 * progress;      // Pixels done in each row.
+        };
+
+        template <class Quantizer>
+        void rowTask(void * data, int y)
+        {
+            Context<Quantizer> * ctx = (Context<Quantizer> *)data;
+
+            const uint w = ctx->width;
+            const uint channelCount = ctx->channelCount;
+
+            float * row = ctx->error + (y % RingSize) * channelCount * w;
+            const float * prev = (y > 0) ? ctx->error + ((y - 1) % RingSize) * channelCount * w : NULL;
+
+            for (uint x0 = 0; x0 < w; x0 += GroupSize)
+            {
+                const uint x1 = min(x0 + GroupSize, w);
+
+                // Wait until the previous row is one pixel past the end of the group.
+                if (prev != NULL) {
+                    const uint32 needed = min(x1 + 1, w);
+                    while (loadAcquire(ctx->progress + y - 1) < needed) {
+                        Thread::yield();
+                    }
+                }
+
+                for (uint x = x0; x < x1; x++)
+                {
+                    for (uint c = 0; c < channelCount; c++)
+                    {
+                        // Same order as when the error is pushed to the next row in a serial scan.
+                        float error = 0.0f;
+                        if (prev != NULL) {
+                            const float * p = prev + c * w;
+                            if (x > 0) error += (1.0f / 16.0f) * p[x - 1];
+                            error += (5.0f / 16.0f) * p[x];
+                            if (x + 1 < w) error += (3.0f / 16.0f) * p[x + 1];
+                        }
+                        if (x > 0) error += (7.0f / 16.0f) * row[c * w + x - 1];
+
+                        row[c * w + x] = ctx->quantizer->quantize(c, x, y, error);
+                    }
+                }
+
+                storeRelease(ctx->progress + y, x1);
+            }
+        }
+
+    } // ErrorDiffusion namespace
+
+
+    template <class Quantizer>
+    void floydSteinberg(Quantizer & quantizer, uint w, uint h, uint channelCount)
+    {
+        if (w == 0 || h == 0) return;
+
+        float * error = new float[ErrorDiffusion::RingSize * channelCount * w];
+        uint32 * progress = new uint32[h];
+        memset(progress, 0, sizeof(uint32) * h);
+
+        ErrorDiffusion::Context<Quantizer> context;
+        context.quantizer = &quantizer;
+        context.width = w;
+        context.channelCount = channelCount;
+        context.error = error;
+        context.progress = progress;
+
+        // Rows are handed out in order, so the row each task waits for has already been started.
+        ParallelFor parallelFor(ErrorDiffusion::rowTask<Quantizer>, &context);
+        parallelFor.run(h);
+
+        delete [] error;
+        delete [] progress;
+    }
+
+} // nv namespace
+
+#endif // NV_IMAGE_ERRORDIFFUSION_H
@@ -2,76 +2,217 @@
 #include "ErrorMetric.h"
 #include "FloatImage.h"
 #include "Filter.h"
+#include "Reduction.h"
 
 #include "nvmath/Matrix.h"
 #include "nvmath/Vector.inl"
+#include "nvmath/SimdVector.h" // NV_USE_SSE
+
+#include "nvthread/ParallelFor.h"
+
+#include "nvcore/Array.inl"
 
 #include <float.h> // FLT_MAX
 
 using namespace nv;
 
-float nv::rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight)
+namespace
 {
-    if (!sameLayout(img, ref)) {
-        return FLT_MAX;
-    }
-    nvDebugCheck(img->componentCount() == 4);
-    nvDebugCheck(ref->componentCount() == 4);
+    // The error of each pixel is added to the 4x4 block it belongs to. A row error computes the error of the pixels
+    // of a row and adds the error of pixel x to columnSums[x]:
+    //
+    //     void addRow(uint y, uint z, float * columnSums) const;
+    //
+    // The four rows of a block are accumulated in the same column sums, so that SIMD code doesn't need horizontal
+    // additions. Rows of blocks are processed in parallel. The sum of each block is accumulated in floats, and the
+    // blocks in doubles.
+    template <class RowError>
+    struct BlockErrorReduction
+    {
+        BlockErrorReduction(const RowError & rowError, uint w, uint h, bool rms, FloatImage * blockErrors, uint chunkCount) :
+            rowError(rowError), width(w), height(h), rms(rms), blockErrors(blockErrors)
+        {
+            sum.resize(chunkCount);
+        }
+
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            const uint blockWidth = (width + 3) / 4;
+            const uint blockHeight = (height + 3) / 4;
+
+            Array<float> columnSums;
+            columnSums.resize(blockWidth * 4);
+
+            double s = 0.0;
+
+            for (uint row = begin; row < end; row++) {
+                const uint z = row / blockHeight;
+                const uint by = row % blockHeight;
+                const uint y0 = by * 4;
+                const uint y1 = min(y0 + 4, height);
+
+                for (uint x = 0; x < blockWidth * 4; x++) {
+                    columnSums[x] = 0.0f;
+                }
+
+                for (uint y = y0; y < y1; y++) {
+                    rowError.addRow(y, z, columnSums.buffer());
+                }
+
+                for (uint bx = 0; bx < blockWidth; bx++) {
+                    const float * c = columnSums.buffer() + bx * 4;
+                    const float blockSum = (c[0] + c[1]) + (c[2] + c[3]);
+                    s += blockSum;
+
+                    if (blockErrors != NULL) {
+                        const uint pixelCount = (min(bx * 4 + 4, width) - bx * 4) * (y1 - y0);
+                        const float e = blockSum / pixelCount;
+                        blockErrors->pixel(0, bx, by, z) = rms ? sqrtf(e) : e;
+                    }
+                }
+            }
+
+            sum[chunk] = s;
+        }
+
+        const RowError & rowError;
+        const uint width;
+        const uint height;
+        const bool rms;
+        FloatImage * blockErrors;
+
+        Array<double> sum;
+    };
+
+    // Rows of blocks processed by each task.
+    const uint BlockRowChunkSize = 4;
+
+    // Average error of all the pixels, or its square root for rms errors. When blockErrors is not NULL, it's set to an
+    // image with the error of each 4x4 block, computed the same way.
+    template <class RowError>
+    float blockError(const RowError & rowError, uint w, uint h, uint d, bool rms, FloatImage * blockErrors)
+    {
+        const uint blockRowCount = d * ((h + 3) / 4);
 
-    double mse = 0;
+        if (blockErrors != NULL) {
+            blockErrors->allocate(1, (w + 3) / 4, (h + 3) / 4, d);
+        }
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        float r0 = img->pixel(i + count * 0);
-        float g0 = img->pixel(i + count * 1);
-        float b0 = img->pixel(i + count * 2);
-        //float a0 = img->pixel(i + count * 3);
-        float r1 = ref->pixel(i + count * 0);
-        float g1 = ref->pixel(i + count * 1);
-        float b1 = ref->pixel(i + count * 2);
-        float a1 = ref->pixel(i + count * 3);
-
-        float r = r0 - r1;
-        float g = g0 - g1;
-        float b = b0 - b1;
-
-        float a = 1;
-        if (alphaWeight) a = a1;
-
-        mse += r * r * a;
-        mse += g * g * a;
-        mse += b * b * a;
-    }
+        BlockErrorReduction<RowError> reduction(rowError, w, h, rms, blockErrors, reductionChunkCount(blockRowCount, BlockRowChunkSize));
+        parallelReduce(reduction, blockRowCount, BlockRowChunkSize);
 
-    return float(sqrt(mse / count));
-}
+        double sum = 0.0;
+        for (uint i = 0; i < reduction.sum.count(); i++) {
+            sum += reduction.sum[i];
+        }
 
-float nv::rmsAlphaError(const FloatImage * img, const FloatImage * ref)
-{
-    if (!sameLayout(img, ref)) {
-        return FLT_MAX;
+        const double e = sum / (double(w) * h * d);
+        return float(rms ? sqrt(e) : e);
     }
-    nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    double mse = 0;
+#if NV_USE_SSE > 1
+    inline __m128 absolute(__m128 v)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+    }
+#endif
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
+    // Squared or absolute error of the RGB channels, optionally weighted by the alpha of the reference.
+    struct ColorError
+    {
+        ColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight, bool squared) :
+            img(img), ref(ref), alphaWeight(alphaWeight), squared(squared) {}
+
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            const uint w = img->width();
+
+            const float * r0 = img->scanline(0, y, z);
+            const float * g0 = img->scanline(1, y, z);
+            const float * b0 = img->scanline(2, y, z);
+            const float * r1 = ref->scanline(0, y, z);
+            const float * g1 = ref->scanline(1, y, z);
+            const float * b1 = ref->scanline(2, y, z);
+            const float * a1 = ref->scanline(3, y, z);
+
+            uint x = 0;
+
+#if NV_USE_SSE > 1
+            for (; x + 4 <= w; x += 4) {
+                __m128 r = _mm_sub_ps(_mm_loadu_ps(r0 + x), _mm_loadu_ps(r1 + x));
+                __m128 g = _mm_sub_ps(_mm_loadu_ps(g0 + x), _mm_loadu_ps(g1 + x));
+                __m128 b = _mm_sub_ps(_mm_loadu_ps(b0 + x), _mm_loadu_ps(b1 + x));
+
+                __m128 e;
+                if (squared) e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+                else e = _mm_add_ps(_mm_add_ps(absolute(r), absolute(g)), absolute(b));
+
+                if (alphaWeight) e = _mm_mul_ps(e, _mm_loadu_ps(a1 + x));
+
+                _mm_storeu_ps(columnSums + x, _mm_add_ps(_mm_loadu_ps(columnSums + x), e));
+            }
+#endif
+
+            for (; x < w; x++) {
+                float r = r0[x] - r1[x];
+                float g = g0[x] - g1[x];
+                float b = b0[x] - b1[x];
+
+                float e;
+                if (squared) e = r * r + g * g + b * b;
+                else e = fabsf(r) + fabsf(g) + fabsf(b);
+
+                if (alphaWeight) e *= a1[x];
+
+                columnSums[x] += e;
+            }
+        }
+
+        const FloatImage * img;
+        const FloatImage * ref;
+        const bool alphaWeight;
+        const bool squared;
+    };
+
+    // Squared or absolute error of a single channel.
+    struct ChannelError
     {
-        float a0 = img->pixel(i + count * 3);
-        float a1 = ref->pixel(i + count * 3);
+        ChannelError(const FloatImage * img, const FloatImage * ref, uint channel, bool squared) : img(img), ref(ref), channel(channel), squared(squared) {}
 
-        float a = a0 - a1;
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            const uint w = img->width();
 
-        mse += a * a;
-    }
+            const float * a0 = img->scanline(channel, y, z);
+            const float * a1 = ref->scanline(channel, y, z);
 
-    return float(sqrt(mse / count));
-}
+            uint x = 0;
+
+#if NV_USE_SSE > 1
+            for (; x + 4 <= w; x += 4) {
+                __m128 a = _mm_sub_ps(_mm_loadu_ps(a0 + x), _mm_loadu_ps(a1 + x));
+                __m128 e = squared ? _mm_mul_ps(a, a) : absolute(a);
 
+                _mm_storeu_ps(columnSums + x, _mm_add_ps(_mm_loadu_ps(columnSums + x), e));
+            }
+#endif
 
-float nv::averageColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight)
+            for (; x < w; x++) {
+                float a = a0[x] - a1[x];
+                columnSums[x] += squared ? a * a : fabsf(a);
+            }
+        }
+
+        const FloatImage * img;
+        const FloatImage * ref;
+        const uint channel;
+        const bool squared;
+    };
+
+} // namespace
+
+
+float nv::rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight, FloatImage * blockErrors/*= NULL*/)
 {
     if (!sameLayout(img, ref)) {
         return FLT_MAX;
@@ -79,56 +220,53 @@ float nv::averageColorError(const FloatImage * img, const FloatImage * ref, bool
     nvDebugCheck(img->componentCount() == 4);
     nvDebugCheck(ref->componentCount() == 4);
 
-    double mae = 0;
+    ColorError error(img, ref, alphaWeight, /*squared=*/true);
+    return blockError(error, img->width(), img->height(), img->depth(), /*rms=*/true, blockErrors);
+}
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        float r0 = img->pixel(i + count * 0);
-        float g0 = img->pixel(i + count * 1);
-        float b0 = img->pixel(i + count * 2);
-        //float a0 = img->pixel(i + count * 3);
-        float r1 = ref->pixel(i + count * 0);
-        float g1 = ref->pixel(i + count * 1);
-        float b1 = ref->pixel(i + count * 2);
-        float a1 = ref->pixel(i + count * 3);
-
-        float r = fabs(r0 - r1);
-        float g = fabs(g0 - g1);
-        float b = fabs(b0 - b1);
-
-        float a = 1;
-        if (alphaWeight) a = a1;
-
-        mae += r * a;
-        mae += g * a;
-        mae += b * a;
+float nv::rmsAlphaError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img, ref)) {
+        return FLT_MAX;
     }
+    nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    return float(mae / count);
+    ChannelError error(img, ref, 3, /*squared=*/true);
+    return blockError(error, img->width(), img->height(), img->depth(), /*rms=*/true, blockErrors);
 }
 
-float nv::averageAlphaError(const FloatImage * img, const FloatImage * ref)
+float nv::rmsChannelError(const FloatImage * img, const FloatImage * ref, uint channel, FloatImage * blockErrors/*= NULL*/)
 {
-    if (img == NULL || ref == NULL || img->width() != ref->width() || img->height() != ref->height()) {
+    if (!sameLayout(img, ref) || channel >= img->componentCount() || channel >= ref->componentCount()) {
         return FLT_MAX;
     }
-    nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    double mae = 0;
+    ChannelError error(img, ref, channel, /*squared=*/true);
+    return blockError(error, img->width(), img->height(), img->depth(), /*rms=*/true, blockErrors);
+}
 
-    const uint count = img->width() * img->height();
-    for (uint i = 0; i < count; i++)
-    {
-        float a0 = img->pixel(i + count * 3);
-        float a1 = ref->pixel(i + count * 3);
 
-        float a = a0 - a1;
+float nv::averageColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img, ref)) {
+        return FLT_MAX;
+    }
+    nvDebugCheck(img->componentCount() == 4);
+    nvDebugCheck(ref->componentCount() == 4);
 
-        mae += fabs(a);
+    ColorError error(img, ref, alphaWeight, /*squared=*/false);
+    return blockError(error, img->width(), img->height(), img->depth(), /*rms=*/false, blockErrors);
+}
+
+float nv::averageAlphaError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img, ref)) {
+        return FLT_MAX;
     }
+    nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    return float(mae / count);
+    ChannelError error(img, ref, 3, /*squared=*/false);
+    return blockError(error, img->width(), img->height(), img->depth(), /*rms=*/false, blockErrors);
 }
 
 
@@ -222,68 +360,283 @@ static Vector3 rgbToCieLab(Vector3::Arg c)
     return xyzToCieLab(rgbToXyz(toLinear(c)));
 }
 
+
+namespace
+{
+    struct CieLabContext
+    {
+        const FloatImage * rgbImage;
+        FloatImage * LabImage;
+    };
+
+    void rgbToCieLabTask(void * data, int i)
+    {
+        CieLabContext * ctx = (CieLabContext *)data;
+
+        const uint h = ctx->rgbImage->height();
+        const uint y = i % h;
+        const uint z = i / h;
+
+        const float * R = ctx->rgbImage->scanline(0, y, z);
+        const float * G = ctx->rgbImage->scanline(1, y, z);
+        const float * B = ctx->rgbImage->scanline(2, y, z);
+
+        float * L = ctx->LabImage->scanline(0, y, z);
+        float * a = ctx->LabImage->scanline(1, y, z);
+        float * b = ctx->LabImage->scanline(2, y, z);
+
+        const uint w = ctx->rgbImage->width();
+        for (uint x = 0; x < w; x++)
+        {
+            Vector3 Lab = rgbToCieLab(Vector3(R[x], G[x], B[x]));
+            L[x] = Lab.x;
+            a[x] = Lab.y;
+            b[x] = Lab.z;
+        }
+    }
+
+} // namespace
+
 static void rgbToCieLab(const FloatImage * rgbImage, FloatImage * LabImage)
 {
     nvDebugCheck(rgbImage != NULL && LabImage != NULL);
     nvDebugCheck(rgbImage->width() == LabImage->width() && rgbImage->height() == LabImage->height());
     nvDebugCheck(rgbImage->componentCount() >= 3 && LabImage->componentCount() >= 3);
 
-    const uint w = rgbImage->width();
-    const uint h = LabImage->height();
+    CieLabContext context;
+    context.rgbImage = rgbImage;
+    context.LabImage = LabImage;
 
-    const float * R = rgbImage->channel(0);
-    const float * G = rgbImage->channel(1);
-    const float * B = rgbImage->channel(2);
-
-    float * L = LabImage->channel(0);
-    float * a = LabImage->channel(1);
-    float * b = LabImage->channel(2);
+    ParallelFor parallelFor(rgbToCieLabTask, &context);
+    parallelFor.run(rgbImage->height() * rgbImage->depth());
+}
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
+namespace
+{
+    // Distance between the colors of two images in CIE-Lab space.
+    struct LabError
     {
-        Vector3 Lab = rgbToCieLab(Vector3(R[i], G[i], B[i]));
-        L[i] = Lab.x;
-        a[i] = Lab.y;
-        b[i] = Lab.z;
-    }
-}
+        LabError(const FloatImage * lab0, const FloatImage * lab1) : lab0(lab0), lab1(lab1) {}
+
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            const uint w = lab0->width();
+
+            const float * L0 = lab0->scanline(0, y, z);
+            const float * a0 = lab0->scanline(1, y, z);
+            const float * b0 = lab0->scanline(2, y, z);
+            const float * L1 = lab1->scanline(0, y, z);
+            const float * a1 = lab1->scanline(1, y, z);
+            const float * b1 = lab1->scanline(2, y, z);
+
+            uint x = 0;
+
+#if NV_USE_SSE > 1
+            for (; x + 4 <= w; x += 4) {
+                __m128 L = _mm_sub_ps(_mm_loadu_ps(L0 + x), _mm_loadu_ps(L1 + x));
+                __m128 a = _mm_sub_ps(_mm_loadu_ps(a0 + x), _mm_loadu_ps(a1 + x));
+                __m128 b = _mm_sub_ps(_mm_loadu_ps(b0 + x), _mm_loadu_ps(b1 + x));
+                __m128 e = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(L, L), _mm_mul_ps(a, a)), _mm_mul_ps(b, b)));
+
+                _mm_storeu_ps(columnSums + x, _mm_add_ps(_mm_loadu_ps(columnSums + x), e));
+            }
+#endif
+
+            for (; x < w; x++) {
+                Vector3 delta(L0[x] - L1[x], a0[x] - a1[x], b0[x] - b1[x]);
+                columnSums[x] += length(delta);
+            }
+        }
+
+        const FloatImage * lab0;
+        const FloatImage * lab1;
+    };
+
+    // Same as LabError, but converts the pixels to CIE-Lab as they are visited, so that no intermediate images are needed.
+    struct RgbLabError
+    {
+        RgbLabError(const FloatImage * img0, const FloatImage * img1) : img0(img0), img1(img1) {}
 
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            const uint w = img0->width();
 
-// Assumes input images are in linear sRGB space.
-float nv::cieLabError(const FloatImage * img0, const FloatImage * img1)
-{
-    if (!sameLayout(img0, img1)) return FLT_MAX;
-    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
+            const float * r0 = img0->scanline(0, y, z);
+            const float * g0 = img0->scanline(1, y, z);
+            const float * b0 = img0->scanline(2, y, z);
+            const float * r1 = img1->scanline(0, y, z);
+            const float * g1 = img1->scanline(1, y, z);
+            const float * b1 = img1->scanline(2, y, z);
+
+            for (uint x = 0; x < w; x++) {
+                Vector3 lab0 = rgbToCieLab(Vector3(r0[x], g0[x], b0[x]));
+                Vector3 lab1 = rgbToCieLab(Vector3(r1[x], g1[x], b1[x]));
 
-    const float * r0 = img0->channel(0);
-    const float * g0 = img0->channel(1);
-    const float * b0 = img0->channel(2);
+                // @@ Measure Delta E.
+                Vector3 delta = lab0 - lab1;
 
-    const float * r1 = img1->channel(0);
-    const float * g1 = img1->channel(1);
-    const float * b1 = img1->channel(2);
+                columnSums[x] += length(delta);
+            }
+        }
 
-    double error = 0.0f;
+        const FloatImage * img0;
+        const FloatImage * img1;
+    };
 
-    const uint count = img0->pixelCount();
-    for (uint i = 0; i < count; i++)
+    struct BlurContext
     {
-        Vector3 lab0 = rgbToCieLab(Vector3(r0[i], g0[i], b0[i]));
-        Vector3 lab1 = rgbToCieLab(Vector3(r1[i], g1[i], b1[i]));
+        FloatImage * img;
+        FloatImage * tmp;
+        uint firstChannel;
+        uint channelCount;
+        const float * weights;  // 2 * radius + 1 normalized weights.
+        int radius;
+    };
+
+    // Horizontal pass, from img to tmp. Texels outside the image are clamped.
+    void blurRowTask(void * data, int i)
+    {
+        BlurContext * ctx = (BlurContext *)data;
+
+        const uint h = ctx->img->height();
+        const int w = ctx->img->width();
+        const uint y = i % h;
+        const uint z = i / h;
+
+        const int radius = ctx->radius;
+        const float * weights = ctx->weights;
+
+        for (uint c = 0; c < ctx->channelCount; c++) {
+            const float * src = ctx->img->scanline(ctx->firstChannel + c, y, z);
+            float * dst = ctx->tmp->scanline(c, y, z);
+
+            int x = 0;
+
+            // Left edge.
+            for (; x < w && x < radius; x++) {
+                float sum = 0.0f;
+                for (int k = -radius; k <= radius; k++) {
+                    sum += weights[k + radius] * src[clamp(x + k, 0, w - 1)];
+                }
+                dst[x] = sum;
+            }
+
+#if NV_USE_SSE > 1
+            // Interior, where the window doesn't need clamping.
+            for (; x + 4 + radius <= w; x += 4) {
+                __m128 sum = _mm_setzero_ps();
+                for (int k = -radius; k <= radius; k++) {
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k + radius]), _mm_loadu_ps(src + x + k)));
+                }
+                _mm_storeu_ps(dst + x, sum);
+            }
+#endif
+
+            for (; x < w; x++) {
+                float sum = 0.0f;
+                for (int k = -radius; k <= radius; k++) {
+                    sum += weights[k + radius] * src[clamp(x + k, 0, w - 1)];
+                }
+                dst[x] = sum;
+            }
+        }
+    }
 
-        // @@ Measure Delta E.
-        Vector3 delta = lab0 - lab1;
-        
-        error += length(delta);
+    // Vertical pass, from tmp back to img.
+    void blurColumnTask(void * data, int i)
+    {
+        BlurContext * ctx = (BlurContext *)data;
+
+        const int h = ctx->img->height();
+        const uint w = ctx->img->width();
+        const int y = i % h;
+        const uint z = i / h;
+
+        for (uint c = 0; c < ctx->channelCount; c++) {
+            float * dst = ctx->img->scanline(ctx->firstChannel + c, y, z);
+
+            for (uint x = 0; x < w; x++) {
+                dst[x] = 0.0f;
+            }
+
+            for (int k = -ctx->radius; k <= ctx->radius; k++) {
+                const float weight = ctx->weights[k + ctx->radius];
+                const float * src = ctx->tmp->scanline(c, clamp(y + k, 0, h - 1), z);
+
+                uint x = 0;
+#if NV_USE_SSE > 1
+                const __m128 vweight = _mm_set1_ps(weight);
+                for (; x + 4 <= w; x += 4) {
+                    _mm_storeu_ps(dst + x, _mm_add_ps(_mm_loadu_ps(dst + x), _mm_mul_ps(vweight, _mm_loadu_ps(src + x))));
+                }
+#endif
+                for (; x < w; x++) {
+                    dst[x] += weight * src[x];
+                }
+            }
+        }
     }
 
-    return float(error / count);
+    // Separable gaussian blur of channelCount channels starting at firstChannel.
+    void blur(FloatImage * img, uint firstChannel, uint channelCount, float variance)
+    {
+        GaussianFilter filter(3.0f * sqrtf(variance));
+        filter.setParameters(variance);
+
+        const int radius = int(ceilf(filter.width()));
+
+        Array<float> weights;
+        weights.resize(2 * radius + 1);
+
+        float total = 0.0f;
+        for (int i = -radius; i <= radius; i++) {
+            weights[i + radius] = filter.evaluate(float(i));
+            total += weights[i + radius];
+        }
+        for (int i = 0; i <= 2 * radius; i++) {
+            weights[i] /= total;
+        }
+
+        FloatImage tmp;
+        tmp.allocate(channelCount, img->width(), img->height(), img->depth());
+
+        BlurContext context;
+        context.img = img;
+        context.tmp = &tmp;
+        context.firstChannel = firstChannel;
+        context.channelCount = channelCount;
+        context.weights = weights.buffer();
+        context.radius = radius;
+
+        {
+            ParallelFor parallelFor(blurRowTask, &context);
+            parallelFor.run(img->height() * img->depth());
+        }
+        {
+            ParallelFor parallelFor(blurColumnTask, &context);
+            parallelFor.run(img->height() * img->depth());
+        }
+    }
+
+} // namespace
+
+
+// Assumes input images are in linear sRGB space.
+float nv::cieLabError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img0, img1)) return FLT_MAX;
+    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
+
+    RgbLabError error(img0, img1);
+    return blockError(error, img0->width(), img0->height(), img0->depth(), /*rms=*/false, blockErrors);
 }
 
-float nv::spatialCieLabError(const FloatImage * img0, const FloatImage * img1)
+// Like cieLabError, but the images are blurred in CIE-Lab space before measuring the difference, so that errors that
+// are not visible at the scale of a pixel, like dithering noise, count less. The chroma channels are blurred more than
+// the luminance, since the eye is less sensitive to high frequencies in the chroma.
+float nv::spatialCieLabError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors/*= NULL*/)
 {
-    if (img0 == NULL || img1 == NULL || img0->width() != img1->width() || img0->height() != img1->height()) {
+    if (!sameLayout(img0, img1)) {
         return FLT_MAX;
     }
     nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
@@ -300,101 +653,215 @@ float nv::spatialCieLabError(const FloatImage * img0, const FloatImage * img1)
     rgbToCieLab(img0, &lab0);
     rgbToCieLab(img1, &lab1);
 
-    // @@ Convolve each channel by the corresponding filter.
-    /*
-    GaussianFilter LFilter(5);
-    GaussianFilter aFilter(5);
-    GaussianFilter bFilter(5);
-
-    lab0.convolve(0, LFilter);
-    lab0.convolve(1, aFilter);
-    lab0.convolve(2, bFilter);
-
-    lab1.convolve(0, LFilter);
-    lab1.convolve(1, aFilter);
-    lab1.convolve(2, bFilter);
-    */
-    // @@ Measure Delta E between lab0 and lab1.
+    // Convolve each channel by the corresponding filter.
+    const float variance[3] = { 1.0f, 4.0f, 9.0f };
+    for (uint c = 0; c < 3; c++) {
+        blur(&lab0, c, 1, variance[c]);
+        blur(&lab1, c, 1, variance[c]);
+    }
 
-    return 0.0f;
+    LabError error(&lab0, &lab1);
+    return blockError(error, w, h, d, /*rms=*/false, blockErrors);
 }
 
 
-// Assumes input images are normal maps.
-float nv::averageAngularError(const FloatImage * img0, const FloatImage * img1)
+namespace
 {
-    if (img0 == NULL || img1 == NULL || img0->width() != img1->width() || img0->height() != img1->height()) {
-        return FLT_MAX;
+    struct MomentsContext
+    {
+        const FloatImage * img;
+        const FloatImage * ref;
+        uint channel;
+        FloatImage * moments;
+    };
+
+    // Store x, y, x^2, y^2 and xy, so that blurring them gives the local means and second moments.
+    void momentsTask(void * data, int i)
+    {
+        MomentsContext * ctx = (MomentsContext *)data;
+
+        const uint h = ctx->img->height();
+        const uint w = ctx->img->width();
+        const uint y = i % h;
+        const uint z = i / h;
+
+        const float * x0 = ctx->img->scanline(ctx->channel, y, z);
+        const float * x1 = ctx->ref->scanline(ctx->channel, y, z);
+
+        float * m0 = ctx->moments->scanline(0, y, z);
+        float * m1 = ctx->moments->scanline(1, y, z);
+        float * m00 = ctx->moments->scanline(2, y, z);
+        float * m11 = ctx->moments->scanline(3, y, z);
+        float * m01 = ctx->moments->scanline(4, y, z);
+
+        for (uint x = 0; x < w; x++) {
+            m0[x] = x0[x];
+            m1[x] = x1[x];
+            m00[x] = x0[x] * x0[x];
+            m11[x] = x1[x] * x1[x];
+            m01[x] = x0[x] * x1[x];
+        }
     }
-    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
 
-    uint w = img0->width();
-    uint h = img0->height();
+    // SSIM of each pixel, from the blurred moments.
+    struct SsimError
+    {
+        SsimError(const FloatImage * moments) : moments(moments) {}
+
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            // Constants for a dynamic range of 1.
+            const float C1 = 0.01f * 0.01f;
+            const float C2 = 0.03f * 0.03f;
+
+            const uint w = moments->width();
+
+            const float * m0 = moments->scanline(0, y, z);
+            const float * m1 = moments->scanline(1, y, z);
+            const float * m00 = moments->scanline(2, y, z);
+            const float * m11 = moments->scanline(3, y, z);
+            const float * m01 = moments->scanline(4, y, z);
+
+            uint x = 0;
+
+#if NV_USE_SSE > 1
+            const __m128 c1 = _mm_set1_ps(C1);
+            const __m128 c2 = _mm_set1_ps(C2);
+            const __m128 two = _mm_set1_ps(2.0f);
+
+            for (; x + 4 <= w; x += 4) {
+                const __m128 mx = _mm_loadu_ps(m0 + x);
+                const __m128 my = _mm_loadu_ps(m1 + x);
+                const __m128 mxx = _mm_mul_ps(mx, mx);
+                const __m128 myy = _mm_mul_ps(my, my);
+                const __m128 mxy = _mm_mul_ps(mx, my);
+
+                const __m128 sxx = _mm_sub_ps(_mm_loadu_ps(m00 + x), mxx);
+                const __m128 syy = _mm_sub_ps(_mm_loadu_ps(m11 + x), myy);
+                const __m128 sxy = _mm_sub_ps(_mm_loadu_ps(m01 + x), mxy);
+
+                const __m128 num = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(two, mxy), c1), _mm_add_ps(_mm_mul_ps(two, sxy), c2));
+                const __m128 den = _mm_mul_ps(_mm_add_ps(_mm_add_ps(mxx, myy), c1), _mm_add_ps(_mm_add_ps(sxx, syy), c2));
+
+                _mm_storeu_ps(columnSums + x, _mm_add_ps(_mm_loadu_ps(columnSums + x), _mm_div_ps(num, den)));
+            }
+#endif
+
+            for (; x < w; x++) {
+                const float mx = m0[x];
+                const float my = m1[x];
+                const float mxx = mx * mx;
+                const float myy = my * my;
+                const float mxy = mx * my;
+
+                const float sxx = m00[x] - mxx;
+                const float syy = m11[x] - myy;
+                const float sxy = m01[x] - mxy;
+
+                columnSums[x] += ((2 * mxy + C1) * (2 * sxy + C2)) / ((mxx + myy + C1) * (sxx + syy + C2));
+            }
+        }
+
+        const FloatImage * moments;
+    };
+
+} // namespace
+
+// Mean SSIM, see: "Image Quality Assessment: From Error Visibility to Structural Similarity", Wang et al. 2004.
+// The local statistics are computed with a gaussian window with a standard deviation of 1.5 pixels, the window is
+// clamped at the borders of the image.
+float nv::structuralSimilarity(const FloatImage * img, const FloatImage * ref, uint channel, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img, ref) || channel >= img->componentCount() || channel >= ref->componentCount()) {
+        return 0.0f;
+    }
 
-    const float * x0 = img0->channel(0);
-    const float * y0 = img0->channel(1);
-    const float * z0 = img0->channel(2);
+    const uint w = img->width();
+    const uint h = img->height();
+    const uint d = img->depth();
 
-    const float * x1 = img1->channel(0);
-    const float * y1 = img1->channel(1);
-    const float * z1 = img1->channel(2);
+    FloatImage moments;
+    moments.allocate(5, w, h, d);
 
-    double error = 0.0f;
+    MomentsContext context;
+    context.img = img;
+    context.ref = ref;
+    context.channel = channel;
+    context.moments = &moments;
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
     {
-        Vector3 n0 = Vector3(x0[i], y0[i], z0[i]);
-        Vector3 n1 = Vector3(x1[i], y1[i], z1[i]);
-
-        n0 = 2.0f * n0 - Vector3(1);
-        n1 = 2.0f * n1 - Vector3(1);
-
-        n0 = normalizeSafe(n0, Vector3(0), 0.0f);
-        n1 = normalizeSafe(n1, Vector3(0), 0.0f);
-
-        error += acos(clamp(dot(n0, n1), -1.0f, 1.0f));
+        ParallelFor parallelFor(momentsTask, &context);
+        parallelFor.run(h * d);
     }
 
-    return float(error / count);
+    blur(&moments, 0, 5, 1.5f * 1.5f);
+
+    SsimError error(&moments);
+    return blockError(error, w, h, d, /*rms=*/false, blockErrors);
 }
 
-float nv::rmsAngularError(const FloatImage * img0, const FloatImage * img1)
+
+namespace
 {
-    if (img0 == NULL || img1 == NULL || img0->width() != img1->width() || img0->height() != img1->height()) {
-        return FLT_MAX;
-    }
-    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
+    // Angle between the normals of two normal maps.
+    struct AngularError
+    {
+        AngularError(const FloatImage * img0, const FloatImage * img1, bool squared) : img0(img0), img1(img1), squared(squared) {}
 
-    uint w = img0->width();
-    uint h = img0->height();
+        void addRow(uint y, uint z, float * columnSums) const
+        {
+            const uint w = img0->width();
 
-    const float * x0 = img0->channel(0);
-    const float * y0 = img0->channel(1);
-    const float * z0 = img0->channel(2);
+            const float * x0 = img0->scanline(0, y, z);
+            const float * y0 = img0->scanline(1, y, z);
+            const float * z0 = img0->scanline(2, y, z);
 
-    const float * x1 = img1->channel(0);
-    const float * y1 = img1->channel(1);
-    const float * z1 = img1->channel(2);
+            const float * x1 = img1->scanline(0, y, z);
+            const float * y1 = img1->scanline(1, y, z);
+            const float * z1 = img1->scanline(2, y, z);
 
-    double error = 0.0f;
+            for (uint x = 0; x < w; x++)
+            {
+                Vector3 n0 = Vector3(x0[x], y0[x], z0[x]);
+                Vector3 n1 = Vector3(x1[x], y1[x], z1[x]);
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
-    {
-        Vector3 n0 = Vector3(x0[i], y0[i], z0[i]);
-        Vector3 n1 = Vector3(x1[i], y1[i], z1[i]);
+                n0 = 2.0f * n0 - Vector3(1);
+                n1 = 2.0f * n1 - Vector3(1);
+
+                n0 = normalizeSafe(n0, Vector3(0), 0.0f);
+                n1 = normalizeSafe(n1, Vector3(0), 0.0f);
+
+                float angle = acosf(clamp(dot(n0, n1), -1.0f, 1.0f));
+                columnSums[x] += squared ? angle * angle : angle;
+            }
+        }
 
-        n0 = 2.0f * n0 - Vector3(1);
-        n1 = 2.0f * n1 - Vector3(1);
+        const FloatImage * img0;
+        const FloatImage * img1;
+        const bool squared;
+    };
 
-        n0 = normalizeSafe(n0, Vector3(0), 0.0f);
-        n1 = normalizeSafe(n1, Vector3(0), 0.0f);
+} // namespace
 
-        float angle = acosf(clamp(dot(n0, n1), -1.0f, 1.0f));
-        error += angle * angle;
+// Assumes input images are normal maps.
+float nv::averageAngularError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img0, img1)) {
+        return FLT_MAX;
     }
+    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
 
-    return float(sqrt(error / count));
+    AngularError error(img0, img1, /*squared=*/false);
+    return blockError(error, img0->width(), img0->height(), img0->depth(), /*rms=*/false, blockErrors);
 }
 
+float nv::rmsAngularError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors/*= NULL*/)
+{
+    if (!sameLayout(img0, img1)) {
+        return FLT_MAX;
+    }
+    nvDebugCheck(img0->componentCount() == 4 && img0->componentCount() == 4);
+
+    AngularError error(img0, img1, /*squared=*/true);
+    return blockError(error, img0->width(), img0->height(), img0->depth(), /*rms=*/true, blockErrors);
+}
@@ -6,16 +6,24 @@ namespace nv
 {
     class FloatImage;
 
-    float rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight);
-    float rmsAlphaError(const FloatImage * img, const FloatImage * ref);
+    // The errors are computed in parallel. When blockErrors is not NULL, it's set to a single channel image with the
+    // error of each 4x4 block of pixels, measured the same way as the error of the whole image.
 
-    float cieLabError(const FloatImage * img, const FloatImage * ref);
-    float spatialCieLabError(const FloatImage * img, const FloatImage * ref);
+    float rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight, FloatImage * blockErrors = NULL);
+    float rmsAlphaError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors = NULL);
+    float rmsChannelError(const FloatImage * img, const FloatImage * ref, uint channel, FloatImage * blockErrors = NULL);
 
-    float averageColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight);
-    float averageAlphaError(const FloatImage * img, const FloatImage * ref);
+    float cieLabError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors = NULL);
+    float spatialCieLabError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors = NULL);
 
-    float averageAngularError(const FloatImage * img0, const FloatImage * img1);
-    float rmsAngularError(const FloatImage * img0, const FloatImage * img1);
+    float averageColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight, FloatImage * blockErrors = NULL);
+    float averageAlphaError(const FloatImage * img, const FloatImage * ref, FloatImage * blockErrors = NULL);
+
+    float averageAngularError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors = NULL);
+    float rmsAngularError(const FloatImage * img0, const FloatImage * img1, FloatImage * blockErrors = NULL);
+
+    // Mean structural similarity index of a channel with values in the [0, 1] range. 1 means that the images are identical.
+    // Returns 0 when the images have different sizes or the channel doesn't exist.
+    float structuralSimilarity(const FloatImage * img, const FloatImage * ref, uint channel, FloatImage * blockErrors = NULL);
 
 } // nv namespace
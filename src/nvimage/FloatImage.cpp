@@ -3,8 +3,10 @@
 #include "FloatImage.h"
 #include "Filter.h"
 #include "Image.h"
+#include "Reduction.h"
 
 #include "nvmath/Color.h"
+#include "nvmath/Half.h"
 #include "nvmath/Vector.inl"
 #include "nvmath/Matrix.inl"
 
@@ -13,6 +15,9 @@
 #include "nvcore/Memory.h"
 #include "nvcore/Array.inl"
 
+#include "nvthread/ParallelFor.h"
+#include "nvthread/Mutex.h"
+
 #include <math.h>
 #include <string.h> // memset, memcpy
 
@@ -22,13 +27,13 @@ using namespace nv;
 
 /// Ctor.
 FloatImage::FloatImage() : m_componentCount(0), m_width(0), m_height(0), m_depth(0),
-  m_pixelCount(0), m_floatCount(0), m_mem(NULL)
+  m_pixelCount(0), m_floatCount(0), m_mem(NULL), m_storageFormat(StorageFormat_Float), m_packed(NULL)
 {
 }
 
 /// Ctor. Init from image.
 FloatImage::FloatImage(const Image * img) : m_componentCount(0), m_width(0), m_height(0), m_depth(0),
-    m_pixelCount(0), m_floatCount(0), m_mem(NULL)
+    m_pixelCount(0), m_floatCount(0), m_mem(NULL), m_storageFormat(StorageFormat_Float), m_packed(NULL)
 {
     initFrom(img);
 }
@@ -118,10 +123,13 @@ Image * FloatImage::createImageGammaCorrect(float gamma/*= 2.2f*/) const
 /// Allocate a 2D float image of the given format and the given extents.
 void FloatImage::allocate(uint c, uint w, uint h, uint d)
 {
-    if (m_componentCount != c || m_width != w || m_height != h || m_depth != d)
+    if (m_componentCount != c || m_width != w || m_height != h || m_depth != d || m_packed != NULL)
     {
         free();
 
+        // Pixels are addressed with 32 bit indices. Larger images have to be processed in stripes, see RowSource.
+        nvCheck(uint64(w) * h * d * c <= 0xFFFFFFFF);
+
         m_width = w;
         m_height = h;
         m_depth = d;
@@ -137,10 +145,16 @@ void FloatImage::free()
 {
     ::free(m_mem);
     m_mem = NULL;
+
+    ::free(m_packed);
+    m_packed = NULL;
+    m_storageFormat = StorageFormat_Float;
 }
 
 void FloatImage::resizeChannelCount(uint c)
 {
+    nvDebugCheck(!isCompact());
+
     if (m_componentCount != c) {
         uint count = m_pixelCount * c;
         m_mem = realloc<float>(m_mem, count);
@@ -154,6 +168,117 @@ void FloatImage::resizeChannelCount(uint c)
     }
 }
 
+static uint storageFormatSize(FloatImage::StorageFormat format)
+{
+    switch (format) {
+        case FloatImage::StorageFormat_Half: return 2;
+        case FloatImage::StorageFormat_UNorm16: return 2;
+        case FloatImage::StorageFormat_UNorm8: return 1;
+        default: return 4;
+    }
+}
+
+/// Convert the float channels to the given storage format and release them. Pixels can't be accessed until the image is expanded again.
+void FloatImage::compact(StorageFormat format)
+{
+    if (isCompact()) {
+        if (format == m_storageFormat) return;
+        expand();
+    }
+    if (format == StorageFormat_Float || m_mem == NULL) return;
+
+    const uint count = m_floatCount;
+    void * packed = ::malloc(count * storageFormatSize(format));
+
+    if (format == StorageFormat_Half) {
+        uint16 * dst = (uint16 *)packed;
+        for (uint i = 0; i < count; i++) {
+            dst[i] = to_half(m_mem[i]);
+        }
+    }
+    else if (format == StorageFormat_UNorm16) {
+        uint16 * dst = (uint16 *)packed;
+        for (uint i = 0; i < count; i++) {
+            dst[i] = uint16(iround(saturate(m_mem[i]) * 65535.0f));
+        }
+    }
+    else {
+        nvDebugCheck(format == StorageFormat_UNorm8);
+        uint8 * dst = (uint8 *)packed;
+        for (uint i = 0; i < count; i++) {
+            dst[i] = uint8(iround(saturate(m_mem[i]) * 255.0f));
+        }
+    }
+
+    ::free(m_mem);
+    m_mem = NULL;
+    m_packed = packed;
+    m_storageFormat = format;
+}
+
+static void unpack(FloatImage::StorageFormat format, const void * packed, uint count, float * mem)
+{
+    if (format == FloatImage::StorageFormat_Half) {
+        const uint16 * src = (const uint16 *)packed;
+        for (uint i = 0; i < count; i++) {
+            union { uint32 u; float f; } x;
+            x.u = half_to_float(src[i]);
+            mem[i] = x.f;
+        }
+    }
+    else if (format == FloatImage::StorageFormat_UNorm16) {
+        const uint16 * src = (const uint16 *)packed;
+        for (uint i = 0; i < count; i++) {
+            mem[i] = float(src[i]) / 65535.0f;
+        }
+    }
+    else {
+        // Same conversion as initFrom, so 8 bit images round trip exactly.
+        nvDebugCheck(format == FloatImage::StorageFormat_UNorm8);
+        const uint8 * src = (const uint8 *)packed;
+        for (uint i = 0; i < count; i++) {
+            mem[i] = float(src[i]) / 255.0f;
+        }
+    }
+}
+
+/// Convert the packed channels back to floats.
+void FloatImage::expand()
+{
+    if (!isCompact()) return;
+
+    const uint count = m_floatCount;
+    float * mem = malloc<float>(count);
+
+    unpack((StorageFormat)m_storageFormat, m_packed, count, mem);
+
+    ::free(m_packed);
+    m_packed = NULL;
+    m_storageFormat = StorageFormat_Float;
+    m_mem = mem;
+}
+
+/// Write the pixels as floats to the given image, reusing its allocation when the layouts match. This image is left unchanged.
+void FloatImage::expandTo(FloatImage * img) const
+{
+    nvCheck(img != NULL && img != this);
+
+    img->allocate(m_componentCount, m_width, m_height, m_depth);
+
+    if (isCompact()) {
+        unpack((StorageFormat)m_storageFormat, m_packed, m_floatCount, img->m_mem);
+    }
+    else {
+        memcpy(img->m_mem, m_mem, m_floatCount * sizeof(float));
+    }
+}
+
+/// Size in bytes of the pixel storage.
+uint64 FloatImage::byteCount() const
+{
+    return uint64(m_floatCount) * storageFormatSize((StorageFormat)m_storageFormat);
+}
+
 void FloatImage::clear(float f/*=0.0f*/)
 {
     for (uint i = 0; i < m_floatCount; i++) {
@@ -182,6 +307,16 @@ void FloatImage::copyChannel(uint src, uint dst)
     memcpy(dstChannel, srcChannel, sizeof(float)*m_pixelCount);
 }
 
+/// Copy the contents of the given image. The current allocation is reused when the layouts match.
+void FloatImage::copyFrom(const FloatImage * img)
+{
+    nvCheck(img != NULL && img != this);
+    nvDebugCheck(!img->isCompact());
+
+    allocate(img->m_componentCount, img->m_width, img->m_height, img->m_depth);
+    memcpy(m_mem, img->m_mem, m_floatCount * sizeof(float));
+}
+
 void FloatImage::normalize(uint baseComponent)
 {
     nvCheck(baseComponent + 3 <= m_componentCount);
@@ -265,6 +400,62 @@ void FloatImage::exponentiate(uint baseComponent, uint num, float power)
     }
 }
 
+/// Out-of-place scale and bias of the given channels, the other channels are copied unchanged.
+void FloatImage::scaleBias(const FloatImage * src, uint baseComponent, uint num, float scale, float bias)
+{
+    nvCheck(src != NULL && src != this);
+    nvCheck(baseComponent + num <= src->m_componentCount);
+
+    allocate(src->m_componentCount, src->m_width, src->m_height, src->m_depth);
+
+    const uint size = m_pixelCount;
+
+    for (uint c = 0; c < m_componentCount; c++) {
+        const float * sptr = src->channel(c);
+        float * dptr = this->channel(c);
+
+        if (c >= baseComponent && c < baseComponent + num) {
+            for (uint i = 0; i < size; i++) {
+                dptr[i] = scale * sptr[i] + bias;
+            }
+        }
+        else {
+            memcpy(dptr, sptr, size * sizeof(float));
+        }
+    }
+}
+
+/// Out-of-place conversion from linear to gamma space.
+void FloatImage::toGamma(const FloatImage * src, uint baseComponent, uint num, float gamma /*= 2.2f*/)
+{
+    exponentiate(src, baseComponent, num, 1.0f/gamma);
+}
+
+/// Out-of-place exponentiation of the given channels, the other channels are copied unchanged.
+void FloatImage::exponentiate(const FloatImage * src, uint baseComponent, uint num, float power)
+{
+    nvCheck(src != NULL && src != this);
+    nvCheck(baseComponent + num <= src->m_componentCount);
+
+    allocate(src->m_componentCount, src->m_width, src->m_height, src->m_depth);
+
+    const uint size = m_pixelCount;
+
+    for (uint c = 0; c < m_componentCount; c++) {
+        const float * sptr = src->channel(c);
+        float * dptr = this->channel(c);
+
+        if (c >= baseComponent && c < baseComponent + num) {
+            for (uint i = 0; i < size; i++) {
+                dptr[i] = powf(max(0.0f, sptr[i]), power);
+            }
+        }
+        else {
+            memcpy(dptr, sptr, size * sizeof(float));
+        }
+    }
+}
+
 /// Apply linear transform.
 void FloatImage::transform(uint baseComponent, const Matrix & m, Vector4::Arg offset)
 {
@@ -527,8 +718,8 @@ FloatImage * FloatImage::fastDownSample() const
 
     AutoPtr<FloatImage> dst_image( new FloatImage() );
 
-    const uint w = max(1, m_width / 2);
-    const uint h = max(1, m_height / 2);
+    const uint w = max(1U, m_width / 2);
+    const uint h = max(1U, m_height / 2);
     dst_image->allocate(m_componentCount, w, h);
 
     // 1D box filter.
@@ -703,9 +894,9 @@ FloatImage * FloatImage::fastDownSample() const
 /// Downsample applying a 1D kernel separately in each dimension.
 FloatImage * FloatImage::downSample(const Filter & filter, WrapMode wm) const
 {
-    const uint w = max(1, m_width / 2);
-    const uint h = max(1, m_height / 2);
-    const uint d = max(1, m_depth / 2);
+    const uint w = max(1U, m_width / 2);
+    const uint h = max(1U, m_height / 2);
+    const uint d = max(1U, m_depth / 2);
 
     return resize(filter, w, h, d, wm);
 }
@@ -713,9 +904,9 @@ FloatImage * FloatImage::downSample(const Filter & filter, WrapMode wm) const
 /// Downsample applying a 1D kernel separately in each dimension.
 FloatImage * FloatImage::downSample(const Filter & filter, WrapMode wm, uint alpha) const
 {
-    const uint w = max(1, m_width / 2);
-    const uint h = max(1, m_height / 2);
-    const uint d = max(1, m_depth / 2);
+    const uint w = max(1U, m_width / 2);
+    const uint h = max(1U, m_height / 2);
+    const uint d = max(1U, m_depth / 2);
 
     return resize(filter, w, h, d, wm, alpha);
 }
@@ -1338,6 +1529,60 @@ void FloatImage::flipZ()
 
 
 
+namespace
+{
+    // Coverage samples that pass the alpha test in rows of quads.
+    struct AlphaTestCoverageReduction
+    {
+        AlphaTestCoverageReduction(const FloatImage * image, float alphaRef, int alphaChannel, float alphaScale, uint rowCount) :
+            image(image), alphaRef(alphaRef), alphaChannel(alphaChannel), alphaScale(alphaScale)
+        {
+            coverage.resize(reductionChunkCount(rowCount, RowChunkSize), 0.0f);
+        }
+
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            const uint w = image->width();
+            const uint n = 8;
+
+            float c = 0.0f;
+
+            // If we want subsampling:
+            for (uint y = begin; y < end; y++) {
+                const float * row0 = image->scanline(alphaChannel, y + 0, 0);
+                const float * row1 = image->scanline(alphaChannel, y + 1, 0);
+
+                for (uint x = 0; x < w-1; x++) {
+
+                    float alpha00 = nv::saturate(row0[x+0] * alphaScale);
+                    float alpha10 = nv::saturate(row0[x+1] * alphaScale);
+                    float alpha01 = nv::saturate(row1[x+0] * alphaScale);
+                    float alpha11 = nv::saturate(row1[x+1] * alphaScale);
+
+                    for (float fy = 0.5f/n; fy < 1.0f; fy++) {
+                        for (float fx = 0.5f/n; fx < 1.0f; fx++) {
+                            float alpha = alpha00 * (1 - fx) * (1 - fy) + alpha10 * fx * (1 - fy) + alpha01 * (1 - fx) * fy + alpha11 * fx * fy;
+                            if (alpha > alphaRef) c += 1.0f;
+                        }
+                    }
+                }
+            }
+
+            coverage[chunk] = c;
+        }
+
+        static const uint RowChunkSize = 64;
+
+        const FloatImage * image;
+        const float alphaRef;
+        const int alphaChannel;
+        const float alphaScale;
+
+        Array<float> coverage;
+    };
+
+} // namespace
+
 float FloatImage::alphaTestCoverage(float alphaRef, int alphaChannel, float alphaScale/*=1*/) const
 {
     const uint w = m_width;
@@ -1357,21 +1602,12 @@ float FloatImage::alphaTestCoverage(float alphaRef, int alphaChannel, float alph
 #else
     const uint n = 8;
 
-    // If we want subsampling:
-    for (uint y = 0; y < h-1; y++) {
-        for (uint x = 0; x < w-1; x++) {
-
-            float alpha00 = nv::saturate(pixel(alphaChannel, x+0, y+0, 0) * alphaScale);
-            float alpha10 = nv::saturate(pixel(alphaChannel, x+1, y+0, 0) * alphaScale);
-            float alpha01 = nv::saturate(pixel(alphaChannel, x+0, y+1, 0) * alphaScale);
-            float alpha11 = nv::saturate(pixel(alphaChannel, x+1, y+1, 0) * alphaScale);
+    if (w > 1 && h > 1) {
+        AlphaTestCoverageReduction reduction(this, alphaRef, alphaChannel, alphaScale, h - 1);
+        parallelReduce(reduction, h - 1, AlphaTestCoverageReduction::RowChunkSize);
 
-            for (float fy = 0.5f/n; fy < 1.0f; fy++) {
-                for (float fx = 0.5f/n; fx < 1.0f; fx++) {
-                    float alpha = alpha00 * (1 - fx) * (1 - fy) + alpha10 * fx * (1 - fy) + alpha01 * (1 - fx) * fy + alpha11 * fx * fy;
-                    if (alpha > alphaRef) coverage += 1.0f;
-                }
-            }
+        for (uint i = 0; i < reduction.coverage.count(); i++) {
+            coverage += reduction.coverage[i];
         }
     }
 
@@ -1381,68 +1617,249 @@ float FloatImage::alphaTestCoverage(float alphaRef, int alphaChannel, float alph
 
 void FloatImage::scaleAlphaToCoverage(float desiredCoverage, float alphaRef, int alphaChannel)
 {
-#if 0
-    float minAlphaRef = 0.0f;
-    float maxAlphaRef = 1.0f;
-    float midAlphaRef = 0.5f;
+    FloatImage * image = this;
+    nv::scaleAlphaToCoverage(&image, 1, desiredCoverage, alphaRef, alphaChannel);
+#if _DEBUG
+    alphaTestCoverage(alphaRef, alphaChannel);
+#endif
+}
+
+
+namespace
+{
+    // Alpha scales are searched in [0, MaxAlphaScale] with this many steps.
+    const float MaxAlphaScale = 4.0f;
+    const uint CoverageBinCount = 4096;
+
+    // Quad rows processed by each task.
+    const uint CoverageBandSize = 64;
 
-    // Determine desired scale using a binary search. Hardcoded to 8 steps max.
-    for (int i = 0; i < 10; i++) {
-        float currentCoverage = alphaTestCoverage(midAlphaRef, alphaChannel);
+    // Coverage sample of a quad, as in FloatImage::alphaTestCoverage.
+    const float CoverageSample = 0.5f / 8;
 
-        if (currentCoverage > desiredCoverage) {
-            minAlphaRef = midAlphaRef;
+    // Smallest alpha scale for which the coverage sample of a quad passes the alpha test. The sample is a bilinear
+    // combination of the saturated and scaled alphas, so it's a piecewise linear and non decreasing function of the
+    // scale, with a breakpoint where each of the alphas saturates.
+    // Returns a negative value when the sample always passes the test and MaxAlphaScale when it never does.
+    float coverageThreshold(const float alpha[4], const float weight[4], float alphaRef)
+    {
+        if (alphaRef < 0.0f) return -1.0f;
+
+        // Sort the alphas by the scale at which they saturate.
+        uint order[4] = { 0, 1, 2, 3 };
+        for (uint i = 1; i < 4; i++) {
+            for (uint j = i; j > 0 && alpha[order[j]] > alpha[order[j - 1]]; j--) {
+                swap(order[j], order[j - 1]);
+            }
         }
-        else if (currentCoverage < desiredCoverage) {
-            maxAlphaRef = midAlphaRef;
+
+        float saturated = 0.0f;     // Contribution of the saturated alphas.
+        float slope = 0.0f;         // Derivative of the sample with respect to the scale.
+        for (uint i = 0; i < 4; i++) {
+            if (alpha[i] > 0.0f) slope += weight[i] * alpha[i];
         }
-        else {
-            break;
+
+        for (uint i = 0; i < 4; i++) {
+            const float a = alpha[order[i]];
+            if (a <= 0.0f) break;
+
+            const float scale = 1.0f / a;
+            if (scale >= MaxAlphaScale) break;
+
+            if (saturated + slope * scale > alphaRef) {
+                return (alphaRef - saturated) / slope;
+            }
+
+            saturated += weight[order[i]];
+            slope -= weight[order[i]] * a;
+        }
+
+        if (slope > 0.0f) {
+            float scale = (alphaRef - saturated) / slope;
+            if (scale < MaxAlphaScale) return scale;
         }
 
-        midAlphaRef = (minAlphaRef + maxAlphaRef) * 0.5f;
+        return MaxAlphaScale;
     }
 
-    float alphaScale = alphaRef / midAlphaRef;
+    struct CoverageTask
+    {
+        uint image;
+        uint y0, y1;            // Quad rows.
+    };
 
-    // Scale alpha channel.
-    scaleBias(alphaChannel, 1, alphaScale, 0.0f);
-    clamp(alphaChannel, 1, 0.0f, 1.0f); 
-#else
-    float minAlphaScale = 0.0f;
-    float maxAlphaScale = 4.0f;
-    float alphaScale = 1.0f;
+    struct CoverageContext
+    {
+        const FloatImage * const * images;
+        const CoverageTask * tasks;
+        uint32 * histograms;    // CoverageBinCount + 1 bins for each image. The last one counts the quads that are always covered.
+        Mutex * mutex;
+        float alphaRef;
+        int alphaChannel;
+    };
+
+    void coverageHistogramTask(void * data, int i)
+    {
+        CoverageContext * ctx = (CoverageContext *)data;
+        const CoverageTask & task = ctx->tasks[i];
+        const FloatImage * image = ctx->images[task.image];
+
+        // @@ Like alphaTestCoverage, this only looks at the first slice of 3D images.
+        if (image->width() < 2 || image->height() < 2) return;
 
-    // Determine desired scale using a binary search. Hardcoded to 8 steps max.
-    for (int i = 0; i < 10; i++) {
-        float currentCoverage = alphaTestCoverage(alphaRef, alphaChannel, alphaScale);
+        const float fx = CoverageSample, fy = CoverageSample;
+        const float weight[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
 
-        if (currentCoverage < desiredCoverage) {
-            minAlphaScale = alphaScale;
+        const uint w = image->width();
+        const float binScale = CoverageBinCount / MaxAlphaScale;
+
+        uint32 histogram[CoverageBinCount + 1];
+        memset(histogram, 0, sizeof(histogram));
+
+        for (uint y = task.y0; y < task.y1; y++) {
+            const float * row0 = image->scanline(ctx->alphaChannel, y, 0);
+            const float * row1 = image->scanline(ctx->alphaChannel, y + 1, 0);
+
+            for (uint x = 0; x < w - 1; x++) {
+                const float alpha[4] = { row0[x], row0[x + 1], row1[x], row1[x + 1] };
+
+                float t = coverageThreshold(alpha, weight, ctx->alphaRef);
+                if (t < 0.0f) histogram[CoverageBinCount]++;
+                else if (t < MaxAlphaScale) histogram[min(uint(t * binScale), CoverageBinCount - 1)]++;
+            }
         }
-        else if (currentCoverage > desiredCoverage) {
-            maxAlphaScale = alphaScale;
+
+        uint32 * dst = ctx->histograms + task.image * (CoverageBinCount + 1);
+
+        Lock<Mutex> lock(*ctx->mutex);
+        for (uint b = 0; b <= CoverageBinCount; b++) {
+            dst[b] += histogram[b];
         }
-        else {
-            break;
+    }
+
+    struct ScaleAlphaContext
+    {
+        FloatImage * const * images;
+        const CoverageTask * tasks;
+        const float * scales;
+        int alphaChannel;
+    };
+
+    void scaleAlphaTask(void * data, int i)
+    {
+        ScaleAlphaContext * ctx = (ScaleAlphaContext *)data;
+        const CoverageTask & task = ctx->tasks[i];
+        FloatImage * image = ctx->images[task.image];
+
+        const float scale = ctx->scales[task.image];
+        const uint w = image->width();
+
+        // Tasks cover quad rows, the last one also covers the last pixel row.
+        const uint y1 = (task.y1 == image->height() - 1) ? task.y1 + 1 : task.y1;
+
+        for (uint z = 0; z < image->depth(); z++) {
+            for (uint y = task.y0; y < y1; y++) {
+                float * alpha = image->scanline(ctx->alphaChannel, y, z);
+                for (uint x = 0; x < w; x++) {
+                    alpha[x] = saturate(alpha[x] * scale);
+                }
+            }
+        }
+    }
+
+} // namespace
+
+void nv::scaleAlphaToCoverage(FloatImage * const * images, uint count, float desiredCoverage, float alphaRef, int alphaChannel)
+{
+    // Split the images in bands of quad rows. Images that are too small to have any quads get a single band, so that their alpha is still clamped.
+    Array<CoverageTask> tasks;
+    for (uint i = 0; i < count; i++) {
+        const uint quadRows = images[i]->height() > 1 ? images[i]->height() - 1 : 1;
+        for (uint y = 0; y < quadRows; y += CoverageBandSize) {
+            CoverageTask task;
+            task.image = i;
+            task.y0 = y;
+            task.y1 = min(y + CoverageBandSize, quadRows);
+            tasks.append(task);
         }
+    }
+
+    Array<uint32> histograms;
+    histograms.resize(count * (CoverageBinCount + 1), 0);
+
+    Mutex mutex;
 
-        alphaScale = (minAlphaScale + maxAlphaScale) * 0.5f;
+    CoverageContext context;
+    context.images = images;
+    context.tasks = tasks.buffer();
+    context.histograms = histograms.buffer();
+    context.mutex = &mutex;
+    context.alphaRef = alphaRef;
+    context.alphaChannel = alphaChannel;
+
+    // Histogram of the smallest scale at which each quad is covered.
+    {
+        ParallelFor parallelFor(coverageHistogramTask, &context);
+        parallelFor.run(tasks.count());
     }
 
-    // Scale alpha channel.
-    scaleBias(alphaChannel, 1, alphaScale, 0.0f);
-    clamp(alphaChannel, 1, 0.0f, 1.0f); 
-#endif
-#if _DEBUG
-    alphaTestCoverage(alphaRef, alphaChannel);
-#endif
+    // Pick the scale whose coverage is closest to the desired one. Scales are tested at the bin edges, where the
+    // number of covered quads is the number of thresholds in the previous bins. On ties, prefer the scale closest to 1.
+    Array<float> scales;
+    scales.resize(count);
+
+    for (uint i = 0; i < count; i++) {
+        const uint32 * histogram = histograms.buffer() + i * (CoverageBinCount + 1);
+        const uint w = images[i]->width();
+        const uint h = images[i]->height();
+
+        // Same normalization as alphaTestCoverage.
+        const double desiredCount = double(desiredCoverage) * double(w) * double(h) * 64.0;
+
+        const uint one = uint(CoverageBinCount / MaxAlphaScale);
+        uint best = one;
+        double bestError = NV_FLOAT_MAX;
+
+        uint64 covered = histogram[CoverageBinCount];
+        for (uint b = 0; b <= CoverageBinCount; b++) {
+            double error = fabs(double(covered) - desiredCount);
+            if (error < bestError || (error == bestError && abs(int(b) - int(one)) < abs(int(best) - int(one)))) {
+                best = b;
+                bestError = error;
+            }
+            if (b < CoverageBinCount) covered += histogram[b];
+        }
+
+        scales[i] = float(best) * (MaxAlphaScale / CoverageBinCount);
+    }
+
+    ScaleAlphaContext scaleContext;
+    scaleContext.images = images;
+    scaleContext.tasks = tasks.buffer();
+    scaleContext.scales = scales.buffer();
+    scaleContext.alphaChannel = alphaChannel;
+
+    ParallelFor parallelFor(scaleAlphaTask, &scaleContext);
+    parallelFor.run(tasks.count());
 }
 
 FloatImage* FloatImage::clone() const
 {
     FloatImage* copy = new FloatImage();
 
+    if (isCompact()) {
+        copy->m_componentCount = m_componentCount;
+        copy->m_width = m_width;
+        copy->m_height = m_height;
+        copy->m_depth = m_depth;
+        copy->m_pixelCount = m_pixelCount;
+        copy->m_floatCount = m_floatCount;
+        copy->m_storageFormat = m_storageFormat;
+        copy->m_packed = ::malloc(size_t(byteCount()));
+        memcpy(copy->m_packed, m_packed, size_t(byteCount()));
+        return copy;
+    }
+
     copy->allocate(m_componentCount, m_width, m_height, m_depth);
     memcpy(copy->m_mem, m_mem, m_floatCount * sizeof(float));
 
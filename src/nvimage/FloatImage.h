@@ -34,6 +34,14 @@ namespace nv
             WrapMode_Mirror
         };
 
+        // Formats used to keep the image in a compact form while it's not being processed.
+        enum StorageFormat {
+            StorageFormat_Float,
+            StorageFormat_Half,
+            StorageFormat_UNorm16,      // Values are clamped to [0, 1].
+            StorageFormat_UNorm8,       // Values are clamped to [0, 1].
+        };
+
         NVIMAGE_API FloatImage();
         NVIMAGE_API FloatImage(const Image * img);
         NVIMAGE_API virtual ~FloatImage();
@@ -52,11 +60,22 @@ namespace nv
         NVIMAGE_API void resizeChannelCount(uint c);
         //@}
 
+        /** @name Compact storage. */
+        //@{
+        NVIMAGE_API void compact(StorageFormat format);
+        NVIMAGE_API void expand();
+        NVIMAGE_API void expandTo(FloatImage * img) const;
+        bool isCompact() const { return m_packed != NULL; }
+        StorageFormat storageFormat() const { return (StorageFormat)m_storageFormat; }
+        NVIMAGE_API uint64 byteCount() const;
+        //@}
+
         /** @name Manipulation. */
         //@{
         NVIMAGE_API void clear(float f = 0.0f);
         NVIMAGE_API void clear(uint component, float f = 0.0f);
         NVIMAGE_API void copyChannel(uint src, uint dst);
+        NVIMAGE_API void copyFrom(const FloatImage * img);
 
         NVIMAGE_API void normalize(uint base_component);
 
@@ -70,6 +89,11 @@ namespace nv
         NVIMAGE_API void toGamma(uint base_component, uint num, float gamma = 2.2f);
         NVIMAGE_API void exponentiate(uint base_component, uint num, float power);
 
+        // Out-of-place versions. These write into this image, reusing its storage when the layout matches, and copy the remaining channels from the source.
+        NVIMAGE_API void scaleBias(const FloatImage * src, uint base_component, uint num, float scale, float add);
+        NVIMAGE_API void toGamma(const FloatImage * src, uint base_component, uint num, float gamma = 2.2f);
+        NVIMAGE_API void exponentiate(const FloatImage * src, uint base_component, uint num, float power);
+
         NVIMAGE_API void transform(uint base_component, const Matrix & m, const Vector4 & offset);
         NVIMAGE_API void swizzle(uint base_component, uint r, uint g, uint b, uint a);
 
@@ -178,13 +202,16 @@ namespace nv
     public:
 
         uint16 m_componentCount;
-        uint16 m_width;
-        uint16 m_height;
-        uint16 m_depth;
+        uint32 m_width;
+        uint32 m_height;
+        uint32 m_depth;
         uint32 m_pixelCount;
         uint32 m_floatCount;
         float * m_mem;
 
+        uint32 m_storageFormat;
+        void * m_packed;        // Packed channels while the image is compact, m_mem is NULL then.
+
     };
 
 
@@ -389,6 +416,10 @@ namespace nv
         return img0->width() == img1->width() && img0->height() == img1->height() && img0->depth() == img1->depth();
     }
 
+    // Scale the alpha of each image so that its alpha test coverage matches the given one. Same as calling
+    // FloatImage::scaleAlphaToCoverage on each image, but all the images are processed in parallel.
+    NVIMAGE_API void scaleAlphaToCoverage(FloatImage * const * images, uint count, float coverage, float alphaRef, int alphaChannel);
+
 
 } // nv namespace
 
@@ -15,7 +15,7 @@
 
 using namespace nv;
 
-Image::Image() : m_width(0), m_height(0), m_format(Format_RGB), m_data(NULL)
+Image::Image() : m_width(0), m_height(0), m_depth(0), m_format(Format_RGB), m_data(NULL)
 {
 }
 
@@ -33,7 +33,7 @@ Image::~Image()
 
 const Image & Image::operator=(const Image & img)
 {
-    allocate(img.m_width, img.m_height, m_depth);
+    allocate(img.m_width, img.m_height, img.m_depth);
     m_format = img.m_format;
     memcpy(m_data, img.m_data, sizeof(Color32) * m_width * m_height * m_depth);
     return *this;
@@ -58,13 +58,19 @@ bool Image::load(const char * name)
         return false;
     }
 
+    acquire(img.ptr());
+
+    return true;
+}
+
+// Take the contents of the given image without copying them. The image is left with the previous contents of this one.
+void Image::acquire(Image * img)
+{
     swap(m_width, img->m_width);
     swap(m_height, img->m_height);
 	swap(m_depth, img->m_depth);
     swap(m_format, img->m_format);
     swap(m_data, img->m_data);
-
-    return true;
 }
 
 void Image::wrap(void * data, uint w, uint h, uint d)
@@ -31,6 +31,7 @@ namespace nv
 
         void allocate(uint w, uint h, uint d = 1);
         bool load(const char * name);
+        void acquire(Image * img);
 
         void wrap(void * data, uint w, uint h, uint d = 1);
         void unwrap();
@@ -861,14 +861,17 @@ static void term_source (j_decompress_ptr /*cinfo*/){
 }
 
 
-static Image * loadJPG(Stream & s)
+static Image * loadJPG(Stream & s, uint minExtent, uint * width, uint * height)
 {
     nvCheck(!s.isError());
 
     // Read the entire file.
+    const uint64 fileSize = s.size();
+    if (fileSize > NV_UINT32_MAX) return NULL;
+
     Array<uint8> byte_array;
-    byte_array.resize(s.size());
-    s.serialize(byte_array.buffer(), s.size());
+    byte_array.resize(uint(fileSize));
+    s.serialize(byte_array.buffer(), fileSize);
 
     jpeg_decompress_struct cinfo;
     jpeg_error_mgr jerr;
@@ -887,6 +890,21 @@ static Image * loadJPG(Stream & s)
     cinfo.src->next_input_byte = byte_array.buffer();
 
     jpeg_read_header(&cinfo, TRUE);
+
+    if (width != NULL) *width = cinfo.image_width;
+    if (height != NULL) *height = cinfo.image_height;
+
+    // Pick the smallest DCT scale that is still at least minExtent pixels wide or tall.
+    if (minExtent != 0) {
+        const uint extent = max(cinfo.image_width, cinfo.image_height);
+        uint denom = 1;
+        while (denom < 8 && (extent + 2 * denom - 1) / (2 * denom) >= minExtent) {
+            denom *= 2;
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+    }
+
     jpeg_start_decompress(&cinfo);
 
     /*
@@ -1161,8 +1179,8 @@ namespace
 
 	virtual void seekg(Imf::Int64 pos)
 	{
-	    nvDebugCheck(pos >= 0 && pos < UINT_MAX);
-	    m_stream.seek((uint)pos);
+	    nvDebugCheck(pos >= 0);
+	    m_stream.seek(uint64(pos));
 	}
 
 	virtual void clear()
@@ -1617,7 +1635,9 @@ bool nv::ImageIO::saveFloatFreeImage(FREE_IMAGE_FORMAT fif, Stream & s, const Fl
 static Image * loadSTB(Stream & s)
 {
     // @@ Assumes stream cursor is at the beginning and that image occupies the whole stream.
-    const int size = s.size();
+    if (s.size() > uint64(NV_INT32_MAX)) return NULL;   // stb_image takes int sizes.
+
+    const int size = int(s.size());
     uint8 * buffer = new uint8[size];
 
     s.serialize(buffer, size);
@@ -1657,7 +1677,9 @@ static Image * loadSTB(Stream & s)
 static FloatImage * loadFloatSTB(Stream & s)
 {
     // @@ Assumes stream cursor is at the beginning and that image occupies the whole stream.
-    const int size = s.size();
+    if (s.size() > uint64(NV_INT32_MAX)) return NULL;   // stb_image takes int sizes.
+
+    const int size = int(s.size());
     uint8 * buffer = new uint8[size];
 
     s.serialize(buffer, size);
@@ -1727,7 +1749,7 @@ Image * nv::ImageIO::load(const char * fileName, Stream & s)
 
 #if defined(HAVE_JPEG)
     if (strCaseCmp(extension, ".jpg") == 0 || strCaseCmp(extension, ".jpeg") == 0) {
-        return loadJPG(s);
+        return loadJPG(s, 0, NULL, NULL);
     }
 #endif
 
@@ -1751,6 +1773,43 @@ Image * nv::ImageIO::load(const char * fileName, Stream & s)
     return NULL;
 }
 
+Image * nv::ImageIO::load(const char * fileName, uint minExtent, uint * width/*= NULL*/, uint * height/*= NULL*/)
+{
+    nvDebugCheck(fileName != NULL);
+
+    StdInputStream stream(fileName);
+
+    if (stream.isError()) {
+        return NULL;
+    }
+
+    return ImageIO::load(fileName, stream, minExtent, width, height);
+}
+
+Image * nv::ImageIO::load(const char * fileName, Stream & s, uint minExtent, uint * width/*= NULL*/, uint * height/*= NULL*/)
+{
+    nvDebugCheck(fileName != NULL);
+    nvDebugCheck(s.isLoading());
+
+#if defined(HAVE_JPEG)
+    const char * extension = Path::extension(fileName);
+
+    if (strCaseCmp(extension, ".jpg") == 0 || strCaseCmp(extension, ".jpeg") == 0) {
+        return loadJPG(s, minExtent, width, height);
+    }
+#endif
+
+    // Other formats are always loaded at full size.
+    Image * img = load(fileName, s);
+
+    if (img != NULL) {
+        if (width != NULL) *width = img->width();
+        if (height != NULL) *height = img->height();
+    }
+
+    return img;
+}
+
 bool nv::ImageIO::save(const char * fileName, Stream & s, const Image * img, const char ** tags/*=NULL*/)
 {
     nvDebugCheck(fileName != NULL);
@@ -1842,7 +1901,7 @@ FloatImage * nv::ImageIO::loadFloat(const char * fileName, Stream & s)
 #endif
 
     if (strCaseCmp(extension, ".dds") == 0) {
-        const uint spos = s.tell(); // Save stream position.
+        const uint64 spos = s.tell(); // Save stream position.
         FloatImage * floatImage = loadFloatDDS(s);
         if (floatImage != NULL) return floatImage;
         else s.seek(spos);
@@ -20,6 +20,12 @@ namespace nv
         NVIMAGE_API Image * load(const char * fileName);
         NVIMAGE_API Image * load(const char * fileName, Stream & s);
 
+        // Load the image downscaled while decoding, when the format allows it, to the smallest size with a width or
+        // height of at least minExtent. Only JPEG files are decoded at a smaller scale, so the result still has to be
+        // resized to the target size. The size of the full image is returned in width and height.
+        NVIMAGE_API Image * load(const char * fileName, uint minExtent, uint * width = NULL, uint * height = NULL);
+        NVIMAGE_API Image * load(const char * fileName, Stream & s, uint minExtent, uint * width = NULL, uint * height = NULL);
+
         NVIMAGE_API FloatImage * loadFloat(const char * fileName);
         NVIMAGE_API FloatImage * loadFloat(const char * fileName, Stream & s);
 
@@ -28,95 +28,323 @@
 
 #include "nvmath/Color.inl"
 #include "nvmath/Vector.h"
+#include "nvmath/SimdVector.h" // NV_USE_SSE
+
+#include "nvthread/ParallelFor.h"
 
 #include "nvcore/Ptr.h"
+#include "nvcore/Array.inl"
+#include "nvcore/Utils.h"
+
+#include <math.h>
 
 
 using namespace nv;
 
-// Create normal map using the given kernels.
-static FloatImage * createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, const Kernel2 * kdu, const Kernel2 * kdv)
+namespace
 {
-    nvDebugCheck(kdu != NULL);
-    nvDebugCheck(kdv != NULL);
-    nvDebugCheck(img != NULL);
+    // Kernel decomposed as a sum of separable terms: k(x, y) = sum(column[t][y] * row[t][x]). The sobel kernels have
+    // rank 1 or 2. Blended kernels have a higher rank, unless some of the weights are zero.
+    struct SeparableKernel
+    {
+        SeparableKernel(const Kernel2 & k) : size(k.windowSize()), termCount(0)
+        {
+            const uint n = size;
+
+            Array<double> m;
+            m.resize(n * n);
+
+            double maxValue = 0;
+            for (uint i = 0; i < n * n; i++) {
+                m[i] = k.valueAt(i % n, i / n);
+                maxValue = max(maxValue, fabs(m[i]));
+            }
+
+            // Gaussian elimination with full pivoting, each pivot removes a rank 1 term.
+            Array<double> c, r;
+            c.resize(n);
+            r.resize(n);
+
+            for (uint t = 0; t < n; t++)
+            {
+                uint p = 0;
+                for (uint i = 1; i < n * n; i++) {
+                    if (fabs(m[i]) > fabs(m[p])) p = i;
+                }
+
+                const uint px = p % n;
+                const uint py = p / n;
+                const double pivot = m[p];
+
+                if (fabs(pivot) <= maxValue * 1e-6) break;
+
+                for (uint i = 0; i < n; i++) {
+                    c[i] = m[i * n + px] / pivot;
+                    r[i] = m[py * n + i];
+                }
+
+                for (uint y = 0; y < n; y++) {
+                    for (uint x = 0; x < n; x++) {
+                        m[y * n + x] -= c[y] * r[x];
+                    }
+                }
+
+                for (uint i = 0; i < n; i++) {
+                    column.append(float(c[i]));
+                    row.append(float(r[i]));
+                }
+                termCount++;
+            }
+        }
 
-    const uint w = img->width();
-    const uint h = img->height();
+        // Two passes of n taps per term are only faster than a single pass of n * n taps when the rank is low.
+        bool isEfficient() const { return 2 * termCount < size; }
 
-    AutoPtr<FloatImage> fimage(new FloatImage());
-    fimage->allocate(4, w, h);
+        const uint size;
+        uint termCount;
+        Array<float> column;
+        Array<float> row;
+    };
 
-    // Compute height and store in alpha channel:
-    float * alphaChannel = fimage->channel(3);
-    for(uint i = 0; i < w * h; i++)
+    // dst[i] += k * src[i]
+    void madd(float * restrict dst, const float * restrict src, float k, uint count)
     {
-        Vector4 color = toVector4(img->pixel(i));
-        alphaChannel[i] = dot(color, heightWeights);
+        uint i = 0;
+#if NV_USE_SSE
+        const __m128 vk = _mm_set1_ps(k);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(vk, _mm_loadu_ps(src + i))));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] += k * src[i];
+        }
     }
 
-    float heightScale = 1.0f / 16.0f;	// @@ Use a user defined factor.
+    struct NormalMapContext
+    {
+        const float * heights;      // Height map with a border of kernelSize / 2 texels, wrapped according to the wrap mode.
+        const float * alpha;
+        uint width;
+        uint height;
+        uint stripeHeight;
+
+        const Kernel2 * kdu;
+        const Kernel2 * kdv;
+        const SeparableKernel * separable;  // NULL when the kernels are applied directly.
+
+        float heightScale;
+        bool pack;                  // Output normals in the [0, 1] range.
+
+        FloatImage * output;
+    };
 
-    for(uint y = 0; y < h; y++)
+    // Apply a separable term to rows [y0, y0 + count) of the padded height map.
+    void applySeparable(const NormalMapContext * ctx, const float * row, const float * column, uint y0, uint count, float * tmp, float * output)
     {
-        for(uint x = 0; x < w; x++)
-        {
-            const float du = fimage->applyKernelXY(kdu, x, y, 0, 3, wm);
-            const float dv = fimage->applyKernelXY(kdv, x, y, 0, 3, wm);
+        const uint n = ctx->kdu->windowSize();
+        const uint w = ctx->width;
+        const uint paddedWidth = w + n - 1;
+
+        // Horizontal pass, including the rows of the vertical border.
+        for (uint y = 0; y < count + n - 1; y++) {
+            float * dst = tmp + y * w;
+            memset(dst, 0, w * sizeof(float));
+
+            const float * src = ctx->heights + (y0 + y) * paddedWidth;
+            for (uint e = 0; e < n; e++) {
+                if (row[e] != 0.0f) madd(dst, src + e, row[e], w);
+            }
+        }
 
-            Vector3 n = normalize(Vector3(du, dv, heightScale));
+        // Vertical pass.
+        for (uint y = 0; y < count; y++) {
+            for (uint i = 0; i < n; i++) {
+                if (column[i] != 0.0f) madd(output + y * w, tmp + (y + i) * w, column[i], w);
+            }
+        }
+    }
 
-            fimage->pixel(x, y, 0, 0) = 0.5f * n.x + 0.5f;
-            fimage->pixel(x, y, 0, 1) = 0.5f * n.y + 0.5f;
-            fimage->pixel(x, y, 0, 2) = 0.5f * n.z + 0.5f;
+    void applyKernel(const NormalMapContext * ctx, const Kernel2 * k, uint y0, uint count, float * output)
+    {
+        const uint n = k->windowSize();
+        const uint w = ctx->width;
+        const uint paddedWidth = w + n - 1;
+
+        for (uint y = 0; y < count; y++) {
+            for (uint i = 0; i < n; i++) {
+                const float * src = ctx->heights + (y0 + y + i) * paddedWidth;
+                for (uint e = 0; e < n; e++) {
+                    const float value = k->valueAt(e, i);
+                    if (value != 0.0f) madd(output + y * w, src + e, value, w);
+                }
+            }
         }
     }
 
-    return fimage.release();
-}
+    void normalMapTask(void * data, int id)
+    {
+        const NormalMapContext * ctx = (const NormalMapContext *)data;
 
+        const uint w = ctx->width;
+        const uint y0 = id * ctx->stripeHeight;
+        const uint count = min(ctx->stripeHeight, ctx->height - y0);
 
-// Create normal map using the given kernels.
-static FloatImage * createNormalMap(const FloatImage * img, FloatImage::WrapMode wm, const Kernel2 * kdu, const Kernel2 * kdv)
+        Array<float> du, dv;
+        du.resize(w * count, 0.0f);
+        dv.resize(w * count, 0.0f);
+
+        if (ctx->separable != NULL) {
+            const SeparableKernel * k = ctx->separable;
+
+            Array<float> tmp;
+            tmp.resize(w * (count + k->size - 1));
+
+            // The transposed kernel has the same terms with the rows and columns swapped.
+            for (uint t = 0; t < k->termCount; t++) {
+                const float * row = k->row.buffer() + t * k->size;
+                const float * column = k->column.buffer() + t * k->size;
+                applySeparable(ctx, row, column, y0, count, tmp.buffer(), du.buffer());
+                applySeparable(ctx, column, row, y0, count, tmp.buffer(), dv.buffer());
+            }
+        }
+        else {
+            applyKernel(ctx, ctx->kdu, y0, count, du.buffer());
+            applyKernel(ctx, ctx->kdv, y0, count, dv.buffer());
+        }
+
+        // Normalize and output the normals in the same pass.
+        const float scale = ctx->pack ? 0.5f : 1.0f;
+        const float bias = ctx->pack ? 0.5f : 0.0f;
+        const float hs2 = ctx->heightScale * ctx->heightScale;
+
+        FloatImage * img = ctx->output;
+        float * rx = img->scanline(0, y0, 0);
+        float * ry = img->scanline(1, y0, 0);
+        float * rz = img->scanline(2, y0, 0);
+
+        uint i = 0;
+#if NV_USE_SSE
+        const __m128 vscale = _mm_set1_ps(scale);
+        const __m128 vbias = _mm_set1_ps(bias);
+        const __m128 vhs = _mm_set1_ps(ctx->heightScale);
+        const __m128 vhs2 = _mm_set1_ps(hs2);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= w * count; i += 4) {
+            const __m128 x = _mm_loadu_ps(du.buffer() + i);
+            const __m128 y = _mm_loadu_ps(dv.buffer() + i);
+            const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), vhs2));
+            const __m128 s = _mm_mul_ps(_mm_div_ps(one, l), vscale);
+            _mm_storeu_ps(rx + i, _mm_add_ps(_mm_mul_ps(x, s), vbias));
+            _mm_storeu_ps(ry + i, _mm_add_ps(_mm_mul_ps(y, s), vbias));
+            _mm_storeu_ps(rz + i, _mm_add_ps(_mm_mul_ps(vhs, s), vbias));
+        }
+#endif
+        for (; i < w * count; i++) {
+            const float x = du[i];
+            const float y = dv[i];
+            const float s = (1.0f / sqrtf(x * x + y * y + hs2)) * scale;
+            rx[i] = x * s + bias;
+            ry[i] = y * s + bias;
+            rz[i] = ctx->heightScale * s + bias;
+        }
+
+        memcpy(img->scanline(3, y0, 0), ctx->alpha + y0 * w, w * count * sizeof(float));
+    }
+
+} // namespace
+
+
+// Create normal map using the given kernels. The derivatives are computed in stripes of rows in parallel, using a
+// copy of the height map with borders, so that the wrap mode doesn't have to be evaluated for every tap.
+static FloatImage * createNormalMap(const float * heights, const float * alpha, uint w, uint h, FloatImage::WrapMode wm, const Kernel2 & kdu, const Kernel2 & kdv, bool pack)
 {
-    nvDebugCheck(kdu != NULL);
-    nvDebugCheck(kdv != NULL);
-    nvDebugCheck(img != NULL);
+    nvDebugCheck(heights != NULL);
+    nvDebugCheck(kdu.windowSize() == kdv.windowSize());
 
 #pragma NV_MESSAGE("FIXME: Height scale parameter should go away. It should be a sensible value that produces good results when the heightmap is in the [0, 1] range.")
     const float heightScale = 1.0f / 16.0f;
 
-    const uint w = img->width();
-    const uint h = img->height();
+    const int radius = int(kdu.windowSize() / 2);
+    const uint paddedWidth = w + 2 * radius;
+    const uint paddedHeight = h + 2 * radius;
+
+    Array<uint> xoffsets;
+    xoffsets.resize(paddedWidth);
+    for (uint x = 0; x < paddedWidth; x++) {
+        const int ix = int(x) - radius;
+        if (wm == FloatImage::WrapMode_Clamp) xoffsets[x] = wrapClamp(ix, w);
+        else if (wm == FloatImage::WrapMode_Repeat) xoffsets[x] = wrapRepeat(ix, w);
+        else xoffsets[x] = wrapMirror(ix, w);
+    }
+
+    Array<float> padded;
+    padded.resize(paddedWidth * paddedHeight);
+    for (uint y = 0; y < paddedHeight; y++) {
+        const int iy = int(y) - radius;
+        uint sy;
+        if (wm == FloatImage::WrapMode_Clamp) sy = wrapClamp(iy, h);
+        else if (wm == FloatImage::WrapMode_Repeat) sy = wrapRepeat(iy, h);
+        else sy = wrapMirror(iy, h);
+
+        const float * src = heights + sy * w;
+        float * dst = padded.buffer() + y * paddedWidth;
+        for (uint x = 0; x < paddedWidth; x++) {
+            dst[x] = src[xoffsets[x]];
+        }
+    }
 
     AutoPtr<FloatImage> img_out(new FloatImage());
     img_out->allocate(4, w, h);
 
-    for (uint y = 0; y < h; y++)
-    {
-        for (uint x = 0; x < w; x++)
-        {
-            const float du = img->applyKernelXY(kdu, x, y, 0, 3, wm);
-            const float dv = img->applyKernelXY(kdv, x, y, 0, 3, wm);
+    SeparableKernel separable(kdu);
 
-            Vector3 n = normalize(Vector3(du, dv, heightScale));
+    NormalMapContext context;
+    context.heights = padded.buffer();
+    context.alpha = alpha;
+    context.width = w;
+    context.height = h;
+    context.stripeHeight = 16;
+    context.kdu = &kdu;
+    context.kdv = &kdv;
+    context.separable = separable.isEfficient() ? &separable : NULL;
+    context.heightScale = heightScale;
+    context.pack = pack;
+    context.output = img_out.ptr();
 
-	    img_out->pixel(x, y, 0, 0) = n.x;
-	    img_out->pixel(x, y, 0, 1) = n.y;
-	    img_out->pixel(x, y, 0, 2) = n.z;
-	}
-    }
+    ParallelFor parallelFor(normalMapTask, &context);
+    parallelFor.run((h + context.stripeHeight - 1) / context.stripeHeight);
 
-    // Copy alpha channel.
-    for (uint y = 0; y < h; y++)
+    return img_out.release();
+}
+
+// Create normal map using the given kernels.
+static FloatImage * createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, const Kernel2 & kdu, const Kernel2 & kdv)
+{
+    nvDebugCheck(img != NULL);
+
+    const uint w = img->width();
+    const uint h = img->height();
+
+    // Compute height and store in alpha channel:
+    Array<float> heights;
+    heights.resize(w * h);
+    for(uint i = 0; i < w * h; i++)
     {
-        for (uint x = 0; x < w; x++)
-        {
-            img_out->pixel(x, y, 0, 3) = img->pixel(x, y, 0, 3);
-        }
+        Vector4 color = toVector4(img->pixel(i));
+        heights[i] = dot(color, heightWeights);
     }
 
-    return img_out.release();
+    return createNormalMap(heights.buffer(), heights.buffer(), w, h, wm, kdu, kdv, /*pack=*/true);
+}
+
+// Create normal map using the given kernels.
+static FloatImage * createNormalMap(const FloatImage * img, FloatImage::WrapMode wm, const Kernel2 & kdu, const Kernel2 & kdv)
+{
+    nvDebugCheck(img != NULL);
+
+    // Height is in the alpha channel, copy it to the output.
+    return createNormalMap(img->channel(3), img->channel(3), img->width(), img->height(), wm, kdu, kdv, /*pack=*/false);
 }
 
 
@@ -126,32 +354,32 @@ FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vec
     nvDebugCheck(img != NULL);
 
     // Init the kernels.
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
+    uint windowSize = 3;
 
     switch(filter)
     {
         case NormalMapFilter_Sobel3x3:
-            kdu = new Kernel2(3);
+            windowSize = 3;
             break;
         case NormalMapFilter_Sobel5x5:
-            kdu = new Kernel2(5);
+            windowSize = 5;
             break;
         case NormalMapFilter_Sobel7x7:
-            kdu = new Kernel2(7);
+            windowSize = 7;
             break;
         case NormalMapFilter_Sobel9x9:
-            kdu = new Kernel2(9);
+            windowSize = 9;
             break;
         default:
             nvDebugCheck(false);
     };
 
-    kdu->initSobel();
-    kdu->normalize();
+    Kernel2 kdu(windowSize);
+    kdu.initSobel();
+    kdu.normalize();
 
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
+    Kernel2 kdv(kdu);
+    kdv.transpose();
 
     return ::createNormalMap(img, wm, heightWeights, kdu, kdv);
 }
@@ -162,15 +390,12 @@ FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vec
 {
     nvDebugCheck(img != NULL);
 
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
+    Kernel2 kdu(9);
+    kdu.initBlendedSobel(filterWeights);
+    kdu.normalize();
 
-    kdu = new Kernel2(9);
-    kdu->initBlendedSobel(filterWeights);
-    kdu->normalize();
-
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
+    Kernel2 kdv(kdu);
+    kdv.transpose();
 
     return ::createNormalMap(img, wm, heightWeights, kdu, kdv);
 }
@@ -180,15 +405,12 @@ FloatImage * nv::createNormalMap(const FloatImage * img, FloatImage::WrapMode wm
 {
     nvDebugCheck(img != NULL);
 
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
-
-    kdu = new Kernel2(9);
-    kdu->initBlendedSobel(filterWeights);
-    kdu->normalize();
+    Kernel2 kdu(9);
+    kdu.initBlendedSobel(filterWeights);
+    kdu.normalize();
 
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
+    Kernel2 kdv(kdu);
+    kdv.transpose();
 
     return ::createNormalMap(img, wm, kdu, kdv);
 }
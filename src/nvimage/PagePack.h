@@ -0,0 +1,92 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_PAGEPACK_H
+#define NV_IMAGE_PAGEPACK_H
+
+#include "nvimage.h"
+#include "DirectDrawSurface.h" // MAKEFOURCC
+
+namespace nv
+{
+    // Layout of the virtual texture page packs produced by nvtt::Compressor::processPages. A pack starts with a
+    // header, followed by a table of mipmap levels and the index of the pages. The compressed pages come after
+    // that, ordered by mipmap level, then in row major order. All values are little endian.
+
+    enum
+    {
+        FOURCC_NVVT = MAKEFOURCC('N', 'V', 'V', 'T'),
+        PagePackVersion = 1,
+    };
+
+    enum PagePackFlags
+    {
+        PagePackFlag_NormalMap = 0x1,
+        PagePackFlag_SRGB = 0x2,
+    };
+
+    struct PagePackHeader
+    {
+        uint32 fourcc;
+        uint32 version;
+        uint32 width;           // Extents of the top mipmap level.
+        uint32 height;
+        uint32 pageSize;        // Texels covered by a page, not including the borders.
+        uint32 borderSize;      // Texels added to each side of a page.
+        uint32 format;          // nvtt::Format of the pages.
+        uint32 flags;
+        uint32 mipmapCount;
+        uint32 pageCount;
+
+        void swapBytes()
+        {
+            fourcc = POSH_LittleU32(fourcc);
+            version = POSH_LittleU32(version);
+            width = POSH_LittleU32(width);
+            height = POSH_LittleU32(height);
+            pageSize = POSH_LittleU32(pageSize);
+            borderSize = POSH_LittleU32(borderSize);
+            format = POSH_LittleU32(format);
+            flags = POSH_LittleU32(flags);
+            mipmapCount = POSH_LittleU32(mipmapCount);
+            pageCount = POSH_LittleU32(pageCount);
+        }
+    };
+
+    struct PagePackLevel
+    {
+        uint32 width;
+        uint32 height;
+        uint32 pageCountX;
+        uint32 pageCountY;
+        uint32 firstPage;       // Index of the first page of the level.
+
+        void swapBytes()
+        {
+            width = POSH_LittleU32(width);
+            height = POSH_LittleU32(height);
+            pageCountX = POSH_LittleU32(pageCountX);
+            pageCountY = POSH_LittleU32(pageCountY);
+            firstPage = POSH_LittleU32(firstPage);
+        }
+    };
+
+    // Pages on the right and bottom edges of a level are clipped to the level extents, so the size of a page is
+    // min(pageSize, levelSize - pageOffset) + 2 * borderSize texels in each dimension.
+    struct PagePackEntry
+    {
+        uint64 offset;          // Offset of the page from the start of the pack.
+        uint32 size;            // Size of the compressed page in bytes.
+        uint32 reserved;
+
+        void swapBytes()
+        {
+            offset = POSH_LittleU64(offset);
+            size = POSH_LittleU32(size);
+            reserved = POSH_LittleU32(reserved);
+        }
+    };
+
+} // nv namespace
+
+#endif // NV_IMAGE_PAGEPACK_H
@@ -15,18 +15,85 @@ http://www.efg2.com/Lab/Library/ImageProcessing/DHALF.TXT
 #include "Quantize.h"
 #include "Image.h"
 #include "PixelFormat.h"
+#include "ErrorDiffusion.h"
 
 #include "nvmath/Color.h"
 #include "nvmath/Vector.inl"
 
-#include "nvcore/Utils.h" // swap
-
-#include <string.h> // memset
+#include "nvcore/Utils.h" // clamp
 
 
 using namespace nv;
 
 
+namespace
+{
+	inline uint8 & component(Color32 & c, uint i)
+	{
+		switch (i) {
+			case 0: return c.r;
+			case 1: return c.g;
+			case 2: return c.b;
+			default: return c.a;
+		}
+	}
+
+	// Reduces the channels of an image to the given number of bits.
+	struct BitQuantizer
+	{
+		BitQuantizer(Image * image, uint rsize, uint gsize, uint bsize, uint asize) : image(image)
+		{
+			size[0] = rsize; size[1] = gsize; size[2] = bsize; size[3] = asize;
+		}
+
+		float quantize(uint c, uint x, uint y, float error)
+		{
+			uint8 & p = component(image->pixel(x, y), c);
+
+			// Add error.
+			int v = clamp(int(p) + int(error), 0, 255);
+
+			// Convert to our desired size, and reconstruct.
+			int q = PixelFormat::convert(v, 8, size[c]);
+			q = PixelFormat::convert(q, size[c], 8);
+
+			// Store color.
+			p = uint8(q);
+
+			// Compute new error.
+			return float(v - q);
+		}
+
+		Image * image;
+		uint size[4];
+	};
+
+	// Quantizes the alpha channel of an image to 0 or 255.
+	struct BinaryAlphaQuantizer
+	{
+		BinaryAlphaQuantizer(Image * image, int threshold) : image(image), threshold(threshold) {}
+
+		float quantize(uint c, uint x, uint y, float error)
+		{
+			uint8 & p = image->pixel(x, y).a;
+
+			// Add error.
+			int alpha = int(p) + int(error);
+
+			// Convert color.
+			p = (alpha > threshold) ? 255 : 0;
+
+			// Compute new error.
+			return float(alpha - p);
+		}
+
+		Image * image;
+		int threshold;
+	};
+
+} // namespace
+
+
 // Simple quantization.
 void nv::Quantize::BinaryAlpha( Image * image, int alpha_threshold /*= 127*/ )
 {
@@ -75,47 +142,9 @@ void nv::Quantize::FloydSteinberg_RGB16( Image * image )
 void nv::Quantize::FloydSteinberg_BinaryAlpha( Image * image, int alpha_threshold /*= 127*/ ) 
 {
 	nvCheck(image != NULL);
-	
-	const uint w = image->width();
-	const uint h = image->height();
-	
-	// @@ Use fixed point?
-	float * row0 = new float[(w+2)];
-	float * row1 = new float[(w+2)];
-	memset(row0, 0, sizeof(float)*(w+2));
-	memset(row1, 0, sizeof(float)*(w+2));
-	
-	for (uint y = 0; y < h; y++) {
-		for (uint x = 0; x < w; x++) {
-			
-			Color32 pixel = image->pixel(x, y);
-			
-			// Add error.
-			int alpha = int(pixel.a) + int(row0[1+x]);
-			
-			// Convert color.
-			if (alpha > alpha_threshold) pixel.a = 255;
-			else pixel.a = 0;
-			
-			// Store color.
-			image->pixel(x, y) = pixel;
-			
-			// Compute new error.
-			float diff = float(alpha - pixel.a);
-			
-			// Propagate new error.
-			row0[1+x+1] += 7.0f / 16.0f * diff;
-			row1[1+x-1] += 3.0f / 16.0f * diff;
-			row1[1+x+0] += 5.0f / 16.0f * diff;
-			row1[1+x+1] += 1.0f / 16.0f * diff;
-		}
-		
-		swap(row0, row1);
-		memset(row1, 0, sizeof(float)*(w+2));
-	}
-	
-	delete [] row0;
-	delete [] row1;
+
+	BinaryAlphaQuantizer quantizer(image, alpha_threshold);
+	floydSteinberg(quantizer, image->width(), image->height(), 1);
 }
 
 
@@ -162,61 +191,7 @@ void nv::Quantize::Truncate(Image * image, uint rsize, uint gsize, uint bsize, u
 void nv::Quantize::FloydSteinberg(Image * image, uint rsize, uint gsize, uint bsize, uint asize)
 {
 	nvCheck(image != NULL);
-	
-	const uint w = image->width();
-	const uint h = image->height();
-	
-	Vector4 * row0 = new Vector4[w+2];
-	Vector4 * row1 = new Vector4[w+2];
-	memset(row0, 0, sizeof(Vector4)*(w+2));
-	memset(row1, 0, sizeof(Vector4)*(w+2));
-	
-	for (uint y = 0; y < h; y++) {
-		for (uint x = 0; x < w; x++) {
-			
-			Color32 pixel = image->pixel(x, y);
-
-			// Add error.
-			pixel.r = clamp(int(pixel.r) + int(row0[1+x].x), 0, 255);
-			pixel.g = clamp(int(pixel.g) + int(row0[1+x].y), 0, 255);
-			pixel.b = clamp(int(pixel.b) + int(row0[1+x].z), 0, 255);
-			pixel.a = clamp(int(pixel.a) + int(row0[1+x].w), 0, 255);
-			
-			int r = pixel.r;
-			int g = pixel.g;
-			int b = pixel.b;
-			int a = pixel.a;
-
-			// Convert to our desired size, and reconstruct.
-			r = PixelFormat::convert(r, 8, rsize);
-			r = PixelFormat::convert(r, rsize, 8);
-
-			g = PixelFormat::convert(g, 8, gsize);
-			g = PixelFormat::convert(g, gsize, 8);
 
-			b = PixelFormat::convert(b, 8, bsize);
-			b = PixelFormat::convert(b, bsize, 8);
-
-			a = PixelFormat::convert(a, 8, asize);
-			a = PixelFormat::convert(a, asize, 8);
-
-			// Store color.
-			image->pixel(x, y) = Color32(r, g, b, a);
-			
-			// Compute new error.
-			Vector4 diff(float(int(pixel.r) - r), float(int(pixel.g) - g), float(int(pixel.b) - b), float(int(pixel.a) - a));
-			
-			// Propagate new error.
-			row0[1+x+1] += 7.0f / 16.0f * diff;
-			row1[1+x-1] += 3.0f / 16.0f * diff;
-			row1[1+x+0] += 5.0f / 16.0f * diff;
-			row1[1+x+1] += 1.0f / 16.0f * diff;
-		}
-		
-		swap(row0, row1);
-		memset(row1, 0, sizeof(Vector4)*(w+2));
-	}
-	
-	delete [] row0;
-	delete [] row1;
+	BitQuantizer quantizer(image, rsize, gsize, bsize, asize);
+	floydSteinberg(quantizer, image->width(), image->height(), 4);
 }
@@ -0,0 +1,225 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#include "Reduction.h"
+
+#include "nvmath/SimdVector.h" // NV_USE_SSE
+
+#include "nvcore/Array.inl"
+
+using namespace nv;
+
+namespace
+{
+    // Range and sum of [begin, end). The sum of a chunk is accumulated in floats, chunks are added in doubles.
+    void rangeAndSum(const float * c, uint begin, uint end, float * minimumPtr, float * maximumPtr, double * sumPtr)
+    {
+        float minimum = NV_FLOAT_MAX;
+        float maximum = -NV_FLOAT_MAX;
+        float sum = 0.0f;
+
+        uint i = begin;
+
+#if NV_USE_SSE > 1
+        __m128 vmin = _mm_set1_ps(NV_FLOAT_MAX);
+        __m128 vmax = _mm_set1_ps(-NV_FLOAT_MAX);
+        __m128 vsum = _mm_setzero_ps();
+        for (; i + 4 <= end; i += 4) {
+            const __m128 v = _mm_loadu_ps(c + i);
+            // NaNs are ignored, like in the scalar comparisons below.
+            vmin = _mm_min_ps(v, vmin);
+            vmax = _mm_max_ps(v, vmax);
+            vsum = _mm_add_ps(vsum, v);
+        }
+
+        NV_ALIGN_16 float tmp[4];
+        _mm_store_ps(tmp, vmin);
+        minimum = nv::min(nv::min(tmp[0], tmp[1]), nv::min(tmp[2], tmp[3]));
+        _mm_store_ps(tmp, vmax);
+        maximum = nv::max(nv::max(tmp[0], tmp[1]), nv::max(tmp[2], tmp[3]));
+        _mm_store_ps(tmp, vsum);
+        sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#endif
+
+        for (; i < end; i++) {
+            const float f = c[i];
+            if (f < minimum) minimum = f;
+            if (f > maximum) maximum = f;
+            sum += f;
+        }
+
+        *minimumPtr = minimum;
+        *maximumPtr = maximum;
+        *sumPtr = sum;
+    }
+
+    void histogram(const float * c, uint begin, uint end, float scale, float bias, uint binCount, int * bins)
+    {
+        const int lastBin = int(binCount) - 1;
+
+        uint i = begin;
+
+#if NV_USE_SSE > 1
+        const __m128 vscale = _mm_set1_ps(scale);
+        const __m128 vbias = _mm_set1_ps(bias);
+        const __m128 vlast = _mm_set1_ps(float(lastBin));
+        const __m128 zero = _mm_setzero_ps();
+
+        NV_ALIGN_16 int idx[4];
+        for (; i + 4 <= end; i += 4) {
+            __m128 f = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c + i), vscale), vbias);
+            // Clamp before the conversion, truncation is the same as floor for positive values. NaNs go to the first bin.
+            f = _mm_min_ps(_mm_max_ps(f, zero), vlast);
+            _mm_store_si128((__m128i *)idx, _mm_cvttps_epi32(f));
+            bins[idx[0]]++;
+            bins[idx[1]]++;
+            bins[idx[2]]++;
+            bins[idx[3]]++;
+        }
+#endif
+
+        for (; i < end; i++) {
+            const float f = c[i] * scale + bias;
+            int idx = (f > 0.0f) ? int(nv::min(f, float(lastBin))) : 0;
+            bins[idx]++;
+        }
+    }
+
+    struct StatisticsReduction
+    {
+        StatisticsReduction(const float * const * channels, uint channelCount, uint count, float scale, float bias, uint binCount, bool computeHistogram) :
+            channels(channels), channelCount(channelCount), scale(scale), bias(bias), binCount(computeHistogram ? binCount : 0)
+        {
+            const uint chunkCount = reductionChunkCount(count);
+            partials.resize(chunkCount * channelCount);
+            if (computeHistogram) {
+                bins.resize(chunkCount * channelCount * binCount, 0);
+            }
+        }
+
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            for (uint c = 0; c < channelCount; c++) {
+                ChannelStatistics & s = partials[chunk * channelCount + c];
+                rangeAndSum(channels[c], begin, end, &s.minimum, &s.maximum, &s.sum);
+
+                if (binCount != 0) {
+                    histogram(channels[c], begin, end, scale, bias, binCount, bins.buffer() + (chunk * channelCount + c) * binCount);
+                }
+            }
+        }
+
+        const float * const * channels;
+        const uint channelCount;
+        const float scale;
+        const float bias;
+        const uint binCount;
+
+        Array<ChannelStatistics> partials;
+        Array<int> bins;
+    };
+
+    struct MaskedRangeReduction
+    {
+        MaskedRangeReduction(const float * channel, const float * alpha, float alphaRef, uint count) :
+            channel(channel), alpha(alpha), alphaRef(alphaRef)
+        {
+            minimum.resize(reductionChunkCount(count));
+            maximum.resize(reductionChunkCount(count));
+        }
+
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            float lo = NV_FLOAT_MAX;
+            float hi = -NV_FLOAT_MAX;
+
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 vref = _mm_set1_ps(alphaRef);
+            __m128 vlo = _mm_set1_ps(NV_FLOAT_MAX);
+            __m128 vhi = _mm_set1_ps(-NV_FLOAT_MAX);
+            for (; i + 4 <= end; i += 4) {
+                const __m128 v = _mm_loadu_ps(channel + i);
+                const __m128 mask = _mm_cmpgt_ps(_mm_loadu_ps(alpha + i), vref);
+                vlo = _mm_min_ps(_mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, vlo)), vlo);
+                vhi = _mm_max_ps(_mm_or_ps(_mm_and_ps(mask, v), _mm_andnot_ps(mask, vhi)), vhi);
+            }
+
+            NV_ALIGN_16 float tmp[4];
+            _mm_store_ps(tmp, vlo);
+            lo = nv::min(nv::min(tmp[0], tmp[1]), nv::min(tmp[2], tmp[3]));
+            _mm_store_ps(tmp, vhi);
+            hi = nv::max(nv::max(tmp[0], tmp[1]), nv::max(tmp[2], tmp[3]));
+#endif
+
+            for (; i < end; i++) {
+                if (alpha[i] > alphaRef) {
+                    const float f = channel[i];
+                    if (f < lo) lo = f;
+                    if (f > hi) hi = f;
+                }
+            }
+
+            minimum[chunk] = lo;
+            maximum[chunk] = hi;
+        }
+
+        const float * channel;
+        const float * alpha;
+        const float alphaRef;
+
+        Array<float> minimum;
+        Array<float> maximum;
+    };
+
+} // namespace
+
+
+void nv::channelStatistics(const float * const * channels, uint channelCount, uint count, ChannelStatistics * stats, float scale/*= 1.0f*/, float bias/*= 0.0f*/, uint binCount/*= 0*/, int * bins/*= NULL*/)
+{
+    const bool computeHistogram = (bins != NULL && binCount != 0);
+
+    StatisticsReduction reduction(channels, channelCount, count, scale, bias, binCount, computeHistogram);
+    parallelReduce(reduction, count);
+
+    const uint chunkCount = reductionChunkCount(count);
+
+    for (uint c = 0; c < channelCount; c++) {
+        stats[c].minimum = NV_FLOAT_MAX;
+        stats[c].maximum = -NV_FLOAT_MAX;
+        stats[c].sum = 0.0;
+
+        for (uint i = 0; i < chunkCount; i++) {
+            const ChannelStatistics & s = reduction.partials[i * channelCount + c];
+            if (s.minimum < stats[c].minimum) stats[c].minimum = s.minimum;
+            if (s.maximum > stats[c].maximum) stats[c].maximum = s.maximum;
+            stats[c].sum += s.sum;
+        }
+
+        if (computeHistogram) {
+            for (uint i = 0; i < chunkCount; i++) {
+                const int * src = reduction.bins.buffer() + (i * channelCount + c) * binCount;
+                int * dst = bins + c * binCount;
+                for (uint b = 0; b < binCount; b++) {
+                    dst[b] += src[b];
+                }
+            }
+        }
+    }
+}
+
+void nv::maskedRange(const float * channel, const float * alpha, float alphaRef, uint count, float * minimum, float * maximum)
+{
+    MaskedRangeReduction reduction(channel, alpha, alphaRef, count);
+    parallelReduce(reduction, count);
+
+    float lo = NV_FLOAT_MAX;
+    float hi = -NV_FLOAT_MAX;
+    for (uint i = 0; i < reduction.minimum.count(); i++) {
+        lo = nv::min(lo, reduction.minimum[i]);
+        hi = nv::max(hi, reduction.maximum[i]);
+    }
+
+    *minimum = lo;
+    *maximum = hi;
+}
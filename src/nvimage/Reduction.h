@@ -0,0 +1,110 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_REDUCTION_H
+#define NV_IMAGE_REDUCTION_H
+
+#include "nvimage.h"
+
+#include "nvthread/ParallelFor.h"
+
+#include "nvcore/Utils.h" // min, max
+
+namespace nv
+{
+    /// Parallel reduction of the range [0, count).
+    ///
+    /// The range is split in chunks that are processed in parallel. The reduction is called as:
+    ///
+    ///     void reduce(uint chunk, uint begin, uint end);
+    ///
+    /// It should store a partial result for each chunk, and combine the partial results in chunk order once
+    /// parallelReduce returns. The chunks only depend on the count, so the results don't depend on the number of
+    /// threads. Use reductionChunkCount to know how many partial results are needed.
+    template <class Reduction>
+    void parallelReduce(Reduction & reduction, uint count, uint minChunkSize = 16 * 1024);
+
+    /// Number of chunks in which parallelReduce splits the given range.
+    uint reductionChunkCount(uint count, uint minChunkSize = 16 * 1024);
+
+
+    /// Statistics of a channel.
+    struct ChannelStatistics
+    {
+        float minimum;      // NV_FLOAT_MAX and -NV_FLOAT_MAX when the channel is empty.
+        float maximum;
+        double sum;
+    };
+
+    /// Compute the statistics of several channels of count floats in a single parallel pass.
+    /// When bins is not NULL, it holds binCount bins for each channel, and the bin floor(value * scale + bias),
+    /// clamped to the valid range, is incremented for each value.
+    NVIMAGE_API void channelStatistics(const float * const * channels, uint channelCount, uint count, ChannelStatistics * stats, float scale = 1.0f, float bias = 0.0f, uint binCount = 0, int * bins = NULL);
+
+    /// Range of the values of a channel whose alpha is greater than alphaRef.
+    NVIMAGE_API void maskedRange(const float * channel, const float * alpha, float alphaRef, uint count, float * minimum, float * maximum);
+
+
+    namespace Reduction
+    {
+        // Partial results are combined on a single thread, so don't create too many of them.
+        const uint MaxChunkCount = 64;
+
+        template <class R>
+        struct Context
+        {
+            R * reduction;
+            uint count;
+            uint chunkSize;
+        };
+
+        template <class R>
+        void chunkTask(void * data, int i)
+        {
+            Context<R> * ctx = (Context<R> *)data;
+            const uint begin = i * ctx->chunkSize;
+            const uint end = min(begin + ctx->chunkSize, ctx->count);
+            ctx->reduction->reduce(i, begin, end);
+        }
+
+        inline uint chunkSize(uint count, uint minChunkSize)
+        {
+            uint size = max((count + MaxChunkCount - 1) / MaxChunkCount, minChunkSize);
+
+            // Multiple of the SIMD width, so that only the last chunk has a remainder.
+            return (size + 3) & ~3U;
+        }
+
+    } // Reduction namespace
+
+
+    inline uint reductionChunkCount(uint count, uint minChunkSize/*= 16 * 1024*/)
+    {
+        if (count == 0) return 1;
+        const uint size = Reduction::chunkSize(count, minChunkSize);
+        return (count + size - 1) / size;
+    }
+
+    template <class R>
+    void parallelReduce(R & reduction, uint count, uint minChunkSize/*= 16 * 1024*/)
+    {
+        const uint chunkCount = reductionChunkCount(count, minChunkSize);
+
+        // Small ranges are not worth waking up the thread pool.
+        if (chunkCount == 1) {
+            reduction.reduce(0, 0, count);
+            return;
+        }
+
+        Reduction::Context<R> context;
+        context.reduction = &reduction;
+        context.count = count;
+        context.chunkSize = Reduction::chunkSize(count, minChunkSize);
+
+        ParallelFor parallelFor(Reduction::chunkTask<R>, &context);
+        parallelFor.run(chunkCount);
+    }
+
+} // nv namespace
+
+#endif // NV_IMAGE_REDUCTION_H
@@ -0,0 +1,411 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#include "RowSource.h"
+#include "Filter.h"
+
+#include "nvcore/Utils.h" // max
+
+#include <math.h>
+#include <string.h> // memcpy, memset
+
+
+using namespace nv;
+
+
+RowCache::RowCache(uint size) : m_size(size), m_next(0)
+{
+    nvDebugCheck(size > 0);
+
+    m_rows = new FloatImage[size];
+    m_index = new uint[size];
+    m_stamp = new uint[size];
+
+    for (uint i = 0; i < size; i++) {
+        m_index[i] = ~0U;
+        m_stamp[i] = 0;
+    }
+}
+
+RowCache::~RowCache()
+{
+    delete [] m_rows;
+    delete [] m_index;
+    delete [] m_stamp;
+}
+
+const FloatImage * RowCache::find(uint y)
+{
+    for (uint i = 0; i < m_size; i++) {
+        if (m_index[i] == y) {
+            m_stamp[i] = ++m_next;
+            return m_rows + i;
+        }
+    }
+    return NULL;
+}
+
+FloatImage * RowCache::insert(uint y)
+{
+    // Evict the least recently used row, so that the rows used by the current request are preserved.
+    uint oldest = 0;
+    for (uint i = 1; i < m_size; i++) {
+        if (m_stamp[i] < m_stamp[oldest]) oldest = i;
+    }
+
+    m_index[oldest] = y;
+    m_stamp[oldest] = ++m_next;
+
+    return m_rows + oldest;
+}
+
+void RowCache::remove(uint y)
+{
+    for (uint i = 0; i < m_size; i++) {
+        if (m_index[i] == y) {
+            m_index[i] = ~0U;
+            m_stamp[i] = 0;
+        }
+    }
+}
+
+const FloatImage * RowCache::read(RowSource * source, uint y)
+{
+    const FloatImage * row = find(y);
+
+    if (row == NULL) {
+        FloatImage * newRow = insert(y);
+        if (!source->readRows(y, 1, newRow)) {
+            remove(y);
+            return NULL;
+        }
+        row = newRow;
+    }
+
+    return row;
+}
+
+
+FloatImageRowSource::FloatImageRowSource(const FloatImage * img) :
+    RowSource(img->width(), img->height(), img->componentCount()), m_image(img)
+{
+    nvDebugCheck(img->depth() == 1);
+}
+
+bool FloatImageRowSource::readRows(uint y, uint count, FloatImage * rows)
+{
+    if (y + count > m_height) return false;
+
+    rows->allocate(m_componentCount, m_width, count);
+
+    for (uint c = 0; c < m_componentCount; c++) {
+        memcpy(rows->channel(c), m_image->scanline(c, y, 0), m_width * count * sizeof(float));
+    }
+
+    return true;
+}
+
+
+DownSampledRowSource::DownSampledRowSource(RowSource * source) :
+    RowSource(max(1U, source->width() / 2), max(1U, source->height() / 2), source->componentCount()),
+    m_source(source), m_cache(3)
+{
+    nvCheck(source->width() != 1 || source->height() != 1);
+}
+
+bool DownSampledRowSource::readRows(uint y, uint count, FloatImage * rows)
+{
+    if (y + count > m_height) return false;
+
+    rows->allocate(m_componentCount, m_width, count);
+
+    float * dst[4];
+    nvDebugCheck(m_componentCount <= 4);
+
+    for (uint i = 0; i < count; i++) {
+        for (uint c = 0; c < m_componentCount; c++) {
+            dst[c] = rows->scanline(c, i, 0);
+        }
+
+        if (!downSampleRow(y + i, dst)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Same filters as FloatImage::fastDownSample, evaluated one row at a time.
+bool DownSampledRowSource::downSampleRow(uint y, float * const * dst)
+{
+    const uint src_w = m_source->width();
+    const uint src_h = m_source->height();
+    const uint w = m_width;
+    const uint h = m_height;
+
+    // 1D box filter.
+    if (src_h == 1)
+    {
+        const FloatImage * row = m_cache.read(m_source, 0);
+        if (row == NULL) return false;
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            const float * src = row->channel(c);
+
+            if (src_w & 1)
+            {
+                const float scale = 1.0f / (2 * w + 1);
+
+                for (uint x = 0; x < w; x++)
+                {
+                    const float w0 = float(w - x);
+                    const float w1 = float(w - 0);
+                    const float w2 = float(1 + x);
+
+                    dst[c][x] = scale * (w0 * src[2 * x] + w1 * src[2 * x + 1] + w2 * src[2 * x + 2]);
+                }
+            }
+            else
+            {
+                for (uint x = 0; x < w; x++)
+                {
+                    dst[c][x] = 0.5f * (src[2 * x] + src[2 * x + 1]);
+                }
+            }
+        }
+    }
+    else if (src_w == 1)
+    {
+        const FloatImage * row0 = m_cache.read(m_source, 2 * y + 0);
+        const FloatImage * row1 = m_cache.read(m_source, 2 * y + 1);
+        const FloatImage * row2 = (src_h & 1) ? m_cache.read(m_source, 2 * y + 2) : row1;
+        if (row0 == NULL || row1 == NULL || row2 == NULL) return false;
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            if (src_h & 1)
+            {
+                const float scale = 1.0f / (2 * h + 1);
+
+                const float w0 = float(h - y);
+                const float w1 = float(h - 0);
+                const float w2 = float(1 + y);
+
+                dst[c][0] = scale * (w0 * row0->channel(c)[0] + w1 * row1->channel(c)[0] + w2 * row2->channel(c)[0]);
+            }
+            else
+            {
+                dst[c][0] = 0.5f * (row0->channel(c)[0] + row1->channel(c)[0]);
+            }
+        }
+    }
+
+    // Regular box filter.
+    else if ((src_w & 1) == 0 && (src_h & 1) == 0)
+    {
+        const FloatImage * row0 = m_cache.read(m_source, 2 * y + 0);
+        const FloatImage * row1 = m_cache.read(m_source, 2 * y + 1);
+        if (row0 == NULL || row1 == NULL) return false;
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            const float * src0 = row0->channel(c);
+            const float * src1 = row1->channel(c);
+
+            for (uint x = 0; x < w; x++)
+            {
+                dst[c][x] = 0.25f * (src0[2 * x] + src0[2 * x + 1] + src1[2 * x] + src1[2 * x + 1]);
+            }
+        }
+    }
+
+    // Polyphase filters.
+    else if (src_w & 1 && src_h & 1)
+    {
+        const FloatImage * row0 = m_cache.read(m_source, 2 * y + 0);
+        const FloatImage * row1 = m_cache.read(m_source, 2 * y + 1);
+        const FloatImage * row2 = m_cache.read(m_source, 2 * y + 2);
+        if (row0 == NULL || row1 == NULL || row2 == NULL) return false;
+
+        // Same as 1.0f / (src_w * src_h), but without overflowing on very large images.
+        const float scale = 1.0f / (float(src_w) * float(src_h));
+
+        const float v0 = float(h - y);
+        const float v1 = float(h - 0);
+        const float v2 = float(1 + y);
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            const float * src0 = row0->channel(c);
+            const float * src1 = row1->channel(c);
+            const float * src2 = row2->channel(c);
+
+            for (uint x = 0; x < w; x++)
+            {
+                const float w0 = float(w - x);
+                const float w1 = float(w - 0);
+                const float w2 = float(1 + x);
+
+                float f = 0.0f;
+                f += v0 * (w0 * src0[2 * x] + w1 * src0[2 * x + 1] + w2 * src0[2 * x + 2]);
+                f += v1 * (w0 * src1[2 * x] + w1 * src1[2 * x + 1] + w2 * src1[2 * x + 2]);
+                f += v2 * (w0 * src2[2 * x] + w1 * src2[2 * x + 1] + w2 * src2[2 * x + 2]);
+
+                dst[c][x] = f * scale;
+            }
+        }
+    }
+    else if (src_w & 1)
+    {
+        const FloatImage * row0 = m_cache.read(m_source, 2 * y + 0);
+        const FloatImage * row1 = m_cache.read(m_source, 2 * y + 1);
+        if (row0 == NULL || row1 == NULL) return false;
+
+        const float scale = 1.0f / (2 * src_w);
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            const float * src0 = row0->channel(c);
+            const float * src1 = row1->channel(c);
+
+            for (uint x = 0; x < w; x++)
+            {
+                const float w0 = float(w - x);
+                const float w1 = float(w - 0);
+                const float w2 = float(1 + x);
+
+                float f = 0.0f;
+                f += w0 * (src0[2 * x + 0] + src1[2 * x + 0]);
+                f += w1 * (src0[2 * x + 1] + src1[2 * x + 1]);
+                f += w2 * (src0[2 * x + 2] + src1[2 * x + 2]);
+
+                dst[c][x] = f * scale;
+            }
+        }
+    }
+    else // if (src_h & 1)
+    {
+        const FloatImage * row0 = m_cache.read(m_source, 2 * y + 0);
+        const FloatImage * row1 = m_cache.read(m_source, 2 * y + 1);
+        const FloatImage * row2 = m_cache.read(m_source, 2 * y + 2);
+        if (row0 == NULL || row1 == NULL || row2 == NULL) return false;
+
+        const float scale = 1.0f / (2 * src_h);
+
+        const float v0 = float(h - y);
+        const float v1 = float(h - 0);
+        const float v2 = float(1 + y);
+
+        for (uint c = 0; c < m_componentCount; c++)
+        {
+            const float * src0 = row0->channel(c);
+            const float * src1 = row1->channel(c);
+            const float * src2 = row2->channel(c);
+
+            for (uint x = 0; x < w; x++)
+            {
+                float f = 0.0f;
+                f += v0 * (src0[2 * x] + src0[2 * x + 1]);
+                f += v1 * (src1[2 * x] + src1[2 * x + 1]);
+                f += v2 * (src2[2 * x] + src2[2 * x + 1]);
+
+                dst[c][x] = f * scale;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+ResampledRowSource::ResampledRowSource(RowSource * source, const Filter & filter, uint w, uint h, FloatImage::WrapMode wm) :
+    RowSource(w, h, source->componentCount()), m_source(source), m_wrapMode(wm)
+{
+    m_xkernel = new PolyphaseKernel(filter, source->width(), w, 32);
+    m_ykernel = new PolyphaseKernel(filter, source->height(), h, 32);
+
+    // Keep the rows of one window, consecutive rows share most of them.
+    m_cache = new RowCache(m_ykernel->windowSize() + 1);
+}
+
+ResampledRowSource::~ResampledRowSource()
+{
+    delete m_xkernel;
+    delete m_ykernel;
+    delete m_cache;
+}
+
+// Get the horizontally filtered source row at the given coordinate.
+const FloatImage * ResampledRowSource::filteredRow(int y)
+{
+    const int src_h = m_source->height();
+
+    uint sy;
+    if (m_wrapMode == FloatImage::WrapMode_Clamp) sy = wrapClamp(y, src_h);
+    else if (m_wrapMode == FloatImage::WrapMode_Repeat) sy = wrapRepeat(y, src_h);
+    else sy = wrapMirror(y, src_h);
+
+    const FloatImage * row = m_cache->find(sy);
+    if (row != NULL) {
+        return row;
+    }
+
+    if (!m_source->readRows(sy, 1, &m_sourceRow)) {
+        return NULL;
+    }
+
+    FloatImage * filtered = m_cache->insert(sy);
+    filtered->allocate(m_componentCount, m_width, 1);
+
+    for (uint c = 0; c < m_componentCount; c++) {
+        m_sourceRow.applyKernelX(*m_xkernel, 0, 0, c, m_wrapMode, filtered->channel(c));
+    }
+
+    return filtered;
+}
+
+// Same as the vertical pass of FloatImage::resize, accumulating one source row at a time.
+bool ResampledRowSource::readRows(uint y, uint count, FloatImage * rows)
+{
+    if (y + count > m_height) return false;
+
+    rows->allocate(m_componentCount, m_width, count);
+
+    const float scale = float(m_height) / float(m_source->height());
+    const float iscale = 1.0f / scale;
+
+    const float width = m_ykernel->width();
+    const int windowSize = m_ykernel->windowSize();
+
+    for (uint i = 0; i < count; i++)
+    {
+        const uint dy = y + i;
+
+        const float center = (0.5f + dy) * iscale;
+        const int left = (int)floorf(center - width);
+
+        for (uint c = 0; c < m_componentCount; c++) {
+            memset(rows->scanline(c, i, 0), 0, m_width * sizeof(float));
+        }
+
+        for (int j = 0; j < windowSize; j++)
+        {
+            const FloatImage * row = filteredRow(left + j);
+            if (row == NULL) return false;
+
+            const float weight = m_ykernel->valueAt(dy, j);
+
+            for (uint c = 0; c < m_componentCount; c++)
+            {
+                const float * src = row->channel(c);
+                float * dst = rows->scanline(c, i, 0);
+
+                for (uint x = 0; x < m_width; x++) {
+                    dst[x] += weight * src[x];
+                }
+            }
+        }
+    }
+
+    return true;
+}
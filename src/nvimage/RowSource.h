@@ -0,0 +1,117 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_ROWSOURCE_H
+#define NV_IMAGE_ROWSOURCE_H
+
+#include "nvimage.h"
+#include "FloatImage.h"
+
+namespace nv
+{
+    class Filter;
+    class PolyphaseKernel;
+
+    /// Source of image rows. Used to process images that are too large to be held in memory:
+    /// sources are chained and pull rows from each other, so only a few rows of each one are
+    /// kept in memory at any time. Rows are usually requested from top to bottom, but random
+    /// access has to be supported to implement the wrap modes.
+    class NVIMAGE_CLASS RowSource
+    {
+    public:
+        RowSource(uint w, uint h, uint c) : m_width(w), m_height(h), m_componentCount(c) {}
+        virtual ~RowSource() {}
+
+        uint width() const { return m_width; }
+        uint height() const { return m_height; }
+        uint componentCount() const { return m_componentCount; }
+
+        /// Read rows [y, y + count) into the given image. The image is reallocated to width() x count pixels.
+        virtual bool readRows(uint y, uint count, FloatImage * rows) = 0;
+
+    protected:
+        const uint m_width;
+        const uint m_height;
+        const uint m_componentCount;
+    };
+
+
+    /// Cache of the most recently used rows of a source.
+    class RowCache
+    {
+        NV_FORBID_COPY(RowCache);
+    public:
+        RowCache(uint size);
+        ~RowCache();
+
+        /// Get the given row, or NULL if it's not in the cache.
+        const FloatImage * find(uint y);
+
+        /// Get a row to store the given row index, evicting the least recently used one.
+        FloatImage * insert(uint y);
+        void remove(uint y);
+
+        /// Get the given row, reading it from the source when it's not in the cache.
+        const FloatImage * read(RowSource * source, uint y);
+
+    private:
+        const uint m_size;
+        FloatImage * m_rows;
+        uint * m_index;
+        uint * m_stamp;
+        uint m_next;
+    };
+
+
+    /// Rows of an image held in memory.
+    class NVIMAGE_CLASS FloatImageRowSource : public RowSource
+    {
+    public:
+        FloatImageRowSource(const FloatImage * img);
+
+        virtual bool readRows(uint y, uint count, FloatImage * rows);
+
+    private:
+        const FloatImage * m_image;
+    };
+
+
+    /// Box filtered half size version of another source. Produces the same results as FloatImage::fastDownSample.
+    class NVIMAGE_CLASS DownSampledRowSource : public RowSource
+    {
+    public:
+        DownSampledRowSource(RowSource * source);
+
+        virtual bool readRows(uint y, uint count, FloatImage * rows);
+
+    private:
+        bool downSampleRow(uint y, float * const * dst);
+
+        RowSource * m_source;
+        RowCache m_cache;
+    };
+
+
+    /// Resized version of another source. Produces the same results as FloatImage::resize.
+    class NVIMAGE_CLASS ResampledRowSource : public RowSource
+    {
+    public:
+        ResampledRowSource(RowSource * source, const Filter & filter, uint w, uint h, FloatImage::WrapMode wm);
+        ~ResampledRowSource();
+
+        virtual bool readRows(uint y, uint count, FloatImage * rows);
+
+    private:
+        const FloatImage * filteredRow(int y);
+
+        RowSource * m_source;
+        FloatImage::WrapMode m_wrapMode;
+        PolyphaseKernel * m_xkernel;
+        PolyphaseKernel * m_ykernel;
+        FloatImage m_sourceRow;
+        RowCache * m_cache;     // Horizontally filtered source rows.
+    };
+
+} // nv namespace
+
+#endif // NV_IMAGE_ROWSOURCE_H
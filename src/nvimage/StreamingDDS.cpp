@@ -0,0 +1,157 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#include "StreamingDDS.h"
+
+#include "nvcore/Debug.h"
+#include "nvcore/StdStream.h"
+#include "nvcore/MemoryMappedFile.h"
+#include "nvcore/Array.inl"
+
+#include <string.h> // memcpy
+
+using namespace nv;
+
+
+StreamingDDSFile::StreamingDDSFile() : m_stream(NULL), m_file(NULL)
+{
+    m_header.fourcc = 0;
+}
+
+StreamingDDSFile::~StreamingDDSFile()
+{
+    delete m_stream;
+    delete m_file;
+}
+
+bool StreamingDDSFile::load(const char * fileName)
+{
+    delete m_stream;
+    m_stream = NULL;
+    delete m_file;
+    m_file = new MemoryMappedFile;
+
+    if (!m_file->open(fileName) || !readIndex()) {
+        delete m_file;
+        m_file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool StreamingDDSFile::load(Stream * stream)
+{
+    delete m_file;
+    m_file = NULL;
+    delete m_stream;
+    m_stream = stream;
+
+    if (stream->isError() || !readIndex()) {
+        delete m_stream;
+        m_stream = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool StreamingDDSFile::isValid() const
+{
+    return (m_file != NULL || m_stream != NULL) && m_header.fourcc == FOURCC_NVSD;
+}
+
+uint StreamingDDSFile::faceCount() const
+{
+    nvDebugCheck(isValid());
+    return m_header.faceCount;
+}
+
+uint StreamingDDSFile::mipmapCount() const
+{
+    nvDebugCheck(isValid());
+    return m_header.mipmapCount;
+}
+
+uint64 StreamingDDSFile::surfaceOffset(uint face, uint mipmap) const
+{
+    nvDebugCheck(face < m_header.faceCount && mipmap < m_header.mipmapCount);
+    return m_index[mipmap * m_header.faceCount + face].offset;
+}
+
+uint StreamingDDSFile::surfaceSize(uint face, uint mipmap) const
+{
+    nvDebugCheck(face < m_header.faceCount && mipmap < m_header.mipmapCount);
+    return m_index[mipmap * m_header.faceCount + face].size;
+}
+
+bool StreamingDDSFile::readSurface(uint face, uint mipmap, void * data, uint size)
+{
+    if (size != surfaceSize(face, mipmap)) return false;
+
+    return read(surfaceOffset(face, mipmap), data, size);
+}
+
+uint64 StreamingDDSFile::tailSize(uint mipmap) const
+{
+    nvDebugCheck(mipmap < m_header.mipmapCount);
+
+    // The first face of the mipmap is the last surface of the tail.
+    const StreamingDDSEntry & last = m_index[mipmap * m_header.faceCount + m_header.faceCount - 1];
+    return last.offset + last.size - m_header.dataOffset;
+}
+
+bool StreamingDDSFile::readTail(uint mipmap, void * data, uint64 size)
+{
+    if (size != tailSize(mipmap)) return false;
+
+    return read(m_header.dataOffset, data, size);
+}
+
+bool StreamingDDSFile::readIndex()
+{
+    m_header.fourcc = 0;
+
+    StreamingDDSHeader header;
+    if (!read(0, &header, sizeof(header))) return false;
+    header.swapBytes();
+
+    if (header.fourcc != FOURCC_NVSD || header.version != StreamingDDSVersion) return false;
+    if (header.faceCount == 0 || header.faceCount > 6 || header.mipmapCount == 0 || header.mipmapCount > 32) return false;
+    if (header.ddsHeaderSize < 128 || header.ddsHeaderSize > sizeof(DDSHeader)) return false;
+
+    const uint entryCount = header.faceCount * header.mipmapCount;
+    const uint indexOffset = sizeof(header) + header.ddsHeaderSize;
+    if (header.dataOffset != indexOffset + entryCount * sizeof(StreamingDDSEntry)) return false;
+
+    // DDS header and index in a single read.
+    Array<uint8> buffer;
+    buffer.resize(header.dataOffset - sizeof(header));
+    if (!read(sizeof(header), buffer.buffer(), buffer.size())) return false;
+
+    MemoryInputStream headerStream(buffer.buffer(), header.ddsHeaderSize);
+    headerStream << this->header;
+    if (headerStream.isError() || this->header.fourcc != FOURCC_DDS) return false;
+
+    m_index.resize(entryCount);
+    memcpy(m_index.buffer(), buffer.buffer() + header.ddsHeaderSize, entryCount * sizeof(StreamingDDSEntry));
+    for (uint i = 0; i < entryCount; i++) {
+        m_index[i].swapBytes();
+    }
+
+    m_header = header;
+    return true;
+}
+
+bool StreamingDDSFile::read(uint64 offset, void * data, uint64 size)
+{
+    if (m_file != NULL) {
+        return m_file->read(offset, data, size) == size;
+    }
+
+    nvDebugCheck(m_stream != NULL);
+
+    m_stream->seek(offset);
+    if (m_stream->isError()) return false;
+
+    return m_stream->serialize(data, size) == size;
+}
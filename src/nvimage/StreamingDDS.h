@@ -0,0 +1,106 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_STREAMINGDDS_H
+#define NV_IMAGE_STREAMINGDDS_H
+
+#include "nvimage.h"
+#include "DirectDrawSurface.h" // DDSHeader, MAKEFOURCC
+
+#include "nvcore/Array.h"
+
+namespace nv
+{
+    class Stream;
+    class MemoryMappedFile;
+
+    // Layout of the streaming DDS files produced with nvtt::OutputOptions::setStreamingLayout. The file starts with
+    // a header, followed by a regular DDS header that describes the texture and the index of the surfaces. The
+    // surfaces come after that, ordered from the smallest mipmap to the largest one, and by face within each mipmap,
+    // so the low resolution tail of the texture can be loaded with a single read. All values are little endian.
+
+    enum
+    {
+        FOURCC_NVSD = MAKEFOURCC('N', 'V', 'S', 'D'),
+        StreamingDDSVersion = 1,
+    };
+
+    struct StreamingDDSHeader
+    {
+        uint32 fourcc;
+        uint32 version;
+        uint32 faceCount;
+        uint32 mipmapCount;
+        uint32 ddsHeaderSize;   // Size of the DDS header, including the DDS magic and the DX10 header when present.
+        uint32 dataOffset;      // Offset of the first surface from the start of the file.
+
+        void swapBytes()
+        {
+            fourcc = POSH_LittleU32(fourcc);
+            version = POSH_LittleU32(version);
+            faceCount = POSH_LittleU32(faceCount);
+            mipmapCount = POSH_LittleU32(mipmapCount);
+            ddsHeaderSize = POSH_LittleU32(ddsHeaderSize);
+            dataOffset = POSH_LittleU32(dataOffset);
+        }
+    };
+
+    // The index has one entry per surface, entry mipmap * faceCount + face.
+    struct StreamingDDSEntry
+    {
+        uint64 offset;          // Offset of the surface from the start of the file.
+        uint32 size;            // Size of the surface in bytes.
+        uint32 reserved;
+
+        void swapBytes()
+        {
+            offset = POSH_LittleU64(offset);
+            size = POSH_LittleU32(size);
+            reserved = POSH_LittleU32(reserved);
+        }
+    };
+
+
+    // Reads the index of a streaming DDS file and the surfaces on demand.
+    class NVIMAGE_CLASS StreamingDDSFile
+    {
+        NV_FORBID_COPY(StreamingDDSFile);
+    public:
+        StreamingDDSFile();
+        ~StreamingDDSFile();
+
+        // Only the headers and the index are read.
+        bool load(const char * fileName);
+        bool load(Stream * stream);
+
+        bool isValid() const;
+
+        uint faceCount() const;
+        uint mipmapCount() const;
+
+        uint64 surfaceOffset(uint face, uint mipmap) const;
+        uint surfaceSize(uint face, uint mipmap) const;
+        bool readSurface(uint face, uint mipmap, void * data, uint size);
+
+        // Size of the surfaces of mipmaps [mipmap, mipmapCount), that are stored together at the start of the data.
+        uint64 tailSize(uint mipmap) const;
+        bool readTail(uint mipmap, void * data, uint64 size);
+
+        // Only initialized after loading.
+        DDSHeader header;
+
+    private:
+
+        bool readIndex();
+        bool read(uint64 offset, void * data, uint64 size);
+
+        StreamingDDSHeader m_header;
+        Array<StreamingDDSEntry> m_index;
+
+        Stream * m_stream;          // When loaded from a stream.
+        MemoryMappedFile * m_file;  // When loaded from a file.
+    };
+
+} // nv namespace
+
+#endif // NV_IMAGE_STREAMINGDDS_H
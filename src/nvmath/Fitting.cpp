@@ -4,6 +4,8 @@
 #include "Vector.inl"
 #include "Plane.inl"
 
+#include "SimdVector.h" // NV_USE_SSE
+
 #include "nvcore/Utils.h" // max, swap
 
 #include <float.h> // FLT_MAX
@@ -153,6 +155,192 @@ Vector3 nv::Fit::computePrincipalComponent(int n, const Vector3 *__restrict poin
 }
 
 
+// Batched fits. The SIMD path processes 4 point sets at once, with exactly the same operations as the scalar code
+// above, so the results are identical to fitting each set on its own. Note that dividing a Vector3 by a scalar
+// computes the reciprocal and multiplies by it, so the SIMD code does the same instead of dividing each component.
+
+static void computeCovarianceLane(int count, int n, const float *__restrict points, const float *__restrict weights, Vector3::Arg metric, int s, float *__restrict centroids, float *__restrict covariances)
+{
+    Vector3 centroid(0.0f);
+    float total = 0.0f;
+
+    for (int i = 0; i < n; i++)
+    {
+        const float w = weights[i * count + s];
+        const Vector3 p(points[(3 * i + 0) * count + s], points[(3 * i + 1) * count + s], points[(3 * i + 2) * count + s]);
+        total += w;
+        centroid += w * p;
+    }
+    centroid /= total;
+
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < n; i++)
+    {
+        const Vector3 p(points[(3 * i + 0) * count + s], points[(3 * i + 1) * count + s], points[(3 * i + 2) * count + s]);
+        Vector3 a = (p - centroid) * metric;
+        Vector3 b = weights[i * count + s] * a;
+
+        covariance[0] += a.x * b.x;
+        covariance[1] += a.x * b.y;
+        covariance[2] += a.x * b.z;
+        covariance[3] += a.y * b.y;
+        covariance[4] += a.y * b.z;
+        covariance[5] += a.z * b.z;
+    }
+
+    for (int c = 0; c < 3; c++) centroids[c * count + s] = centroid.component[c];
+    for (int k = 0; k < 6; k++) covariances[k * count + s] = covariance[k];
+}
+
+void nv::Fit::computeCovariances(int count, int n, const float *__restrict points, const float *__restrict weights, Vector3::Arg metric, float *__restrict centroids, float *__restrict covariances)
+{
+    int s = 0;
+
+#if NV_USE_SSE > 1
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 mx = _mm_set1_ps(metric.x);
+    const __m128 my = _mm_set1_ps(metric.y);
+    const __m128 mz = _mm_set1_ps(metric.z);
+
+    for (; s + 4 <= count; s += 4)
+    {
+        __m128 cx = _mm_setzero_ps();
+        __m128 cy = _mm_setzero_ps();
+        __m128 cz = _mm_setzero_ps();
+        __m128 total = _mm_setzero_ps();
+
+        for (int i = 0; i < n; i++)
+        {
+            const __m128 w = _mm_loadu_ps(weights + i * count + s);
+            total = _mm_add_ps(total, w);
+            cx = _mm_add_ps(cx, _mm_mul_ps(_mm_loadu_ps(points + (3 * i + 0) * count + s), w));
+            cy = _mm_add_ps(cy, _mm_mul_ps(_mm_loadu_ps(points + (3 * i + 1) * count + s), w));
+            cz = _mm_add_ps(cz, _mm_mul_ps(_mm_loadu_ps(points + (3 * i + 2) * count + s), w));
+        }
+
+        // centroid /= total
+        const __m128 itotal = _mm_div_ps(one, total);
+        cx = _mm_mul_ps(cx, itotal);
+        cy = _mm_mul_ps(cy, itotal);
+        cz = _mm_mul_ps(cz, itotal);
+
+        __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps();
+        __m128 c3 = _mm_setzero_ps(), c4 = _mm_setzero_ps(), c5 = _mm_setzero_ps();
+
+        for (int i = 0; i < n; i++)
+        {
+            const __m128 w = _mm_loadu_ps(weights + i * count + s);
+            const __m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(points + (3 * i + 0) * count + s), cx), mx);
+            const __m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(points + (3 * i + 1) * count + s), cy), my);
+            const __m128 az = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(points + (3 * i + 2) * count + s), cz), mz);
+            const __m128 bx = _mm_mul_ps(ax, w);
+            const __m128 by = _mm_mul_ps(ay, w);
+            const __m128 bz = _mm_mul_ps(az, w);
+
+            c0 = _mm_add_ps(c0, _mm_mul_ps(ax, bx));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(ax, by));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(ax, bz));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(ay, by));
+            c4 = _mm_add_ps(c4, _mm_mul_ps(ay, bz));
+            c5 = _mm_add_ps(c5, _mm_mul_ps(az, bz));
+        }
+
+        _mm_storeu_ps(centroids + 0 * count + s, cx);
+        _mm_storeu_ps(centroids + 1 * count + s, cy);
+        _mm_storeu_ps(centroids + 2 * count + s, cz);
+
+        _mm_storeu_ps(covariances + 0 * count + s, c0);
+        _mm_storeu_ps(covariances + 1 * count + s, c1);
+        _mm_storeu_ps(covariances + 2 * count + s, c2);
+        _mm_storeu_ps(covariances + 3 * count + s, c3);
+        _mm_storeu_ps(covariances + 4 * count + s, c4);
+        _mm_storeu_ps(covariances + 5 * count + s, c5);
+    }
+#endif
+
+    for (; s < count; s++)
+    {
+        computeCovarianceLane(count, n, points, weights, metric, s, centroids, covariances);
+    }
+}
+
+#if NV_USE_SSE > 1
+static inline __m128 blend(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+void nv::Fit::computePrincipalComponents(int count, int n, const float *__restrict points, const float *__restrict weights, Vector3::Arg metric, float *__restrict components)
+{
+    float * centroids = new float[3 * count];
+    float * covariances = new float[6 * count];
+
+    computeCovariances(count, n, points, weights, metric, centroids, covariances);
+
+    int s = 0;
+
+#if NV_USE_SSE > 1
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for (; s + 4 <= count; s += 4)
+    {
+        __m128 m[6];
+        for (int k = 0; k < 6; k++) m[k] = _mm_loadu_ps(covariances + k * count + s);
+
+        // Same as estimatePrincipleComponent: start with the row of largest length.
+        const __m128 r0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], m[0]), _mm_mul_ps(m[1], m[1])), _mm_mul_ps(m[2], m[2]));
+        const __m128 r1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], m[1]), _mm_mul_ps(m[3], m[3])), _mm_mul_ps(m[4], m[4]));
+        const __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], m[2]), _mm_mul_ps(m[4], m[4])), _mm_mul_ps(m[5], m[5]));
+
+        const __m128 pick0 = _mm_and_ps(_mm_cmpgt_ps(r0, r1), _mm_cmpgt_ps(r0, r2));
+        const __m128 pick1 = _mm_cmpgt_ps(r1, r2);
+
+        __m128 vx = blend(pick0, m[0], blend(pick1, m[1], m[2]));
+        __m128 vy = blend(pick0, m[1], blend(pick1, m[3], m[4]));
+        __m128 vz = blend(pick0, m[2], blend(pick1, m[4], m[5]));
+
+        const int NUM = 8;
+        for (int i = 0; i < NUM; i++)
+        {
+            const __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[0]), _mm_mul_ps(vy, m[1])), _mm_mul_ps(vz, m[2]));
+            const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[1]), _mm_mul_ps(vy, m[3])), _mm_mul_ps(vz, m[4]));
+            const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[2]), _mm_mul_ps(vy, m[4])), _mm_mul_ps(vz, m[5]));
+
+            // _mm_max_ps returns the second operand when the comparison fails, like nv::max.
+            // v = Vector3(x, y, z) / norm
+            const __m128 inorm = _mm_div_ps(one, _mm_max_ps(_mm_max_ps(x, y), z));
+
+            vx = _mm_mul_ps(x, inorm);
+            vy = _mm_mul_ps(y, inorm);
+            vz = _mm_mul_ps(z, inorm);
+        }
+
+        // Sets without variance have no principal component.
+        const __m128 empty = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(m[0], zero), _mm_cmpeq_ps(m[3], zero)), _mm_cmpeq_ps(m[5], zero));
+
+        _mm_storeu_ps(components + 0 * count + s, _mm_andnot_ps(empty, vx));
+        _mm_storeu_ps(components + 1 * count + s, _mm_andnot_ps(empty, vy));
+        _mm_storeu_ps(components + 2 * count + s, _mm_andnot_ps(empty, vz));
+    }
+#endif
+
+    for (; s < count; s++)
+    {
+        float matrix[6];
+        for (int k = 0; k < 6; k++) matrix[k] = covariances[k * count + s];
+
+        Vector3 v = firstEigenVector_PowerMethod(matrix);
+        for (int c = 0; c < 3; c++) components[c * count + s] = v.component[c];
+    }
+
+    delete [] centroids;
+    delete [] covariances;
+}
+
+
 Plane nv::Fit::bestPlane(int n, const Vector3 *__restrict points)
 {
     // compute the centroid and covariance
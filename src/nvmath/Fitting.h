@@ -20,6 +20,13 @@ namespace nv
         Vector3 computePrincipalComponent(int n, const Vector3 * points);
         Vector3 computePrincipalComponent(int n, const Vector3 * points, const float * weights, const Vector3 & metric);
 
+        // Batched versions for count point sets of n points each, in structure of arrays layout so that several sets are
+        // processed at once in SIMD lanes. Component c of point i of set s is points[(3 * i + c) * count + s] and its weight
+        // is weights[i * count + s]. Outputs use the same layout: centroids[c * count + s], covariances[k * count + s] and
+        // components[c * count + s]. Smaller sets can be padded with zero points of zero weight.
+        void computeCovariances(int count, int n, const float * points, const float * weights, const Vector3 & metric, float * centroids, float * covariances);
+        void computePrincipalComponents(int count, int n, const float * points, const float * weights, const Vector3 & metric, float * components);
+
         Plane bestPlane(int n, const Vector3 * points);
         bool isPlanar(int n, const Vector3 * points, float epsilon = NV_EPSILON);
 
@@ -205,6 +205,29 @@ float nv::shBasis( int l, int m, Vector3::Arg v )
 }
 
 
+/**
+ * Evaluate the basis functions of the first three bands for the given unit vector. These are
+ * the polynomial forms of shBasis, including the Condon-Shortley phase of the Legendre
+ * polynomials.
+ */
+void Sh2::eval(Vector3::Arg dir)
+{
+	const float x = dir.x;
+	const float y = dir.y;
+	const float z = dir.z;
+
+	m_elemArray[0] = 0.282095f;						// K(0, 0)
+	m_elemArray[1] = -0.488603f * y;				// sqrt(3 / PI) / 2
+	m_elemArray[2] = 0.488603f * z;
+	m_elemArray[3] = -0.488603f * x;
+	m_elemArray[4] = 1.092548f * x * y;				// sqrt(15 / PI) / 2
+	m_elemArray[5] = -1.092548f * y * z;
+	m_elemArray[6] = 0.315392f * (3 * z * z - 1);	// sqrt(5 / PI) / 4
+	m_elemArray[7] = -1.092548f * x * z;
+	m_elemArray[8] = 0.546274f * (x * x - y * y);	// sqrt(15 / PI) / 4
+}
+
+
 /**
  * Evaluate the hemispherical harmonic function for the given angles.
  * @param l is the band.
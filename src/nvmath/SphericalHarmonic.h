@@ -239,6 +239,9 @@ namespace nv
         /// Copy constructor.
         Sh2(const Sh2 & sh) : Sh(sh) {}
 
+        /// Evaluate the basis functions in closed form. Same result as Sh::eval, but much faster.
+        NVMATH_API void eval(const Vector3 & dir);
+
         /// Spherical harmonic resulting from projecting the clamped cosine transfer function to the SH basis.
         void cosineTransfer()
         {
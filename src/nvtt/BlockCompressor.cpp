@@ -118,6 +118,7 @@ struct ColorBlockCompressorContext
     nvtt::AlphaMode alphaMode;
     uint w, h;
     const float * data;
+    const uint * bgra;      // Used instead of data by compressColor32.
     const nvtt::CompressionOptions::Private * compressionOptions;
 
     uint bw, bh, bs;
@@ -136,29 +137,24 @@ void ColorBlockCompressorTask(void * data, int i)
     //for (uint x = 0; x < d->bw; x++)
     {
         ColorBlock rgba;
-        rgba.init(d->w, d->h, d->data, 4*x, 4*y);
+        if (d->bgra != NULL) {
+            rgba.init(d->w, d->h, d->bgra, 4*x, 4*y);
+        }
+        else {
+            rgba.init(d->w, d->h, d->data, 4*x, 4*y);
+        }
 
         uint8 * ptr = d->mem + (y * d->bw + x) * d->bs;
         d->compressor->compressBlock(rgba, d->alphaMode, *d->compressionOptions, ptr);
     }
 }
 
-void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+// Compress all the blocks of the image described by the context.
+static void compressBlocks(ColorBlockCompressorContext & context, nvtt::TaskDispatcher * dispatcher, const nvtt::OutputOptions::Private & outputOptions)
 {
-    nvDebugCheck(d == 1);
-
-    ColorBlockCompressorContext context;
-    context.alphaMode = alphaMode;
-    context.w = w;
-    context.h = h;
-    context.data = data;
-    context.compressionOptions = &compressionOptions;
-
-    context.bs = blockSize();
-    context.bw = (w + 3) / 4;
-    context.bh = (h + 3) / 4;
-
-    context.compressor = this;
+    context.bs = context.compressor->blockSize();
+    context.bw = (context.w + 3) / 4;
+    context.bh = (context.h + 3) / 4;
 
     SequentialTaskDispatcher sequential;
 
@@ -176,6 +172,38 @@ void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, u
     delete [] context.mem;
 }
 
+void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+{
+    nvDebugCheck(d == 1);
+
+    ColorBlockCompressorContext context;
+    context.alphaMode = alphaMode;
+    context.w = w;
+    context.h = h;
+    context.data = data;
+    context.bgra = NULL;
+    context.compressionOptions = &compressionOptions;
+    context.compressor = this;
+
+    compressBlocks(context, dispatcher, outputOptions);
+}
+
+void ColorBlockCompressor::compressColor32(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const Color32 * bgra, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+{
+    nvDebugCheck(d == 1);
+
+    ColorBlockCompressorContext context;
+    context.alphaMode = alphaMode;
+    context.w = w;
+    context.h = h;
+    context.data = NULL;
+    context.bgra = (const uint *)bgra;
+    context.compressionOptions = &compressionOptions;
+    context.compressor = this;
+
+    compressBlocks(context, dispatcher, outputOptions);
+}
+
 
 struct ColorSetCompressorContext
 {
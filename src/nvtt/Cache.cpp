@@ -0,0 +1,732 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Cache.h"
+#include "InputOptions.h"
+#include "CompressionOptions.h"
+#include "OutputOptions.h" // Includes nvcore/StdStream.h
+
+#include "nvimage/DirectDrawSurface.h" // MAKEFOURCC
+
+#include "nvcore/FileSystem.h"
+#include "nvcore/Utils.h" // min, max
+#include "nvcore/Array.inl"
+
+#if NV_OS_WIN32
+#include <windows.h> // FindFirstFile, GetCurrentProcessId
+#include <sys/utime.h> // _utime
+#else
+#include <sys/types.h>
+#include <sys/stat.h> // stat
+#include <dirent.h> // opendir
+#include <unistd.h> // getpid
+#include <utime.h> // utime
+#endif
+
+#include <stdlib.h> // qsort
+#include <string.h> // memcpy, strlen
+
+using namespace nv;
+using namespace nvtt;
+
+namespace
+{
+    // Change it when the format of the entries or the way keys are computed changes.
+    const uint CacheVersion = 1;
+
+    const uint FOURCC_NVTC = MAKEFOURCC('N', 'V', 'T', 'C');
+
+    struct EntryHeader
+    {
+        uint32 fourcc;
+        uint32 version;
+        uint64 key[2];
+
+        void swapBytes()
+        {
+            fourcc = POSH_LittleU32(fourcc);
+            version = POSH_LittleU32(version);
+            key[0] = POSH_LittleU64(key[0]);
+            key[1] = POSH_LittleU64(key[1]);
+        }
+    };
+
+    // The header is followed by the calls to the output handler, each of them is a record type and its arguments.
+    enum RecordType
+    {
+        Record_End = 0,
+        Record_BeginImage = 1,     // size, width, height, depth, face, miplevel
+        Record_Data = 2,           // size, data
+        Record_EndImage = 3,
+    };
+
+
+    // Two 64 bit multiply-rotate lanes, finalized with the MurmurHash3 mixer. Every value is added as a whole, so the
+    // key depends on the sequence of values added, not only on their bytes.
+    struct KeyHasher
+    {
+        KeyHasher() : h0(0x243F6A8885A308D3ULL), h1(0x13198A2E03707344ULL) {}
+
+        void add(uint64 v)
+        {
+            h0 = rotate(h0 ^ v, 31) * 0x9E3779B97F4A7C15ULL;
+            h1 = rotate(h1 ^ v, 29) * 0xC2B2AE3D27D4EB4FULL;
+        }
+
+        void add(uint v) { add(uint64(v)); }
+        void add(int v) { add(uint64(uint(v))); }
+        void add(bool b) { add(uint64(b ? 1 : 0)); }
+
+        void add(float f)
+        {
+            uint32 bits;
+            memcpy(&bits, &f, sizeof(bits));
+            add(uint64(bits));
+        }
+
+        void add(const Vector4 & v)
+        {
+            add(v.x); add(v.y); add(v.z); add(v.w);
+        }
+
+        void add(const void * data, uint64 size)
+        {
+            const uint8 * ptr = (const uint8 *)data;
+
+            uint64 i = 0;
+            for (; i + 8 <= size; i += 8) {
+                uint64 w;
+                memcpy(&w, ptr + i, 8);
+                add(POSH_LittleU64(w));
+            }
+
+            uint64 tail = 0;
+            for (uint b = 0; i < size; i++, b += 8) {
+                tail |= uint64(ptr[i]) << b;
+            }
+            add(tail);
+            add(size);
+        }
+
+        void add(const char * str)
+        {
+            if (str == NULL) add(uint64(0));
+            else add(str, strlen(str) + 1);
+        }
+
+        CacheKey finish() const
+        {
+            CacheKey key;
+            key.value[0] = mix(h0 ^ rotate(h1, 17));
+            key.value[1] = mix(h1 ^ rotate(h0, 43));
+            return key;
+        }
+
+        static uint64 rotate(uint64 x, uint r) { return (x << r) | (x >> (64 - r)); }
+
+        static uint64 mix(uint64 k)
+        {
+            k ^= k >> 33;
+            k *= 0xFF51AFD7ED558CCDULL;
+            k ^= k >> 33;
+            k *= 0xC4CEB9FE1A85EC53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+
+        uint64 h0, h1;
+    };
+
+
+    // Reads the records of an entry, making sure they are within its bounds.
+    struct EntryReader
+    {
+        EntryReader(const Array<uint8> & entry) : data(entry.buffer()), size(entry.size()), offset(sizeof(EntryHeader)) {}
+
+        bool read(uint32 * value)
+        {
+            if (size - offset < 4) return false;
+            memcpy(value, data + offset, 4);
+            *value = POSH_LittleU32(*value);
+            offset += 4;
+            return true;
+        }
+
+        const uint8 * data;
+        uint size;
+        uint offset;
+    };
+
+    bool writeRecord(Stream * stream, const uint32 * values, uint count)
+    {
+        uint32 buffer[8];
+        nvDebugCheck(count <= 8);
+
+        for (uint i = 0; i < count; i++) {
+            buffer[i] = POSH_LittleU32(values[i]);
+        }
+
+        return stream->serialize(buffer, count * 4) == count * 4;
+    }
+
+
+    // File of an entry in the cache directory.
+    struct CacheFile
+    {
+        char name[40];
+        uint64 size;
+        uint64 time;
+    };
+
+    // Entry names are the 32 hexadecimal digits of the key and the extension.
+    bool isEntryName(const char * name)
+    {
+        if (strlen(name) != 36 || strcmp(name + 32, ".nvc") != 0) return false;
+
+        for (int i = 0; i < 32; i++) {
+            const char c = name[i];
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+        }
+        return true;
+    }
+
+    void listEntries(const char * path, Array<CacheFile> & files)
+    {
+        CacheFile file;
+
+#if NV_OS_WIN32
+        Path pattern;
+        pattern.format("%s*.nvc", path);
+
+        WIN32_FIND_DATAA data;
+        HANDLE handle = FindFirstFileA(pattern.str(), &data);
+        if (handle == INVALID_HANDLE_VALUE) return;
+
+        do {
+            if (!isEntryName(data.cFileName)) continue;
+
+            strcpy(file.name, data.cFileName);
+            file.size = (uint64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            file.time = (uint64(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+            files.append(file);
+        } while (FindNextFileA(handle, &data));
+
+        FindClose(handle);
+#else
+        DIR * dir = opendir(path);
+        if (dir == NULL) return;
+
+        Path fileName;
+        while (struct dirent * entry = readdir(dir)) {
+            if (!isEntryName(entry->d_name)) continue;
+
+            fileName.format("%s%s", path, entry->d_name);
+
+            struct stat buf;
+            if (stat(fileName.str(), &buf) != 0) continue;
+
+            strcpy(file.name, entry->d_name);
+            file.size = uint64(buf.st_size);
+            // Entries are often stored and hit within the same second, use the nanoseconds when available.
+#if NV_OS_LINUX
+            file.time = uint64(buf.st_mtim.tv_sec) * 1000000000 + uint64(buf.st_mtim.tv_nsec);
+#elif NV_OS_DARWIN
+            file.time = uint64(buf.st_mtimespec.tv_sec) * 1000000000 + uint64(buf.st_mtimespec.tv_nsec);
+#else
+            file.time = uint64(buf.st_mtime);
+#endif
+            files.append(file);
+        }
+
+        closedir(dir);
+#endif
+    }
+
+    int compareTime(const void * a, const void * b)
+    {
+        const CacheFile * fa = (const CacheFile *)a;
+        const CacheFile * fb = (const CacheFile *)b;
+        if (fa->time < fb->time) return -1;
+        if (fa->time > fb->time) return 1;
+        return 0;
+    }
+
+    // Mark an entry as recently used.
+    void touchFile(const char * fileName)
+    {
+#if NV_OS_WIN32
+        _utime(fileName, NULL);
+#else
+        utime(fileName, NULL);
+#endif
+    }
+
+    uint processId()
+    {
+#if NV_OS_WIN32
+        return uint(GetCurrentProcessId());
+#else
+        return uint(getpid());
+#endif
+    }
+
+} // namespace
+
+
+Cache::Cache() : m(*new Cache::Private())
+{
+    m.size = 0;
+    m.entryCount = 0;
+    m.tempCount = 0;
+    m.hitCount = 0;
+    m.missCount = 0;
+    m.storeCount = 0;
+    m.evictionCount = 0;
+
+    setSizeLimit(1024);
+}
+
+Cache::~Cache()
+{
+    delete &m;
+}
+
+/// Keep the cache in the given directory. Entries that are already there are reused, and evicted when the
+/// directory is over the size limits.
+bool Cache::open(const char * path)
+{
+    nvCheck(path != NULL && path[0] != '\0');
+
+    if (!FileSystem::exists(path) && !FileSystem::createDirectory(path)) {
+        return false;
+    }
+
+    Lock<Mutex> lock(m.mutex);
+
+    m.path = path;
+    const char last = path[strlen(path) - 1];
+    if (last != '/' && last != '\\') {
+        m.path.appendSeparator();
+    }
+
+    m.hitCount = 0;
+    m.missCount = 0;
+    m.storeCount = 0;
+    m.evictionCount = 0;
+    m.evict();
+
+    return true;
+}
+
+/// Set the maximum size of the cache directory. The least recently used entries are removed when it's exceeded.
+void Cache::setSizeLimit(int megabytes, int entryCount/*= 0*/)
+{
+    Lock<Mutex> lock(m.mutex);
+
+    m.sizeLimit = uint64(max(megabytes, 1)) << 20;
+    m.entryCountLimit = uint(max(entryCount, 0));
+
+    if (m.isOpen()) m.evict();
+}
+
+int Cache::hitCount() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return m.hitCount;
+}
+
+int Cache::missCount() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return m.missCount;
+}
+
+int Cache::storeCount() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return m.storeCount;
+}
+
+int Cache::evictionCount() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return m.evictionCount;
+}
+
+int Cache::entryCount() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return int(m.entryCount);
+}
+
+float Cache::size() const
+{
+    Lock<Mutex> lock(m.mutex);
+    return float(m.size) / (1024 * 1024);
+}
+
+
+CacheKey Cache::Private::computeKey(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, bool cudaEnabled) const
+{
+    KeyHasher hasher;
+
+    hasher.add(uint(NVTT_VERSION));
+    hasher.add(CacheVersion);
+    hasher.add(cudaEnabled);
+
+    // Input options.
+    hasher.add(uint(inputOptions.wrapMode));
+    hasher.add(uint(inputOptions.textureType));
+    hasher.add(uint(inputOptions.inputFormat));
+    hasher.add(uint(inputOptions.alphaMode));
+    hasher.add(inputOptions.width);
+    hasher.add(inputOptions.height);
+    hasher.add(inputOptions.depth);
+    hasher.add(inputOptions.faceCount);
+    hasher.add(inputOptions.mipmapCount);
+    hasher.add(inputOptions.inputGamma);
+    hasher.add(inputOptions.outputGamma);
+    hasher.add(inputOptions.generateMipmaps);
+    hasher.add(inputOptions.maxLevel);
+    hasher.add(uint(inputOptions.mipmapFilter));
+    hasher.add(inputOptions.kaiserWidth);
+    hasher.add(inputOptions.kaiserAlpha);
+    hasher.add(inputOptions.kaiserStretch);
+    hasher.add(inputOptions.alphaCoverage);
+    hasher.add(inputOptions.alphaCoverageRef);
+    hasher.add(inputOptions.isNormalMap);
+    hasher.add(inputOptions.normalizeMipmaps);
+    hasher.add(inputOptions.convertToNormalMap);
+    hasher.add(inputOptions.heightFactors);
+    hasher.add(inputOptions.bumpFrequencyScale);
+    hasher.add(inputOptions.maxExtent);
+    hasher.add(uint(inputOptions.roundMode));
+    hasher.add(uint(inputOptions.storageFormat));
+
+    // Input images, with the sizes used by InputOptions::setMipmapData.
+    uint componentSize = 4;
+    if (inputOptions.inputFormat == InputFormat_BGRA_8UB) componentSize = 1;
+    else if (inputOptions.inputFormat == InputFormat_RGBA_16F) componentSize = 2;
+
+    for (uint i = 0; i < inputOptions.imageCount; i++) {
+        if (inputOptions.images[i] == NULL) {
+            hasher.add(uint64(0));
+            continue;
+        }
+
+        const uint mipmap = i / inputOptions.faceCount;
+        const uint w = max(1U, inputOptions.width >> mipmap);
+        const uint h = max(1U, inputOptions.height >> mipmap);
+        const uint d = max(1U, inputOptions.depth >> mipmap);
+
+        hasher.add(inputOptions.images[i], uint64(w) * h * d * 4 * componentSize);
+    }
+
+    // Compression options.
+    hasher.add(uint(compressionOptions.format));
+    hasher.add(uint(compressionOptions.quality));
+    hasher.add(compressionOptions.colorWeight);
+    hasher.add(compressionOptions.bitcount);
+    hasher.add(compressionOptions.rmask);
+    hasher.add(compressionOptions.gmask);
+    hasher.add(compressionOptions.bmask);
+    hasher.add(compressionOptions.amask);
+    hasher.add(uint(compressionOptions.rsize));
+    hasher.add(uint(compressionOptions.gsize));
+    hasher.add(uint(compressionOptions.bsize));
+    hasher.add(uint(compressionOptions.asize));
+    hasher.add(uint(compressionOptions.pixelType));
+    hasher.add(compressionOptions.pitchAlignment);
+    hasher.add(compressionOptions.externalCompressor.str());
+    hasher.add(compressionOptions.enableColorDithering);
+    hasher.add(compressionOptions.enableAlphaDithering);
+    hasher.add(compressionOptions.binaryAlpha);
+    hasher.add(compressionOptions.alphaThreshold);
+    hasher.add(uint(compressionOptions.decoder));
+
+    // Output options. The destination and the way it's written don't change the output.
+    hasher.add(outputOptions.outputHeader);
+    hasher.add(uint(outputOptions.container));
+    hasher.add(outputOptions.version);
+    hasher.add(outputOptions.srgb);
+    hasher.add(outputOptions.streamingLayout);
+
+    return hasher.finish();
+}
+
+bool Cache::Private::lookup(const CacheKey & key, Array<uint8> * entry)
+{
+    Path fileName;
+    entryPath(key, &fileName);
+
+    bool exists = false;
+    bool found = false;
+    uint64 fileSize = 0;
+    {
+        StdInputStream stream(fileName.str());
+        if (!stream.isError()) {
+            exists = true;
+            fileSize = stream.size();
+            if (fileSize >= sizeof(EntryHeader) && fileSize <= NV_UINT32_MAX) {
+                entry->resize(uint(fileSize));
+                found = stream.serialize(entry->buffer(), fileSize) == fileSize;
+            }
+        }
+    }
+
+    if (found) {
+        EntryHeader header;
+        memcpy(&header, entry->buffer(), sizeof(header));
+        header.swapBytes();
+
+        found = header.fourcc == FOURCC_NVTC && header.version == CacheVersion &&
+            header.key[0] == key.value[0] && header.key[1] == key.value[1] &&
+            replay(*entry, NULL);
+    }
+
+    if (found) {
+        touchFile(fileName.str());
+    }
+
+    // Entries that are truncated or damaged are removed, the new output will be stored in their place.
+    const bool removed = exists && !found && FileSystem::removeFile(fileName.str());
+
+    Lock<Mutex> lock(mutex);
+    if (found) hitCount++;
+    else missCount++;
+
+    if (removed) {
+        size -= min(size, fileSize);
+        if (entryCount > 0) entryCount--;
+    }
+
+    return found;
+}
+
+/// Send the recorded output to the output handler, or only validate the records when the handler is NULL.
+/*static*/ bool Cache::Private::replay(const Array<uint8> & entry, OutputHandler * outputHandler)
+{
+    EntryReader reader(entry);
+
+    for (;;) {
+        uint32 type;
+        if (!reader.read(&type)) return false;
+
+        if (type == Record_End) {
+            return reader.offset == reader.size;
+        }
+        else if (type == Record_BeginImage) {
+            uint32 args[6];
+            for (int i = 0; i < 6; i++) {
+                if (!reader.read(args + i)) return false;
+            }
+            if (outputHandler != NULL) {
+                outputHandler->beginImage(int(args[0]), int(args[1]), int(args[2]), int(args[3]), int(args[4]), int(args[5]));
+            }
+        }
+        else if (type == Record_Data) {
+            uint32 size;
+            if (!reader.read(&size) || size > NV_INT32_MAX || reader.size - reader.offset < size) return false;
+
+            if (outputHandler != NULL && !outputHandler->writeData(reader.data + reader.offset, int(size))) {
+                return false;
+            }
+            reader.offset += size;
+        }
+        else if (type == Record_EndImage) {
+            if (outputHandler != NULL) outputHandler->endImage();
+        }
+        else {
+            return false;
+        }
+    }
+}
+
+void Cache::Private::entryPath(const CacheKey & key, Path * fileName) const
+{
+    fileName->format("%s%08x%08x%08x%08x.nvc", path.str(),
+        uint(key.value[0] >> 32), uint(key.value[0]), uint(key.value[1] >> 32), uint(key.value[1]));
+}
+
+// Entries are written to a temporary file first, so that other processes never see an incomplete entry.
+void Cache::Private::tempPath(const CacheKey & key, Path * fileName)
+{
+    uint count;
+    {
+        Lock<Mutex> lock(mutex);
+        count = tempCount++;
+    }
+
+    fileName->format("%s%08x%08x.%u.%u.tmp", path.str(), uint(key.value[0] >> 32), uint(key.value[0]), processId(), count);
+}
+
+void Cache::Private::addEntry(uint64 entrySize)
+{
+    Lock<Mutex> lock(mutex);
+
+    storeCount++;
+    size += entrySize;
+    entryCount++;
+
+    // Entries stored by other processes are only accounted for in the next scan.
+    if (size > sizeLimit || (entryCountLimit != 0 && entryCount > entryCountLimit)) {
+        evict();
+    }
+}
+
+// The mutex must be locked.
+void Cache::Private::evict()
+{
+    Array<CacheFile> files;
+    listEntries(path.str(), files);
+
+    uint64 totalSize = 0;
+    for (uint i = 0; i < files.count(); i++) {
+        totalSize += files[i].size;
+    }
+    uint count = files.count();
+
+    if (totalSize > sizeLimit || (entryCountLimit != 0 && count > entryCountLimit)) {
+        // Leave some room, so that the directory is not scanned again for every new entry.
+        const uint64 targetSize = sizeLimit - sizeLimit / 10;
+        const uint targetCount = entryCountLimit - entryCountLimit / 10;
+
+        qsort(files.buffer(), files.count(), sizeof(CacheFile), compareTime);
+
+        Path fileName;
+        for (uint i = 0; i < files.count(); i++) {
+            if (totalSize <= targetSize && (entryCountLimit == 0 || count <= targetCount)) break;
+
+            fileName.format("%s%s", path.str(), files[i].name);
+            if (FileSystem::removeFile(fileName.str())) {
+                totalSize -= files[i].size;
+                count--;
+                evictionCount++;
+            }
+        }
+    }
+
+    size = totalSize;
+    entryCount = count;
+}
+
+
+CacheRecorder::CacheRecorder(Cache::Private & cache, const CacheKey & key, OutputHandler * outputHandler) :
+    outputHandler(outputHandler), m_cache(cache), m_key(key), m_failed(false)
+{
+    m_cache.tempPath(key, &m_tempName);
+    m_stream = new StdOutputStream(m_tempName.str());
+
+    if (m_stream->isError()) {
+        m_stream = NULL;
+        return;
+    }
+
+    EntryHeader header;
+    header.fourcc = FOURCC_NVTC;
+    header.version = CacheVersion;
+    header.key[0] = key.value[0];
+    header.key[1] = key.value[1];
+    header.swapBytes();
+
+    m_stream->serialize(&header, sizeof(header));
+}
+
+CacheRecorder::~CacheRecorder()
+{
+    if (m_stream != NULL) {
+        // Not committed.
+        m_stream = NULL;
+        FileSystem::removeFile(m_tempName.str());
+    }
+}
+
+void CacheRecorder::beginImage(int size, int width, int height, int depth, int face, int miplevel)
+{
+    outputHandler->beginImage(size, width, height, depth, face, miplevel);
+
+    if (m_stream != NULL) {
+        const uint32 record[7] = { Record_BeginImage, uint32(size), uint32(width), uint32(height), uint32(depth), uint32(face), uint32(miplevel) };
+        writeRecord(m_stream.ptr(), record, 7);
+    }
+}
+
+bool CacheRecorder::writeData(const void * data, int size)
+{
+    const bool writeSucceed = outputHandler->writeData(data, size);
+    if (!writeSucceed) m_failed = true;
+
+    if (m_stream != NULL) {
+        const uint32 record[2] = { Record_Data, uint32(size) };
+        writeRecord(m_stream.ptr(), record, 2);
+        m_stream->serialize(const_cast<void *>(data), uint64(size));
+    }
+
+    return writeSucceed;
+}
+
+void CacheRecorder::endImage()
+{
+    outputHandler->endImage();
+
+    if (m_stream != NULL) {
+        const uint32 record[1] = { Record_EndImage };
+        writeRecord(m_stream.ptr(), record, 1);
+    }
+}
+
+void CacheRecorder::commit()
+{
+    if (m_stream == NULL) return;
+
+    // Partial outputs are not stored.
+    if (m_failed) return;
+
+    const uint32 record[1] = { Record_End };
+    writeRecord(m_stream.ptr(), record, 1);
+
+    fflush(m_stream->fileHandle());
+    const bool writeSucceed = !m_stream->isError();
+    const uint64 entrySize = m_stream->tell();
+    m_stream = NULL;
+
+    if (!writeSucceed || entrySize > m_cache.sizeLimit) {
+        FileSystem::removeFile(m_tempName.str());
+        return;
+    }
+
+    Path fileName;
+    m_cache.entryPath(m_key, &fileName);
+
+    // Another process may have stored the same entry in the meantime, the new one replaces it.
+#if NV_OS_WIN32
+    if (!MoveFileExA(m_tempName.str(), fileName.str(), MOVEFILE_REPLACE_EXISTING)) {
+#else
+    if (rename(m_tempName.str(), fileName.str()) != 0) {
+#endif
+        FileSystem::removeFile(m_tempName.str());
+        return;
+    }
+
+    m_cache.addEntry(entrySize);
+}
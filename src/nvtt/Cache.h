@@ -0,0 +1,114 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef NVTT_CACHE_H
+#define NVTT_CACHE_H
+
+#include "nvtt.h"
+
+#include "nvthread/Mutex.h"
+
+#include "nvcore/StrLib.h" // Path
+#include "nvcore/Ptr.h" // AutoPtr
+#include "nvcore/Array.h"
+
+namespace nv
+{
+    class StdOutputStream;
+}
+
+namespace nvtt
+{
+
+    // Entries of the cache are files named after the hexadecimal key, with a header followed by the recorded calls
+    // to the output handler. Their modification time is the time of the last use, and it's used for LRU eviction.
+    //
+    // The key is a 128 bit hash of the input images and all the settings that affect the output. It's good enough to
+    // tell apart the inputs of a build, but it's not a cryptographic hash.
+    struct CacheKey
+    {
+        uint64 value[2];
+    };
+
+    struct Cache::Private
+    {
+        nv::Path path;
+        uint64 sizeLimit;
+        uint entryCountLimit;
+
+        // Shared state, protected by the mutex. A cache can be used by several contexts at the same time.
+        nv::Mutex mutex;
+        uint64 size;                    // Total size of the entries, as of the last scan plus the entries stored since then.
+        uint entryCount;
+        uint tempCount;                 // Used to give unique names to the files being written.
+        int hitCount;
+        int missCount;
+        int storeCount;
+        int evictionCount;
+
+        bool isOpen() const { return !path.isNull(); }
+
+        CacheKey computeKey(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, bool cudaEnabled) const;
+
+        // Read the entry of the given key. Returns false when it's not in the cache or it's not valid.
+        bool lookup(const CacheKey & key, nv::Array<uint8> * entry);
+
+        // Send the output recorded in an entry to the output handler.
+        static bool replay(const nv::Array<uint8> & entry, OutputHandler * outputHandler);
+
+        void entryPath(const CacheKey & key, nv::Path * fileName) const;
+        void tempPath(const CacheKey & key, nv::Path * fileName);
+        void addEntry(uint64 entrySize);
+
+        // Scan the directory, and remove the least recently used entries when the cache is over the limits.
+        void evict();
+    };
+
+
+    // Forwards the output to another handler, and records it to a new cache entry.
+    struct CacheRecorder : public OutputHandler
+    {
+        CacheRecorder(Cache::Private & cache, const CacheKey & key, OutputHandler * outputHandler);
+        virtual ~CacheRecorder();
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel);
+        virtual bool writeData(const void * data, int size);
+        virtual void endImage();
+
+        // Add the entry to the cache, when the output is complete and it was recorded without errors.
+        void commit();
+
+        OutputHandler * const outputHandler;
+
+    private:
+        Cache::Private & m_cache;
+        CacheKey m_key;
+        nv::Path m_tempName;
+        nv::AutoPtr<nv::StdOutputStream> m_stream;     // NULL once the entry is committed, or if it couldn't be created.
+        bool m_failed;
+    };
+
+} // nvtt namespace
+
+
+#endif // NVTT_CACHE_H
@@ -27,13 +27,20 @@
 
 #include "nvtt.h"
 #include "nvcore/nvcore.h" // uint
+#include "nvcore/Debug.h" // nvUnreachable
 
 namespace nv
 {
+    class Color32;
+
     struct CompressorInterface
     {
         virtual ~CompressorInterface() {}
         virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions) = 0;
+
+        // Compressors that work on 8 bit colors can also take them directly, without a conversion to floats.
+        virtual bool canCompressColor32() const { return false; }
+        virtual void compressColor32(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const Color32 * bgra, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions) { nvUnreachable(); }
     };
 
 } // nv namespace
@@ -30,6 +30,7 @@
 #include "CompressionOptions.h"
 #include "OutputOptions.h"
 #include "Surface.h"
+#include "Cache.h"
 
 #include "CompressorDX9.h"
 #include "CompressorDX10.h"
@@ -48,9 +49,13 @@
 #include "nvimage/NormalMap.h"
 #include "nvimage/PixelFormat.h"
 #include "nvimage/ColorSpace.h"
+#include "nvimage/RowSource.h"
+#include "nvimage/PagePack.h"
 
 #include "nvcore/Memory.h"
 #include "nvcore/Ptr.h"
+#include "nvcore/Array.inl"
+#include "nvcore/Utils.h"
 
 using namespace nv;
 using namespace nvtt;
@@ -65,6 +70,10 @@ Compressor::Compressor() : m(*new Compressor::Private())
     enableCudaAcceleration(m.cudaSupported);
 
     m.dispatcher = &m.defaultDispatcher;
+
+    m.cache = NULL;
+
+    m.memoryBudget = 256 << 20;
 }
 
 Compressor::~Compressor()
@@ -107,11 +116,46 @@ void Compressor::setTaskDispatcher(TaskDispatcher * disp)
     }
 }
 
+void Compressor::setCache(Cache * cache)
+{
+    m.cache = cache;
+}
+
+void Compressor::setMemoryBudget(int megabytes)
+{
+    m.memoryBudget = uint64(max(megabytes, 1)) << 20;
+}
+
 
 // Input Options API.
 bool Compressor::process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
 {
-    return m.compress(inputOptions.m, compressionOptions.m, outputOptions.m);
+    bool success;
+    if (m.cache != NULL) {
+        success = m.compressCached(inputOptions.m, compressionOptions.m, outputOptions.m);
+    }
+    else {
+        success = m.compress(inputOptions.m, compressionOptions.m, outputOptions.m);
+    }
+
+    // Flush the streaming output if the compression stopped before the last surface.
+    outputOptions.m.endTexture();
+
+    return success;
+}
+
+bool Compressor::process(const InputOptions & inputOptions, ImageSource * source, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    const bool success = m.compress(inputOptions.m, source, compressionOptions.m, outputOptions.m);
+    outputOptions.m.endTexture();
+    return success;
+}
+
+bool Compressor::processPages(const InputOptions & inputOptions, ImageSource * source, int pageSize, int borderSize, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    const bool success = m.compressPages(inputOptions.m, source, pageSize, borderSize, compressionOptions.m, outputOptions.m);
+    outputOptions.m.endTexture();
+    return success;
 }
 
 int Compressor::estimateSize(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const
@@ -209,6 +253,57 @@ int Compressor::estimateSize(int w, int h, int d, int mipmapCount, const Compres
 
 
 
+// Replay the output from the cache when it's there, otherwise compress the texture and record its output.
+bool Compressor::Private::compressCached(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    Cache::Private & cache = this->cache->m;
+
+    // Nothing to record when there's no output.
+    if (!cache.isOpen() || outputOptions.outputHandler == NULL) {
+        return compress(inputOptions, compressionOptions, outputOptions);
+    }
+
+    const CacheKey key = cache.computeKey(inputOptions, compressionOptions, outputOptions, cudaEnabled);
+
+    Array<uint8> entry;
+    if (cache.lookup(key, &entry)) {
+        if (!Cache::Private::replay(entry, outputOptions.outputHandler)) {
+            outputOptions.error(Error_FileWrite);
+            return false;
+        }
+        return true;
+    }
+
+    // The output is recorded through a copy of the options, the caller's options may be used by other threads.
+    CacheRecorder recorder(cache, key, outputOptions.outputHandler);
+
+    OutputOptions::Private recorderOptions;
+    recorderOptions.redirect(outputOptions, &recorder);
+
+    const bool success = compress(inputOptions, compressionOptions, recorderOptions);
+
+    // Flush the streaming output to the recorder if the compression stopped before the last surface.
+    recorderOptions.endTexture();
+
+    if (success) {
+        recorder.commit();
+    }
+
+    return success;
+}
+
+// Build the next mipmap of a linear image using the filter selected in the input options.
+static void buildNextMipmap(Surface & img, const InputOptions::Private & inputOptions)
+{
+    if (inputOptions.mipmapFilter == MipmapFilter_Kaiser) {
+        float params[2] = { inputOptions.kaiserStretch, inputOptions.kaiserAlpha };
+        img.buildNextMipmap(MipmapFilter_Kaiser, inputOptions.kaiserWidth, params);
+    }
+    else {
+        img.buildNextMipmap(inputOptions.mipmapFilter);
+    }
+}
+
 bool Compressor::Private::compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
 {
     // Make sure enums match.
@@ -227,6 +322,9 @@ bool Compressor::Private::compress(const InputOptions::Private & inputOptions, c
     img.setAlphaMode(inputOptions.alphaMode);
     img.setNormalMap(inputOptions.isNormalMap);
 
+    // The image and the mipmaps held for alpha coverage are packed between the processing steps.
+    img.compact(inputOptions.storageFormat);
+
     const int faceCount = inputOptions.faceCount;
     int width = inputOptions.width;
     int height = inputOptions.height;
@@ -247,6 +345,13 @@ bool Compressor::Private::compress(const InputOptions::Private & inputOptions, c
         return false;
     }
 
+    if (canCompressColor32(inputOptions, width, height, depth, mipmapCount, compressionOptions)) {
+        return compressColor32(inputOptions, mipmapCount, compressionOptions, outputOptions);
+    }
+
+
+    // Scratch surface that holds the gamma corrected or packed copy of each mipmap. Its storage is reused across mipmaps and faces.
+    nvtt::Surface tmp;
 
     // Output images.
     for (int f = 0; f < faceCount; f++)
@@ -275,16 +380,16 @@ bool Compressor::Private::compress(const InputOptions::Private & inputOptions, c
         // Resize input.
         img.resize(w, h, d, ResizeFilter_Box);
 
-        nvtt::Surface tmp = img;
-        if (!img.isNormalMap()) {
-            tmp.toGamma(inputOptions.outputGamma);
-        }
-        else {
-            tmp.packNormals();
+        // When the alpha test coverage of the top level is preserved, the mipmaps are kept until the whole chain is built and their alpha is scaled in a single pass.
+        const bool alphaCoverage = inputOptions.alphaCoverage && !img.isNormalMap() && mipmapCount > 1;
+        float coverage = 0.0f;
+        Array<Surface> mipmaps;
+
+        if (alphaCoverage) {
+            coverage = img.alphaTestCoverage(inputOptions.alphaCoverageRef);
         }
 
-        quantize(tmp, compressionOptions);
-        compress(tmp, f, 0, compressionOptions, outputOptions);
+        compressMipmap(img, tmp, f, 0, inputOptions, compressionOptions, outputOptions);
 
         for (int m = 1; m < mipmapCount; m++) {
             w = max(1, w/2);
@@ -315,41 +420,63 @@ bool Compressor::Private::compress(const InputOptions::Private & inputOptions, c
                 }
             }
             else {
-                if (inputOptions.mipmapFilter == MipmapFilter_Kaiser) {
-                    float params[2] = { inputOptions.kaiserStretch, inputOptions.kaiserAlpha };
-                    img.buildNextMipmap(MipmapFilter_Kaiser, inputOptions.kaiserWidth, params);
-                }
-                else {
-                    img.buildNextMipmap(inputOptions.mipmapFilter);
-                }
+                buildNextMipmap(img, inputOptions);
             }
             nvDebugCheck(img.width() == w);
             nvDebugCheck(img.height() == h);
             nvDebugCheck(img.depth() == d);
 
-            if (img.isNormalMap()) {
-                if (inputOptions.normalizeMipmaps) {
-                    img.normalizeNormalMap();
-                }
-                tmp = img;
-                tmp.packNormals();
+            if (alphaCoverage) {
+                mipmaps.append(img);
+                continue;
             }
-            else {
-                tmp = img;
-                tmp.toGamma(inputOptions.outputGamma);
+
+            if (img.isNormalMap() && inputOptions.normalizeMipmaps) {
+                img.normalizeNormalMap();
             }
 
-            quantize(tmp, compressionOptions);
-            compress(tmp, f, m, compressionOptions, outputOptions);
+            compressMipmap(img, tmp, f, m, inputOptions, compressionOptions, outputOptions);
+        }
+
+        if (alphaCoverage) {
+            nvtt::scaleAlphaToCoverage(mipmaps.buffer(), mipmaps.count(), coverage, inputOptions.alphaCoverageRef);
+
+            for (uint i = 0; i < mipmaps.count(); i++) {
+                compressMipmap(mipmaps[i], tmp, f, 1 + i, inputOptions, compressionOptions, outputOptions);
+            }
         }
     }
 
     return true;
 }
 
+// Convert a linear mipmap to the output color space, using tmp as scratch, and compress it.
+bool Compressor::Private::compressMipmap(const Surface & img, Surface & tmp, int face, int mipmap, const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    if (img.isNormalMap()) {
+        nvtt::packNormals(img, 0.5f, 0.5f, &tmp);
+    }
+    else {
+        nvtt::toGamma(img, inputOptions.outputGamma, &tmp);
+    }
+
+    quantize(tmp, compressionOptions);
+    const bool success = compress(tmp, face, mipmap, compressionOptions, outputOptions);
+
+    // With compact storage the footprint matters more than reusing the scratch storage, which has the size of the top level.
+    if (inputOptions.storageFormat != StorageFormat_Float) {
+        tmp = Surface();
+    }
+
+    return success;
+}
+
 bool Compressor::Private::compress(const Surface & tex, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
 {
-    if (!compress(tex.alphaMode(), tex.width(), tex.height(), tex.depth(), face, mipmap, tex.data(), compressionOptions, outputOptions)) {
+    // Compact surfaces are decoded to a temporary copy, so that they stay packed.
+    FloatPixels pixels(tex);
+
+    if (!compress(tex.alphaMode(), tex.width(), tex.height(), tex.depth(), face, mipmap, pixels->channel(0), compressionOptions, outputOptions)) {
         return false;
     }
 
@@ -389,28 +516,837 @@ bool Compressor::Private::compress(AlphaMode alphaMode, int w, int h, int d, int
 }
 
 
+// The float pipeline converts each 8 bit value to linear space and back, and then truncates it to 8 bits in
+// ColorBlock::init. That doesn't give back the input value for every gamma, even when the input and output gammas are
+// equal, so all the values are run through the same code to find out.
+static bool isGammaRoundTripExact(float inputGamma, float outputGamma)
+{
+    Color32 values[256];
+    for (uint i = 0; i < 256; i++) {
+        values[i] = Color32(uint8(i), uint8(i), uint8(i), uint8(i));
+    }
+
+    Surface img;
+    img.setImage(InputFormat_BGRA_8UB, 256, 1, 1, values);
+    img.toLinear(inputGamma);
+
+    Surface tmp;
+    nvtt::toGamma(img, outputGamma, &tmp);
+
+    for (uint x = 0; x < 256; x += 4) {
+        ColorBlock block;
+        block.init(256, 1, tmp.data(), x, 0);
+
+        for (uint e = 0; e < 4; e++) {
+            if (block.color(e, 0).u != values[x + e].u) return false;
+        }
+    }
+
+    return true;
+}
+
+// The input images can be compressed as they are when none of the processing in linear space changes them: the
+// texture is not resized, every mipmap is supplied, the gamma conversions cancel out and there's no quantization.
+bool Compressor::Private::canCompressColor32(const InputOptions::Private & inputOptions, int w, int h, int d, int mipmapCount, const CompressionOptions::Private & compressionOptions) const
+{
+    if (inputOptions.inputFormat != InputFormat_BGRA_8UB) return false;
+    if (inputOptions.width != uint(w) || inputOptions.height != uint(h) || inputOptions.depth != uint(d) || d != 1) return false;
+    if (inputOptions.isNormalMap || inputOptions.convertToNormalMap) return false;
+    if (inputOptions.storageFormat != StorageFormat_Float) return false;
+    if (inputOptions.alphaCoverage && mipmapCount > 1) return false;
+    if (compressionOptions.enableColorDithering || compressionOptions.enableAlphaDithering || compressionOptions.binaryAlpha) return false;
+
+    for (int i = 0; i < mipmapCount * int(inputOptions.faceCount); i++) {
+        if (inputOptions.images[i] == NULL) return false;
+    }
+
+#if defined HAVE_CUDA
+    if (cudaEnabled) return false;
+#endif
+
+    AutoPtr<CompressorInterface> compressor(chooseCpuCompressor(compressionOptions));
+    if (compressor == NULL || !compressor->canCompressColor32()) return false;
+
+    return isGammaRoundTripExact(inputOptions.inputGamma, inputOptions.outputGamma);
+}
+
+// Compress the 8 bit input images directly, without converting them to floats.
+bool Compressor::Private::compressColor32(const InputOptions::Private & inputOptions, int mipmapCount, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    AutoPtr<CompressorInterface> compressor(chooseCpuCompressor(compressionOptions));
+
+    const int faceCount = inputOptions.faceCount;
+
+    for (int f = 0; f < faceCount; f++)
+    {
+        int w = inputOptions.width;
+        int h = inputOptions.height;
+
+        for (int m = 0; m < mipmapCount; m++)
+        {
+            int size = computeImageSize(w, h, 1, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+            outputOptions.beginImage(size, w, h, 1, f, m);
+
+            const Color32 * bgra = (const Color32 *)inputOptions.images[m * faceCount + f];
+            compressor->compressColor32(inputOptions.alphaMode, w, h, 1, bgra, dispatcher, compressionOptions, outputOptions);
+
+            outputOptions.endImage();
+
+            w = max(1, w/2);
+            h = max(1, h/2);
+        }
+    }
+
+    return true;
+}
+
+
+namespace
+{
+    // The memory budget of the out-of-core API is shared by the buffers that grow with the size of the image: an eighth
+    // of it is used to buffer the input, and the rest holds either a level processed in memory, with its working copies
+    // and its compressed output, or the stripe being compressed. The rows cached by the mipmap filters, the bands of the
+    // virtual texture pages and the scratch memory of the compressors are not counted, so the actual usage can exceed
+    // the budget by a few rows of each level.
+    uint64 inputBufferSize(uint64 memoryBudget)
+    {
+        return memoryBudget / 8;
+    }
+
+    // Size of the compressed output of count rows, rounded up to whole block rows.
+    uint64 outputSize(uint w, uint count, const CompressionOptions::Private & compressionOptions)
+    {
+        const uint64 blockRowSize = computeImageSize(w, 4, 1, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+        return blockRowSize * ((count + 3) / 4);
+    }
+
+    // Memory used to process a level in memory: the level, its copy in output space, the next mipmap and the compressed output.
+    uint64 inMemorySize(uint w, uint h, const CompressionOptions::Private & compressionOptions)
+    {
+        const uint64 levelSize = uint64(w) * h * 4 * sizeof(float);
+        return levelSize * 2 + levelSize / 4 + outputSize(w, h, compressionOptions);
+    }
+
+    // Reads the rows of an image source in chunks and converts them to linear space, like the in-memory path does with the whole image.
+    class InputRowSource : public RowSource
+    {
+    public:
+        InputRowSource(ImageSource * source, uint w, uint h, uint bufferRows, const InputOptions::Private & inputOptions) :
+            RowSource(w, h, 4), m_source(source), m_bufferRows(bufferRows), m_first(0), m_count(0), m_inputOptions(inputOptions)
+        {
+        }
+
+        virtual bool readRows(uint y, uint count, FloatImage * rows)
+        {
+            if (y + count > m_height) return false;
+
+            if (y < m_first || y + count > m_first + m_count)
+            {
+                const uint n = min(max(count, m_bufferRows), m_height - y);
+
+                m_count = 0;
+                m_buffer.allocate(4, m_width, n);
+
+                if (!m_source->readRows(int(y), int(n), m_buffer.channel(0))) {
+                    return false;
+                }
+
+                m_first = y;
+                m_count = n;
+
+                if (!m_inputOptions.isNormalMap) {
+                    if (!equal(m_inputOptions.inputGamma, 1.0f)) {
+                        m_buffer.toLinear(0, 3, m_inputOptions.inputGamma);
+                    }
+                }
+                else {
+                    m_buffer.scaleBias(0, 3, 2.0f, -1.0f);
+                }
+            }
+
+            rows->allocate(4, m_width, count);
+
+            for (uint c = 0; c < 4; c++) {
+                memcpy(rows->channel(c), m_buffer.scanline(c, y - m_first, 0), m_width * count * sizeof(float));
+            }
+
+            return true;
+        }
+
+    private:
+        ImageSource * m_source;
+        const uint m_bufferRows;
+        uint m_first;
+        uint m_count;
+        FloatImage m_buffer;
+        const InputOptions::Private & m_inputOptions;
+    };
+
+    // Normalizes the rows of a normal map.
+    class NormalizedRowSource : public RowSource
+    {
+    public:
+        NormalizedRowSource(RowSource * source) : RowSource(source->width(), source->height(), source->componentCount()), m_source(source)
+        {
+        }
+
+        virtual bool readRows(uint y, uint count, FloatImage * rows)
+        {
+            if (!m_source->readRows(y, count, rows)) {
+                return false;
+            }
+
+            rows->normalize(0);
+
+            return true;
+        }
+
+    private:
+        RowSource * m_source;
+    };
+
+    // Source of the next mipmap. Uses the same filters as buildNextMipmap.
+    RowSource * createMipmapSource(RowSource * source, const InputOptions::Private & inputOptions)
+    {
+        const uint w = max(1U, source->width() / 2);
+        const uint h = max(1U, source->height() / 2);
+        const FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)inputOptions.wrapMode;
+
+        if (inputOptions.mipmapFilter == MipmapFilter_Box) {
+            return new DownSampledRowSource(source);
+        }
+        else if (inputOptions.mipmapFilter == MipmapFilter_Triangle) {
+            TriangleFilter filter;
+            return new ResampledRowSource(source, filter, w, h, wrapMode);
+        }
+        else {
+            nvDebugCheck(inputOptions.mipmapFilter == MipmapFilter_Kaiser);
+            KaiserFilter filter(inputOptions.kaiserWidth);
+            filter.setParameters(inputOptions.kaiserStretch, inputOptions.kaiserAlpha);
+            return new ResampledRowSource(source, filter, w, h, wrapMode);
+        }
+    }
+
+    // Produces the levels of the mipmap chain of an image source in linear space. Mipmaps are generated by chaining
+    // row sources, so each level that doesn't fit in memory is produced with a new pass over the input. Once a level
+    // fits in the memory budget it's loaded and the rest of the chain is generated in memory, exactly as in the
+    // regular path.
+    class MipmapChain
+    {
+        NV_FORBID_COPY(MipmapChain);
+    public:
+        MipmapChain(ImageSource * source, uint w, uint h, uint64 memoryBudget, const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions) :
+            m_input(source, inputOptions.width, inputOptions.height, bufferRows(memoryBudget, inputOptions), inputOptions),
+            m_memoryBudget(memoryBudget), m_mipmap(-1), m_inMemory(false), m_inputOptions(inputOptions), m_compressionOptions(compressionOptions)
+        {
+            m_level = &m_input;
+
+            if (inputOptions.width != w || inputOptions.height != h) {
+                BoxFilter filter;
+                m_level = new ResampledRowSource(m_level, filter, w, h, (FloatImage::WrapMode)inputOptions.wrapMode);
+                m_chain.append(m_level);
+            }
+
+            m_image.setWrapMode(inputOptions.wrapMode);
+            m_image.setAlphaMode(inputOptions.alphaMode);
+            m_image.setNormalMap(inputOptions.isNormalMap);
+        }
+
+        ~MipmapChain()
+        {
+            deleteAll(m_chain);
+        }
+
+        // Advance to the next level, the first call produces the top level.
+        bool nextLevel()
+        {
+            m_mipmap++;
+
+            if (m_inMemory)
+            {
+                buildNextMipmap(m_image, m_inputOptions);
+
+                if (m_image.isNormalMap() && m_inputOptions.normalizeMipmaps) {
+                    m_image.normalizeNormalMap();
+                }
+
+                return true;
+            }
+
+            if (m_mipmap > 0) {
+                m_level = createMipmapSource(m_level, m_inputOptions);
+                m_chain.append(m_level);
+
+                if (m_inputOptions.isNormalMap && m_inputOptions.normalizeMipmaps) {
+                    m_level = new NormalizedRowSource(m_level);
+                    m_chain.append(m_level);
+                }
+            }
+
+            if (inputBufferSize(m_memoryBudget) + inMemorySize(m_level->width(), m_level->height(), m_compressionOptions) <= m_memoryBudget)
+            {
+                m_image.setImage(m_level->width(), m_level->height(), 1);
+
+                if (!m_level->readRows(0, m_level->height(), m_image.m->image)) {
+                    return false;
+                }
+
+                m_inMemory = true;
+            }
+
+            return true;
+        }
+
+        bool inMemory() const { return m_inMemory; }
+
+        // Source of the current level when it's not in memory.
+        RowSource * source() const { return m_level; }
+
+        // Current level when it's in memory.
+        nvtt::Surface & image() { return m_image; }
+
+    private:
+        static uint bufferRows(uint64 memoryBudget, const InputOptions::Private & inputOptions)
+        {
+            const uint64 inputRowSize = uint64(inputOptions.width) * 4 * sizeof(float);
+            return uint(clamp<uint64>(inputBufferSize(memoryBudget) / inputRowSize, 1, inputOptions.height));
+        }
+
+        InputRowSource m_input;
+        Array<RowSource *> m_chain;
+        RowSource * m_level;
+        const uint64 m_memoryBudget;
+        int m_mipmap;
+        bool m_inMemory;
+        nvtt::Surface m_image;
+        const InputOptions::Private & m_inputOptions;
+        const CompressionOptions::Private & m_compressionOptions;
+    };
+
+    // Computes the target extents and mipmap count of an out-of-core texture and checks that its options are supported.
+    bool setupOutOfCore(const InputOptions::Private & inputOptions, ImageSource * source, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, int * width, int * height, int * mipmapCount)
+    {
+        if (!outputOptions.hasValidOutputHandler()) {
+            outputOptions.error(Error_FileOpen);
+            return false;
+        }
+
+        if (source == NULL || inputOptions.textureType != TextureType_2D || inputOptions.faceCount != 1 || inputOptions.depth != 1) {
+            outputOptions.error(Error_InvalidInput);
+            return false;
+        }
+
+        int depth = inputOptions.depth;
+        *width = inputOptions.width;
+        *height = inputOptions.height;
+
+        nv::getTargetExtent(width, height, &depth, inputOptions.maxExtent, inputOptions.roundMode, inputOptions.textureType);
+
+        const bool resize = (inputOptions.width != uint(*width) || inputOptions.height != uint(*height));
+
+        *mipmapCount = 1;
+        if (inputOptions.generateMipmaps) {
+            *mipmapCount = countMipmaps(*width, *height, depth);
+            if (inputOptions.maxLevel > 0) *mipmapCount = min(*mipmapCount, inputOptions.maxLevel);
+        }
+
+        // Dithering diffuses the error over the whole image, and the height map conversion and the alpha weighted filters don't work on stripes yet.
+        if (inputOptions.convertToNormalMap || compressionOptions.enableColorDithering || compressionOptions.enableAlphaDithering ||
+            (inputOptions.alphaMode == AlphaMode_Transparency && (resize || *mipmapCount > 1)))
+        {
+            outputOptions.error(Error_UnsupportedFeature);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Stores the output of a compressor in memory.
+    struct MemoryOutputHandler : public nvtt::OutputHandler
+    {
+        MemoryOutputHandler() : data(NULL), size(0), offset(0) {}
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+        {
+            // ignore.
+        }
+
+        virtual bool writeData(const void * data, int size)
+        {
+            if (offset + size > this->size) return false;
+            memcpy(this->data + offset, data, size);
+            offset += size;
+            return true;
+        }
+
+        virtual void endImage()
+        {
+            // ignore.
+        }
+
+        uint8 * data;
+        uint size;
+        uint offset;
+    };
+
+    // Context of the tasks that compress the pages of a row of pages.
+    struct PageRowContext
+    {
+        const float * band;         // Rows of the level covered by the page row, including borders, in output space.
+        uint bandWidth;
+        uint bandHeight;
+        uint levelWidth;
+        uint pageSize;
+        uint borderSize;
+
+        float * pages;              // Scratch memory for each page.
+        uint8 * output;             // Compressed pages, in order.
+        const uint * pageOffsets;   // Offset of each page in the output.
+        MemoryOutputHandler * outputHandlers;
+        OutputOptions::Private * outputOptions;
+
+        CompressorInterface * compressor;
+        AlphaMode alphaMode;
+        const CompressionOptions::Private * compressionOptions;
+    };
+
+    void compressPageTask(void * data, int i)
+    {
+        PageRowContext * ctx = (PageRowContext *) data;
+
+        const uint x = i * ctx->pageSize;
+        const uint w = min(ctx->pageSize, ctx->levelWidth - x) + 2 * ctx->borderSize;
+        const uint h = ctx->bandHeight;
+
+        // Crop the page, the band already includes the border columns.
+        float * page = ctx->pages + uint64(i) * (ctx->pageSize + 2 * ctx->borderSize) * h * 4;
+        for (uint c = 0; c < 4; c++) {
+            for (uint y = 0; y < h; y++) {
+                memcpy(page + (c * h + y) * w, ctx->band + (uint64(c) * h + y) * ctx->bandWidth + x, w * sizeof(float));
+            }
+        }
+
+        MemoryOutputHandler & handler = ctx->outputHandlers[i];
+        handler.data = ctx->output + ctx->pageOffsets[i];
+        handler.size = ctx->pageOffsets[i + 1] - ctx->pageOffsets[i];
+        handler.offset = 0;
+
+        // Pages are compressed in parallel, so each one is compressed in a single thread.
+        SequentialTaskDispatcher dispatcher;
+        ctx->compressor->compress(ctx->alphaMode, w, h, 1, page, &dispatcher, *ctx->compressionOptions, ctx->outputOptions[i]);
+    }
+
+    uint wrapIndex(int x, uint w, FloatImage::WrapMode wrapMode)
+    {
+        if (wrapMode == FloatImage::WrapMode_Clamp) return wrapClamp(x, w);
+        if (wrapMode == FloatImage::WrapMode_Repeat) return wrapRepeat(x, w);
+        return wrapMirror(x, w);
+    }
+
+} // namespace
+
+
+// Out-of-core version of the InputOptions API. Levels that don't fit in memory are compressed in stripes as they are
+// read from the mipmap chain.
+bool Compressor::Private::compress(const InputOptions::Private & inputOptions, ImageSource * source, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    int width, height, mipmapCount;
+    if (!setupOutOfCore(inputOptions, source, compressionOptions, outputOptions, &width, &height, &mipmapCount)) {
+        return false;
+    }
+
+    if (!outputHeader(inputOptions.textureType, width, height, 1, mipmapCount, inputOptions.isNormalMap, compressionOptions, outputOptions)) {
+        return false;
+    }
+
+    MipmapChain chain(source, width, height, memoryBudget, inputOptions, compressionOptions);
+
+    nvtt::Surface tmp;
+
+    for (int m = 0; m < mipmapCount; m++)
+    {
+        if (!chain.nextLevel()) {
+            outputOptions.error(Error_InvalidInput);
+            return false;
+        }
+
+        if (!chain.inMemory())
+        {
+            if (!compress(chain.source(), inputOptions.alphaMode, inputOptions.isNormalMap, inputOptions.outputGamma, m, compressionOptions, outputOptions)) {
+                return false;
+            }
+            continue;
+        }
+
+        const nvtt::Surface & img = chain.image();
+
+        if (!img.isNormalMap()) {
+            nvtt::toGamma(img, inputOptions.outputGamma, &tmp);
+        }
+        else {
+            nvtt::packNormals(img, 0.5f, 0.5f, &tmp);
+        }
+
+        quantize(tmp, compressionOptions);
+        compress(tmp, 0, m, compressionOptions, outputOptions);
+    }
+
+    return true;
+}
+
+// Compress one mipmap level reading it from the given source in stripes of whole block rows.
+bool Compressor::Private::compress(RowSource * source, AlphaMode alphaMode, bool isNormalMap, float outputGamma, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    const uint w = source->width();
+    const uint h = source->height();
+
+    // The stripe is converted to the output space in a second image, and compressed to memory before it's output. Half
+    // of the budget is left for the input buffer and the rows cached by the filters of the mipmap chain.
+    const uint64 rowSize = uint64(w) * 4 * sizeof(float) * 2 + outputSize(w, 4, compressionOptions) / 4;
+    uint stripeHeight = uint(min<uint64>(memoryBudget / 2 / rowSize, h)) & ~3U;
+    if (stripeHeight < 4) stripeHeight = 4;
+
+    // Levels larger than 2GB can't be described by the output handler, it's only a hint.
+    uint64 size = 0;
+    for (uint y = 0; y < h; y += stripeHeight) {
+        size += computeImageSize(w, min(stripeHeight, h - y), 1, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+    }
+    outputOptions.beginImage(int(min<uint64>(size, NV_INT32_MAX)), w, h, 1, 0, mipmap);
+
+    AutoPtr<CompressorInterface> compressor(chooseCpuCompressor(compressionOptions));
+    if (compressor == NULL) {
+        outputOptions.error(Error_UnsupportedFeature);
+        outputOptions.endImage();
+        return false;
+    }
+
+    nvtt::Surface stripe;
+    stripe.setAlphaMode(alphaMode);
+    stripe.setNormalMap(isNormalMap);
+    stripe.m->image = new FloatImage;
+
+    nvtt::Surface tmp;
+
+    bool success = true;
+
+    for (uint y = 0; y < h; y += stripeHeight)
+    {
+        const uint count = min(stripeHeight, h - y);
+
+        if (!source->readRows(y, count, stripe.m->image)) {
+            outputOptions.error(Error_InvalidInput);
+            success = false;
+            break;
+        }
+
+        if (!isNormalMap) {
+            nvtt::toGamma(stripe, outputGamma, &tmp);
+        }
+        else {
+            nvtt::packNormals(stripe, 0.5f, 0.5f, &tmp);
+        }
+
+        quantize(tmp, compressionOptions);
+
+        compressor->compress(alphaMode, w, count, 1, tmp.data(), dispatcher, compressionOptions, outputOptions);
+    }
+
+    outputOptions.endImage();
+
+    return success;
+}
+
+
+// Virtual texture version of the out-of-core API. The levels are processed in rows of pages: the rows covered by
+// each row of pages are read into a band, including the borders, and then all the pages of the band are cropped
+// and compressed in parallel.
+bool Compressor::Private::compressPages(const InputOptions::Private & inputOptions, ImageSource * source, int pageSize, int borderSize, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    int width, height, mipmapCount;
+    if (!setupOutOfCore(inputOptions, source, compressionOptions, outputOptions, &width, &height, &mipmapCount)) {
+        return false;
+    }
+
+    if (pageSize <= 0 || borderSize < 0) {
+        outputOptions.error(Error_InvalidInput);
+        return false;
+    }
+
+    AutoPtr<CompressorInterface> compressor(chooseCpuCompressor(compressionOptions));
+    if (compressor == NULL) {
+        outputOptions.error(Error_UnsupportedFeature);
+        return false;
+    }
+
+    const uint bitCount = compressionOptions.getBitCount();
+    const uint pitchAlignment = compressionOptions.pitchAlignment;
+    const uint border = borderSize;
+
+    // The size of all the pages is known in advance, so the index can be output before the pages.
+    Array<PagePackLevel> levels;
+    levels.resize(mipmapCount);
+
+    uint pageCount = 0;
+    for (int m = 0; m < mipmapCount; m++) {
+        PagePackLevel & level = levels[m];
+        level.width = max(1U, uint(width) >> m);
+        level.height = max(1U, uint(height) >> m);
+        level.pageCountX = (level.width + pageSize - 1) / pageSize;
+        level.pageCountY = (level.height + pageSize - 1) / pageSize;
+        level.firstPage = pageCount;
+        pageCount += level.pageCountX * level.pageCountY;
+    }
+
+    Array<PagePackEntry> index;
+    index.resize(pageCount);
+
+    uint64 offset = sizeof(PagePackHeader) + levels.size() * sizeof(PagePackLevel) + index.size() * sizeof(PagePackEntry);
+    for (int m = 0; m < mipmapCount; m++) {
+        const PagePackLevel & level = levels[m];
+        for (uint y = 0; y < level.pageCountY; y++) {
+            for (uint x = 0; x < level.pageCountX; x++) {
+                const uint w = min(uint(pageSize), level.width - x * pageSize) + 2 * border;
+                const uint h = min(uint(pageSize), level.height - y * pageSize) + 2 * border;
+
+                PagePackEntry & entry = index[level.firstPage + y * level.pageCountX + x];
+                entry.offset = offset;
+                entry.size = computeImageSize(w, h, 1, bitCount, pitchAlignment, compressionOptions.format);
+                entry.reserved = 0;
+                offset += entry.size;
+            }
+        }
+    }
+
+    PagePackHeader header;
+    header.fourcc = FOURCC_NVVT;
+    header.version = PagePackVersion;
+    header.width = width;
+    header.height = height;
+    header.pageSize = pageSize;
+    header.borderSize = borderSize;
+    header.format = compressionOptions.format;
+    header.flags = 0;
+    if (inputOptions.isNormalMap) header.flags |= PagePackFlag_NormalMap;
+    if (outputOptions.srgb) header.flags |= PagePackFlag_SRGB;
+    header.mipmapCount = mipmapCount;
+    header.pageCount = pageCount;
+
+    header.swapBytes();
+    for (uint i = 0; i < levels.size(); i++) levels[i].swapBytes();
+    for (uint i = 0; i < index.size(); i++) index[i].swapBytes();
+
+    if (!outputOptions.writeData(&header, sizeof(header)) ||
+        !outputOptions.writeData(levels.buffer(), levels.size() * sizeof(PagePackLevel)) ||
+        !outputOptions.writeData(index.buffer(), index.size() * sizeof(PagePackEntry)))
+    {
+        outputOptions.error(Error_FileWrite);
+        return false;
+    }
+
+    MipmapChain chain(source, width, height, memoryBudget, inputOptions, compressionOptions);
+
+    for (int m = 0; m < mipmapCount; m++)
+    {
+        if (!chain.nextLevel()) {
+            outputOptions.error(Error_InvalidInput);
+            return false;
+        }
+
+        bool success;
+        if (chain.inMemory()) {
+            FloatImageRowSource level(chain.image().m->image);
+            success = compressPages(&level, inputOptions, pageSize, border, m, compressor.ptr(), compressionOptions, outputOptions);
+        }
+        else {
+            success = compressPages(chain.source(), inputOptions, pageSize, border, m, compressor.ptr(), compressionOptions, outputOptions);
+        }
+
+        if (!success) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Compress the pages of one mipmap level, one row of pages at a time.
+bool Compressor::Private::compressPages(RowSource * source, const InputOptions::Private & inputOptions, uint pageSize, uint borderSize, int mipmap, CompressorInterface * compressor, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    const uint w = source->width();
+    const uint h = source->height();
+    const uint pageCountX = (w + pageSize - 1) / pageSize;
+    const uint maxPageSize = pageSize + 2 * borderSize;
+    const FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)inputOptions.wrapMode;
+
+    const uint bitCount = compressionOptions.getBitCount();
+    const uint pitchAlignment = compressionOptions.pitchAlignment;
+
+    // Only a hint, pages of large levels can add up to more than 2GB.
+    uint64 size = 0;
+    for (uint y = 0; y < h; y += pageSize) {
+        for (uint x = 0; x < w; x += pageSize) {
+            size += computeImageSize(min(pageSize, w - x) + 2 * borderSize, min(pageSize, h - y) + 2 * borderSize, 1, bitCount, pitchAlignment, compressionOptions.format);
+        }
+    }
+    outputOptions.beginImage(int(min<uint64>(size, NV_INT32_MAX)), w, h, 1, 0, mipmap);
+
+    // Each page is compressed to memory with its own output handler, the row of pages is output at once.
+    Array<MemoryOutputHandler> outputHandlers;
+    outputHandlers.resize(pageCountX);
+
+    Array<OutputOptions::Private> pageOutputOptions;
+    pageOutputOptions.resize(pageCountX);
+
+    for (uint i = 0; i < pageCountX; i++) {
+        OutputOptions::Private & options = pageOutputOptions[i];
+        options.redirect(outputOptions, &outputHandlers[i]);
+        options.outputHeader = false;
+    }
+
+    Array<uint> pageOffsets;
+    pageOffsets.resize(pageCountX + 1);
+
+    Array<float> pages;
+    pages.resize(pageCountX * maxPageSize * maxPageSize * 4);
+
+    Array<uint8> output;
+
+    nvtt::Surface band;
+    band.setAlphaMode(inputOptions.alphaMode);
+    band.setNormalMap(inputOptions.isNormalMap);
+    band.m->image = new FloatImage;
+
+    nvtt::Surface tmp;
+    FloatImage rows;
+    FloatImage edgeRow;
+
+    bool success = true;
+
+    for (uint y = 0; y < h && success; y += pageSize)
+    {
+        const uint bandWidth = w + 2 * borderSize;
+        const uint bandHeight = min(pageSize, h - y) + 2 * borderSize;
+
+        // Rows inside the level are read at once, the border rows outside of it are wrapped.
+        const int first = int(y) - int(borderSize);
+        const uint rowBegin = uint(max(first, 0));
+        const uint rowEnd = min(y + pageSize + borderSize, h);
+
+        if (!source->readRows(rowBegin, rowEnd - rowBegin, &rows)) {
+            outputOptions.error(Error_InvalidInput);
+            success = false;
+            break;
+        }
+
+        FloatImage * img = band.m->image;
+        img->allocate(4, bandWidth, bandHeight);
+
+        for (uint r = 0; r < bandHeight; r++)
+        {
+            const uint sy = wrapIndex(first + int(r), h, wrapMode);
+
+            const FloatImage * src = &rows;
+            uint srcRow = sy - rowBegin;
+
+            if (sy < rowBegin || sy >= rowEnd) {
+                if (!source->readRows(sy, 1, &edgeRow)) {
+                    outputOptions.error(Error_InvalidInput);
+                    success = false;
+                    break;
+                }
+                src = &edgeRow;
+                srcRow = 0;
+            }
+
+            for (uint c = 0; c < 4; c++) {
+                const float * srcLine = src->scanline(c, srcRow, 0);
+                float * dstLine = img->scanline(c, r, 0);
+
+                for (uint x = 0; x < borderSize; x++) {
+                    dstLine[x] = srcLine[wrapIndex(int(x) - int(borderSize), w, wrapMode)];
+                    dstLine[borderSize + w + x] = srcLine[wrapIndex(int(w + x), w, wrapMode)];
+                }
+                memcpy(dstLine + borderSize, srcLine, w * sizeof(float));
+            }
+        }
+
+        if (!success) break;
+
+        if (!inputOptions.isNormalMap) {
+            nvtt::toGamma(band, inputOptions.outputGamma, &tmp);
+        }
+        else {
+            nvtt::packNormals(band, 0.5f, 0.5f, &tmp);
+        }
+
+        quantize(tmp, compressionOptions);
+
+        pageOffsets[0] = 0;
+        for (uint i = 0; i < pageCountX; i++) {
+            const uint pw = min(pageSize, w - i * pageSize) + 2 * borderSize;
+            pageOffsets[i + 1] = pageOffsets[i] + computeImageSize(pw, bandHeight, 1, bitCount, pitchAlignment, compressionOptions.format);
+        }
+        output.resize(pageOffsets[pageCountX]);
+
+        PageRowContext context;
+        context.band = tmp.data();
+        context.bandWidth = bandWidth;
+        context.bandHeight = bandHeight;
+        context.levelWidth = w;
+        context.pageSize = pageSize;
+        context.borderSize = borderSize;
+        context.pages = pages.buffer();
+        context.output = output.buffer();
+        context.pageOffsets = pageOffsets.buffer();
+        context.outputHandlers = outputHandlers.buffer();
+        context.outputOptions = pageOutputOptions.buffer();
+        context.compressor = compressor;
+        context.alphaMode = inputOptions.alphaMode;
+        context.compressionOptions = &compressionOptions;
+
+        dispatcher->dispatch(compressPageTask, &context, pageCountX);
+
+        if (!outputOptions.writeData(output.buffer(), output.size())) {
+            outputOptions.error(Error_FileWrite);
+            success = false;
+        }
+    }
+
+    outputOptions.endImage();
+
+    return success;
+}
+
+
 void Compressor::Private::quantize(Surface & img, const CompressionOptions::Private & compressionOptions) const
 {
+    // Channels that are dithered together.
+    int bits[4] = { -1, -1, -1, -1 };
+
     if (compressionOptions.enableColorDithering) {
         if (compressionOptions.format >= Format_BC1 && compressionOptions.format <= Format_BC3) {
-            img.quantize(0, 5, true, true);
-            img.quantize(1, 6, true, true);
-            img.quantize(2, 5, true, true);
+            bits[0] = 5;
+            bits[1] = 6;
+            bits[2] = 5;
         }
         else if (compressionOptions.format == Format_RGB) {
-            img.quantize(0, compressionOptions.rsize, true, true);
-            img.quantize(1, compressionOptions.gsize, true, true);
-            img.quantize(2, compressionOptions.bsize, true, true);
+            bits[0] = compressionOptions.rsize;
+            bits[1] = compressionOptions.gsize;
+            bits[2] = compressionOptions.bsize;
         }
     }
     if (compressionOptions.enableAlphaDithering) {
         if (compressionOptions.format == Format_RGB) {
-            img.quantize(3, compressionOptions.asize, true, true);
+            bits[3] = compressionOptions.asize;
         }
     }
     else if (compressionOptions.binaryAlpha) {
         img.binarize(3, float(compressionOptions.alphaThreshold)/255.0f, compressionOptions.enableAlphaDithering);
     }
+
+    if (bits[0] >= 0 || bits[3] >= 0) {
+        nvtt::quantize(img, bits, true, true);
+    }
 }
 
 
@@ -654,6 +1590,9 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
         // Swap bytes if necessary.
         header.swapBytes();
 
+        // In the streaming layout the output is held until all the surfaces of the texture are done.
+        outputOptions.beginTexture(textureType == TextureType_Cube ? 6 : 1, mipmapCount);
+
         bool writeSucceed = outputOptions.writeData(&header, headerSize);
         if (!writeSucceed)
         {
@@ -35,6 +35,7 @@
 namespace nv
 {
     class Image;
+    class RowSource;
 }
 
 namespace nvtt
@@ -46,8 +47,16 @@ namespace nvtt
         Private() {}
 
         bool compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressCached(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
         bool compress(const Surface & tex, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressMipmap(const Surface & img, Surface & tmp, int face, int mipmap, const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
         bool compress(AlphaMode alphaMode, int w, int h, int d, int face, int mipmap, const float * data, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool canCompressColor32(const InputOptions::Private & inputOptions, int w, int h, int d, int mipmapCount, const CompressionOptions::Private & compressionOptions) const;
+        bool compressColor32(const InputOptions::Private & inputOptions, int mipmapCount, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compress(const InputOptions::Private & inputOptions, ImageSource * source, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compress(nv::RowSource * source, AlphaMode alphaMode, bool isNormalMap, float outputGamma, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressPages(const InputOptions::Private & inputOptions, ImageSource * source, int pageSize, int borderSize, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressPages(nv::RowSource * source, const InputOptions::Private & inputOptions, uint pageSize, uint borderSize, int mipmap, nv::CompressorInterface * compressor, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
 
         void quantize(Surface & tex, const CompressionOptions::Private & compressionOptions) const;
 
@@ -63,6 +72,11 @@ namespace nvtt
         nv::AutoPtr<nv::CudaContext> cuda;
 
         TaskDispatcher * dispatcher;
+
+        Cache * cache;
+
+        // Working memory used by the out-of-core API.
+        uint64 memoryBudget;
         //SequentialTaskDispatcher defaultDispatcher;
         ConcurrentTaskDispatcher defaultDispatcher;
     };
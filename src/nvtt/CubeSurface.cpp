@@ -25,9 +25,14 @@
 #include "Surface.h"
 
 #include "nvimage/DirectDrawSurface.h"
+#include "nvimage/Filter.h"
+#include "nvimage/Reduction.h"
 
+#include "nvmath/SphericalHarmonic.h"
 #include "nvmath/Vector.inl"
 
+#include "nvthread/Mutex.h"
+
 #include "nvcore/Array.inl"
 #include "nvcore/StrLib.h"
 
@@ -203,6 +208,167 @@ static const Vector3 faceV[6] = {
     Vector3(0, -1, 0),
 };
 
+// Face and texture coordinates in the [0, 1] range corresponding to the given direction.
+static uint cubeCoordinates(const Vector3 & dir, float * s, float * t)
+{
+    uint f;
+    float ma;
+    if (fabs(dir.x) > fabs(dir.y) && fabs(dir.x) > fabs(dir.z)) {
+        f = (dir.x > 0) ? 0 : 1;
+        ma = fabsf(dir.x);
+    }
+    else if (fabs(dir.y) > fabs(dir.z)) {
+        f = (dir.y > 0) ? 2 : 3;
+        ma = fabsf(dir.y);
+    }
+    else {
+        f = (dir.z > 0) ? 4 : 5;
+        ma = fabsf(dir.z);
+    }
+
+    // uv coordinates in the [-1, 1] range, as in texelDirection.
+    float u = dot(dir, faceU[f]) / ma;
+    float v = dot(dir, faceV[f]) / ma;
+
+    *s = (u + 1) * 0.5f;
+    *t = (v + 1) * 0.5f;
+
+    return f;
+}
+
+// Bilinear sample of the RGB channels of a face. sampleLinearClamp puts texel centers at integer coordinates, so offset by half a texel.
+static Vector3 sampleFace(const FloatImage * img, float s, float t)
+{
+    s -= 0.5f / img->width();
+    t -= 0.5f / img->height();
+
+    Vector3 color;
+    color.x = img->sampleLinearClamp(0, s, t);
+    color.y = img->sampleLinearClamp(1, s, t);
+    color.z = img->sampleLinearClamp(2, s, t);
+
+    return color;
+}
+
+// Texel of the cube corresponding to the texel (x, y) of the given face, where x and y may be outside of the face.
+// Texels outside of the face are taken from the adjacent faces.
+static uint cubeTexel(uint f, int x, int y, uint edgeLength, uint * cx, uint * cy)
+{
+    if (x >= 0 && x < int(edgeLength) && y >= 0 && y < int(edgeLength)) {
+        *cx = x;
+        *cy = y;
+        return f;
+    }
+
+    // Extend the plane of the face, and find the face it projects to.
+    float u = (float(x) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+    float v = (float(y) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+    Vector3 dir = faceNormals[f] + faceU[f] * u + faceV[f] * v;
+
+    float s, t;
+    uint face = cubeCoordinates(dir, &s, &t);
+
+    *cx = clamp(int(s * edgeLength), 0, int(edgeLength) - 1);
+    *cy = clamp(int(t * edgeLength), 0, int(edgeLength) - 1);
+    return face;
+}
+
+// Value of the texel (x, y) of the given face, where x and y may be outside of the face. Texels outside of the face
+// are interpolated from the adjacent faces at the point where the extended plane of the face projects to.
+static void sampleCubeTexel(const CubeSurface::Private * cube, uint f, int x, int y, float * color)
+{
+    const uint edgeLength = cube->edgeLength;
+
+    if (x >= 0 && x < int(edgeLength) && y >= 0 && y < int(edgeLength)) {
+        const FloatImage * img = cube->face[f].m->image;
+        for (uint c = 0; c < 4; c++) {
+            color[c] = img->pixel(c, x, y, 0);
+        }
+        return;
+    }
+
+    float u = (float(x) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+    float v = (float(y) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+    Vector3 dir = faceNormals[f] + faceU[f] * u + faceV[f] * v;
+
+    float s, t;
+    const FloatImage * img = cube->face[cubeCoordinates(dir, &s, &t)].m->image;
+
+    // sampleLinearClamp puts texel centers at integer coordinates.
+    s -= 0.5f / edgeLength;
+    t -= 0.5f / edgeLength;
+
+    for (uint c = 0; c < 4; c++) {
+        color[c] = img->sampleLinearClamp(c, s, t);
+    }
+}
+
+// Average the texels along the edges of each face with the texels on the other side of the edge, so that there are
+// no discontinuities at the seams.
+static void averageEdges(CubeSurface::Private * cube)
+{
+    const uint edgeLength = cube->edgeLength;
+    const int L = int(edgeLength) - 1;
+
+    struct EdgeTexel {
+        uint face, x, y;
+        float color[4];
+    };
+    Array<EdgeTexel> edgeTexels;
+    edgeTexels.reserve(6 * 4 * edgeLength);
+
+    // Compute all the averages first, so that both sides of the edge get the same value.
+    for (uint f = 0; f < 6; f++) {
+        const FloatImage * img = cube->face[f].m->image;
+
+        for (int y = 0; y <= L; y++) {
+            for (int x = 0; x <= L; x++) {
+                if (x != 0 && x != L && y != 0 && y != L) {
+                    // Skip to the right edge.
+                    x = L - 1;
+                    continue;
+                }
+
+                EdgeTexel texel;
+                texel.face = f;
+                texel.x = x;
+                texel.y = y;
+                for (uint c = 0; c < 4; c++) {
+                    texel.color[c] = img->pixel(c, x, y, 0);
+                }
+                int count = 1;
+
+                const int neighbors[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+                for (uint i = 0; i < 4; i++) {
+                    const int nx = neighbors[i][0];
+                    const int ny = neighbors[i][1];
+                    if (nx >= 0 && nx <= L && ny >= 0 && ny <= L) continue;
+
+                    uint cx, cy;
+                    const uint cf = cubeTexel(f, nx, ny, edgeLength, &cx, &cy);
+                    for (uint c = 0; c < 4; c++) {
+                        texel.color[c] += cube->face[cf].m->image->pixel(c, cx, cy, 0);
+                    }
+                    count++;
+                }
+
+                for (uint c = 0; c < 4; c++) {
+                    texel.color[c] /= count;
+                }
+                edgeTexels.append(texel);
+            }
+        }
+    }
+
+    for (uint i = 0; i < edgeTexels.count(); i++) {
+        const EdgeTexel & texel = edgeTexels[i];
+        FloatImage * img = cube->face[texel.face].m->image;
+        for (uint c = 0; c < 4; c++) {
+            img->pixel(c, texel.x, texel.y, 0) = texel.color[c];
+        }
+    }
+}
+
 
 static Vector2 toPolar(Vector3::Arg v) {
     Vector2 p;
@@ -381,48 +547,89 @@ Surface CubeSurface::unfold(CubeLayout layout) const
 }
 
 
-float CubeSurface::average(int channel) const
+namespace
 {
-    const uint edgeLength = m->edgeLength;
-    m->allocateTexelTable();
+    // Solid angle weighted sum of a channel. Rows of all faces are reduced together.
+    struct CubeAverageReduction
+    {
+        CubeAverageReduction(const CubeSurface::Private * cube, int channel) : cube(cube), channel(channel)
+        {
+            sum.resize(reductionChunkCount(6 * cube->edgeLength, RowChunkSize));
+            total.resize(reductionChunkCount(6 * cube->edgeLength, RowChunkSize));
+        }
 
-    float total = 0.0f;
-    float sum = 0.0f;
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            const uint edgeLength = cube->edgeLength;
 
-    for (int f = 0; f < 6; f++) {
-        float * c = m->face[f].m->image->channel(channel);
+            float s = 0.0f;
+            float t = 0.0f;
+
+            for (uint row = begin; row < end; row++) {
+                const uint f = row / edgeLength;
+                const uint y = row % edgeLength;
+                const float * c = cube->face[f].m->image->channel(channel) + y * edgeLength;
 
-         for (uint y = 0; y < edgeLength; y++) {
-             for (uint x = 0; x < edgeLength; x++) {
-                float solidAngle = m->texelTable->solidAngle(f, x, y);
+                for (uint x = 0; x < edgeLength; x++) {
+                    float solidAngle = cube->texelTable->solidAngle(f, x, y);
 
-                total += solidAngle;
-                sum += c[y * edgeLength + x] * solidAngle;
+                    t += solidAngle;
+                    s += c[x] * solidAngle;
+                }
             }
+
+            sum[chunk] = s;
+            total[chunk] = t;
         }
+
+        static const uint RowChunkSize = 16;
+
+        const CubeSurface::Private * cube;
+        const int channel;
+
+        Array<double> sum;
+        Array<double> total;
+    };
+
+} // namespace
+
+float CubeSurface::average(int channel) const
+{
+    m->expandFaces();
+
+    const uint edgeLength = m->edgeLength;
+    m->allocateTexelTable();
+
+    CubeAverageReduction reduction(m, channel);
+    parallelReduce(reduction, 6 * edgeLength, CubeAverageReduction::RowChunkSize);
+
+    double total = 0.0;
+    double sum = 0.0;
+    for (uint i = 0; i < reduction.sum.count(); i++) {
+        sum += reduction.sum[i];
+        total += reduction.total[i];
     }
 
-    return sum / total;
+    return float(sum / total);
 }
 
 void CubeSurface::range(int channel, float * minimum_ptr, float * maximum_ptr) const
 {
+    m->expandFaces();
+
     const uint edgeLength = m->edgeLength;
-    m->allocateTexelTable();
 
     float minimum = NV_FLOAT_MAX;
     float maximum = 0.0f;
 
     for (int f = 0; f < 6; f++) {
-        float * c = m->face[f].m->image->channel(channel);
+        const float * c = m->face[f].m->image->channel(channel);
 
-         for (uint y = 0; y < edgeLength; y++) {
-             for (uint x = 0; x < edgeLength; x++) {
+        ChannelStatistics stats;
+        channelStatistics(&c, 1, edgeLength * edgeLength, &stats);
 
-                 minimum = nv::min(minimum, c[y * edgeLength + x]);
-                 maximum = nv::max(maximum, c[y * edgeLength + x]);
-            }
-        }
+        minimum = nv::min(minimum, stats.minimum);
+        maximum = nv::max(maximum, stats.maximum);
     }
 
     *minimum_ptr = minimum;
@@ -437,47 +644,155 @@ void CubeSurface::clamp(int channel, float low/*= 0.0f*/, float high/*= 1.0f*/)
 
 
 
-#include "nvmath/SphericalHarmonic.h"
-
-CubeSurface CubeSurface::irradianceFilter(int size, EdgeFixup fixupMethod) const
+namespace
 {
-    m->allocateTexelTable();
+    // Number of coefficients of a second order spherical harmonic, Sh::basisNum(2).
+    const int ShBasisCount = 9;
 
-    // Transform this cube to spherical harmonic basis
-    Sh2 sh;
+    // Projection of the RGB channels of the cube to the SH basis. Rows of all faces are reduced together.
+    struct ShProjectionReduction
+    {
+        ShProjectionReduction(const CubeSurface::Private * cube) : cube(cube)
+        {
+            coefficients.resize(reductionChunkCount(6 * cube->edgeLength, RowChunkSize) * 3 * ShBasisCount);
+        }
 
-    // For each texel of the input cube.
-    const uint edgeLength = m->edgeLength;
-    for (uint f = 0; f < 6; f++) {
-        for (uint y = 0; y < edgeLength; y++) {
-            for (uint x = 0; x < edgeLength; x++) {
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            const uint edgeLength = cube->edgeLength;
+
+            double sh[3 * ShBasisCount] = { 0 };
+
+            Sh2 basis;
+
+            for (uint row = begin; row < end; row++) {
+                const uint f = row / edgeLength;
+                const uint y = row % edgeLength;
+                const FloatImage * img = cube->face[f].m->image;
+                const float * r = img->channel(0) + y * edgeLength;
+                const float * g = img->channel(1) + y * edgeLength;
+                const float * b = img->channel(2) + y * edgeLength;
+
+                // Accumulate the row in floats, and the rows in doubles.
+                float rowSh[3 * ShBasisCount] = { 0 };
+
+                for (uint x = 0; x < edgeLength; x++) {
+                    basis.eval(cube->texelTable->direction(f, x, y));
+
+                    const float solidAngle = cube->texelTable->solidAngle(f, x, y);
+                    const float R = r[x] * solidAngle;
+                    const float G = g[x] * solidAngle;
+                    const float B = b[x] * solidAngle;
+
+                    for (int i = 0; i < ShBasisCount; i++) {
+                        rowSh[0 * ShBasisCount + i] += R * basis.elemAt(i);
+                        rowSh[1 * ShBasisCount + i] += G * basis.elemAt(i);
+                        rowSh[2 * ShBasisCount + i] += B * basis.elemAt(i);
+                    }
+                }
+
+                for (int i = 0; i < 3 * ShBasisCount; i++) {
+                    sh[i] += rowSh[i];
+                }
+            }
+
+            for (int i = 0; i < 3 * ShBasisCount; i++) {
+                coefficients[chunk * 3 * ShBasisCount + i] = sh[i];
+            }
+        }
+
+        static const uint RowChunkSize = 16;
+
+        const CubeSurface::Private * cube;
+
+        Array<double> coefficients;
+    };
+
+    struct IrradianceEvalContext
+    {
+        CubeSurface::Private * cube;
+        float sh[3 * ShBasisCount];
+        EdgeFixup fixupMethod;
+    };
 
-                Vector3 dir = m->texelTable->direction(f, x, y);
-                float solidAngle = m->texelTable->solidAngle(f, x, y);
+    // Evaluate the irradiance of a row of the output cube.
+    void irradianceEvalTask(void * data, int row)
+    {
+        IrradianceEvalContext * ctx = (IrradianceEvalContext *)data;
+
+        const uint size = ctx->cube->edgeLength;
+        const uint f = row / size;
+        const uint y = row % size;
+
+        FloatImage * img = ctx->cube->face[f].m->image;
+        float * r = img->channel(0) + y * size;
+        float * g = img->channel(1) + y * size;
+        float * b = img->channel(2) + y * size;
+        float * a = img->channel(3) + y * size;
 
-                Sh2 shDir;
-                shDir.eval(dir);
+        Sh2 basis;
 
-                sh.addScaled(sh, solidAngle);
+        for (uint x = 0; x < size; x++) {
+            basis.eval(texelDirection(f, x, y, size, ctx->fixupMethod));
+
+            float R = 0, G = 0, B = 0;
+            for (int i = 0; i < ShBasisCount; i++) {
+                R += ctx->sh[0 * ShBasisCount + i] * basis.elemAt(i);
+                G += ctx->sh[1 * ShBasisCount + i] * basis.elemAt(i);
+                B += ctx->sh[2 * ShBasisCount + i] * basis.elemAt(i);
             }
+
+            r[x] = R;
+            g[x] = G;
+            b[x] = B;
+            a[x] = 1.0f;
         }
     }
 
+} // namespace
+
+// Irradiance is the convolution of the cube with the clamped cosine lobe. The lobe is almost entirely contained in
+// the first three SH bands, so we project the cube to those, scale each band by the lobe coefficients and evaluate
+// the result for each output texel. See: "An Efficient Representation for Irradiance Environment Maps", Ramamoorthi
+// and Hanrahan, 2001.
+CubeSurface CubeSurface::irradianceFilter(int size, EdgeFixup fixupMethod) const
+{
+    m->expandFaces();
+
+    m->allocateTexelTable();
+
+    // Transform this cube to spherical harmonic basis.
+    ShProjectionReduction reduction(m);
+    parallelReduce(reduction, 6 * m->edgeLength, ShProjectionReduction::RowChunkSize);
+
+    double sh[3 * ShBasisCount] = { 0 };
+    for (uint i = 0; i < reduction.coefficients.count(); i++) {
+        sh[i % (3 * ShBasisCount)] += reduction.coefficients[i];
+    }
+
+    // Convolve with the clamped cosine: A0 = PI, A1 = 2PI/3, A2 = PI/4. The result is divided by PI, so that the
+    // output is the cosine weighted average of the input, like in cosinePowerFilter with a power of 1.
+    static const float bandScale[ShBasisCount] = { 1.0f, 2.0f/3.0f, 2.0f/3.0f, 2.0f/3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
 
     // Evaluate spherical harmonic for each output texel.
     CubeSurface output;
     output.m->allocate(size);
 
+    IrradianceEvalContext context;
+    context.cube = output.m;
+    context.fixupMethod = fixupMethod;
+    for (int i = 0; i < 3 * ShBasisCount; i++) {
+        context.sh[i] = float(sh[i] * bandScale[i % ShBasisCount]);
+    }
 
+    nv::ParallelFor parallelFor(irradianceEvalTask, &context);
+    parallelFor.run(6 * size);
 
-
-    // @@ TODO
-    return CubeSurface();
+    return output;
 }
 
 
 
-
 // Convolve filter against this cube.
 Vector3 CubeSurface::Private::applyAngularFilter(const Vector3 & filterDir, float coneAngle, float * filterTable, int tableSize)
 {
@@ -740,6 +1055,8 @@ void ApplyAngularFilterTask(void * context, int id)
 
 CubeSurface CubeSurface::cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod) const
 {
+    m->expandFaces();
+
     // Allocate output cube.
     CubeSurface filteredCube;
     filteredCube.m->allocate(size);
@@ -791,24 +1108,8 @@ CubeSurface CubeSurface::cosinePowerFilter(int size, float cosinePower, EdgeFixu
     nv::ParallelFor parallelFor(ApplyAngularFilterTask, &context);
     parallelFor.run(6 * size * size);
 
-    // @@ Implement edge averaging.
     if (fixupMethod == EdgeFixup_Average) {
-        for (uint f = 0; f < 6; f++) {
-            nvtt::Surface filteredFace = filteredCube.m->face[f];
-            FloatImage * filteredImage = filteredFace.m->image;
-
-            // For each component.
-            for (uint c = 0; c < 3; c++) {
-                // @@ For each corner, sample the two adjacent faces.
-                filteredImage->pixel(c, 0, 0, 0);
-                filteredImage->pixel(c, size-1, 0, 0);
-                filteredImage->pixel(c, 0, size-1, 0);
-                filteredImage->pixel(c, size-1, size-1, 0);
-
-                // @@ For each edge, sample the adjacent face.
-
-            }
-        }
+        averageEdges(filteredCube.m);
     }
 
     return filteredCube;
@@ -818,38 +1119,17 @@ CubeSurface CubeSurface::cosinePowerFilter(int size, float cosinePower, EdgeFixu
 // Sample cubemap in the given direction.
 Vector3 CubeSurface::Private::sample(const Vector3 & dir)
 {
-    int f = -1;
-    if (fabs(dir.x) > fabs(dir.y) && fabs(dir.x) > fabs(dir.z)) {
-        if (dir.x > 0) f = 0;
-        else f = 1;
-    }
-    else if (fabs(dir.y) > fabs(dir.z)) {
-        if (dir.y > 0) f = 2;
-        else f = 3;
-    }
-    else {
-        if (dir.z > 0) f = 4;
-        else f = 5;
-    }
-    nvDebugCheck(f != -1);
-
-    // uv coordinates corresponding to filterDir.
-    float u = dot(dir, faceU[f]);
-    float v = dot(dir, faceV[f]);
+    float s, t;
+    uint f = cubeCoordinates(dir, &s, &t);
 
-    FloatImage * img = face[f].m->image;
-
-    Vector3 color;
-    color.x = img->sampleLinearClamp(0, u, v);
-    color.y = img->sampleLinearClamp(1, u, v);
-    color.z = img->sampleLinearClamp(2, u, v);
-
-    return color;
+    return sampleFace(face[f].m->image, s, t);
 }
 
 // @@ Not tested!
 CubeSurface CubeSurface::fastResample(int size, EdgeFixup fixupMethod) const
 {
+    m->expandFaces();
+
     // Allocate output cube.
     CubeSurface resampledCube;
     resampledCube.m->allocate(size);
@@ -873,14 +1153,421 @@ CubeSurface CubeSurface::fastResample(int size, EdgeFixup fixupMethod) const
         }
     }
 
-    // @@ Implement edge averaging. Share this code with cosinePowerFilter
     if (fixupMethod == EdgeFixup_Average) {
+        averageEdges(resampledCube.m);
     }
 
     return resampledCube;
 }
 
 
+namespace
+{
+    // A tap of the importance sampled cosine power lobe, in a frame where the lobe is centered around +z.
+    struct CosinePowerTap
+    {
+        Vector3 dir;
+        float level;    // Mipmap level of the input cube that covers the solid angle of the tap.
+    };
+
+    // Radical inverse in base 2, for the Hammersley point set.
+    inline float radicalInverse(uint32 bits)
+    {
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555) << 1) | ((bits & 0xAAAAAAAA) >> 1);
+        bits = ((bits & 0x33333333) << 2) | ((bits & 0xCCCCCCCC) >> 2);
+        bits = ((bits & 0x0F0F0F0F) << 4) | ((bits & 0xF0F0F0F0) >> 4);
+        bits = ((bits & 0x00FF00FF) << 8) | ((bits & 0xFF00FF00) >> 8);
+        return float(bits) * 2.3283064365386963e-10f; // 1 / 2^32
+    }
+
+    // Distribute the taps according to the pdf of the lobe, (n + 1) / (2 PI) * cos(theta)^n, and pick the level
+    // whose texels have the same solid angle as the tap. See "GPU-Based Importance Sampling", GPU Gems 3, chapter 20.
+    void computeCosinePowerTaps(float cosinePower, uint sampleCount, uint edgeLength, Array<CosinePowerTap> & taps)
+    {
+        const float texelSolidAngle = 4 * PI / (6 * float(edgeLength) * float(edgeLength));
+
+        taps.resize(sampleCount);
+
+        for (uint i = 0; i < sampleCount; i++) {
+            const float u = (float(i) + 0.5f) / sampleCount;
+            const float v = radicalInverse(i);
+
+            const float cosTheta = powf(u, 1.0f / (cosinePower + 1));
+            const float sinTheta = sqrtf(max(0.0f, 1 - cosTheta * cosTheta));
+            const float phi = 2 * PI * v;
+
+            const float pdf = (cosinePower + 1) / (2 * PI) * powf(cosTheta, cosinePower);
+            const float tapSolidAngle = 1.0f / (sampleCount * pdf);
+
+            taps[i].dir = Vector3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+            taps[i].level = max(0.0f, 0.5f * log2f(tapSolidAngle / texelSolidAngle) + 1.0f);
+        }
+    }
+
+    // The taps only depend on the filter parameters and the size of the input, and a mipmap chain is usually filtered
+    // with the same few parameters over and over, so they are computed once and shared by all the calls. Tables are
+    // never removed, so the references stay valid without holding the lock. When the cache is full the taps are
+    // computed in the given array.
+    struct CosinePowerTapTable
+    {
+        float cosinePower;
+        uint sampleCount;
+        uint edgeLength;
+        Array<CosinePowerTap> taps;
+    };
+
+    const uint MaxCosinePowerTapTables = 32;
+    CosinePowerTapTable s_cosinePowerTapTables[MaxCosinePowerTapTables];
+    uint s_cosinePowerTapTableCount = 0;
+    Mutex s_cosinePowerTapMutex;
+
+    const Array<CosinePowerTap> & cosinePowerTaps(float cosinePower, uint sampleCount, uint edgeLength, Array<CosinePowerTap> & uncachedTaps)
+    {
+        Lock<Mutex> lock(s_cosinePowerTapMutex);
+
+        for (uint i = 0; i < s_cosinePowerTapTableCount; i++) {
+            const CosinePowerTapTable & table = s_cosinePowerTapTables[i];
+            if (table.cosinePower == cosinePower && table.sampleCount == sampleCount && table.edgeLength == edgeLength) {
+                return table.taps;
+            }
+        }
+
+        if (s_cosinePowerTapTableCount == MaxCosinePowerTapTables) {
+            computeCosinePowerTaps(cosinePower, sampleCount, edgeLength, uncachedTaps);
+            return uncachedTaps;
+        }
+
+        CosinePowerTapTable & table = s_cosinePowerTapTables[s_cosinePowerTapTableCount];
+        table.cosinePower = cosinePower;
+        table.sampleCount = sampleCount;
+        table.edgeLength = edgeLength;
+        computeCosinePowerTaps(cosinePower, sampleCount, edgeLength, table.taps);
+        s_cosinePowerTapTableCount++;
+
+        return table.taps;
+    }
+
+    struct FastCosinePowerFilterContext
+    {
+        const Array<FloatImage *> * mipmaps;   // Mipmaps of each face, the first one is the face itself.
+        const Array<CosinePowerTap> * taps;
+        CubeSurface::Private * filteredCube;
+        EdgeFixup fixupMethod;
+    };
+
+    // Filter a row of the output cube.
+    void fastCosinePowerFilterTask(void * data, int row)
+    {
+        FastCosinePowerFilterContext * ctx = (FastCosinePowerFilterContext *)data;
+
+        const uint size = ctx->filteredCube->edgeLength;
+        const uint f = row / size;
+        const uint y = row % size;
+
+        const Array<CosinePowerTap> & taps = *ctx->taps;
+        const uint tapCount = taps.count();
+        const float maxLevel = float(ctx->mipmaps[0].count() - 1);
+
+        FloatImage * filteredImage = ctx->filteredCube->face[f].m->image;
+
+        for (uint x = 0; x < size; x++) {
+            const Vector3 n = texelDirection(f, x, y, size, ctx->fixupMethod);
+
+            // Tangent frame around the filter direction.
+            const Vector3 up = (fabsf(n.z) < 0.999f) ? Vector3(0, 0, 1) : Vector3(1, 0, 0);
+            const Vector3 tx = normalize(cross(up, n));
+            const Vector3 ty = cross(n, tx);
+
+            Vector3 color(0);
+
+            for (uint i = 0; i < tapCount; i++) {
+                const CosinePowerTap & tap = taps[i];
+                const Vector3 dir = tx * tap.dir.x + ty * tap.dir.y + n * tap.dir.z;
+
+                float s, t;
+                const uint face = cubeCoordinates(dir, &s, &t);
+
+                // Trilinear interpolation between the two closest levels.
+                const float level = min(tap.level, maxLevel);
+                const uint l0 = uint(level);
+                const uint l1 = min(l0 + 1, uint(maxLevel));
+                const float frac = level - float(l0);
+
+                Vector3 c = sampleFace(ctx->mipmaps[face][l0], s, t);
+                if (frac > 0.0f) {
+                    c = lerp(c, sampleFace(ctx->mipmaps[face][l1], s, t), frac);
+                }
+
+                color += c;
+            }
+
+            color *= 1.0f / tapCount;
+
+            filteredImage->pixel(0, x, y, 0) = color.x;
+            filteredImage->pixel(1, x, y, 0) = color.y;
+            filteredImage->pixel(2, x, y, 0) = color.z;
+            filteredImage->pixel(3, x, y, 0) = 1.0f;
+        }
+    }
+
+} // namespace
+
+// Monte Carlo approximation of cosinePowerFilter. Instead of visiting all the input texels inside the cone, each output
+// texel takes a fixed set of taps distributed according to the filter, and reads them from the mipmaps of the input
+// cube to avoid aliasing. The cost only depends on the size of the output and the number of samples.
+CubeSurface CubeSurface::fastCosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod, int sampleCount/*= 256*/) const
+{
+    m->expandFaces();
+
+    // Box filtered mipmaps of each face.
+    Array<FloatImage *> mipmaps[6];
+    for (uint f = 0; f < 6; f++) {
+        FloatImage * img = m->face[f].m->image;
+        mipmaps[f].append(img);
+
+        while (img->width() > 1 || img->height() > 1) {
+            img = img->fastDownSample();
+            mipmaps[f].append(img);
+        }
+    }
+
+    // The taps are the same for all texels of all faces.
+    Array<CosinePowerTap> uncachedTaps;
+    const Array<CosinePowerTap> & taps = cosinePowerTaps(cosinePower, max(sampleCount, 1), m->edgeLength, uncachedTaps);
+
+    // Allocate output cube.
+    CubeSurface filteredCube;
+    filteredCube.m->allocate(size);
+
+    FastCosinePowerFilterContext context;
+    context.mipmaps = mipmaps;
+    context.taps = &taps;
+    context.filteredCube = filteredCube.m;
+    context.fixupMethod = fixupMethod;
+
+    {
+        nv::ParallelFor parallelFor(fastCosinePowerFilterTask, &context);
+        parallelFor.run(6 * size);
+    }
+
+    if (fixupMethod == EdgeFixup_Average) {
+        averageEdges(filteredCube.m);
+    }
+
+    for (uint f = 0; f < 6; f++) {
+        for (uint i = 1; i < mipmaps[f].count(); i++) {
+            delete mipmaps[f][i];
+        }
+    }
+
+    return filteredCube;
+}
+
+
+namespace
+{
+    struct CubeMipmapContext
+    {
+        const CubeSurface::Private * inputCube;
+        CubeSurface::Private * outputCube;
+        const PolyphaseKernel * kernel;
+        int border;             // Texels that the kernel reads outside of each face.
+        FloatImage * rows;      // Horizontally filtered rows of each face, including the border.
+    };
+
+    // Box filter a whole face.
+    void cubeFastDownSampleTask(void * data, int f)
+    {
+        CubeMipmapContext * ctx = (CubeMipmapContext *)data;
+        ctx->outputCube->face[f].m->image = ctx->inputCube->face[f].m->image->fastDownSample();
+    }
+
+    // Filter a row of a face horizontally, reading the texels past the left and right edges from the adjacent faces.
+    void cubeMipmapRowTask(void * data, int i)
+    {
+        CubeMipmapContext * ctx = (CubeMipmapContext *)data;
+
+        const uint edgeLength = ctx->inputCube->edgeLength;
+        const int border = ctx->border;
+        const uint rowCount = edgeLength + 2 * border;
+        const uint f = i / rowCount;
+        const int y = int(i % rowCount) - border;
+
+        const PolyphaseKernel & kernel = *ctx->kernel;
+        const uint length = kernel.length();
+        const int windowSize = kernel.windowSize();
+        const float iscale = float(edgeLength) / float(length);
+        const float width = kernel.width();
+
+        // Gather the row with its borders.
+        const uint paddedLength = edgeLength + 2 * border;
+        Array<float> row;
+        row.resize(4 * paddedLength);
+
+        for (uint px = 0; px < paddedLength; px++) {
+            float color[4];
+            sampleCubeTexel(ctx->inputCube, f, int(px) - border, y, color);
+            for (uint c = 0; c < 4; c++) {
+                row[c * paddedLength + px] = color[c];
+            }
+        }
+
+        // Same windows as in FloatImage::applyKernelX.
+        FloatImage * rows = ctx->rows;
+        for (uint c = 0; c < 4; c++) {
+            const float * src = row.buffer() + c * paddedLength + border;
+            float * dst = rows->channel(c) + (f * rowCount + (y + border)) * length;
+
+            for (uint x = 0; x < length; x++) {
+                const float center = (0.5f + x) * iscale;
+                const int left = (int)floorf(center - width);
+
+                float sum = 0;
+                for (int j = 0; j < windowSize; j++) {
+                    sum += kernel.valueAt(x, j) * src[left + j];
+                }
+                dst[x] = sum;
+            }
+        }
+    }
+
+    // Filter a row of the output faces vertically.
+    void cubeMipmapColumnTask(void * data, int i)
+    {
+        CubeMipmapContext * ctx = (CubeMipmapContext *)data;
+
+        const uint edgeLength = ctx->inputCube->edgeLength;
+        const int border = ctx->border;
+        const uint rowCount = edgeLength + 2 * border;
+
+        const PolyphaseKernel & kernel = *ctx->kernel;
+        const uint length = kernel.length();
+        const int windowSize = kernel.windowSize();
+        const float iscale = float(edgeLength) / float(length);
+        const float width = kernel.width();
+
+        const uint f = i / length;
+        const uint y = i % length;
+
+        const float center = (0.5f + y) * iscale;
+        const int top = (int)floorf(center - width) + border;
+
+        FloatImage * img = ctx->outputCube->face[f].m->image;
+
+        for (uint c = 0; c < 4; c++) {
+            const float * src = ctx->rows->channel(c) + (f * rowCount + top) * length;
+            float * dst = img->channel(c) + y * length;
+
+            for (uint x = 0; x < length; x++) {
+                dst[x] = 0.0f;
+            }
+            for (int j = 0; j < windowSize; j++) {
+                const float w = kernel.valueAt(y, j);
+                const float * s = src + j * length;
+                for (uint x = 0; x < length; x++) {
+                    dst[x] += w * s[x];
+                }
+            }
+        }
+    }
+
+} // namespace
+
+bool CubeSurface::buildNextMipmap(MipmapFilter filter, EdgeFixup fixupMethod)
+{
+    float filterWidth;
+    float params[2];
+    getDefaultFilterWidthAndParams(filter, &filterWidth, params);
+
+    return buildNextMipmap(filter, filterWidth, params, fixupMethod);
+}
+
+// Downsample all the faces at once. Unlike mipmapping each face separately, the filter reads the texels past the edges
+// of each face from the adjacent faces, so the mipmaps don't have seams.
+bool CubeSurface::buildNextMipmap(MipmapFilter filter, float filterWidth, const float * params, EdgeFixup fixupMethod)
+{
+    if (isNull() || m->edgeLength == 1) {
+        return false;
+    }
+
+    m->expandFaces();
+
+    const uint edgeLength = m->edgeLength;
+    const uint size = edgeLength / 2;
+
+    CubeSurface result;
+
+    if (filter == MipmapFilter_Box && filterWidth == 0.5f && edgeLength % 2 == 0) {
+        // The 2x2 box doesn't reach across the edges, so the faces are independent.
+        result.m->edgeLength = size;
+
+        CubeMipmapContext context;
+        context.inputCube = m;
+        context.outputCube = result.m;
+
+        nv::ParallelFor parallelFor(cubeFastDownSampleTask, &context);
+        parallelFor.run(6);
+    }
+    else {
+        AutoPtr<Filter> f;
+        if (filter == MipmapFilter_Box) {
+            f = new BoxFilter(filterWidth);
+        }
+        else if (filter == MipmapFilter_Triangle) {
+            f = new TriangleFilter(filterWidth);
+        }
+        else {
+            nvDebugCheck(filter == MipmapFilter_Kaiser);
+            KaiserFilter * kaiser = new KaiserFilter(filterWidth);
+            if (params != NULL) kaiser->setParameters(params[0], params[1]);
+            f = kaiser;
+        }
+
+        PolyphaseKernel kernel(*f, edgeLength, size);
+
+        result.m->allocate(size);
+
+        CubeMipmapContext context;
+        context.inputCube = m;
+        context.outputCube = result.m;
+        context.kernel = &kernel;
+        context.border = kernel.windowSize();
+
+        const uint rowCount = edgeLength + 2 * context.border;
+        FloatImage rows;
+        rows.allocate(4, size, 6 * rowCount);
+        context.rows = &rows;
+
+        {
+            nv::ParallelFor parallelFor(cubeMipmapRowTask, &context);
+            parallelFor.run(6 * rowCount);
+        }
+        {
+            nv::ParallelFor parallelFor(cubeMipmapColumnTask, &context);
+            parallelFor.run(6 * size);
+        }
+    }
+
+    if (fixupMethod == EdgeFixup_Average) {
+        averageEdges(result.m);
+    }
+
+    // Keep the settings of the faces.
+    for (uint i = 0; i < 6; i++) {
+        Surface::Private * face = result.m->face[i].m;
+        face->type = m->face[i].m->type;
+        face->wrapMode = m->face[i].m->wrapMode;
+        face->alphaMode = m->face[i].m->alphaMode;
+        face->isNormalMap = m->face[i].m->isNormalMap;
+    }
+
+    *this = result;
+
+    return true;
+}
+
+
 void CubeSurface::toLinear(float gamma)
 {
     if (isNull()) return;
@@ -951,4 +1638,4 @@ void CubeSurface::sky(float turbidity, float albedo[3], float solarElevation) {
     }
     */
 }
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
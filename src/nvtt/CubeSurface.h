@@ -86,6 +86,14 @@ namespace nvtt
             }
         }
 
+        // Expand compact faces before accessing their pixels.
+        void expandFaces() const
+        {
+            for (uint i = 0; i < 6; i++) {
+                face[i].m->expand();
+            }
+        }
+
         void allocateTexelTable()
         {
             if (texelTable == NULL) {
@@ -112,6 +112,9 @@ void InputOptions::reset()
     m.kaiserAlpha = 4.0f;
     m.kaiserStretch = 1.0f;
 
+    m.alphaCoverage = false;
+    m.alphaCoverageRef = 0.5f;
+
     m.isNormalMap = false;
     m.normalizeMipmaps = true;
     m.convertToNormalMap = false;
@@ -120,6 +123,8 @@ void InputOptions::reset()
 
     m.maxExtent = 0;
     m.roundMode = RoundMode_None;
+
+    m.storageFormat = StorageFormat_Float;
 }
 
 
@@ -282,6 +287,14 @@ void InputOptions::setKaiserParameters(float width, float alpha, float stretch)
     m.kaiserStretch = stretch;
 }
 
+/// Scale the alpha of the mipmaps so that they have the same alpha test coverage as the top level. The mipmaps of each
+/// face are generated first and their alpha is scaled in a single pass. Ignored when compressing from an ImageSource.
+void InputOptions::setAlphaCoverage(bool enabled, float alphaRef/*= 0.5f*/)
+{
+    m.alphaCoverage = enabled;
+    m.alphaCoverageRef = alphaRef;
+}
+
 /// Indicate whether input is a normal map or not.
 void InputOptions::setNormalMap(bool b)
 {
@@ -325,3 +338,12 @@ void InputOptions::setRoundMode(RoundMode mode)
 {
     m.roundMode = mode;
 }
+
+/// Keep the working image and the mipmaps that are held for alpha coverage in the given format between processing steps, see
+/// Surface::compact. This reduces the memory used by each compression, but the intermediate results are rounded to the storage
+/// precision. The images are in linear space, so UNorm8 loses detail in the dark tones, Half is a better choice for most
+/// inputs. UNorm formats clamp to [0, 1], so don't use them with HDR input. Ignored when compressing from an ImageSource.
+void InputOptions::setStorageFormat(StorageFormat format)
+{
+    m.storageFormat = format;
+}
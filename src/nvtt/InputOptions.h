@@ -65,6 +65,10 @@ namespace nvtt
         float kaiserAlpha;
         float kaiserStretch;
 
+        // Alpha coverage preservation.
+        bool alphaCoverage;
+        float alphaCoverageRef;
+
         // Normal map options.
         bool isNormalMap;
         bool normalizeMipmaps;
@@ -75,6 +79,9 @@ namespace nvtt
         // Adjust extents.
         uint maxExtent;
         RoundMode roundMode;
+
+        // Format of the images kept between processing steps.
+        StorageFormat storageFormat;
     };
 
 } // nvtt namespace
@@ -24,8 +24,30 @@
 
 #include "OutputOptions.h"
 
+#include "nvimage/StreamingDDS.h"
+
+#include "nvcore/Array.inl"
+
+using namespace nv;
 using namespace nvtt;
 
+namespace
+{
+    // The output handler takes int sizes, write large buffers in pieces.
+    bool writeChunks(OutputHandler * outputHandler, const void * data, uint64 size)
+    {
+        const uint64 maxChunkSize = 1U << 30;
+        while (size > maxChunkSize) {
+            if (!outputHandler->writeData(data, int(maxChunkSize))) return false;
+            data = (const uint8 *)data + maxChunkSize;
+            size -= maxChunkSize;
+        }
+
+        return outputHandler->writeData(data, int(size));
+    }
+
+} // namespace
+
 
 OutputOptions::OutputOptions() : m(*new OutputOptions::Private())
 {
@@ -34,6 +56,9 @@ OutputOptions::OutputOptions() : m(*new OutputOptions::Private())
 
 OutputOptions::~OutputOptions()
 {
+    // Write the texture that is still held in the streaming layout, if any.
+    m.endTexture();
+
     // Cleanup output handler.
     setOutputHandler(NULL);
 
@@ -54,6 +79,14 @@ void OutputOptions::reset()
     m.version = 0;
     m.srgb = false;
     m.deleteOutputHandler = false;
+
+    m.writeBehind = false;
+    m.writeBehindBufferSize = 1024 * 1024;
+    m.writeBehindBufferCount = 4;
+    m.directIO = false;
+
+    m.streamingLayout = false;
+    m.streamingOutput = NULL;
 }
 
 
@@ -75,6 +108,7 @@ void OutputOptions::setFileName(const char * fileName)
         delete oh;
     }
     else {
+        oh->setWriteBehind(m.writeBehind, m.writeBehindBufferSize, m.writeBehindBufferCount, m.directIO);
         m.deleteOutputHandler = true;
         m.outputHandler = oh;
     }
@@ -97,11 +131,41 @@ void OutputOptions::setFileHandle(void * fp)
         delete oh;
     }
     else {
+        oh->setWriteBehind(m.writeBehind, m.writeBehindBufferSize, m.writeBehindBufferCount, m.directIO);
         m.deleteOutputHandler = true;
         m.outputHandler = oh;
     }
 }
 
+/// Write the mipmaps from the smallest to the largest, after an index of their offsets. See nvimage/StreamingDDS.h.
+/// The texture is written once all its surfaces are compressed. When using the low level API, a texture with fewer
+/// surfaces than declared in its header is written when the next one starts or the output options are destroyed.
+void OutputOptions::setStreamingLayout(bool b)
+{
+    m.streamingLayout = b;
+}
+
+/// Write the output file from a separate thread.
+///
+/// The data is copied to bufferCount buffers of bufferSize bytes, and compression only waits for the disk when
+/// all of them are full. When directIO is set, the output bypasses the page cache where the platform allows it.
+/// This only applies to the output of setFileName and setFileHandle, the file is complete once the output
+/// options are destroyed, or another output is set.
+void OutputOptions::setWriteBehind(bool enable, int bufferSize/*= 1024 * 1024*/, int bufferCount/*= 4*/, bool directIO/*= false*/)
+{
+    nvCheck(bufferSize > 0 && bufferCount > 0);
+
+    m.writeBehind = enable;
+    m.writeBehindBufferSize = bufferSize;
+    m.writeBehindBufferCount = bufferCount;
+    m.directIO = directIO;
+
+    if (m.deleteOutputHandler) {
+        DefaultOutputHandler * oh = (DefaultOutputHandler *)m.outputHandler;
+        oh->setWriteBehind(enable, bufferSize, bufferCount, directIO);
+    }
+}
+
 
 /// Set output handler.
 void OutputOptions::setOutputHandler(OutputHandler * outputHandler)
@@ -146,6 +210,29 @@ void OutputOptions::setSrgbFlag(bool b)
     m.srgb = b;
 }
 
+void OutputOptions::Private::redirect(const Private & options, OutputHandler * outputHandler)
+{
+    this->fileName.reset();
+    this->fileHandle = NULL;
+    this->outputHandler = outputHandler;
+    this->errorHandler = options.errorHandler;
+
+    this->outputHeader = options.outputHeader;
+    this->container = options.container;
+    this->version = options.version;
+    this->srgb = options.srgb;
+    this->deleteOutputHandler = false;
+
+    // The output handler is not a file, so these are ignored.
+    this->writeBehind = false;
+    this->writeBehindBufferSize = options.writeBehindBufferSize;
+    this->writeBehindBufferCount = options.writeBehindBufferCount;
+    this->directIO = false;
+
+    this->streamingLayout = options.streamingLayout;
+    this->streamingOutput = NULL;
+}
+
 bool OutputOptions::Private::hasValidOutputHandler() const
 {
     if (!fileName.isNull() || fileHandle != NULL)
@@ -156,21 +243,135 @@ bool OutputOptions::Private::hasValidOutputHandler() const
     return true;
 }
 
+void OutputOptions::Private::beginTexture(int faceCount, int mipmapCount) const
+{
+    endTexture();
+
+    if (streamingLayout && outputHandler != NULL) {
+        streamingOutput = new StreamingOutput(faceCount, mipmapCount);
+    }
+    else {
+        streamingOutput = NULL;
+    }
+}
+
 void OutputOptions::Private::beginImage(int size, int width, int height, int depth, int face, int miplevel) const
 {
+    if (streamingOutput != NULL) {
+        nvCheck(face < streamingOutput->faceCount && miplevel < streamingOutput->mipmapCount);
+
+        streamingOutput->current = miplevel * streamingOutput->faceCount + face;
+
+        StreamingOutput::Image & image = streamingOutput->images[streamingOutput->current];
+        image.data.reserve(size);
+        image.width = width;
+        image.height = height;
+        image.depth = depth;
+        return;
+    }
+
     if (outputHandler != NULL) outputHandler->beginImage(size, width, height, depth, face, miplevel);
 }
 
-bool OutputOptions::Private::writeData(const void * data, int size) const
+bool OutputOptions::Private::writeData(const void * data, uint64 size) const
 {
-    return outputHandler == NULL || outputHandler->writeData(data, size);
+    if (outputHandler == NULL) return true;
+
+    if (streamingOutput != NULL) {
+        Array<uint8> & buffer = (streamingOutput->current < 0) ? streamingOutput->header : streamingOutput->images[streamingOutput->current].data;
+        nvCheck(buffer.size() + size <= NV_INT32_MAX);
+        buffer.append((const uint8 *)data, uint(size));
+        return true;
+    }
+
+    return writeChunks(outputHandler, data, size);
 }
 
 void OutputOptions::Private::endImage() const
 {
+    if (streamingOutput != NULL) {
+        streamingOutput->current = -1;
+        streamingOutput->doneCount++;
+
+        if (streamingOutput->doneCount == streamingOutput->faceCount * streamingOutput->mipmapCount) {
+            const bool writeSucceed = writeStreamingOutput();
+            streamingOutput = NULL;
+
+            if (!writeSucceed) error(Error_FileWrite);
+        }
+        return;
+    }
+
     if (outputHandler != NULL) outputHandler->endImage();
 }
 
+// In the streaming layout the texture is written when its last surface is done. If fewer surfaces than declared in
+// the header were output, write what was produced and report the error. The missing surfaces have a size of zero in
+// the index.
+void OutputOptions::Private::endTexture() const
+{
+    if (streamingOutput == NULL) return;
+
+    const bool writeSucceed = writeStreamingOutput();
+    streamingOutput = NULL;
+
+    error(writeSucceed ? Error_InvalidInput : Error_FileWrite);
+}
+
+bool OutputOptions::Private::writeStreamingOutput() const
+{
+    const StreamingOutput & output = *streamingOutput;
+    const uint entryCount = output.faceCount * output.mipmapCount;
+
+    StreamingDDSHeader header;
+    header.fourcc = FOURCC_NVSD;
+    header.version = StreamingDDSVersion;
+    header.faceCount = output.faceCount;
+    header.mipmapCount = output.mipmapCount;
+    header.ddsHeaderSize = output.header.size();
+    header.dataOffset = sizeof(StreamingDDSHeader) + header.ddsHeaderSize + entryCount * sizeof(StreamingDDSEntry);
+
+    Array<StreamingDDSEntry> index;
+    index.resize(entryCount);
+
+    uint64 offset = header.dataOffset;
+    for (int m = output.mipmapCount - 1; m >= 0; m--) {
+        for (int f = 0; f < output.faceCount; f++) {
+            StreamingDDSEntry & entry = index[m * output.faceCount + f];
+            entry.offset = offset;
+            entry.size = output.images[m * output.faceCount + f].data.size();
+            entry.reserved = 0;
+            offset += entry.size;
+
+            entry.swapBytes();
+        }
+    }
+
+    header.swapBytes();
+
+    if (!writeChunks(outputHandler, &header, sizeof(header)) ||
+        !writeChunks(outputHandler, output.header.buffer(), output.header.size()) ||
+        !writeChunks(outputHandler, index.buffer(), index.size() * sizeof(StreamingDDSEntry)))
+    {
+        return false;
+    }
+
+    for (int m = output.mipmapCount - 1; m >= 0; m--) {
+        for (int f = 0; f < output.faceCount; f++) {
+            const StreamingOutput::Image & image = output.images[m * output.faceCount + f];
+            if (image.width == 0) continue;     // Missing surface.
+
+            outputHandler->beginImage(image.data.size(), image.width, image.height, image.depth, f, m);
+            const bool writeSucceed = writeChunks(outputHandler, image.data.buffer(), image.data.size());
+            outputHandler->endImage();
+
+            if (!writeSucceed) return false;
+        }
+    }
+
+    return true;
+}
+
 void OutputOptions::Private::error(Error e) const
 {
     if (errorHandler != NULL) errorHandler->error(e);
@@ -26,9 +26,12 @@
 #define NV_TT_OUTPUTOPTIONS_H
 
 #include "nvtt.h"
+#include "WriteBehind.h"
 
 #include "nvcore/StrLib.h" // Path
 #include "nvcore/StdStream.h"
+#include "nvcore/Ptr.h" // AutoPtr
+#include "nvcore/Array.h"
 
 
 namespace nvtt
@@ -49,7 +52,12 @@ namespace nvtt
 		// Output data.
 		virtual bool writeData(const void * data, int size)
 		{
-			stream.serialize(const_cast<void *>(data), size);
+			nvDebugCheck(size >= 0);
+			if (writeBehind != NULL) {
+				return writeBehind->write(data, uint64(size));
+			}
+
+			stream.serialize(const_cast<void *>(data), uint64(size));
 
 			//return !stream.isError();
 			return true;
@@ -60,7 +68,44 @@ namespace nvtt
 			// ignore.
 		}
 
+		void setWriteBehind(bool enable, uint bufferSize, uint bufferCount, bool directIO)
+		{
+			// Finish the writes of the previous settings first.
+			writeBehind = NULL;
+
+			if (enable) {
+				writeBehind = new WriteBehind(stream.fileHandle(), bufferSize, bufferCount, directIO);
+			}
+		}
+
 		nv::StdOutputStream stream;
+		nv::AutoPtr<WriteBehind> writeBehind;     // Destroyed before the stream, so that pending writes are done before it's closed.
+	};
+
+
+	// Output of a texture in the streaming layout. The surfaces are produced from the largest mipmap to the smallest
+	// one, so they are kept until the whole texture is done and then written in reverse order.
+	struct StreamingOutput
+	{
+		struct Image
+		{
+			Image() : width(0), height(0), depth(0) {}
+
+			nv::Array<uint8> data;
+			int width, height, depth;
+		};
+
+		StreamingOutput(int faceCount, int mipmapCount) : faceCount(faceCount), mipmapCount(mipmapCount), current(-1), doneCount(0)
+		{
+			images.resize(faceCount * mipmapCount);
+		}
+
+		int faceCount;
+		int mipmapCount;
+		nv::Array<uint8> header;
+		nv::Array<Image> images;        // Image mipmap * faceCount + face.
+		int current;                    // Image being written, -1 for the header.
+		int doneCount;
 	};
 
 
@@ -77,13 +122,30 @@ namespace nvtt
         int version;
         bool srgb;
         bool deleteOutputHandler;
+
+        bool writeBehind;
+        uint writeBehindBufferSize;
+        uint writeBehindBufferCount;
+        bool directIO;
+
+        bool streamingLayout;
+        mutable nv::AutoPtr<StreamingOutput> streamingOutput;
 		
+		// Use the settings of the given options with another output handler, that is not owned by these options.
+		void redirect(const Private & options, OutputHandler * outputHandler);
+
 		bool hasValidOutputHandler() const;
 
+		void beginTexture(int faceCount, int mipmapCount) const;
+		void endTexture() const;
+
 		void beginImage(int size, int width, int height, int depth, int face, int miplevel) const;
-		bool writeData(const void * data, int size) const;
+		bool writeData(const void * data, uint64 size) const;
         void endImage() const;
 		void error(Error e) const;
+
+	private:
+		bool writeStreamingOutput() const;
 	};
 
 	
@@ -28,14 +28,22 @@
 #include "nvmath/Matrix.inl"
 #include "nvmath/Color.h"
 #include "nvmath/Half.h"
+#include "nvmath/SimdVector.h" // NV_USE_SSE
 
 #include "nvimage/Filter.h"
 #include "nvimage/ImageIO.h"
+#include "nvimage/DirectDrawSurface.h"
 #include "nvimage/NormalMap.h"
 #include "nvimage/BlockDXT.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/PixelFormat.h"
 #include "nvimage/ErrorMetric.h"
+#include "nvimage/ErrorDiffusion.h"
+#include "nvimage/Reduction.h"
+
+#include "nvthread/ParallelFor.h"
+
+#include "nvcore/Array.inl"
 
 #include <float.h>
 #include <string.h> // memset, memcpy
@@ -103,6 +111,15 @@ namespace
         if (input > 0) return 1 << input;
         return ~input;
     }*/
+
+    // Operations work on float channels. Surfaces with a compact storage format are packed again when they are done.
+    struct Repack
+    {
+        Repack(Surface & s) : s(s) {}
+        ~Repack() { s.m->pack(); }
+
+        Surface & s;
+    };
 }
 
 bool nv::canMakeNextMipmap(uint w, uint h, uint d, uint min_size)
@@ -254,14 +271,53 @@ void Surface::operator=(const Surface & tex)
     m = tex.m;
 }
 
+// Detach the surface before changing its attributes. The image keeps its storage format.
+static void detachAttributes(Surface & s)
+{
+    if (s.m->refCount() > 1)
+    {
+        s.m->release();
+        s.m = new Surface::Private(*s.m);
+        s.m->addRef();
+        nvDebugCheck(s.m->refCount() == 1);
+    }
+}
+
+FloatPixels::FloatPixels(const Surface & s) : m_image(s.m->image)
+{
+    nv::Lock<nv::Mutex> lock(s.m->mutex);
+
+    if (m_image != NULL && m_image->isCompact()) {
+        m_scratch = new FloatImage;
+        m_image->expandTo(m_scratch.ptr());
+        m_image = m_scratch.ptr();
+    }
+}
+
 void Surface::detach()
 {
-    if (m->refCount() > 1)
+    detachAttributes(*this);
+
+    // The pixels are about to be modified, make sure they are stored as floats.
+    m->expand();
+}
+
+// Detach the surface without cloning its image. Only use this when the image is about to be replaced.
+static void detachWithoutImage(Surface & s)
+{
+    if (s.m->refCount() > 1)
     {
-        m->release();
-        m = new Surface::Private(*m);
-        m->addRef();
-        nvDebugCheck(m->refCount() == 1);
+        Surface::Private * p = new Surface::Private();
+        p->type = s.m->type;
+        p->wrapMode = s.m->wrapMode;
+        p->alphaMode = s.m->alphaMode;
+        p->isNormalMap = s.m->isNormalMap;
+        p->storageFormat = s.m->storageFormat;
+
+        s.m->release();
+        s.m = p;
+        s.m->addRef();
+        nvDebugCheck(s.m->refCount() == 1);
     }
 }
 
@@ -269,7 +325,7 @@ void Surface::setWrapMode(WrapMode wrapMode)
 {
     if (m->wrapMode != wrapMode)
     {
-        detach();
+        detachAttributes(*this);
         m->wrapMode = wrapMode;
     }
 }
@@ -278,7 +334,7 @@ void Surface::setAlphaMode(AlphaMode alphaMode)
 {
     if (m->alphaMode != alphaMode)
     {
-        detach();
+        detachAttributes(*this);
         m->alphaMode = alphaMode;
     }
 }
@@ -287,7 +343,7 @@ void Surface::setNormalMap(bool isNormalMap)
 {
     if (m->isNormalMap != isNormalMap)
     {
-        detach();
+        detachAttributes(*this);
         m->isNormalMap = isNormalMap;
     }
 }
@@ -353,53 +409,92 @@ float Surface::alphaTestCoverage(float alphaRef/*= 0.5*/) const
 
     alphaRef = nv::clamp(alphaRef, 1.0f/256, 255.0f/256);
 
-    return m->image->alphaTestCoverage(alphaRef, 3);
+    FloatPixels img(*this);
+
+    return img->alphaTestCoverage(alphaRef, 3);
 }
 
+namespace
+{
+    // Sum of the gamma corrected values of a channel, optionally weighted by alpha.
+    struct AverageReduction
+    {
+        AverageReduction(const float * c, const float * a, float gamma, uint count) : c(c), a(a), gamma(gamma)
+        {
+            sum.resize(reductionChunkCount(count));
+            alphaSum.resize(reductionChunkCount(count));
+        }
+
+        void reduce(uint chunk, uint begin, uint end)
+        {
+            float s = 0.0f;
+            float as = 0.0f;
+
+            if (a == NULL) {
+                for (uint i = begin; i < end; i++) {
+                    s += powf(c[i], gamma);
+                }
+                as = float(end - begin);
+            }
+            else {
+                for (uint i = begin; i < end; i++) {
+                    s += powf(c[i], gamma) * a[i];
+                    as += a[i];
+                }
+            }
+
+            sum[chunk] = s;
+            alphaSum[chunk] = as;
+        }
+
+        const float * c;
+        const float * a;
+        const float gamma;
+
+        Array<double> sum;
+        Array<double> alphaSum;
+    };
+
+} // namespace
+
 float Surface::average(int channel, int alpha_channel/*= -1*/, float gamma /*= 2.2f*/) const
 {
     if (m->image == NULL) return 0.0f;
 
-    const uint count = m->image->width() * m->image->height();
+    FloatPixels img(*this);
 
-    float sum = 0.0f;
-    const float * c = m->image->channel(channel);
-
-    float denom;
+    const uint count = img->width() * img->height();
 
-    if (alpha_channel == -1) {
-        for (uint i = 0; i < count; i++) {
-            sum += powf(c[i], gamma);
-        }
+    const float * c = img->channel(channel);
+    const float * a = (alpha_channel == -1) ? NULL : img->channel(alpha_channel);
 
-        denom = float(count);
-    }
-    else {
-        float alpha_sum = 0.0f;
-        const float * a = m->image->channel(alpha_channel);
-        
-        for (uint i = 0; i < count; i++) {
-            sum += powf(c[i], gamma) * a[i];
-            alpha_sum += a[i];
-        }
+    AverageReduction reduction(c, a, gamma, count);
+    parallelReduce(reduction, count);
 
-        denom = alpha_sum;
+    double sum = 0.0;
+    double denom = 0.0;
+    for (uint i = 0; i < reduction.sum.count(); i++) {
+        sum += reduction.sum[i];
+        denom += reduction.alphaSum[i];
     }
 
     // Avoid division by zero.
-    if (denom == 0.0f) return 0.0f;
+    if (denom == 0.0) return 0.0f;
 
-    return powf(sum / denom, 1.0f/gamma);
+    return powf(float(sum / denom), 1.0f/gamma);
 }
 
+// The pointer stays valid after the call, so compact surfaces are expanded in place.
 const float * Surface::data() const
 {
+    m->expand();
     return m->image->channel(0);
 }
 
 const float * Surface::channel(int i) const
 {
     if (i < 0 || i > 3) return NULL;
+    m->expand();
     return m->image->channel(i);
 }
 
@@ -411,57 +506,35 @@ void Surface::histogram(int channel, float rangeMin, float rangeMax, int binCoun
 
     if (m->image == NULL) return;
 
-    const float * c = m->image->channel(channel);
+    FloatPixels img(*this);
+
+    const float * c = img->channel(channel);
 
     float scale = float(binCount) / rangeMax;
     float bias = - scale * rangeMin;
 
-    const uint count = m->image->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float f = c[i] * scale + bias;
-        int idx = ifloor(f);
-        if (idx < 0) idx = 0;
-        if (idx > binCount-1) idx = binCount-1;
-        binPtr[idx]++;
-    }
+    ChannelStatistics stats;
+    channelStatistics(&c, 1, img->pixelCount(), &stats, scale, bias, binCount, binPtr);
 }
 
 void Surface::range(int channel, float * rangeMin, float * rangeMax, int alpha_channel/*= -1*/, float alpha_ref/*= 0.f*/) const
 {
     Vector2 range(FLT_MAX, -FLT_MAX);
 
-    FloatImage * img = m->image;
-
-    if (alpha_channel == -1) { // no alpha channel; just like the original range function
-
     if (m->image != NULL)
     {
-        float * c = img->channel(channel);
+        FloatPixels img(*this);
 
-        const uint count = img->pixelCount();
-        for (uint p = 0; p < count; p++) {
-            float f = c[p];
-            if (f < range.x) range.x = f;
-            if (f > range.y) range.y = f;
-        }
-    }
-    }
-    else { // use alpha test to ignore some pixels
-        //note, it's quite possible to get FLT_MAX,-FLT_MAX back if all pixels fail the test
+        const float * c = img->channel(channel);
 
-        if (m->image != NULL)
-        {
-            const float * c = img->channel(channel);
-            const float * a = img->channel(alpha_channel);
-
-            const uint count = img->pixelCount();
-            for (uint p = 0; p < count; p++) {
-                if(a[p]>alpha_ref) {
-                    float f = c[p];
-                    if (f < range.x) range.x = f;
-                    if (f > range.y) range.y = f;
-                }
-            }
+        if (alpha_channel == -1) { // no alpha channel; just like the original range function
+            ChannelStatistics stats;
+            channelStatistics(&c, 1, img->pixelCount(), &stats);
+            range.set(stats.minimum, stats.maximum);
+        }
+        else { // use alpha test to ignore some pixels
+            //note, it's quite possible to get FLT_MAX,-FLT_MAX back if all pixels fail the test
+            maskedRange(c, img->channel(alpha_channel), alpha_ref, img->pixelCount(), &range.x, &range.y);
         }
     }
 
@@ -469,6 +542,53 @@ void Surface::range(int channel, float * rangeMin, float * rangeMax, int alpha_c
     *rangeMax = range.y;
 }
 
+// Minimum, maximum, mean and histogram of all channels in a single pass.
+void Surface::statistics(Statistics * stats, float rangeMin/*= 0.0f*/, float rangeMax/*= 1.0f*/) const
+{
+    memset(stats, 0, sizeof(Statistics));
+
+    if (m->image == NULL) return;
+
+    FloatPixels img(*this);
+
+    const uint count = img->pixelCount();
+
+    const float * channels[4] = { img->channel(0), img->channel(1), img->channel(2), img->channel(3) };
+
+    const uint binCount = 256;
+    const float scale = (rangeMax > rangeMin) ? float(binCount) / (rangeMax - rangeMin) : 0.0f;
+    const float bias = - scale * rangeMin;
+
+    ChannelStatistics channelStats[4];
+    channelStatistics(channels, 4, count, channelStats, scale, bias, binCount, &stats->histogram[0][0]);
+
+    for (int c = 0; c < 4; c++) {
+        stats->minimum[c] = channelStats[c].minimum;
+        stats->maximum[c] = channelStats[c].maximum;
+        stats->mean[c] = float(channelStats[c].sum / count);
+    }
+}
+
+StorageFormat Surface::storageFormat() const
+{
+    return m->storageFormat;
+}
+
+void Surface::compact(StorageFormat format)
+{
+    nvStaticCheck(FloatImage::StorageFormat_Half == (FloatImage::StorageFormat)StorageFormat_Half);
+    nvStaticCheck(FloatImage::StorageFormat_UNorm16 == (FloatImage::StorageFormat)StorageFormat_UNorm16);
+    nvStaticCheck(FloatImage::StorageFormat_UNorm8 == (FloatImage::StorageFormat)StorageFormat_UNorm8);
+
+    if (storageFormat() == format) return;
+
+    detachAttributes(*this);
+
+    m->storageFormat = format;
+    if (format == StorageFormat_Float) m->expand();
+    else m->pack();
+}
+
 
 bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
 {
@@ -477,7 +597,8 @@ bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
         return false;
     }
 
-    detach();
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
     if (hasAlpha != NULL) {
         *hasAlpha = (img->componentCount() == 4);
@@ -492,17 +613,74 @@ bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
     return true;
 }
 
+// Only the selected mipmap is read and decoded. JPEG files are decoded at the smallest DCT scale that is large enough,
+// other files without mipmaps are loaded at full size.
+bool Surface::loadMipmap(const char * fileName, int minExtent, bool * hasAlpha/*= NULL*/)
+{
+    const char * extension = Path::extension(fileName);
+
+    if (strCaseCmp(extension, ".jpg") == 0 || strCaseCmp(extension, ".jpeg") == 0) {
+        AutoPtr<Image> img(ImageIO::load(fileName, uint(max(minExtent, 1))));
+        if (img == NULL) {
+            return false;
+        }
+
+        detachWithoutImage(*this);
+        Repack repack(*this);
+
+        if (hasAlpha != NULL) {
+            *hasAlpha = (img->format() == Image::Format_ARGB);
+        }
+
+        delete m->image;
+        m->image = new FloatImage(img.ptr());
+
+        return true;
+    }
+
+    if (strCaseCmp(extension, ".dds") != 0) {
+        return load(fileName, hasAlpha);
+    }
+
+    DirectDrawSurface dds(fileName);
+    if (!dds.isValid() || !dds.isSupported() || !dds.isTexture2D()) {
+        return false;
+    }
+
+    // Floating point surfaces are not decoded by DirectDrawSurface.
+    if (!dds.header.hasDX10Header() && dds.header.pf.fourcc == D3DFMT_A16B16G16R16F) {
+        return load(fileName, hasAlpha);
+    }
+
+    Image img;
+    dds.mipmap(&img, 0, dds.smallestMipmap(uint(max(minExtent, 1))));
+
+    detachWithoutImage(*this);
+    Repack repack(*this);
+
+    if (hasAlpha != NULL) {
+        *hasAlpha = dds.hasAlpha();
+    }
+
+    delete m->image;
+    m->image = new FloatImage(&img);
+
+    return true;
+}
+
 bool Surface::save(const char * fileName, bool hasAlpha/*=0*/, bool hdr/*=0*/) const
 {
     if (m->image == NULL) {
         return false;
     }
 
+    FloatPixels img(*this);
+
     if (hdr) {
-        return ImageIO::saveFloat(fileName, m->image, 0, 4);
+        return ImageIO::saveFloat(fileName, img.ptr(), 0, 4);
     }
     else {
-        AutoPtr<Image> image(m->image->createImage(0, 4));
+        AutoPtr<Image> image(img->createImage(0, 4));
         nvCheck(image != NULL);
 
         if (hasAlpha) {
@@ -516,7 +694,8 @@ bool Surface::save(const char * fileName, bool hasAlpha/*=0*/, bool hdr/*=0*/) c
 
 bool Surface::setImage(int w, int h, int d)
 {
-    detach();
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
     if (m->image == NULL) {
         m->image = new FloatImage();
@@ -557,7 +736,8 @@ static int filter(unsigned int code, struct _EXCEPTION_POINTERS *ep) {
 
 bool Surface::setImage(nvtt::InputFormat format, int w, int h, int d, const void * data)
 {
-    detach();
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
     if (m->image == NULL) {
         m->image = new FloatImage();
@@ -629,7 +809,8 @@ bool Surface::setImage(nvtt::InputFormat format, int w, int h, int d, const void
 
 bool Surface::setImage(InputFormat format, int w, int h, int d, const void * r, const void * g, const void * b, const void * a)
 {
-    detach();
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
     if (m->image == NULL) {
         m->image = new FloatImage();
@@ -707,7 +888,8 @@ bool Surface::setImage2D(Format format, Decoder decoder, int w, int h, const voi
         return false;
     }
 
-    detach();
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
     if (m->image == NULL) {
         m->image = new FloatImage();
@@ -810,7 +992,7 @@ bool Surface::setImage2D(Format format, Decoder decoder, int w, int h, const voi
 }
 
 
-static void getDefaultFilterWidthAndParams(int filter, float * filterWidth, float params[2])
+void nvtt::getDefaultFilterWidthAndParams(int filter, float * filterWidth, float params[2])
 {
     if (filter == ResizeFilter_Box) {
         *filterWidth = 0.5f;
@@ -847,9 +1029,11 @@ void Surface::resize(int w, int h, int d, ResizeFilter filter, float filterWidth
         return;
     }
 
-    detach();
+    // The image is about to be replaced, so it's only decoded to a copy when it's shared.
+    if (m->refCount() == 1) m->expand();
+    FloatPixels src(*this);
 
-    FloatImage * img = m->image;
+    FloatImage * img = NULL;
 
     FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)m->wrapMode;
 
@@ -858,25 +1042,25 @@ void Surface::resize(int w, int h, int d, ResizeFilter filter, float filterWidth
         if (filter == ResizeFilter_Box)
         {
             BoxFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
+            img = src->resize(filter, w, h, d, wrapMode, 3);
         }
         else if (filter == ResizeFilter_Triangle)
         {
             TriangleFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
+            img = src->resize(filter, w, h, d, wrapMode, 3);
         }
         else if (filter == ResizeFilter_Kaiser)
         {
             KaiserFilter filter(filterWidth);
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
+            img = src->resize(filter, w, h, d, wrapMode, 3);
         }
         else //if (filter == ResizeFilter_Mitchell)
         {
             nvDebugCheck(filter == ResizeFilter_Mitchell);
             MitchellFilter filter;
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
+            img = src->resize(filter, w, h, d, wrapMode, 3);
         }
     }
     else
@@ -884,28 +1068,31 @@ void Surface::resize(int w, int h, int d, ResizeFilter filter, float filterWidth
         if (filter == ResizeFilter_Box)
         {
             BoxFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode);
+            img = src->resize(filter, w, h, d, wrapMode);
         }
         else if (filter == ResizeFilter_Triangle)
         {
             TriangleFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode);
+            img = src->resize(filter, w, h, d, wrapMode);
         }
         else if (filter == ResizeFilter_Kaiser)
         {
             KaiserFilter filter(filterWidth);
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode);
+            img = src->resize(filter, w, h, d, wrapMode);
         }
         else //if (filter == ResizeFilter_Mitchell)
         {
             nvDebugCheck(filter == ResizeFilter_Mitchell);
             MitchellFilter filter;
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode);
+            img = src->resize(filter, w, h, d, wrapMode);
         }
     }
 
+    detachWithoutImage(*this);
+    Repack repack(*this);
+
     delete m->image;
     m->image = img;
 }
@@ -992,9 +1179,11 @@ bool Surface::buildNextMipmap(MipmapFilter filter, float filterWidth, const floa
         return false;
     }
 
-    detach();
+    // The image is about to be replaced, so it's only decoded to a copy when it's shared.
+    if (m->refCount() == 1) m->expand();
+    FloatPixels src(*this);
 
-    FloatImage * img = m->image;
+    FloatImage * img = NULL;
 
     FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)m->wrapMode;
 
@@ -1003,47 +1192,50 @@ bool Surface::buildNextMipmap(MipmapFilter filter, float filterWidth, const floa
         if (filter == MipmapFilter_Box)
         {
             BoxFilter filter(filterWidth);
-            img = img->downSample(filter, wrapMode, 3);
+            img = src->downSample(filter, wrapMode, 3);
         }
         else if (filter == MipmapFilter_Triangle)
         {
             TriangleFilter filter(filterWidth);
-            img = img->downSample(filter, wrapMode, 3);
+            img = src->downSample(filter, wrapMode, 3);
         }
         else if (filter == MipmapFilter_Kaiser)
         {
             nvDebugCheck(filter == MipmapFilter_Kaiser);
             KaiserFilter filter(filterWidth);
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->downSample(filter, wrapMode, 3);
+            img = src->downSample(filter, wrapMode, 3);
         }
     }
     else
     {
         if (filter == MipmapFilter_Box)
         {
-            if (filterWidth == 0.5f && img->depth() == 1) {
-                img = img->fastDownSample();
+            if (filterWidth == 0.5f && src->depth() == 1) {
+                img = src->fastDownSample();
             }
             else {
                 BoxFilter filter(filterWidth);
-                img = img->downSample(filter, wrapMode);
+                img = src->downSample(filter, wrapMode);
             }
         }
         else if (filter == MipmapFilter_Triangle)
         {
             TriangleFilter filter(filterWidth);
-            img = img->downSample(filter, wrapMode);
+            img = src->downSample(filter, wrapMode);
         }
         else //if (filter == MipmapFilter_Kaiser)
         {
             nvDebugCheck(filter == MipmapFilter_Kaiser);
             KaiserFilter filter(filterWidth);
             if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->downSample(filter, wrapMode);
+            img = src->downSample(filter, wrapMode);
         }
     }
 
+    detachWithoutImage(*this);
+    Repack repack(*this);
+
     delete m->image;
     m->image = img;
 
@@ -1056,11 +1248,9 @@ bool Surface::buildNextMipmapSolidColor(const float * const color_components)
         return false;
     }
 
-    detach();
-
     FloatImage * img = new FloatImage();
-    const uint w = max(1, m->image->m_width / 2);
-    const uint h = max(1, m->image->m_height / 2);
+    const uint w = max(1U, m->image->m_width / 2);
+    const uint h = max(1U, m->image->m_height / 2);
     img->allocate(m->image->m_componentCount, w, h);
 
     for(uint c = 0; c < img->m_componentCount; c++)
@@ -1068,6 +1258,9 @@ bool Surface::buildNextMipmapSolidColor(const float * const color_components)
         img->clear(c, color_components[c]);
     }
 
+    detachWithoutImage(*this);
+    Repack repack(*this);
+
     delete m->image;
     m->image = img;
 
@@ -1082,9 +1275,8 @@ void Surface::canvasSize(int w, int h, int d)
         return;
     }
 
-    detach();
-
-    FloatImage * img = m->image;
+    if (m->refCount() == 1) m->expand();
+    FloatPixels img(*this);
 
     FloatImage * new_img = new FloatImage;
     new_img->allocate(4, w, h, d);
@@ -1105,6 +1297,9 @@ void Surface::canvasSize(int w, int h, int d)
         }
     }
 
+    detachWithoutImage(*this);
+    Repack repack(*this);
+
     delete m->image;
     m->image = new_img;
     m->type = (d == 1) ? TextureType_2D : TextureType_3D;
@@ -1118,6 +1313,7 @@ void Surface::toLinear(float gamma)
     if (equal(gamma, 1.0f)) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->toLinear(0, 3, gamma);
 }
@@ -1128,6 +1324,7 @@ void Surface::toGamma(float gamma)
     if (equal(gamma, 1.0f)) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->toGamma(0, 3, gamma);
 }
@@ -1138,6 +1335,7 @@ void Surface::toLinear(int channel, float gamma)
     if (equal(gamma, 1.0f)) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->toLinear(channel, 1, gamma);
 }
@@ -1148,6 +1346,7 @@ void Surface::toGamma(int channel, float gamma)
     if (equal(gamma, 1.0f)) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->toGamma(channel, 1, gamma);
 }
@@ -1168,6 +1367,7 @@ void Surface::toSrgb()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
@@ -1193,6 +1393,7 @@ void Surface::toLinearFromSrgb()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
@@ -1220,6 +1421,7 @@ void Surface::toXenonSrgb()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
@@ -1238,6 +1440,7 @@ void Surface::transform(const float w0[4], const float w1[4], const float w2[4],
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     Matrix xform(
         Vector4(w0[0], w0[1], w0[2], w0[3]),
@@ -1257,6 +1460,7 @@ void Surface::swizzle(int r, int g, int b, int a)
     if (r == 0 && g == 1 && b == 2 && a == 3) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->swizzle(0, r, g, b, a);
 }
@@ -1268,6 +1472,7 @@ void Surface::scaleBias(int channel, float scale, float bias)
     if (equal(scale, 1.0f) && equal(bias, 0.0f)) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->scaleBias(channel, 1, scale, bias);
 }
@@ -1277,6 +1482,7 @@ void Surface::clamp(int channel, float low, float high)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->clamp(channel, 1, low, high);
 }
@@ -1286,6 +1492,7 @@ void Surface::blend(float red, float green, float blue, float alpha, float t)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * r = img->channel(0);
@@ -1308,6 +1515,7 @@ void Surface::premultiplyAlpha()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * r = img->channel(0);
@@ -1330,6 +1538,7 @@ void Surface::toGreyScale(float redScale, float greenScale, float blueScale, flo
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     float sum = redScale + greenScale + blueScale + alphaScale;
     redScale /= sum;
@@ -1357,6 +1566,7 @@ void Surface::setBorder(float r, float g, float b, float a)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     const uint w = img->width();
@@ -1399,6 +1609,7 @@ void Surface::fill(float red, float green, float blue, float alpha)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * r = img->channel(0);
@@ -1419,12 +1630,32 @@ void Surface::scaleAlphaToCoverage(float coverage, float alphaRef/*= 0.5f*/)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     alphaRef = nv::clamp(alphaRef, 1.0f/256, 255.0f/256);
 
     m->image->scaleAlphaToCoverage(coverage, alphaRef, 3);
 }
 
+void nvtt::scaleAlphaToCoverage(Surface * surfaces, int count, float coverage, float alphaRef/*= 0.5f*/)
+{
+    alphaRef = nv::clamp(alphaRef, 1.0f/256, 255.0f/256);
+
+    Array<FloatImage *> images;
+    for (int i = 0; i < count; i++) {
+        if (surfaces[i].isNull()) continue;
+
+        surfaces[i].detach();
+        images.append(surfaces[i].m->image);
+    }
+
+    nv::scaleAlphaToCoverage(images.buffer(), images.count(), coverage, alphaRef, 3);
+
+    for (int i = 0; i < count; i++) {
+        if (!surfaces[i].isNull()) surfaces[i].m->pack();
+    }
+}
+
 /*bool Surface::normalizeRange(float * rangeMin, float * rangeMax)
 {
     if (m->image == NULL) return false;
@@ -1453,157 +1684,599 @@ void Surface::scaleAlphaToCoverage(float coverage, float alphaRef/*= 0.5f*/)
     return true;
 }*/
 
-// Ideally you should compress/quantize the RGB and M portions independently.
-// Once you have M quantized, you would compute the corresponding RGB and quantize that.
-void Surface::toRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
+namespace
 {
-    if (isNull()) return;
+    // Pixels processed by each task of the color transforms.
+    const uint PixelChunkSize = 16 * 1024;
 
-    detach();
+    template <class Transform>
+    struct PixelTransformContext
+    {
+        const Transform * transform;
+        uint count;
+    };
 
-    threshold = ::clamp(threshold, 1e-6f, 1.0f);
+    template <class Transform>
+    void pixelTransformTask(void * data, int i)
+    {
+        const PixelTransformContext<Transform> * ctx = (const PixelTransformContext<Transform> *)data;
+        const uint begin = i * PixelChunkSize;
+        const uint end = min(begin + PixelChunkSize, ctx->count);
+        ctx->transform->run(begin, end);
+    }
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+    // Run a per pixel transform on chunks of pixels in parallel. The transform is called as:
+    //     void run(uint begin, uint end) const;
+    template <class Transform>
+    void transformPixels(const Transform & transform, uint count)
+    {
+        const uint chunkCount = (count + PixelChunkSize - 1) / PixelChunkSize;
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float R = nv::clamp(r[i], 0.0f, 1.0f);
-        float G = nv::clamp(g[i], 0.0f, 1.0f);
-        float B = nv::clamp(b[i], 0.0f, 1.0f);
-#if 1
-        float M = max(max(R, G), max(B, threshold));
+        if (chunkCount <= 1) {
+            transform.run(0, count);
+            return;
+        }
 
-        r[i] = R / M;
-        g[i] = G / M;
-        b[i] = B / M;
+        PixelTransformContext<Transform> context;
+        context.transform = &transform;
+        context.count = count;
 
-        a[i] = (M - threshold) / (1 - threshold);
+        ParallelFor parallelFor(pixelTransformTask<Transform>, &context);
+        parallelFor.run(chunkCount);
+    }
 
-#else
+#if NV_USE_SSE > 1
+    // Same as int(floorf(f)), including NaNs and out of range values.
+    inline __m128i floorToInt(__m128 f)
+    {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(f));
+        t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, f), _mm_set1_ps(1.0f)));
+        return _mm_cvttps_epi32(t);
+    }
 
-        // The optimal compressor theoretically produces the best results, but unfortunately introduces
-        // severe interpolation errors!
-        float bestM;
-        float bestError = FLT_MAX;
+    // Same as iround(f).
+    inline __m128i roundToInt(__m128 f)
+    {
+        return floorToInt(_mm_add_ps(f, _mm_set1_ps(0.5f)));
+    }
+#endif
+
+    // The SIMD versions of the transforms use the same operations in the same order as the scalar code, so that they
+    // produce identical results. nv::min and nv::max match _mm_min_ps and _mm_max_ps, also when there are NaNs.
 
-        int minM = iround(min(R, G, B) * 255.0f);
+    struct RGBMEncoder
+    {
+        float * r, * g, * b, * a;
+        float threshold;
 
-        for (int m = minM; m < 256; m++) {
-            float fm = float(m) / 255.0f;
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
 
-            // Encode.
-            int ir = iround(255.0f * nv::clamp(R / fm, 0.0f, 1.0f));
-            int ig = iround(255.0f * nv::clamp(G / fm, 0.0f, 1.0f));
-            int ib = iround(255.0f * nv::clamp(B / fm, 0.0f, 1.0f));
+#if NV_USE_SSE > 1
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 vthreshold = _mm_set1_ps(threshold);
+            const __m128 vscale = _mm_set1_ps(1 - threshold);
 
-            // Decode.
-            float fr = (float(ir) / 255.0f) * fm;
-            float fg = (float(ig) / 255.0f) * fm;
-            float fb = (float(ib) / 255.0f) * fm;
+            for (; i + 4 <= end; i += 4) {
+                __m128 R = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(r + i), zero), one);
+                __m128 G = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(g + i), zero), one);
+                __m128 B = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(b + i), zero), one);
 
-            // Measure error.
-            float error = square(R-fr) + square(G-fg) + square(B-fb);
+                __m128 M = _mm_max_ps(_mm_max_ps(R, G), _mm_max_ps(B, vthreshold));
 
-            if (error < bestError) {
-                bestError = error;
-                bestM = fm;
+                _mm_storeu_ps(r + i, _mm_div_ps(R, M));
+                _mm_storeu_ps(g + i, _mm_div_ps(G, M));
+                _mm_storeu_ps(b + i, _mm_div_ps(B, M));
+                _mm_storeu_ps(a + i, _mm_div_ps(_mm_sub_ps(M, vthreshold), vscale));
             }
-        }
-
-        M = bestM;
-        r[i] = nv::clamp(R / M, 0.0f, 1.0f);
-        g[i] = nv::clamp(G / M, 0.0f, 1.0f);
-        b[i] = nv::clamp(B / M, 0.0f, 1.0f);
-        a[i] = M;
 #endif
-    }
-}
 
+            for (; i < end; i++) {
+                float R = nv::clamp(r[i], 0.0f, 1.0f);
+                float G = nv::clamp(g[i], 0.0f, 1.0f);
+                float B = nv::clamp(b[i], 0.0f, 1.0f);
 
-void Surface::fromRGBM(float range/*= 1*/)
-{
-    if (isNull()) return;
+#if 1
+                float M = max(max(R, G), max(B, threshold));
 
-    detach();
+                r[i] = R / M;
+                g[i] = G / M;
+                b[i] = B / M;
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+                a[i] = (M - threshold) / (1 - threshold);
+#else
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float M = a[i] * range;
+                // The optimal compressor theoretically produces the best results, but unfortunately introduces
+                // severe interpolation errors!
+                float bestM;
+                float bestError = FLT_MAX;
 
-        r[i] *= M;
-        g[i] *= M;
-        b[i] *= M;
-        a[i] = 1.0f;
-    }
-}
+                int minM = iround(min(R, G, B) * 255.0f);
 
-// This is dumb way to encode luminance only values.
-void Surface::toLM(float range/*= 1*/, float threshold/*= 0.25*/)
-{
-    if (isNull()) return;
+                for (int m = minM; m < 256; m++) {
+                    float fm = float(m) / 255.0f;
 
-    detach();
+                    // Encode.
+                    int ir = iround(255.0f * nv::clamp(R / fm, 0.0f, 1.0f));
+                    int ig = iround(255.0f * nv::clamp(G / fm, 0.0f, 1.0f));
+                    int ib = iround(255.0f * nv::clamp(B / fm, 0.0f, 1.0f));
 
-    threshold = ::clamp(threshold, 1e-6f, 1.0f);
+                    // Decode.
+                    float fr = (float(ir) / 255.0f) * fm;
+                    float fg = (float(ig) / 255.0f) * fm;
+                    float fb = (float(ib) / 255.0f) * fm;
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+                    // Measure error.
+                    float error = square(R-fr) + square(G-fg) + square(B-fb);
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float R = nv::clamp(r[i], 0.0f, 1.0f);
-        float G = nv::clamp(g[i], 0.0f, 1.0f);
-        float B = nv::clamp(b[i], 0.0f, 1.0f);
+                    if (error < bestError) {
+                        bestError = error;
+                        bestM = fm;
+                    }
+                }
 
-        float M = max(max(R, G), max(B, threshold));
+                M = bestM;
+                r[i] = nv::clamp(R / M, 0.0f, 1.0f);
+                g[i] = nv::clamp(G / M, 0.0f, 1.0f);
+                b[i] = nv::clamp(B / M, 0.0f, 1.0f);
+                a[i] = M;
+#endif
+            }
+        }
+    };
 
-        float L = (R + G + B) / 3;
-        r[i] = L / M;
-        b[i] = L / M;
-        g[i] = L / M;
-        a[i] = (M - threshold) / (1 - threshold);
-    }
-}
+    struct RGBMDecoder
+    {
+        float * r, * g, * b, * a;
+        float range;
 
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
 
-static Color32 toRgbe8(float r, float g, float b)
-{
-    Color32 c;
-    float v = max(max(r, g), b);
-    if (v < 1e-32) {
-        c.r = c.g = c.b = c.a = 0;
-    }
-    else {
-        int e;
-        v = frexp(v, &e) * 256.0f / v;
-        c.r = uint8(clamp(r * v, 0.0f, 255.0f));
-        c.g = uint8(clamp(g * v, 0.0f, 255.0f));
-        c.b = uint8(clamp(b * v, 0.0f, 255.0f));
-        c.a = e + 128;
-    }
+#if NV_USE_SSE > 1
+            const __m128 vrange = _mm_set1_ps(range);
+            const __m128 one = _mm_set1_ps(1.0f);
 
-    return c;
-}
+            for (; i + 4 <= end; i += 4) {
+                __m128 M = _mm_mul_ps(_mm_loadu_ps(a + i), vrange);
 
+                _mm_storeu_ps(r + i, _mm_mul_ps(_mm_loadu_ps(r + i), M));
+                _mm_storeu_ps(g + i, _mm_mul_ps(_mm_loadu_ps(g + i), M));
+                _mm_storeu_ps(b + i, _mm_mul_ps(_mm_loadu_ps(b + i), M));
+                _mm_storeu_ps(a + i, one);
+            }
+#endif
 
-/*
-  Alen Ladavac @ GDAlgorithms-list on Feb 7, 2007:
-    One trick that we use to alleviate such problems is to use RGBE5.3 -
-    i.e. have a fixed point exponent. Note that it is not enough to just
-    shift the exponent up for 3 bits, but you actually have to convert
+            for (; i < end; i++) {
+                float M = a[i] * range;
+
+                r[i] *= M;
+                g[i] *= M;
+                b[i] *= M;
+                a[i] = 1.0f;
+            }
+        }
+    };
+
+    struct RGBEEncoder
+    {
+        float * r, * g, * b, * a;
+        int mantissaBits;
+        int exponentBits;
+        int exponentBias;
+        float maxValue;
+
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 vmax = _mm_set1_ps(maxValue);
+            const __m128 vmantissaMax = _mm_set1_ps(float((1 << mantissaBits) - 1));
+            const __m128 vexponentMax = _mm_set1_ps(float((1 << exponentBits) - 1));
+            const __m128i vminExponent = _mm_set1_epi32(- exponentBias - 1);
+            const __m128i vbias = _mm_set1_epi32(1 + exponentBias);
+            const __m128i vmantissaLimit = _mm_set1_epi32(1 << mantissaBits);
+            const __m128i one = _mm_set1_epi32(1);
+
+            for (; i + 4 <= end; i += 4) {
+                // Clamp components:
+                __m128 R = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(r + i), zero), vmax);
+                __m128 G = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(g + i), zero), vmax);
+                __m128 B = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(b + i), zero), vmax);
+
+                // Compute max:
+                __m128 M = _mm_max_ps(R, _mm_max_ps(G, B));
+
+                // Preliminary exponent:
+                __m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(_mm_castps_si128(M), 23), _mm_set1_epi32(0xFF)), _mm_set1_epi32(127));
+                __m128i greater = _mm_cmpgt_epi32(e, vminExponent);
+                e = _mm_or_si128(_mm_and_si128(greater, e), _mm_andnot_si128(greater, vminExponent));
+                __m128i E = _mm_add_epi32(e, vbias);
+
+                // Refine exponent:
+                __m128i m = roundToInt(divideByExponent(M, E));
+                E = _mm_add_epi32(E, _mm_and_si128(_mm_cmpeq_epi32(m, vmantissaLimit), one));
+
+                R = _mm_cvtepi32_ps(floorToInt(_mm_add_ps(divideByExponent(R, E), half)));
+                G = _mm_cvtepi32_ps(floorToInt(_mm_add_ps(divideByExponent(G, E), half)));
+                B = _mm_cvtepi32_ps(floorToInt(_mm_add_ps(divideByExponent(B, E), half)));
+
+                // Store as normalized float.
+                _mm_storeu_ps(r + i, _mm_div_ps(R, vmantissaMax));
+                _mm_storeu_ps(g + i, _mm_div_ps(G, vmantissaMax));
+                _mm_storeu_ps(b + i, _mm_div_ps(B, vmantissaMax));
+                _mm_storeu_ps(a + i, _mm_div_ps(_mm_cvtepi32_ps(E), vexponentMax));
+            }
+#endif
+
+            for (; i < end; i++) {
+                // Clamp components:
+                float R = ::clamp(r[i], 0.0f, maxValue);
+                float G = ::clamp(g[i], 0.0f, maxValue);
+                float B = ::clamp(b[i], 0.0f, maxValue);
+
+                // Compute max:
+                float M = max3(R, G, B);
+
+                // Preliminary exponent:
+                int E = max(- exponentBias - 1, floatExponent(M)) + 1 + exponentBias;
+                nvDebugCheck(E >= 0 && E < (1 << exponentBits));
+
+                double denom = pow(2.0, double(E - exponentBias - mantissaBits));
+
+                // Refine exponent:
+                int m = iround(float(M / denom));
+                nvDebugCheck(m <= (1 << mantissaBits));
+
+                if (m == (1 << mantissaBits)) {
+                    denom *= 2;
+                    E += 1;
+                    nvDebugCheck(E < (1 << exponentBits));
+                }
+
+                R = floatRound(float(R / denom));
+                G = floatRound(float(G / denom));
+                B = floatRound(float(B / denom));
+
+                nvDebugCheck(R >= 0 && R < (1 << mantissaBits));
+                nvDebugCheck(G >= 0 && G < (1 << mantissaBits));
+                nvDebugCheck(B >= 0 && B < (1 << mantissaBits));
+
+                // Store as normalized float.
+                r[i] = R / ((1 << mantissaBits) - 1);
+                g[i] = G / ((1 << mantissaBits) - 1);
+                b[i] = B / ((1 << mantissaBits) - 1);
+                a[i] = float(E) / ((1 << exponentBits) - 1);
+            }
+        }
+
+#if NV_USE_SSE > 1
+        // float(x / 2^(E - exponentBias - mantissaBits)). The division by a power of two is exact in doubles, so it can
+        // be done as a multiplication. The result is rounded to float once, like in the scalar code.
+        __m128 divideByExponent(__m128 x, __m128i E) const
+        {
+            // Bits of the doubles 2^-(E - exponentBias - mantissaBits).
+            __m128i k = _mm_sub_epi32(_mm_set1_epi32(1023 + exponentBias + mantissaBits), E);
+            __m128i lo = _mm_slli_epi64(_mm_unpacklo_epi32(k, _mm_setzero_si128()), 52);
+            __m128i hi = _mm_slli_epi64(_mm_unpackhi_epi32(k, _mm_setzero_si128()), 52);
+
+            __m128 xlo = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(x), _mm_castsi128_pd(lo)));
+            __m128 xhi = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), _mm_castsi128_pd(hi)));
+
+            return _mm_movelh_ps(xlo, xhi);
+        }
+#endif
+    };
+
+    struct RGBEDecoder
+    {
+        float * r, * g, * b, * a;
+        int mantissaBits;
+        int exponentBits;
+        int exponentBias;
+        const float * scales;   // Scale of each exponent in [0, 1 << exponentBits).
+
+        float scale(int E) const
+        {
+            if (uint(E) < uint(1 << exponentBits)) return scales[E];
+
+            //float scale = ldexpf(1.0f, E - exponentBias - mantissaBits);
+            return powf(2, float(E - exponentBias - mantissaBits));
+        }
+
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 vmantissaMax = _mm_set1_ps(float((1 << mantissaBits) - 1));
+            const __m128 vexponentMax = _mm_set1_ps(float((1 << exponentBits) - 1));
+            const __m128 one = _mm_set1_ps(1.0f);
+
+            for (; i + 4 <= end; i += 4) {
+                // Expand normalized float to to 9995
+                __m128 R = _mm_cvtepi32_ps(roundToInt(_mm_mul_ps(_mm_loadu_ps(r + i), vmantissaMax)));
+                __m128 G = _mm_cvtepi32_ps(roundToInt(_mm_mul_ps(_mm_loadu_ps(g + i), vmantissaMax)));
+                __m128 B = _mm_cvtepi32_ps(roundToInt(_mm_mul_ps(_mm_loadu_ps(b + i), vmantissaMax)));
+
+                NV_ALIGN_16 int E[4];
+                _mm_store_si128((__m128i *)E, roundToInt(_mm_mul_ps(_mm_loadu_ps(a + i), vexponentMax)));
+
+                __m128 s = _mm_setr_ps(scale(E[0]), scale(E[1]), scale(E[2]), scale(E[3]));
+
+                _mm_storeu_ps(r + i, _mm_mul_ps(R, s));
+                _mm_storeu_ps(g + i, _mm_mul_ps(G, s));
+                _mm_storeu_ps(b + i, _mm_mul_ps(B, s));
+                _mm_storeu_ps(a + i, one);
+            }
+#endif
+
+            for (; i < end; i++) {
+                // Expand normalized float to to 9995
+                int R = iround(r[i] * ((1 << mantissaBits) - 1));
+                int G = iround(g[i] * ((1 << mantissaBits) - 1));
+                int B = iround(b[i] * ((1 << mantissaBits) - 1));
+                int E = iround(a[i] * ((1 << exponentBits) - 1));
+
+                float s = scale(E);
+
+                r[i] = R * s;
+                g[i] = G * s;
+                b[i] = B * s;
+                a[i] = 1;
+            }
+        }
+    };
+
+    struct YCoCgEncoder
+    {
+        float * r, * g, * b, * a;
+
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 two = _mm_set1_ps(2.0f);
+            const __m128 quarter = _mm_set1_ps(0.25f);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 one = _mm_set1_ps(1.0f);
+
+            for (; i + 4 <= end; i += 4) {
+                __m128 R = _mm_loadu_ps(r + i);
+                __m128 G2 = _mm_mul_ps(two, _mm_loadu_ps(g + i));
+                __m128 B = _mm_loadu_ps(b + i);
+
+                __m128 Y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(G2, R), B), quarter);
+                __m128 Co = _mm_sub_ps(R, B);
+                __m128 Cg = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(G2, R), B), half);
+
+                _mm_storeu_ps(r + i, Co);
+                _mm_storeu_ps(g + i, Cg);
+                _mm_storeu_ps(b + i, one);
+                _mm_storeu_ps(a + i, Y);
+            }
+#endif
+
+            for (; i < end; i++) {
+                float R = r[i];
+                float G = g[i];
+                float B = b[i];
+
+                float Y = (2*G + R + B) * 0.25f;
+                float Co = (R - B);
+                float Cg = (2*G - R - B) * 0.5f;
+
+                r[i] = Co;
+                g[i] = Cg;
+                b[i] = 1.0f;
+                a[i] = Y;
+            }
+        }
+    };
+
+    struct YCoCgDecoder
+    {
+        float * r, * g, * b, * a;
+
+        void run(uint begin, uint end) const
+        {
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 one = _mm_set1_ps(1.0f);
+
+            for (; i + 4 <= end; i += 4) {
+                __m128 scale = _mm_mul_ps(_mm_loadu_ps(b + i), half);
+                __m128 Co = _mm_mul_ps(_mm_loadu_ps(r + i), scale);
+                __m128 Cg = _mm_mul_ps(_mm_loadu_ps(g + i), scale);
+                __m128 Y = _mm_loadu_ps(a + i);
+
+                _mm_storeu_ps(r + i, _mm_sub_ps(_mm_add_ps(Y, Co), Cg));
+                _mm_storeu_ps(g + i, _mm_add_ps(Y, Cg));
+                _mm_storeu_ps(b + i, _mm_sub_ps(_mm_sub_ps(Y, Co), Cg));
+                _mm_storeu_ps(a + i, one);
+            }
+#endif
+
+            for (; i < end; i++) {
+                float Co = r[i];
+                float Cg = g[i];
+                float scale = b[i] * 0.5f;
+                float Y = a[i];
+
+                Co *= scale;
+                Cg *= scale;
+
+                float R = Y + Co - Cg;
+                float G = Y + Cg;
+                float B = Y - Co - Cg;
+
+                r[i] = R;
+                g[i] = G;
+                b[i] = B;
+                a[i] = 1.0f;
+            }
+        }
+    };
+
+    struct LUVWEncoder
+    {
+        float * r, * g, * b, * a;
+        float irange;
+
+        void run(uint begin, uint end) const
+        {
+            const float sqrt3 = sqrtf(3);
+
+            uint i = begin;
+
+#if NV_USE_SSE > 1
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 epsilon = _mm_set1_ps(1e-6f);
+            const __m128 virange = _mm_set1_ps(irange);
+            const __m128 vsqrt3 = _mm_set1_ps(sqrt3);
+
+            for (; i + 4 <= end; i += 4) {
+                __m128 R = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(r + i), virange), zero), one);
+                __m128 G = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(g + i), virange), zero), one);
+                __m128 B = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(b + i), virange), zero), one);
+
+                __m128 L = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(R, R), _mm_mul_ps(G, G)), _mm_mul_ps(B, B))), epsilon);
+
+                _mm_storeu_ps(r + i, _mm_div_ps(R, L));
+                _mm_storeu_ps(g + i, _mm_div_ps(G, L));
+                _mm_storeu_ps(b + i, _mm_div_ps(B, L));
+                _mm_storeu_ps(a + i, _mm_div_ps(L, vsqrt3));
+            }
+#endif
+
+            for (; i < end; i++) {
+                float R = nv::clamp(r[i] * irange, 0.0f, 1.0f);
+                float G = nv::clamp(g[i] * irange, 0.0f, 1.0f);
+                float B = nv::clamp(b[i] * irange, 0.0f, 1.0f);
+
+                float L = max(sqrtf(R*R + G*G + B*B), 1e-6f); // Avoid division by zero.
+
+                r[i] = R / L;
+                g[i] = G / L;
+                b[i] = B / L;
+                a[i] = L / sqrt3;
+            }
+        }
+    };
+
+} // namespace
+
+// Ideally you should compress/quantize the RGB and M portions independently.
+// Once you have M quantized, you would compute the corresponding RGB and quantize that.
+void Surface::toRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
+{
+    if (isNull()) return;
+
+    detach();
+    Repack repack(*this);
+
+    threshold = ::clamp(threshold, 1e-6f, 1.0f);
+
+    FloatImage * img = m->image;
+
+    RGBMEncoder encoder;
+    encoder.r = img->channel(0);
+    encoder.g = img->channel(1);
+    encoder.b = img->channel(2);
+    encoder.a = img->channel(3);
+    encoder.threshold = threshold;
+
+    transformPixels(encoder, img->pixelCount());
+}
+
+
+void Surface::fromRGBM(float range/*= 1*/)
+{
+    if (isNull()) return;
+
+    detach();
+    Repack repack(*this);
+
+    FloatImage * img = m->image;
+
+    RGBMDecoder decoder;
+    decoder.r = img->channel(0);
+    decoder.g = img->channel(1);
+    decoder.b = img->channel(2);
+    decoder.a = img->channel(3);
+    decoder.range = range;
+
+    transformPixels(decoder, img->pixelCount());
+}
+
+// This is dumb way to encode luminance only values.
+void Surface::toLM(float range/*= 1*/, float threshold/*= 0.25*/)
+{
+    if (isNull()) return;
+
+    detach();
+    Repack repack(*this);
+
+    threshold = ::clamp(threshold, 1e-6f, 1.0f);
+
+    FloatImage * img = m->image;
+    float * r = img->channel(0);
+    float * g = img->channel(1);
+    float * b = img->channel(2);
+    float * a = img->channel(3);
+
+    const uint count = img->pixelCount();
+    for (uint i = 0; i < count; i++) {
+        float R = nv::clamp(r[i], 0.0f, 1.0f);
+        float G = nv::clamp(g[i], 0.0f, 1.0f);
+        float B = nv::clamp(b[i], 0.0f, 1.0f);
+
+        float M = max(max(R, G), max(B, threshold));
+
+        float L = (R + G + B) / 3;
+        r[i] = L / M;
+        b[i] = L / M;
+        g[i] = L / M;
+        a[i] = (M - threshold) / (1 - threshold);
+    }
+}
+
+
+static Color32 toRgbe8(float r, float g, float b)
+{
+    Color32 c;
+    float v = max(max(r, g), b);
+    if (v < 1e-32) {
+        c.r = c.g = c.b = c.a = 0;
+    }
+    else {
+        int e;
+        v = frexp(v, &e) * 256.0f / v;
+        c.r = uint8(clamp(r * v, 0.0f, 255.0f));
+        c.g = uint8(clamp(g * v, 0.0f, 255.0f));
+        c.b = uint8(clamp(b * v, 0.0f, 255.0f));
+        c.a = e + 128;
+    }
+
+    return c;
+}
+
+
+/*
+  Alen Ladavac @ GDAlgorithms-list on Feb 7, 2007:
+    One trick that we use to alleviate such problems is to use RGBE5.3 -
+    i.e. have a fixed point exponent. Note that it is not enough to just
+    shift the exponent up for 3 bits, but you actually have to convert
     each pixel in the RGBE8 texture by unpacking it to floats and then
     repacking it with a non-integer exponent, which gives different
     mantissas as well. Now your jumps in exponent are much smaller, thus
@@ -1704,6 +2377,7 @@ void Surface::toRGBE(int mantissaBits, int exponentBits)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     // mantissaBits = N
     // exponentBits = E
@@ -1721,52 +2395,17 @@ void Surface::toRGBE(int mantissaBits, int exponentBits)
     const float maxValue = float(exponentMax) / float(exponentMax + 1) * float(1 << (exponentMax - exponentBias));
 
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        // Clamp components:
-        float R = ::clamp(r[i], 0.0f, maxValue);
-        float G = ::clamp(g[i], 0.0f, maxValue);
-        float B = ::clamp(b[i], 0.0f, maxValue);
-
-        // Compute max:
-        float M = max3(R, G, B);
-
-        // Preliminary exponent:
-        int E = max(- exponentBias - 1, floatExponent(M)) + 1 + exponentBias;
-        nvDebugCheck(E >= 0 && E < (1 << exponentBits));
+    RGBEEncoder encoder;
+    encoder.r = m->image->channel(0);
+    encoder.g = m->image->channel(1);
+    encoder.b = m->image->channel(2);
+    encoder.a = m->image->channel(3);
+    encoder.mantissaBits = mantissaBits;
+    encoder.exponentBits = exponentBits;
+    encoder.exponentBias = exponentBias;
+    encoder.maxValue = maxValue;
 
-        double denom = pow(2.0, double(E - exponentBias - mantissaBits));
-
-        // Refine exponent:
-        int m = iround(float(M / denom));
-        nvDebugCheck(m <= (1 << mantissaBits));
-
-        if (m == (1 << mantissaBits)) {
-            denom *= 2;
-            E += 1;
-            nvDebugCheck(E < (1 << exponentBits));
-        }
-
-        R = floatRound(float(R / denom));
-        G = floatRound(float(G / denom));
-        B = floatRound(float(B / denom));
-
-        nvDebugCheck(R >= 0 && R < (1 << mantissaBits));
-        nvDebugCheck(G >= 0 && G < (1 << mantissaBits));
-        nvDebugCheck(B >= 0 && B < (1 << mantissaBits));
-
-        // Store as normalized float.
-        r[i] = R / ((1 << mantissaBits) - 1);
-        g[i] = G / ((1 << mantissaBits) - 1);
-        b[i] = B / ((1 << mantissaBits) - 1);
-        a[i] = float(E) / ((1 << exponentBits) - 1);
-    }
+    transformPixels(encoder, m->image->pixelCount());
 }
 
 void Surface::fromRGBE(int mantissaBits, int exponentBits)
@@ -1799,32 +2438,30 @@ void Surface::fromRGBE(int mantissaBits, int exponentBits)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     // exponent bias: 5 -> 15, 8 -> 127
     const int exponentBias = (1 << (exponentBits - 1)) - 1;
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        // Expand normalized float to to 9995
-        int R = iround(r[i] * ((1 << mantissaBits) - 1));
-        int G = iround(g[i] * ((1 << mantissaBits) - 1));
-        int B = iround(b[i] * ((1 << mantissaBits) - 1));
-        int E = iround(a[i] * ((1 << exponentBits) - 1));
-
+    // Scale of each exponent.
+    Array<float> scales;
+    scales.resize(1 << exponentBits);
+    for (int E = 0; E < (1 << exponentBits); E++) {
         //float scale = ldexpf(1.0f, E - exponentBias - mantissaBits);
-        float scale = powf(2, float(E - exponentBias - mantissaBits));
-
-        r[i] = R * scale;
-        g[i] = G * scale;
-        b[i] = B * scale;
-        a[i] = 1;
+        scales[E] = powf(2, float(E - exponentBias - mantissaBits));
     }
+
+    RGBEDecoder decoder;
+    decoder.r = m->image->channel(0);
+    decoder.g = m->image->channel(1);
+    decoder.b = m->image->channel(2);
+    decoder.a = m->image->channel(3);
+    decoder.mantissaBits = mantissaBits;
+    decoder.exponentBits = exponentBits;
+    decoder.exponentBias = exponentBias;
+    decoder.scales = scales.buffer();
+
+    transformPixels(decoder, m->image->pixelCount());
 }
 
 // Y is in the [0, 1] range, while CoCg are in the [-1, 1] range.
@@ -1833,80 +2470,92 @@ void Surface::toYCoCg()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float R = r[i];
-        float G = g[i];
-        float B = b[i];
+    YCoCgEncoder encoder;
+    encoder.r = img->channel(0);
+    encoder.g = img->channel(1);
+    encoder.b = img->channel(2);
+    encoder.a = img->channel(3);
 
-        float Y = (2*G + R + B) * 0.25f;
-        float Co = (R - B);
-        float Cg = (2*G - R - B) * 0.5f;
-
-        r[i] = Co;
-        g[i] = Cg;
-        b[i] = 1.0f;
-        a[i] = Y;
-    }
+    transformPixels(encoder, img->pixelCount());
 }
 
-// img.toYCoCg();
-// img.blockScaleCoCg();
-// img.scaleBias(0, 0.5, 0.5);
-// img.scaleBias(1, 0.5, 0.5);
-
-// @@ Add support for threshold.
-// We could do something to prevent scale values from adjacent blocks from being too different to each other
-// and minimize bilinear interpolation artifacts.
-void Surface::blockScaleCoCg(int bits/*= 5*/, float threshold/*= 0.0*/)
+namespace
 {
-    if (isNull() || depth() != 1) return;
+    struct BlockScaleCoCgContext
+    {
+        FloatImage * img;
+        int bits;
+    };
 
-    detach();
+    // Scale the CoCg of a row of 4x4 blocks.
+    void blockScaleCoCgTask(void * data, int bj)
+    {
+        BlockScaleCoCgContext * ctx = (BlockScaleCoCgContext *)data;
+        FloatImage * img = ctx->img;
 
-    FloatImage * img = m->image;
-    const uint w = img->width();
-    const uint h = img->height();
-    const uint bw = max(1U, w/4);
-    const uint bh = max(1U, h/4);
+        const uint w = img->width();
+        const uint h = img->height();
+        const uint bw = (w + 3) / 4;
 
-    for (uint bj = 0; bj < bh; bj++) {
         for (uint bi = 0; bi < bw; bi++) {
+            const uint x0 = bi*4;
+            const uint y0 = bj*4;
+            const bool fullBlock = (x0 + 4 <= w && y0 + 4 <= h);
 
             // Compute per block scale.
             float m = 1.0f / 255.0f;
-            for (uint j = 0; j < 4; j++) {
-                const uint y = bj*4 + j;
-                if (y >= h) continue;
 
-                for (uint i = 0; i < 4; i++) {
-                    const uint x = bi*4 + i;
-                    if (x >= w) continue;
+#if NV_USE_SSE > 1
+            if (fullBlock) {
+                const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
 
-                    float Co = img->pixel(0, x, y, 0);
-                    float Cg = img->pixel(1, x, y, 0);
+                __m128 vm = _mm_set1_ps(m);
+                for (uint j = 0; j < 4; j++) {
+                    vm = _mm_max_ps(vm, _mm_and_ps(_mm_loadu_ps(img->scanline(0, y0 + j, 0) + x0), signMask));
+                    vm = _mm_max_ps(vm, _mm_and_ps(_mm_loadu_ps(img->scanline(1, y0 + j, 0) + x0), signMask));
+                }
 
-                    m = max(m, fabsf(Co));
-                    m = max(m, fabsf(Cg));
+                NV_ALIGN_16 float tmp[4];
+                _mm_store_ps(tmp, vm);
+                m = max(max(tmp[0], tmp[1]), max(tmp[2], tmp[3]));
+            }
+            else
+#endif
+            {
+                for (uint y = y0; y < min(y0 + 4, h); y++) {
+                    for (uint x = x0; x < min(x0 + 4, w); x++) {
+                        float Co = img->pixel(0, x, y, 0);
+                        float Cg = img->pixel(1, x, y, 0);
+
+                        m = max(m, fabsf(Co));
+                        m = max(m, fabsf(Cg));
+                    }
                 }
             }
 
-            float scale = PixelFormat::quantizeCeil(m, bits, 8);
+            float scale = PixelFormat::quantizeCeil(m, ctx->bits, 8);
             nvDebugCheck(scale >= m);
 
             // Store block scale in blue channel and scale CoCg.
-            for (uint j = 0; j < 4; j++) {
-                for (uint i = 0; i < 4; i++) {
-                    uint x = min(bi*4 + i, w);
-                    uint y = min(bj*4 + j, h);
-
+#if NV_USE_SSE > 1
+            if (fullBlock) {
+                const __m128 vscale = _mm_set1_ps(scale);
+                for (uint j = 0; j < 4; j++) {
+                    float * Co = img->scanline(0, y0 + j, 0) + x0;
+                    float * Cg = img->scanline(1, y0 + j, 0) + x0;
+                    _mm_storeu_ps(Co, _mm_div_ps(_mm_loadu_ps(Co), vscale));
+                    _mm_storeu_ps(Cg, _mm_div_ps(_mm_loadu_ps(Cg), vscale));
+                    _mm_storeu_ps(img->scanline(2, y0 + j, 0) + x0, vscale);
+                }
+                continue;
+            }
+#endif
+            for (uint y = y0; y < min(y0 + 4, h); y++) {
+                for (uint x = x0; x < min(x0 + 4, w); x++) {
                     float & Co = img->pixel(0, x, y, 0);
                     float & Cg = img->pixel(1, x, y, 0);
 
@@ -1921,6 +2570,31 @@ void Surface::blockScaleCoCg(int bits/*= 5*/, float threshold/*= 0.0*/)
             }
         }
     }
+
+} // namespace
+
+// img.toYCoCg();
+// img.blockScaleCoCg();
+// img.scaleBias(0, 0.5, 0.5);
+// img.scaleBias(1, 0.5, 0.5);
+
+// @@ Add support for threshold.
+// We could do something to prevent scale values from adjacent blocks from being too different to each other
+// and minimize bilinear interpolation artifacts.
+void Surface::blockScaleCoCg(int bits/*= 5*/, float threshold/*= 0.0*/)
+{
+    if (isNull() || depth() != 1) return;
+
+    detach();
+    Repack repack(*this);
+
+    BlockScaleCoCgContext context;
+    context.img = m->image;
+    context.bits = bits;
+
+    // Blocks on the right and bottom edges may be partial.
+    ParallelFor parallelFor(blockScaleCoCgTask, &context);
+    parallelFor.run((m->image->height() + 3) / 4);
 }
 
 void Surface::fromYCoCg()
@@ -1928,32 +2602,17 @@ void Surface::fromYCoCg()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float Co = r[i];
-        float Cg = g[i];
-        float scale = b[i] * 0.5f;
-        float Y = a[i];
-
-        Co *= scale;
-        Cg *= scale;
 
-        float R = Y + Co - Cg;
-        float G = Y + Cg;
-        float B = Y - Co - Cg;
+    YCoCgDecoder decoder;
+    decoder.r = img->channel(0);
+    decoder.g = img->channel(1);
+    decoder.b = img->channel(2);
+    decoder.a = img->channel(3);
 
-        r[i] = R;
-        g[i] = G;
-        b[i] = B;
-        a[i] = 1.0f;
-    }
+    transformPixels(decoder, img->pixelCount());
 }
 
 void Surface::toLUVW(float range/*= 1.0f*/)
@@ -1961,28 +2620,18 @@ void Surface::toLUVW(float range/*= 1.0f*/)
     if (isNull()) return;
 
     detach();
-
-    float irange = 1.0f / range;
+    Repack repack(*this);
 
     FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float R = nv::clamp(r[i] * irange, 0.0f, 1.0f);
-        float G = nv::clamp(g[i] * irange, 0.0f, 1.0f);
-        float B = nv::clamp(b[i] * irange, 0.0f, 1.0f);
+    LUVWEncoder encoder;
+    encoder.r = img->channel(0);
+    encoder.g = img->channel(1);
+    encoder.b = img->channel(2);
+    encoder.a = img->channel(3);
+    encoder.irange = 1.0f / range;
 
-        float L = max(sqrtf(R*R + G*G + B*B), 1e-6f); // Avoid division by zero.
-
-        r[i] = R / L;
-        g[i] = G / L;
-        b[i] = B / L;
-        a[i] = L / sqrtf(3);
-    }
+    transformPixels(encoder, img->pixelCount());
 }
 
 void Surface::fromLUVW(float range/*= 1.0f*/)
@@ -1996,6 +2645,7 @@ void Surface::abs(int channel)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * c = img->channel(channel);
@@ -2011,6 +2661,7 @@ void Surface::convolve(int channel, int kernelSize, float * kernelData)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     Kernel2 k(kernelSize, kernelData);
     m->image->convolve(k, channel, (FloatImage::WrapMode)m->wrapMode);
@@ -2022,6 +2673,7 @@ void Surface::toneMap(ToneMapper tm, float * parameters)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * r = img->channel(0);
@@ -2074,6 +2726,7 @@ void Surface::toLogScale(int channel, float base) {
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * c = img->channel(channel);
@@ -2090,6 +2743,7 @@ void Surface::fromLogScale(int channel, float base) {
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
     float * c = img->channel(channel);
@@ -2228,142 +2882,126 @@ void Surface::fromJPEGLS()
 */
 
 
-// If dither is true, this uses Floyd-Steinberg dithering method.
-void Surface::binarize(int channel, float threshold, bool dither)
+namespace
 {
-    if (isNull()) return;
+    // Quantizers for nv::floydSteinberg. The error is computed from the original value, not from the value with the diffused error.
+    struct BinaryQuantizer
+    {
+        float quantize(uint c, uint x, uint y, float error)
+        {
+            float & f = img->pixel(channel, x, y, z);
 
-    detach();
+            // Add error and quantize.
+            float qf = float(f + error > threshold);
 
-    FloatImage * img = m->image;
+            // Compute new error:
+            float diff = f - qf;
 
-    if (!dither) {
-        float * c = img->channel(channel);
-        const uint count = img->pixelCount();
-        for (uint i = 0; i < count; i++) {
-            c[i] = float(c[i] > threshold);
-        }
-    }
-    else {
-        const uint w = img->width();
-        const uint h = img->height();
-        const uint d = img->depth();
+            // Store color.
+            f = qf;
 
-        float * row0 = new float[(w+2)];
-        float * row1 = new float[(w+2)];
+            return diff;
+        }
 
-        // @@ Extend Floyd-Steinberg dithering to 3D properly.
-        for (uint z = 0; z < d; z++) {
-            memset(row0, 0, sizeof(float)*(w+2));
-            memset(row1, 0, sizeof(float)*(w+2));
+        FloatImage * img;
+        uint z;
+        uint channel;
+        float threshold;
+    };
 
-            for (uint y = 0; y < h; y++) {
-                for (uint x = 0; x < w; x++) {
+    struct UniformQuantizer
+    {
+        void setChannel(uint i, uint c, int bits, bool exactEndPoints)
+        {
+            channel[i] = c;
 
-                    float & f = img->pixel(channel, x, y, 0);
+            if (exactEndPoints) {
+                // floor(x*(range-1) + 0.5) / (range-1)
+                scale[i] = float((1 << bits) - 1);
+                offset0[i] = 0.5f;
+                offset1[i] = 0.0f;
+            }
+            else {
+                // (floor(x*range) + 0.5) / range
+                scale[i] = float(1 << bits);
+                offset0[i] = 0.0f;
+                offset1[i] = 0.5f;
+            }
+        }
 
-                    // Add error and quantize.
-                    float qf = float(f + row0[1+x] > threshold);
+        float quantize(uint c, uint x, uint y, float error)
+        {
+            float & f = img->pixel(channel[c], x, y, z);
 
-                    // Compute new error:
-                    float diff = f - qf;
+            // Add error and quantize.
+            float qf = saturate((floorf((f + error) * scale[c] + offset0[c]) + offset1[c]) / scale[c]);
 
-                    // Store color.
-                    f = qf;
+            // Compute new error:
+            float diff = f - qf;
 
-                    // Propagate new error.
-                    row0[1+x+1] += (7.0f / 16.0f) * diff;
-                    row1[1+x-1] += (3.0f / 16.0f) * diff;
-                    row1[1+x+0] += (5.0f / 16.0f) * diff;
-                    row1[1+x+1] += (1.0f / 16.0f) * diff;
-                }
+            // Store color.
+            f = qf;
 
-                swap(row0, row1);
-                memset(row1, 0, sizeof(float)*(w+2));
-            }
+            return diff;
         }
 
-        delete [] row0;
-        delete [] row1;
-    }
-}
+        FloatImage * img;
+        uint z;
+        uint channel[4];
+        float scale[4];
+        float offset0[4];
+        float offset1[4];
+    };
 
-// Uniform quantizer.
-// Assumes input is in [0, 1] range. Output is in the [0, 1] range, but rounded to the middle of each bin.
-// If exactEndPoints is true, [0, 1] are represented exactly, and the correponding bins are half the size, so quantization is not truly uniform.
-// When dither is true, this uses Floyd-Steinberg dithering.
-void Surface::quantize(int channel, int bits, bool exactEndPoints, bool dither)
+} // namespace
+
+// If dither is true, this uses Floyd-Steinberg dithering method.
+void Surface::binarize(int channel, float threshold, bool dither)
 {
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
-    float scale, offset0, offset1;
-    if (exactEndPoints) {
-        // floor(x*(range-1) + 0.5) / (range-1)
-        scale = float((1 << bits) - 1);
-        offset0 = 0.5f;
-        offset1 = 0.0f;
-    }
-    else {
-        // (floor(x*range) + 0.5) / range
-        scale = float(1 << bits);
-        offset0 = 0.0f;
-        offset1 = 0.5f;
-    }
-
     if (!dither) {
         float * c = img->channel(channel);
         const uint count = img->pixelCount();
         for (uint i = 0; i < count; i++) {
-            c[i] = saturate((floorf(c[i] * scale + offset0) + offset1) / scale);
+            c[i] = float(c[i] > threshold);
         }
     }
     else {
-        const uint w = img->width();
-        const uint h = img->height();
-        const uint d = img->depth();
-
-        float * row0 = new float[(w+2)];
-        float * row1 = new float[(w+2)];
-
-        for (uint z = 0; z < d; z++) {
-            memset(row0, 0, sizeof(float)*(w+2));
-            memset(row1, 0, sizeof(float)*(w+2));
-
-            for (uint y = 0; y < h; y++) {
-                for (uint x = 0; x < w; x++) {
+        BinaryQuantizer quantizer;
+        quantizer.img = img;
+        quantizer.channel = channel;
+        quantizer.threshold = threshold;
 
-                    float & f = img->pixel(channel, x, y, 0);
-
-                    // Add error and quantize.
-                    float qf = saturate((floorf((f + row0[1+x]) * scale + offset0) + offset1) / scale);
-
-                    // Compute new error:
-                    float diff = f - qf;
-
-                    // Store color.
-                    f = qf;
-
-                    // Propagate new error.
-                    row0[1+x+1] += (7.0f / 16.0f) * diff;
-                    row1[1+x-1] += (3.0f / 16.0f) * diff;
-                    row1[1+x+0] += (5.0f / 16.0f) * diff;
-                    row1[1+x+1] += (1.0f / 16.0f) * diff;
-                }
-
-                swap(row0, row1);
-                memset(row1, 0, sizeof(float)*(w+2));
-            }
+        // @@ Extend Floyd-Steinberg dithering to 3D properly.
+        for (uint z = 0; z < img->depth(); z++) {
+            quantizer.z = z;
+            floydSteinberg(quantizer, img->width(), img->height(), 1);
         }
-
-        delete [] row0;
-        delete [] row1;
     }
 }
 
+// Uniform quantizer.
+// Assumes input is in [0, 1] range. Output is in the [0, 1] range, but rounded to the middle of each bin.
+// If exactEndPoints is true, [0, 1] are represented exactly, and the correponding bins are half the size, so quantization is not truly uniform.
+// When dither is true, this uses Floyd-Steinberg dithering.
+void Surface::quantize(int channel, int bits, bool exactEndPoints, bool dither)
+{
+    const int channelBits[4] = {
+        channel == 0 ? bits : -1,
+        channel == 1 ? bits : -1,
+        channel == 2 ? bits : -1,
+        channel == 3 ? bits : -1
+    };
+
+    nvtt::quantize(*this, channelBits, exactEndPoints, dither);
+}
+
 
 
 // Set normal map options.
@@ -2371,14 +3009,16 @@ void Surface::toNormalMap(float sm, float medium, float big, float large)
 {
     if (isNull()) return;
 
-    detach();
-
     const Vector4 filterWeights(sm, medium, big, large);
 
-    const FloatImage * img = m->image;
-    m->image = nv::createNormalMap(img, (FloatImage::WrapMode)m->wrapMode, filterWeights);
+    if (m->refCount() == 1) m->expand();
+    FloatImage * img = nv::createNormalMap(FloatPixels(*this).ptr(), (FloatImage::WrapMode)m->wrapMode, filterWeights);
+
+    detachWithoutImage(*this);
+    Repack repack(*this);
 
-    delete img;
+    delete m->image;
+    m->image = img;
 
     m->isNormalMap = true;
 }
@@ -2389,6 +3029,7 @@ void Surface::normalizeNormalMap()
     if (!m->isNormalMap) return;
 
     detach();
+    Repack repack(*this);
 
     nv::normalizeNormalMap(m->image);
 }
@@ -2398,6 +3039,7 @@ void Surface::transformNormals(NormalTransform xform)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
@@ -2468,6 +3110,7 @@ void Surface::reconstructNormals(NormalTransform xform)
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     FloatImage * img = m->image;
 
@@ -2514,6 +3157,7 @@ void Surface::toCleanNormalMap()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     const uint count = m->image->pixelCount();
     for (uint i = 0; i < count; i++) {
@@ -2528,6 +3172,7 @@ void Surface::toCleanNormalMap()
 void Surface::packNormals(float scale/*= 0.5f*/, float bias/*= 0.5f*/) {
     if (isNull()) return;
     detach();
+    Repack repack(*this);
     m->image->scaleBias(0, 3, scale, bias);
 }
 
@@ -2535,6 +3180,7 @@ void Surface::packNormals(float scale/*= 0.5f*/, float bias/*= 0.5f*/) {
 void Surface::expandNormals(float scale/*= 2.0f*/, float bias/*= - 2.0f * 127.0f / 255.0f*/) {
     if (isNull()) return;
     detach();
+    Repack repack(*this);
     m->image->scaleBias(0, 3, scale, bias);
 }
 
@@ -2572,6 +3218,7 @@ void Surface::flipX()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->flipX();
 }
@@ -2581,6 +3228,7 @@ void Surface::flipY()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->flipY();
 }
@@ -2590,6 +3238,7 @@ void Surface::flipZ()
     if (isNull()) return;
 
     detach();
+    Repack repack(*this);
 
     m->image->flipZ();
 }
@@ -2604,6 +3253,8 @@ Surface Surface::createSubImage(int x0, int x1, int y0, int y1, int z0, int z1)
     if (z0 < 0 || z1 > depth() || z0 > z1) return s;
     if (x1 >= width() || y1 >= height() || z1 >= depth()) return s;
 
+    FloatPixels src(*this);
+
     FloatImage * img = s.m->image = new FloatImage;
 
     int w = x1 - x0 + 1;
@@ -2616,7 +3267,7 @@ Surface Surface::createSubImage(int x0, int x1, int y0, int y1, int z0, int z1)
         for (int z = 0; z < d; z++) {
             for (int y = 0; y < h; y++) {
                 for (int x = 0; x < w; x++) {
-                    img->pixel(c, x, y, z) = m->image->pixel(c, x0+x, y0+y, z0+z);
+                    img->pixel(c, x, y, z) = src->pixel(c, x0+x, y0+y, z0+z);
                 }
             }
         }
@@ -2643,6 +3294,9 @@ bool Surface::copyChannel(const Surface & srcImage, int srcChannel, int dstChann
     nvDebugCheck(dst->componentCount() == 4 && src->componentCount() == 4);
 
     detach();
+    Repack repack(*this);
+    FloatPixels srcPixels(srcImage);
+    src = srcPixels.ptr();
 
     dst = m->image;
 
@@ -2664,6 +3318,9 @@ bool Surface::addChannel(const Surface & srcImage, int srcChannel, int dstChanne
     nvDebugCheck(dst->componentCount() == 4 && src->componentCount() == 4);
 
     detach();
+    Repack repack(*this);
+    FloatPixels srcPixels(srcImage);
+    src = srcPixels.ptr();
 
     dst = m->image;
 
@@ -2691,6 +3348,11 @@ bool Surface::copy(const Surface & srcImage, int xsrc, int ysrc, int zsrc, int x
     if (toU32(xdst + xsize) > dst->width() || toU32(ydst + ysize) > dst->height() || toU32(zdst + zsize) > dst->depth()) return false;
 
     detach();
+    Repack repack(*this);
+    FloatPixels srcPixels(srcImage);
+    src = srcPixels.ptr();
+
+    dst = m->image;
 
     // For each channel.
     for(int i = 0; i < 4; i++) {
@@ -2712,34 +3374,227 @@ bool Surface::copy(const Surface & srcImage, int xsrc, int ysrc, int zsrc, int x
 
 
 
-float nvtt::rmsError(const Surface & reference, const Surface & image)
+// Prepare dst to receive the contents of src without sharing or cloning the image of src. Returns false when there's nothing to transform.
+static bool prepareOutOfPlace(const Surface & src, Surface * dst)
 {
-    return nv::rmsColorError(reference.m->image, image.m->image, reference.alphaMode() == nvtt::AlphaMode_Transparency);
+    nvDebugCheck(dst != NULL && dst != &src);
+
+    if (src.isNull()) {
+        *dst = src;
+        return false;
+    }
+
+    detachWithoutImage(*dst);
+
+    dst->m->type = src.m->type;
+    dst->m->wrapMode = src.m->wrapMode;
+    dst->m->alphaMode = src.m->alphaMode;
+    dst->m->isNormalMap = src.m->isNormalMap;
+
+    if (dst->m->image == NULL) {
+        dst->m->image = new FloatImage();
+    }
+
+    return true;
 }
 
+void nvtt::toGamma(const Surface & src, float gamma, Surface * dst)
+{
+    if (!prepareOutOfPlace(src, dst)) return;
+
+    if (src.m->image->isCompact()) {
+        // Decode straight to the destination and convert it in place, so that the source stays packed.
+        {
+            nv::Lock<nv::Mutex> lock(src.m->mutex);
+            src.m->image->expandTo(dst->m->image);
+        }
+        if (!equal(gamma, 1.0f)) {
+            dst->m->image->toGamma(0, 3, gamma);
+        }
+    }
+    else if (equal(gamma, 1.0f)) {
+        dst->m->image->copyFrom(src.m->image);
+    }
+    else {
+        dst->m->image->toGamma(src.m->image, 0, 3, gamma);
+    }
+}
 
-float nvtt::rmsAlphaError(const Surface & reference, const Surface & image)
+void nvtt::packNormals(const Surface & src, float scale, float bias, Surface * dst)
 {
-    return nv::rmsAlphaError(reference.m->image, image.m->image);
+    if (!prepareOutOfPlace(src, dst)) return;
+
+    if (src.m->image->isCompact()) {
+        {
+            nv::Lock<nv::Mutex> lock(src.m->mutex);
+            src.m->image->expandTo(dst->m->image);
+        }
+        dst->m->image->scaleBias(0, 3, scale, bias);
+    }
+    else {
+        dst->m->image->scaleBias(src.m->image, 0, 3, scale, bias);
+    }
 }
 
+void nvtt::quantize(Surface & img, const int bits[4], bool exactEndPoints, bool dither)
+{
+    if (img.isNull()) return;
+
+    img.detach();
+    Repack repack(img);
 
-float nvtt::cieLabError(const Surface & reference, const Surface & image)
+    FloatImage * image = img.m->image;
+
+    UniformQuantizer quantizer;
+    quantizer.img = image;
+
+    uint channelCount = 0;
+    for (uint c = 0; c < 4; c++) {
+        if (bits[c] >= 0) {
+            quantizer.setChannel(channelCount++, c, bits[c], exactEndPoints);
+        }
+    }
+
+    if (!dither) {
+        const uint count = image->pixelCount();
+        for (uint i = 0; i < channelCount; i++) {
+            float * c = image->channel(quantizer.channel[i]);
+            for (uint p = 0; p < count; p++) {
+                c[p] = saturate((floorf(c[p] * quantizer.scale[i] + quantizer.offset0[i]) + quantizer.offset1[i]) / quantizer.scale[i]);
+            }
+        }
+    }
+    else if (channelCount > 0) {
+        // All the channels are dithered in the same pass.
+        for (uint z = 0; z < image->depth(); z++) {
+            quantizer.z = z;
+            floydSteinberg(quantizer, image->width(), image->height(), channelCount);
+        }
+    }
+}
+
+
+namespace
+{
+    // Copy the single channel block error map to the color channels of a surface.
+    void setBlockErrors(const FloatImage & map, Surface * blockErrors)
+    {
+        *blockErrors = Surface();
+
+        FloatImage * img = blockErrors->m->image = new FloatImage;
+        img->allocate(4, map.width(), map.height(), map.depth());
+
+        const uint count = map.pixelCount();
+        for (uint i = 0; i < count; i++) {
+            const float e = map.pixel(0, i);
+            img->pixel(0, i) = e;
+            img->pixel(1, i) = e;
+            img->pixel(2, i) = e;
+            img->pixel(3, i) = 1.0f;
+        }
+    }
+
+} // namespace
+
+float nvtt::rmsError(const Surface & reference, const Surface & image, Surface * blockErrors/*= NULL*/)
 {
-    return nv::cieLabError(reference.m->image, image.m->image);
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    FloatImage map;
+    float error = nv::rmsColorError(referencePixels.ptr(), imagePixels.ptr(), reference.alphaMode() == nvtt::AlphaMode_Transparency, blockErrors ? &map : NULL);
+
+    if (blockErrors != NULL && error != FLT_MAX) setBlockErrors(map, blockErrors);
+    return error;
 }
 
-float nvtt::angularError(const Surface & reference, const Surface & image)
+
+float nvtt::rmsAlphaError(const Surface & reference, const Surface & image, Surface * blockErrors/*= NULL*/)
 {
-    //return nv::averageAngularError(reference.m->image, image.m->image);
-    return nv::rmsAngularError(reference.m->image, image.m->image);
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    FloatImage map;
+    float error = nv::rmsAlphaError(referencePixels.ptr(), imagePixels.ptr(), blockErrors ? &map : NULL);
+
+    if (blockErrors != NULL && error != FLT_MAX) setBlockErrors(map, blockErrors);
+    return error;
+}
+
+
+float nvtt::cieLabError(const Surface & reference, const Surface & image, Surface * blockErrors/*= NULL*/)
+{
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    FloatImage map;
+    float error = nv::cieLabError(referencePixels.ptr(), imagePixels.ptr(), blockErrors ? &map : NULL);
+
+    if (blockErrors != NULL && error != FLT_MAX) setBlockErrors(map, blockErrors);
+    return error;
+}
+
+float nvtt::angularError(const Surface & reference, const Surface & image, Surface * blockErrors/*= NULL*/)
+{
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    FloatImage map;
+    //float error = nv::averageAngularError(reference.m->image, image.m->image, blockErrors ? &map : NULL);
+    float error = nv::rmsAngularError(referencePixels.ptr(), imagePixels.ptr(), blockErrors ? &map : NULL);
+
+    if (blockErrors != NULL && error != FLT_MAX) setBlockErrors(map, blockErrors);
+    return error;
+}
+
+float nvtt::psnr(const Surface & reference, const Surface & image, int channel/*= -1*/)
+{
+    if (channel < -1 || channel > 3) return 0.0f;
+
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    float mse;
+    if (channel < 0) {
+        // Mean of the squared error of the color channels.
+        float rmse = nv::rmsColorError(referencePixels.ptr(), imagePixels.ptr(), /*alphaWeight=*/false);
+        if (rmse == FLT_MAX) return 0.0f;
+        mse = rmse * rmse / 3.0f;
+    }
+    else {
+        float rmse = nv::rmsChannelError(referencePixels.ptr(), imagePixels.ptr(), channel);
+        if (rmse == FLT_MAX) return 0.0f;
+        mse = rmse * rmse;
+    }
+
+    if (mse == 0.0f) return 999.0f;
+
+    // Peak value is 1.
+    return -10.0f * log10f(mse);
+}
+
+float nvtt::ssim(const Surface & reference, const Surface & image, int channel, Surface * blockErrors/*= NULL*/)
+{
+    if (channel < 0 || channel > 3) return 0.0f;
+
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    FloatImage map;
+    float similarity = nv::structuralSimilarity(imagePixels.ptr(), referencePixels.ptr(), channel, blockErrors ? &map : NULL);
+
+    if (blockErrors != NULL && map.pixelCount() != 0) setBlockErrors(map, blockErrors);
+    return similarity;
 }
 
 
 Surface nvtt::diff(const Surface & reference, const Surface & image, float scale)
 {
-    const FloatImage * ref = reference.m->image;
-    const FloatImage * img = image.m->image;
+    FloatPixels referencePixels(reference);
+    FloatPixels imagePixels(image);
+
+    const FloatImage * ref = referencePixels.ptr();
+    const FloatImage * img = imagePixels.ptr();
 
     if (!sameLayout(img, ref)) {
         return Surface();
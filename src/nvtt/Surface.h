@@ -27,6 +27,8 @@
 
 #include "nvtt.h"
 
+#include "nvthread/Mutex.h"
+
 #include "nvcore/RefCounted.h"
 #include "nvcore/Ptr.h"
 
@@ -48,6 +50,7 @@ namespace nvtt
             wrapMode = WrapMode_Mirror;
             alphaMode = AlphaMode_None;
             isNormalMap = false;
+            storageFormat = StorageFormat_Float;
             
             image = NULL;
         }
@@ -59,22 +62,67 @@ namespace nvtt
             wrapMode = p.wrapMode;
             alphaMode = p.alphaMode;
             isNormalMap = p.isNormalMap;
+            storageFormat = p.storageFormat;
 
-            image = p.image->clone();
+            nv::Lock<nv::Mutex> lock(p.mutex);
+            image = (p.image != NULL) ? p.image->clone() : NULL;
         }
         ~Private()
         {
             delete image;
         }
 
+        // Expand compact storage before accessing the pixels in place. The contents are logically the same, so this is also done on
+        // shared and const surfaces by Surface::data and Surface::channel, the mutex makes sure that only one thread does it. Code that
+        // only reads the pixels should use FloatPixels instead, so that the storage stays compact.
+        void expand() const
+        {
+            nv::Lock<nv::Mutex> lock(mutex);
+            if (image != NULL) image->expand();
+        }
+
+        // Pack the pixels again after they have been modified. Only call this when the surface is not shared.
+        void pack()
+        {
+            nvDebugCheck(refCount() <= 1);
+            if (image != NULL && storageFormat != StorageFormat_Float) image->compact((nv::FloatImage::StorageFormat)storageFormat);
+        }
+
         TextureType type;
         WrapMode wrapMode;
         AlphaMode alphaMode;
         bool isNormalMap;
+        StorageFormat storageFormat;    // Format the pixels are kept in between operations.
 
         nv::FloatImage * image;
+        mutable nv::Mutex mutex;
+    };
+
+    // Float pixels of a surface, for code that only reads them. Compact surfaces are decoded to a scratch image that lives as long
+    // as this object, so that their storage stays packed.
+    class FloatPixels
+    {
+    public:
+        FloatPixels(const Surface & s);
+
+        const nv::FloatImage * operator->() const { return m_image; }
+        const nv::FloatImage * ptr() const { return m_image; }
+
+    private:
+        const nv::FloatImage * m_image;
+        nv::AutoPtr<nv::FloatImage> m_scratch;
     };
 
+    // Out-of-place transforms used by the compressor. These write the result to dst reusing its storage, instead of sharing and cloning the source.
+    void toGamma(const Surface & src, float gamma, Surface * dst);
+    void packNormals(const Surface & src, float scale, float bias, Surface * dst);
+
+    // Quantize all the channels with a non negative bit count in a single pass, see Surface::quantize.
+    void quantize(Surface & img, const int bits[4], bool exactEndPoints, bool dither);
+
+    // Default width and parameters of a ResizeFilter or MipmapFilter.
+    void getDefaultFilterWidthAndParams(int filter, float * filterWidth, float params[2]);
+
 } // nvtt namespace
 
 namespace nv {
@@ -0,0 +1,295 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "WriteBehind.h"
+
+#include "nvcore/StdStream.h" // fileSeek, fileTell
+#include "nvcore/Utils.h" // min, max
+#include "nvcore/Array.inl"
+
+#if !NV_OS_WIN32
+#include <sys/uio.h> // writev
+#include <fcntl.h> // fcntl, posix_fadvise, O_DIRECT
+#include <unistd.h> // write
+#include <errno.h>
+#endif
+
+#include <string.h> // memcpy
+
+using namespace nv;
+using namespace nvtt;
+
+namespace
+{
+    // Alignment of the buffers, their size and the file offset required by direct I/O.
+    const uint Alignment = 4096;
+
+    // Buffers written with a single call.
+    const uint MaxBufferCount = 64;
+
+#if !NV_OS_WIN32
+    // Write all the vectors, resuming after partial writes.
+    bool writeVectors(int fd, struct iovec * iov, int count)
+    {
+        while (count > 0) {
+            ssize_t result = ::writev(fd, iov, count);
+            if (result < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+
+            size_t written = size_t(result);
+            while (count > 0 && written >= iov->iov_len) {
+                written -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = (uint8 *)iov->iov_base + written;
+                iov->iov_len -= written;
+            }
+        }
+        return true;
+    }
+
+    void setDirectIO(int fd, bool enable)
+    {
+#if defined(O_DIRECT)
+        int flags = fcntl(fd, F_GETFL);
+        if (flags != -1) {
+            fcntl(fd, F_SETFL, enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT));
+        }
+#endif
+    }
+#endif
+
+} // namespace
+
+
+WriteBehind::WriteBehind(FILE * fp, uint bufferSize, uint bufferCount, bool directIO) :
+    m_fp(fp), m_fd(-1), m_offset(0), m_adviseOffset(0), m_directIO(false), m_dropCache(false),
+    m_current(0), m_used(0), m_closed(false), m_first(0), m_pending(0), m_closing(false), m_error(false)
+{
+    nvDebugCheck(fp != NULL);
+
+    m_bufferSize = (max(bufferSize, Alignment) + Alignment - 1) & ~(Alignment - 1);
+    m_bufferCount = clamp(bufferCount, 1U, MaxBufferCount);
+
+    m_memory = (uint8 *)::malloc(m_bufferCount * m_bufferSize + Alignment);
+    m_buffers = (uint8 *)((uintptr_t(m_memory) + Alignment - 1) & ~uintptr_t(Alignment - 1));
+    m_sizes.resize(m_bufferCount, 0);
+
+    // Anything buffered by stdio goes first.
+    fflush(m_fp);
+    m_offset = fileTell(m_fp);
+    m_adviseOffset = m_offset;
+
+#if !NV_OS_WIN32
+    m_fd = fileno(m_fp);
+
+    if (directIO) {
+#if defined(O_DIRECT)
+        // The buffers are aligned, but the file offset must be too.
+        if ((m_offset & (Alignment - 1)) == 0) {
+            setDirectIO(m_fd, true);
+            m_directIO = (fcntl(m_fd, F_GETFL) & O_DIRECT) != 0;
+        }
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+        m_dropCache = !m_directIO;
+#endif
+    }
+#endif
+
+    m_thread.start(threadFunc, this);
+}
+
+WriteBehind::~WriteBehind()
+{
+    close();
+    ::free(m_memory);
+}
+
+bool WriteBehind::write(const void * data, uint64 size)
+{
+    nvDebugCheck(!m_closed);
+
+    const uint8 * ptr = (const uint8 *)data;
+    while (size > 0) {
+        uint count = uint(min(size, uint64(m_bufferSize - m_used)));
+        memcpy(buffer(m_current) + m_used, ptr, count);
+        m_used += count;
+        ptr += count;
+        size -= count;
+
+        if (m_used == m_bufferSize) {
+            if (!submit()) return false;
+        }
+    }
+
+    return true;
+}
+
+bool WriteBehind::close()
+{
+    if (m_closed) return !m_error;
+
+    if (m_used != 0) {
+        submit();
+    }
+
+    m_mutex.lock();
+    m_closing = true;
+    m_mutex.unlock();
+
+    m_dataReady.post();
+    m_thread.wait();
+    m_closed = true;
+
+#if !NV_OS_WIN32
+    if (m_directIO) {
+        setDirectIO(m_fd, false);
+    }
+
+    // The file descriptor was written directly, stdio must know where it is.
+    fileSeek(m_fp, m_offset, SEEK_SET);
+#endif
+
+    return !m_error;
+}
+
+// Queue the current buffer and wait until the next one is free.
+bool WriteBehind::submit()
+{
+    m_sizes[m_current] = m_used;
+
+    m_mutex.lock();
+    m_pending++;
+    m_mutex.unlock();
+
+    m_dataReady.post();
+
+    m_current = (m_current + 1) % m_bufferCount;
+    m_used = 0;
+
+    for (;;) {
+        m_mutex.lock();
+        const bool full = (m_pending == m_bufferCount);
+        const bool error = m_error;
+        m_mutex.unlock();
+
+        if (!full) return !error;
+
+        m_bufferFree.wait();
+    }
+}
+
+/*static*/ void WriteBehind::threadFunc(void * arg)
+{
+    ((WriteBehind *)arg)->run();
+}
+
+void WriteBehind::run()
+{
+    for (;;) {
+        m_mutex.lock();
+        while (m_pending == 0 && !m_closing) {
+            m_mutex.unlock();
+            m_dataReady.wait();
+            m_mutex.lock();
+        }
+        const uint first = m_first;
+        const uint count = m_pending;
+        const bool error = m_error;
+        m_mutex.unlock();
+
+        if (count == 0) break;
+
+        // After an error the buffers are dropped, so that the writer doesn't block.
+        const bool ok = error || writeBuffers(first, count);
+
+        m_mutex.lock();
+        m_first = (first + count) % m_bufferCount;
+        m_pending -= count;
+        if (!ok) m_error = true;
+        m_mutex.unlock();
+
+        m_bufferFree.post();
+    }
+}
+
+bool WriteBehind::writeBuffers(uint first, uint count)
+{
+    uint64 total = 0;
+
+#if NV_OS_WIN32
+    for (uint i = 0; i < count; i++) {
+        const uint b = (first + i) % m_bufferCount;
+        if (fwrite(buffer(b), 1, m_sizes[b], m_fp) != m_sizes[b]) return false;
+        total += m_sizes[b];
+    }
+#else
+    struct iovec iov[MaxBufferCount];
+    for (uint i = 0; i < count; i++) {
+        const uint b = (first + i) % m_bufferCount;
+        iov[i].iov_base = buffer(b);
+        iov[i].iov_len = m_sizes[b];
+        total += m_sizes[b];
+    }
+
+    // Only the last buffer can be partial. Direct I/O needs whole blocks, so it's written through the page cache.
+    uint directCount = count;
+    if (m_directIO && iov[count - 1].iov_len != m_bufferSize) {
+        directCount--;
+    }
+
+    if (!writeVectors(m_fd, iov, directCount)) {
+        if (!m_directIO || errno != EINVAL) return false;
+
+        // The file system doesn't support direct I/O after all. Continue where the failed write stopped.
+        setDirectIO(m_fd, false);
+        m_directIO = false;
+#if defined(POSIX_FADV_DONTNEED)
+        m_dropCache = true;
+#endif
+        if (!writeVectors(m_fd, iov, directCount)) return false;
+    }
+
+    if (directCount != count) {
+        setDirectIO(m_fd, false);
+        m_directIO = false;
+        if (!writeVectors(m_fd, iov + directCount, count - directCount)) return false;
+    }
+
+#if defined(POSIX_FADV_DONTNEED)
+    if (m_dropCache) {
+        // Starts writeback of the dirty pages and drops the clean ones, the pages of the previous write should be clean by now.
+        posix_fadvise(m_fd, off_t(m_adviseOffset), off_t(m_offset + total - m_adviseOffset), POSIX_FADV_DONTNEED);
+        m_adviseOffset = m_offset;
+    }
+#endif
+#endif
+
+    m_offset += total;
+    return true;
+}
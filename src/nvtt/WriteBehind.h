@@ -0,0 +1,101 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef NVTT_WRITEBEHIND_H
+#define NVTT_WRITEBEHIND_H
+
+#include "nvthread/Thread.h"
+#include "nvthread/Mutex.h"
+#include "nvthread/Event.h"
+
+#include "nvcore/Array.h"
+
+#include <stdio.h> // FILE
+
+
+namespace nvtt
+{
+
+    // Writes to a file from a separate I/O thread.
+    //
+    // Data is copied to a ring of large aligned buffers. The I/O thread writes all the buffers that are full with
+    // a single vectored write, so the writer only blocks when every buffer is waiting for the disk.
+    class WriteBehind
+    {
+        NV_FORBID_COPY(WriteBehind);
+    public:
+
+        // The file is written at the current position of fp. When directIO is set, the page cache is bypassed
+        // with O_DIRECT where possible, otherwise the written pages are dropped from the cache with posix_fadvise.
+        WriteBehind(FILE * fp, uint bufferSize, uint bufferCount, bool directIO);
+        ~WriteBehind();
+
+        bool write(const void * data, uint64 size);
+
+        // Write the remaining data, stop the I/O thread and move the position of fp to the end of the output.
+        bool close();
+
+    private:
+
+        static void threadFunc(void * arg);
+        void run();
+
+        bool submit();
+        bool writeBuffers(uint first, uint count);
+        uint8 * buffer(uint i) const { return m_buffers + i * m_bufferSize; }
+
+        FILE * m_fp;
+        int m_fd;
+        uint64 m_offset;                // File offset of the next buffer written by the I/O thread.
+        uint64 m_adviseOffset;          // Start of the range that is not dropped from the page cache yet.
+
+        uint m_bufferSize;
+        uint m_bufferCount;
+        bool m_directIO;                // O_DIRECT is enabled.
+        bool m_dropCache;               // Drop the written pages with posix_fadvise.
+
+        uint8 * m_memory;
+        uint8 * m_buffers;
+        nv::Array<uint> m_sizes;
+
+        // Producer state.
+        uint m_current;
+        uint m_used;
+        bool m_closed;
+
+        // Shared state, protected by the mutex.
+        nv::Mutex m_mutex;
+        uint m_first;                   // First buffer waiting to be written.
+        uint m_pending;                 // Number of buffers waiting to be written.
+        bool m_closing;
+        bool m_error;
+
+        nv::Event m_dataReady;
+        nv::Event m_bufferFree;
+        nv::Thread m_thread;
+    };
+
+} // nvtt namespace
+
+
+#endif // NVTT_WRITEBEHIND_H
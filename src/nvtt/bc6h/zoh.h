@@ -61,7 +61,7 @@ public:
 	static void decompresstwo(const char *block, Tile &t);
 
 	static double refinetwo(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_TWO], char *block);
-	static double roughtwo(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_TWO]);
+	static double roughtwo(const Tile &tile, int shape, const nv::Vector3 directions[NREGIONS_TWO], FltEndpts endpts[NREGIONS_TWO]);
 
 	static double refineone(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_ONE], char *block);
 	static double roughone(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_ONE]);
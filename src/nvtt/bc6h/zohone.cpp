@@ -742,6 +742,7 @@ double ZOH::roughone(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS
 
         mean /= float(np);
 
+        // There's a single shape with a single region in this mode, so there's nothing to batch with Fit::computePrincipalComponents.
         Vector3 direction = Fit::computePrincipalComponent(np, colors);
 
         // project each pixel value along the principal direction
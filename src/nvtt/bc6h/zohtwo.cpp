@@ -787,7 +787,8 @@ static double map_colors(const Tile &tile, int shapeindex, const FltEndpts endpt
     return toterr;
 }
 
-double ZOH::roughtwo(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS_TWO])
+// directions are the principal components of the regions, see compresstwo.
+double ZOH::roughtwo(const Tile &tile, int shapeindex, const Vector3 directions[NREGIONS_TWO], FltEndpts endpts[NREGIONS_TWO])
 {
     for (int region=0; region<NREGIONS_TWO; ++region)
     {
@@ -827,7 +828,7 @@ double ZOH::roughtwo(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS
 
         mean /= float(np);
 
-        Vector3 direction = Fit::computePrincipalComponent(np, colors);
+        const Vector3 & direction = directions[region];
 
         // project each pixel value along the principal direction
         float minp = FLT_MAX, maxp = -FLT_MAX;
@@ -862,10 +863,44 @@ double ZOH::compresstwo(const Tile &t, char *block)
     collect the mse values that are within 5% of the best values
     optimize each one and choose the best
     */
+    // principal components of the regions of all the shapes, computed at once with the batched fit. the pixels that are
+    // not in a region have zero weight, so the result is the same as fitting the pixels of each region on its own.
+    const int NSETS = NSHAPES * NREGIONS_TWO;
+    float points[3 * Tile::TILE_TOTAL * NSETS];
+    float weights[Tile::TILE_TOTAL * NSETS];
+    float components[3 * NSETS];
+
+    for (int y = 0; y < Tile::TILE_H; y++)
+    for (int x = 0; x < Tile::TILE_W; x++)
+    {
+        const int i = y * Tile::TILE_W + x;
+        const bool inside = (x < t.size_x && y < t.size_y);
+        const Vector3 color = inside ? t.data[y][x] : Vector3(0.0f);
+
+        for (int shape = 0; shape < NSHAPES; shape++)
+        for (int region = 0; region < NREGIONS_TWO; region++)
+        {
+            const int set = shape * NREGIONS_TWO + region;
+            points[(3 * i + 0) * NSETS + set] = color.x;
+            points[(3 * i + 1) * NSETS + set] = color.y;
+            points[(3 * i + 2) * NSETS + set] = color.z;
+            weights[i * NSETS + set] = (inside && REGION(x,y,shape) == region) ? 1.0f : 0.0f;
+        }
+    }
+
+    Fit::computePrincipalComponents(NSETS, Tile::TILE_TOTAL, points, weights, Vector3(1.0f), components);
+
     // hack for now -- just use the best value WORK
     for (int i=0; i<NSHAPES && msebest>0.0; ++i)
     {
-        double mse = roughtwo(t, i, tempendpts);
+        Vector3 directions[NREGIONS_TWO];
+        for (int region = 0; region < NREGIONS_TWO; region++)
+        {
+            const int set = i * NREGIONS_TWO + region;
+            directions[region] = Vector3(components[0 * NSETS + set], components[1 * NSETS + set], components[2 * NSETS + set]);
+        }
+
+        double mse = roughtwo(t, i, directions, tempendpts);
         if (mse < msebest)
         {
             msebest = mse;
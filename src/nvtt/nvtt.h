@@ -243,6 +243,14 @@ namespace nvtt
         AlphaMode_Premultiplied,
     };
 
+    // Storage formats for Surface::compact and InputOptions::setStorageFormat.
+    enum StorageFormat {
+        StorageFormat_Float,
+        StorageFormat_Half,
+        StorageFormat_UNorm16,      // Values are clamped to [0, 1].
+        StorageFormat_UNorm8,       // Values are clamped to [0, 1].
+    };
+
     // Input options. Specify format and layout of the input texture.
     struct InputOptions
     {
@@ -278,6 +286,7 @@ namespace nvtt
         NVTT_API void setMipmapFilter(MipmapFilter filter);
         NVTT_API void setMipmapGeneration(bool enabled, int maxLevel = -1);
         NVTT_API void setKaiserParameters(float width, float alpha, float stretch);
+        NVTT_API void setAlphaCoverage(bool enabled, float alphaRef = 0.5f);
 
         // Set normal map options.
         NVTT_API void setNormalMap(bool b);
@@ -289,6 +298,9 @@ namespace nvtt
         // Set resizing options.
         NVTT_API void setMaxExtents(int d);
         NVTT_API void setRoundMode(RoundMode mode);
+
+        // Set the format of the images kept between processing steps.
+        NVTT_API void setStorageFormat(StorageFormat format);
     };
 
 
@@ -361,6 +373,19 @@ namespace nvtt
         NVTT_API void setContainer(Container container);
         NVTT_API void setUserVersion(int version);
         NVTT_API void setSrgbFlag(bool b);
+
+        NVTT_API void setStreamingLayout(bool b);   // Mipmaps from smallest to largest, after an index of their offsets.
+        NVTT_API void setWriteBehind(bool enable, int bufferSize = 1024 * 1024, int bufferCount = 4, bool directIO = false);
+    };
+
+    // Interface used to provide the pixels of images that are too large to be held in memory.
+    struct ImageSource
+    {
+        virtual ~ImageSource() {}
+
+        // Read rows [y, y + count) of the image. The pixels are returned in planar RGBA float format, the
+        // same used by Surface: channel c of row r starts at rgba + (c * count + r) * width.
+        virtual bool readRows(int y, int count, float * rgba) = 0;
     };
 
     typedef void Task(void * context, int id);
@@ -370,6 +395,32 @@ namespace nvtt
         virtual void dispatch(Task * task, void * context, int count) = 0;
     };
 
+    // Persistent cache of compressed textures, shared by all the builds that use the same directory. See Compressor::setCache.
+    struct Cache
+    {
+        NVTT_FORBID_COPY(Cache);
+        NVTT_DECLARE_PIMPL(Cache);
+
+        NVTT_API Cache();
+        NVTT_API ~Cache();
+
+        // Keep the entries in the given directory, it's created if it doesn't exist.
+        NVTT_API bool open(const char * path);
+
+        // The least recently used entries are evicted when the cache grows over the limits. An entry count of 0 means no limit.
+        NVTT_API void setSizeLimit(int megabytes, int entryCount = 0);
+
+        // Statistics of the lookups since the cache was opened.
+        NVTT_API int hitCount() const;
+        NVTT_API int missCount() const;
+        NVTT_API int storeCount() const;
+        NVTT_API int evictionCount() const;
+
+        // Contents of the cache directory.
+        NVTT_API int entryCount() const;
+        NVTT_API float size() const;    // In megabytes.
+    };
+
     // Context.
     struct Compressor
     {
@@ -384,10 +435,31 @@ namespace nvtt
         NVTT_API bool isCudaAccelerationEnabled() const;
         NVTT_API void setTaskDispatcher(TaskDispatcher * disp);
 
+        // Look up the output of process in the cache before compressing the texture, and store it there afterwards. The key
+        // is a hash of the input images, all the input, compression and output settings, and the library version.
+        NVTT_API void setCache(Cache * cache);
+
         // InputOptions API.
         NVTT_API bool process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API int estimateSize(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const;
 
+        // Out-of-core API. Compress a 2D texture that is too large to be held in memory. The extents and processing options
+        // are taken from the input options, but the pixels are read from the given source in stripes, and the compressed
+        // blocks are written to the output handler as they are produced. Mipmap levels that fit in the memory budget are
+        // processed in memory.
+        NVTT_API bool process(const InputOptions & inputOptions, ImageSource * source, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
+
+        // Memory used by the out-of-core API for the input buffer, the stripes and the levels processed in memory, including
+        // their working copies and compressed output. The budget is approximate: the rows cached by the mipmap filters and the
+        // scratch memory of the compressors are not counted. The default is 256 MB.
+        NVTT_API void setMemoryBudget(int megabytes);
+
+        // Virtual texture API. Cut every mipmap level of an out-of-core texture in pages of pageSize x pageSize texels, add
+        // borderSize texels around each page, taken from the neighbor pages or according to the wrap mode at the edges, and
+        // compress them in parallel. The output is a page pack: a header and an index with the offset of each page followed
+        // by the compressed pages (see nvimage/PagePack.h). The container setting of the output options is ignored.
+        NVTT_API bool processPages(const InputOptions & inputOptions, ImageSource * source, int pageSize, int borderSize, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
+
         // Surface API.
         NVTT_API bool outputHeader(const Surface & img, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API bool compress(const Surface & img, int face, int mipmap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
@@ -422,6 +494,15 @@ namespace nvtt
         ToneMapper_Lightmap,
     };
 
+    // Statistics of the channels of a surface, see Surface::statistics.
+    struct Statistics
+    {
+        float minimum[4];
+        float maximum[4];
+        float mean[4];
+        int histogram[4][256];      // Histogram of each channel in the range given to Surface::statistics. Values out of the range go to the first or last bin.
+    };
+
     /*enum ChannelMask {
         R = 0x70000001,
         G = 0x70000002,
@@ -461,9 +542,19 @@ namespace nvtt
         NVTT_API const float * channel(int i) const;
         NVTT_API void histogram(int channel, float rangeMin, float rangeMax, int binCount, int * binPtr) const;
         NVTT_API void range(int channel, float * rangeMin, float * rangeMax, int alpha_channel = -1, float alpha_ref = 0.f) const;
+        NVTT_API void statistics(Statistics * stats, float rangeMin = 0.0f, float rangeMax = 1.0f) const;
+        NVTT_API StorageFormat storageFormat() const;
+
+        // Compact storage. The pixels are kept in the given format between operations: they are expanded to floats while an operation
+        // modifies them and packed again when it's done, so the results are rounded to the storage precision. Operations that only read
+        // the pixels, like the compressor and the error metrics, decode them to a temporary copy. data() and channel() return pointers
+        // to the pixels, so they leave them expanded until the surface is modified again. Use Float to go back to full precision. Use this to reduce the footprint of surfaces that are kept around, for example, LDR images or the
+        // levels of a mipmap chain.
+        NVTT_API void compact(StorageFormat format);
 
         // Texture data.
         NVTT_API bool load(const char * fileName, bool * hasAlpha = 0);
+        NVTT_API bool loadMipmap(const char * fileName, int minExtent, bool * hasAlpha = 0); // Smallest mipmap or JPEG scale with width or height >= minExtent.
         NVTT_API bool save(const char * fileName, bool hasAlpha = 0, bool hdr = 0) const;
         NVTT_API bool setImage(int w, int h, int d);
         NVTT_API bool setImage(InputFormat format, int w, int h, int d, const void * data);
@@ -614,6 +705,7 @@ namespace nvtt
         // Filtering.
         NVTT_API CubeSurface irradianceFilter(int size, EdgeFixup fixupMethod) const;
         NVTT_API CubeSurface cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod) const;
+        NVTT_API CubeSurface fastCosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod, int sampleCount = 256) const;
 
         NVTT_API CubeSurface fastResample(int size, EdgeFixup fixupMethod) const;
 
@@ -623,10 +715,12 @@ namespace nvtt
         NVTT_API void resize(int w, int h, ResizeFilter filter, float filterWidth, const float * params = 0);
         NVTT_API void resize(int maxExtent, RoundMode mode, ResizeFilter filter);
         NVTT_API void resize(int maxExtent, RoundMode mode, ResizeFilter filter, float filterWidth, const float * params = 0);
-        NVTT_API bool buildNextMipmap(MipmapFilter filter);
-        NVTT_API bool buildNextMipmap(MipmapFilter filter, float filterWidth, const float * params = 0);
         */
 
+        // Mipmapping. Faces are filtered across the edges.
+        NVTT_API bool buildNextMipmap(MipmapFilter filter, EdgeFixup fixupMethod);
+        NVTT_API bool buildNextMipmap(MipmapFilter filter, float filterWidth, const float * params, EdgeFixup fixupMethod);
+
         // Color transforms.
         NVTT_API void toLinear(float gamma);
         NVTT_API void toGamma(float gamma);
@@ -645,12 +739,21 @@ namespace nvtt
     // Return NVTT version.
     NVTT_API unsigned int version();
 
-    NVTT_API float rmsError(const Surface & reference, const Surface & img);
-    NVTT_API float rmsAlphaError(const Surface & reference, const Surface & img);
-    NVTT_API float cieLabError(const Surface & reference, const Surface & img);
-    NVTT_API float angularError(const Surface & reference, const Surface & img);
+    // Error metrics. When blockErrors is not NULL, it's set to a surface with the error of each 4x4 block in the color channels.
+    NVTT_API float rmsError(const Surface & reference, const Surface & img, Surface * blockErrors = 0);
+    NVTT_API float rmsAlphaError(const Surface & reference, const Surface & img, Surface * blockErrors = 0);
+    NVTT_API float cieLabError(const Surface & reference, const Surface & img, Surface * blockErrors = 0);
+    NVTT_API float angularError(const Surface & reference, const Surface & img, Surface * blockErrors = 0);
+
+    // Peak signal to noise ratio in dB of the given channel, or of the color channels when channel is -1. Values are assumed to be in the [0, 1] range. Returns 999 when the surfaces are identical, and 0 when they have different sizes or the channel is not valid.
+    NVTT_API float psnr(const Surface & reference, const Surface & img, int channel = -1);
+    // Mean structural similarity index of the given channel, in the [-1, 1] range where 1 means identical. The block errors hold the mean SSIM of each block. Returns 0 when the surfaces have different sizes or the channel is not valid.
+    NVTT_API float ssim(const Surface & reference, const Surface & img, int channel, Surface * blockErrors = 0);
     NVTT_API Surface diff(const Surface & reference, const Surface & img, float scale);
 
+    // Scale the alpha of the given surfaces so that they have the given alpha test coverage. All surfaces are processed in a single parallel pass.
+    NVTT_API void scaleAlphaToCoverage(Surface * surfaces, int count, float coverage, float alphaRef = 0.5f);
+
 
 } // nvtt namespace
 
@@ -0,0 +1,183 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+
+// Compresses the same texture with and without a cache. Checks the hits, misses and evictions of the cache, that the
+// replayed output is identical to the compressed one, and that the key changes with the options and the pixels.
+
+#include <nvtt/nvtt.h>
+#include <nvcore/nvcore.h>
+
+#include <stdio.h>
+#include <stdlib.h> // rand
+#include <time.h> // time
+
+#include <vector>
+
+
+// Stores the output in memory, including the image headers.
+struct MemoryOutputHandler : public nvtt::OutputHandler
+{
+    virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+    {
+        const int header[] = { -1, size, width, height, depth, face, miplevel };
+        buffer.insert(buffer.end(), (const unsigned char *)header, (const unsigned char *)(header + 7));
+    }
+
+    virtual bool writeData(const void * data, int size)
+    {
+        const unsigned char * bytes = (const unsigned char *)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        return true;
+    }
+
+    virtual void endImage()
+    {
+        const int footer = -2;
+        buffer.insert(buffer.end(), (const unsigned char *)&footer, (const unsigned char *)(&footer + 1));
+    }
+
+    std::vector<unsigned char> buffer;
+};
+
+struct Settings
+{
+    Settings() : format(nvtt::Format_BC3), wrapMode(nvtt::WrapMode_Mirror) {}
+
+    nvtt::Format format;
+    nvtt::WrapMode wrapMode;
+};
+
+static bool compress(nvtt::Cache * cache, const std::vector<unsigned char> & bgra, int w, int h, const Settings & settings, std::vector<unsigned char> * output)
+{
+    nvtt::InputOptions inputOptions;
+    inputOptions.setTextureLayout(nvtt::TextureType_2D, w, h);
+    inputOptions.setMipmapData(&bgra[0], w, h);
+    inputOptions.setWrapMode(settings.wrapMode);
+
+    nvtt::CompressionOptions compressionOptions;
+    compressionOptions.setFormat(settings.format);
+    compressionOptions.setQuality(nvtt::Quality_Fastest);
+
+    MemoryOutputHandler outputHandler;
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+    compressor.setCache(cache);
+
+    bool success = compressor.process(inputOptions, compressionOptions, outputOptions);
+    output->swap(outputHandler.buffer);
+
+    return success;
+}
+
+static int s_failures = 0;
+
+static void check(bool condition, const char * test)
+{
+    printf("%s: %s\n", test, condition ? "ok" : "FAILED");
+    if (!condition) s_failures++;
+}
+
+int main(int argc, char *argv[])
+{
+    const int w = 64;
+    const int h = 48;
+
+    // The directory keeps the entries of previous runs, use different pixels every time so that they are not hit.
+    srand(uint(time(NULL)));
+
+    std::vector<unsigned char> bgra(w * h * 4);
+    for (int i = 0; i < w * h * 4; i++) {
+        bgra[i] = (unsigned char)(rand() & 0xFF);
+    }
+
+    const int entryCountLimit = 8;
+
+    nvtt::Cache cache;
+    cache.setSizeLimit(64, entryCountLimit);
+    if (!cache.open("cachetest.dir")) {
+        printf("Can't open cache directory.\n");
+        return EXIT_FAILURE;
+    }
+
+    Settings settings;
+
+    std::vector<unsigned char> reference;
+    if (!compress(NULL, bgra, w, h, settings, &reference)) {
+        printf("Compression failed.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Miss, the output is stored.
+    std::vector<unsigned char> output;
+    bool success = compress(&cache, bgra, w, h, settings, &output);
+    check(success && cache.missCount() == 1 && cache.hitCount() == 0 && cache.storeCount() == 1, "miss");
+    check(output == reference, "miss output");
+
+    // Hit, the stored output is replayed.
+    success = compress(&cache, bgra, w, h, settings, &output);
+    check(success && cache.missCount() == 1 && cache.hitCount() == 1 && cache.storeCount() == 1, "hit");
+    check(output == reference, "replayed output");
+
+    // Different compression options.
+    Settings other = settings;
+    other.format = nvtt::Format_BC2;
+    success = compress(&cache, bgra, w, h, other, &output);
+    check(success && cache.missCount() == 2 && cache.hitCount() == 1, "compression options in key");
+
+    // Different input options.
+    other = settings;
+    other.wrapMode = nvtt::WrapMode_Repeat;
+    success = compress(&cache, bgra, w, h, other, &output);
+    check(success && cache.missCount() == 3 && cache.hitCount() == 1, "input options in key");
+
+    // Different pixels, only the last one is changed.
+    std::vector<unsigned char> changed = bgra;
+    changed[w * h * 4 - 1] ^= 1;
+    success = compress(&cache, changed, w, h, settings, &output);
+    check(success && cache.missCount() == 4 && cache.hitCount() == 1, "pixels in key");
+
+    // The original output is still there.
+    success = compress(&cache, bgra, w, h, settings, &output);
+    check(success && cache.missCount() == 4 && cache.hitCount() == 2 && output == reference, "hit after misses");
+
+    // Eviction, more new entries than the limit.
+    const int evictionCount = cache.evictionCount();
+    for (int i = 0; i < entryCountLimit + 2; i++) {
+        changed = bgra;
+        changed[i] ^= 1;
+        success &= compress(&cache, changed, w, h, settings, &output);
+    }
+    check(success && cache.evictionCount() > evictionCount && cache.entryCount() <= entryCountLimit, "eviction");
+
+    // The most recent entry is kept.
+    const int hitCount = cache.hitCount();
+    success = compress(&cache, changed, w, h, settings, &output);
+    check(success && cache.hitCount() == hitCount + 1, "hit after eviction");
+
+    return s_failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// 8 bit input can be compressed without converting it to floats. Checks that the output is identical to the one of the
+// float pipeline, which is used for the same pixels when they are supplied as floats, for several gammas and formats.
+
+#include <nvtt/nvtt.h>
+#include <nvcore/nvcore.h>
+
+#include <stdio.h>
+#include <stdlib.h> // rand
+#include <string.h> // memcmp
+
+#include <vector>
+
+
+// Stores the output in memory.
+struct MemoryOutputHandler : public nvtt::OutputHandler
+{
+    virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+    {
+        // ignore.
+    }
+
+    virtual bool writeData(const void * data, int size)
+    {
+        const unsigned char * bytes = (const unsigned char *)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        return true;
+    }
+
+    virtual void endImage()
+    {
+        // ignore.
+    }
+
+    std::vector<unsigned char> buffer;
+};
+
+static bool compress(nvtt::InputFormat format, const void * data, int w, int h, float gamma, nvtt::Format compressionFormat, std::vector<unsigned char> * output)
+{
+    nvtt::InputOptions inputOptions;
+    inputOptions.setTextureLayout(nvtt::TextureType_2D, w, h);
+    inputOptions.setFormat(format);
+    inputOptions.setMipmapData(data, w, h);
+    inputOptions.setMipmapGeneration(false);
+    inputOptions.setGamma(gamma, gamma);
+
+    nvtt::CompressionOptions compressionOptions;
+    compressionOptions.setFormat(compressionFormat);
+    compressionOptions.setQuality(nvtt::Quality_Fastest);
+
+    MemoryOutputHandler outputHandler;
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+
+    bool success = compressor.process(inputOptions, compressionOptions, outputOptions);
+    output->swap(outputHandler.buffer);
+
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    // Odd size, so that the partial blocks are tested too.
+    const int w = 61;
+    const int h = 37;
+
+    std::vector<unsigned char> bgra(w * h * 4);
+    std::vector<float> rgba(w * h * 4);
+
+    srand(1);
+    for (int i = 0; i < w * h; i++) {
+        for (int c = 0; c < 4; c++) {
+            bgra[4 * i + c] = (unsigned char)(rand() & 0xFF);
+        }
+
+        // Same conversion as Surface::setImage.
+        rgba[4 * i + 0] = float(bgra[4 * i + 2]) / 255.0f;
+        rgba[4 * i + 1] = float(bgra[4 * i + 1]) / 255.0f;
+        rgba[4 * i + 2] = float(bgra[4 * i + 0]) / 255.0f;
+        rgba[4 * i + 3] = float(bgra[4 * i + 3]) / 255.0f;
+    }
+
+    const float gammas[] = { 1.0f, 1.8f, 2.0f, 2.2f, 2.4f, 3.0f };
+    const int gammaCount = sizeof(gammas) / sizeof(gammas[0]);
+
+    const nvtt::Format formats[] = { nvtt::Format_BC2, nvtt::Format_BC3, nvtt::Format_BC4, nvtt::Format_BC5 };
+    const char * formatNames[] = { "BC2", "BC3", "BC4", "BC5" };
+    const int formatCount = sizeof(formats) / sizeof(formats[0]);
+
+    int failures = 0;
+
+    for (int g = 0; g < gammaCount; g++) {
+        for (int f = 0; f < formatCount; f++) {
+            std::vector<unsigned char> output8;
+            std::vector<unsigned char> output32;
+
+            bool success = compress(nvtt::InputFormat_BGRA_8UB, &bgra[0], w, h, gammas[g], formats[f], &output8);
+            success &= compress(nvtt::InputFormat_RGBA_32F, &rgba[0], w, h, gammas[g], formats[f], &output32);
+
+            int diff = 0;
+            if (success && output8.size() == output32.size()) {
+                for (size_t i = 0; i < output8.size(); i++) {
+                    if (output8[i] != output32[i]) diff++;
+                }
+            }
+
+            printf("gamma %.1f %s: ", gammas[g], formatNames[f]);
+            if (!success) {
+                printf("compression failed\n");
+                failures++;
+            }
+            else if (output8.size() != output32.size() || diff != 0) {
+                printf("%d of %d bytes differ\n", diff, int(output8.size()));
+                failures++;
+            }
+            else {
+                printf("identical\n");
+            }
+        }
+    }
+
+    return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -30,6 +30,7 @@
 
 #include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE
 #include <stdio.h> // printf
+#include <math.h> // fabsf, sqrt
 
 
 int main(int argc, char *argv[])
@@ -82,6 +83,7 @@ int main(int argc, char *argv[])
     timer.start();
 
     nvtt::CubeSurface filteredEnvmap[mipmapCount];
+    float filterTime[mipmapCount];
 
     // Output filtered mipmaps.
     for (int m = firstMipmap; m < mipmapCount; m++) {
@@ -91,7 +93,11 @@ int main(int argc, char *argv[])
 
         printf("filtering step: %d/%d\n", m+1, mipmapCount);
 
+        nv::Timer filterTimer;
+        filterTimer.start();
         filteredEnvmap[m] = envmap.cosinePowerFilter(size, cosine_power, nvtt::EdgeFixup_Warp);
+        filterTimer.stop();
+        filterTime[m] = filterTimer.elapsed();
         //filteredEnvmap[m].toGamma(2.2f);
     }
 
@@ -105,6 +111,37 @@ int main(int argc, char *argv[])
 
     printf("done in %f seconds\n", timer.elapsed());
 
+    // Compare the Monte Carlo approximation against the exact filter.
+    printf("%-6s %-7s %10s %10s %10s %10s\n", "level", "power", "exact", "fast", "rms error", "max error");
+
+    for (int m = firstMipmap; m < mipmapCount; m++) {
+        int size = topSize >> m;
+        float cosine_power = nv::max(1.0f, topPower / (1 << (2 * m)));
+
+        nv::Timer filterTimer;
+        filterTimer.start();
+        nvtt::CubeSurface fastEnvmap = envmap.fastCosinePowerFilter(size, cosine_power, nvtt::EdgeFixup_Warp);
+        filterTimer.stop();
+
+        double error = 0;
+        float maxError = 0;
+        for (int f = 0; f < 6; f++) {
+            for (int c = 0; c < 3; c++) {
+                const float * exact = filteredEnvmap[m].face(f).channel(c);
+                const float * fast = fastEnvmap.face(f).channel(c);
+
+                for (int i = 0; i < size * size; i++) {
+                    float diff = fabsf(exact[i] - fast[i]);
+                    error += diff * diff;
+                    maxError = nv::max(maxError, diff);
+                }
+            }
+        }
+
+        printf("%-6d %-7g %9.2fms %9.2fms %10f %10f\n", m, cosine_power, 1000 * filterTime[m], 1000 * filterTimer.elapsed(),
+            sqrt(error / (6 * 3 * size * size)), maxError);
+    }
+
     return EXIT_SUCCESS;
 }
 
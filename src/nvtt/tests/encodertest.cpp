@@ -0,0 +1,340 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Compares the color transforms of nvtt::Surface with straightforward scalar versions, checks that the results are
+// identical and reports their speed.
+
+#include <nvtt/nvtt.h>
+#include <nvimage/PixelFormat.h>
+#include <nvmath/nvmath.h>
+#include <nvcore/Utils.h>
+#include <nvcore/Timer.h>
+
+#include <stdio.h>
+#include <stdlib.h> // atoi, rand
+#include <string.h> // memcmp, memcpy
+#include <math.h>
+
+using namespace nv;
+
+
+// Scalar versions of the transforms. Each function gets the four channels of count pixels.
+
+static void toRGBM(float * r, float * g, float * b, float * a, int count, float threshold)
+{
+    for (int i = 0; i < count; i++) {
+        float R = nv::clamp(r[i], 0.0f, 1.0f);
+        float G = nv::clamp(g[i], 0.0f, 1.0f);
+        float B = nv::clamp(b[i], 0.0f, 1.0f);
+
+        float M = max(max(R, G), max(B, threshold));
+
+        r[i] = R / M;
+        g[i] = G / M;
+        b[i] = B / M;
+        a[i] = (M - threshold) / (1 - threshold);
+    }
+}
+
+static void fromRGBM(float * r, float * g, float * b, float * a, int count, float range)
+{
+    for (int i = 0; i < count; i++) {
+        float M = a[i] * range;
+
+        r[i] *= M;
+        g[i] *= M;
+        b[i] *= M;
+        a[i] = 1.0f;
+    }
+}
+
+static void toRGBE(float * r, float * g, float * b, float * a, int count, int mantissaBits, int exponentBits)
+{
+    const int exponentMax = (1 << exponentBits) - 1;
+    const int exponentBias = (1 << (exponentBits - 1)) - 1;
+    const float maxValue = float(exponentMax) / float(exponentMax + 1) * float(1 << (exponentMax - exponentBias));
+
+    for (int i = 0; i < count; i++) {
+        float R = nv::clamp(r[i], 0.0f, maxValue);
+        float G = nv::clamp(g[i], 0.0f, maxValue);
+        float B = nv::clamp(b[i], 0.0f, maxValue);
+
+        float M = max3(R, G, B);
+
+        int E = max(- exponentBias - 1, floatExponent(M)) + 1 + exponentBias;
+
+        double denom = pow(2.0, double(E - exponentBias - mantissaBits));
+
+        int m = iround(float(M / denom));
+        if (m == (1 << mantissaBits)) {
+            denom *= 2;
+            E += 1;
+        }
+
+        R = floatRound(float(R / denom));
+        G = floatRound(float(G / denom));
+        B = floatRound(float(B / denom));
+
+        r[i] = R / ((1 << mantissaBits) - 1);
+        g[i] = G / ((1 << mantissaBits) - 1);
+        b[i] = B / ((1 << mantissaBits) - 1);
+        a[i] = float(E) / ((1 << exponentBits) - 1);
+    }
+}
+
+static void fromRGBE(float * r, float * g, float * b, float * a, int count, int mantissaBits, int exponentBits)
+{
+    const int exponentBias = (1 << (exponentBits - 1)) - 1;
+
+    for (int i = 0; i < count; i++) {
+        int R = iround(r[i] * ((1 << mantissaBits) - 1));
+        int G = iround(g[i] * ((1 << mantissaBits) - 1));
+        int B = iround(b[i] * ((1 << mantissaBits) - 1));
+        int E = iround(a[i] * ((1 << exponentBits) - 1));
+
+        float scale = powf(2, float(E - exponentBias - mantissaBits));
+
+        r[i] = R * scale;
+        g[i] = G * scale;
+        b[i] = B * scale;
+        a[i] = 1;
+    }
+}
+
+static void toYCoCg(float * r, float * g, float * b, float * a, int count)
+{
+    for (int i = 0; i < count; i++) {
+        float R = r[i];
+        float G = g[i];
+        float B = b[i];
+
+        r[i] = (R - B);
+        g[i] = (2*G - R - B) * 0.5f;
+        b[i] = 1.0f;
+        a[i] = (2*G + R + B) * 0.25f;
+    }
+}
+
+static void blockScaleCoCg(float * r, float * g, float * b, int w, int h, int bits)
+{
+    for (int bj = 0; bj < (h + 3) / 4; bj++) {
+        for (int bi = 0; bi < (w + 3) / 4; bi++) {
+            float m = 1.0f / 255.0f;
+            for (int y = bj*4; y < min(bj*4 + 4, h); y++) {
+                for (int x = bi*4; x < min(bi*4 + 4, w); x++) {
+                    m = max(m, fabsf(r[y * w + x]));
+                    m = max(m, fabsf(g[y * w + x]));
+                }
+            }
+
+            float scale = PixelFormat::quantizeCeil(m, bits, 8);
+
+            for (int y = bj*4; y < min(bj*4 + 4, h); y++) {
+                for (int x = bi*4; x < min(bi*4 + 4, w); x++) {
+                    r[y * w + x] /= scale;
+                    g[y * w + x] /= scale;
+                    b[y * w + x] = scale;
+                }
+            }
+        }
+    }
+}
+
+static void fromYCoCg(float * r, float * g, float * b, float * a, int count)
+{
+    for (int i = 0; i < count; i++) {
+        float scale = b[i] * 0.5f;
+        float Co = r[i] * scale;
+        float Cg = g[i] * scale;
+        float Y = a[i];
+
+        r[i] = Y + Co - Cg;
+        g[i] = Y + Cg;
+        b[i] = Y - Co - Cg;
+        a[i] = 1.0f;
+    }
+}
+
+static void toLUVW(float * r, float * g, float * b, float * a, int count, float range)
+{
+    float irange = 1.0f / range;
+
+    for (int i = 0; i < count; i++) {
+        float R = nv::clamp(r[i] * irange, 0.0f, 1.0f);
+        float G = nv::clamp(g[i] * irange, 0.0f, 1.0f);
+        float B = nv::clamp(b[i] * irange, 0.0f, 1.0f);
+
+        float L = max(sqrtf(R*R + G*G + B*B), 1e-6f);
+
+        r[i] = R / L;
+        g[i] = G / L;
+        b[i] = B / L;
+        a[i] = L / sqrtf(3);
+    }
+}
+
+
+enum Transform
+{
+    Transform_ToRGBM,
+    Transform_FromRGBM,
+    Transform_ToRGBE,
+    Transform_FromRGBE,
+    Transform_ToRGB9E5,
+    Transform_ToYCoCg,
+    Transform_BlockScaleCoCg,
+    Transform_FromYCoCg,
+    Transform_ToLUVW,
+    Transform_Count
+};
+
+static const char * s_transformNames[Transform_Count] = {
+    "toRGBM",
+    "fromRGBM",
+    "toRGBE(8, 8)",
+    "fromRGBE(8, 8)",
+    "toRGBE(9, 5)",
+    "toYCoCg",
+    "blockScaleCoCg",
+    "fromYCoCg",
+    "toLUVW",
+};
+
+static void applyScalar(Transform t, float * c[4], int w, int h)
+{
+    const int count = w * h;
+    switch (t) {
+        case Transform_ToRGBM: toRGBM(c[0], c[1], c[2], c[3], count, 0.25f); break;
+        case Transform_FromRGBM: fromRGBM(c[0], c[1], c[2], c[3], count, 4.0f); break;
+        case Transform_ToRGBE: toRGBE(c[0], c[1], c[2], c[3], count, 8, 8); break;
+        case Transform_FromRGBE: fromRGBE(c[0], c[1], c[2], c[3], count, 8, 8); break;
+        case Transform_ToRGB9E5: toRGBE(c[0], c[1], c[2], c[3], count, 9, 5); break;
+        case Transform_ToYCoCg: toYCoCg(c[0], c[1], c[2], c[3], count); break;
+        case Transform_BlockScaleCoCg: blockScaleCoCg(c[0], c[1], c[2], w, h, 5); break;
+        case Transform_FromYCoCg: fromYCoCg(c[0], c[1], c[2], c[3], count); break;
+        case Transform_ToLUVW: toLUVW(c[0], c[1], c[2], c[3], count, 4.0f); break;
+        default: break;
+    }
+}
+
+static void apply(Transform t, nvtt::Surface & img)
+{
+    switch (t) {
+        case Transform_ToRGBM: img.toRGBM(1.0f, 0.25f); break;
+        case Transform_FromRGBM: img.fromRGBM(4.0f); break;
+        case Transform_ToRGBE: img.toRGBE(8, 8); break;
+        case Transform_FromRGBE: img.fromRGBE(8, 8); break;
+        case Transform_ToRGB9E5: img.toRGBE(9, 5); break;
+        case Transform_ToYCoCg: img.toYCoCg(); break;
+        case Transform_BlockScaleCoCg: img.blockScaleCoCg(5); break;
+        case Transform_FromYCoCg: img.fromYCoCg(); break;
+        case Transform_ToLUVW: img.toLUVW(4.0f); break;
+        default: break;
+    }
+}
+
+// Random HDR colors, with some special values mixed in.
+static float randomValue(Transform t)
+{
+    const int r = rand();
+    const float f = float(rand()) / RAND_MAX;
+
+    // The input of blockScaleCoCg is in the [-1, 1] range.
+    if (t == Transform_BlockScaleCoCg) return 2 * f - 1;
+
+    if (r % 64 == 0) {
+        static const float special[] = { 0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 1e-30f, 1e-40f, 65504.0f, 1e30f, NAN };
+        return special[(r / 64) % (sizeof(special) / sizeof(special[0]))];
+    }
+
+    // The inputs of the decoders are normalized.
+    if (t == Transform_FromRGBM || t == Transform_FromRGBE || t == Transform_FromYCoCg) return f;
+
+    return powf(2.0f, 24 * f - 12) * ((r & 1) ? 1.0f : -0.125f);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int size = 512;
+    int iterations = 4;
+    if (argc > 1) size = atoi(argv[1]);
+    if (argc > 2) iterations = atoi(argv[2]);
+
+    // Odd extents to test the remainders and the partial blocks.
+    const int w = size + 3;
+    const int h = size + 1;
+    const int count = w * h;
+
+    float * input = new float[4 * count];
+    float * reference = new float[4 * count];
+
+    printf("%dx%d pixels, %d iterations\n", w, h, iterations);
+    printf("%-16s %10s %10s %8s\n", "transform", "scalar", "nvtt", "speedup");
+
+    int failures = 0;
+
+    for (int t = 0; t < Transform_Count; t++) {
+        for (int i = 0; i < 4 * count; i++) {
+            input[i] = randomValue(Transform(t));
+        }
+
+        nvtt::Surface img;
+        Timer timer;
+
+        float scalarTime = 0.0f;
+        float surfaceTime = 0.0f;
+
+        for (int it = 0; it < iterations; it++) {
+            memcpy(reference, input, sizeof(float) * 4 * count);
+            float * c[4] = { reference, reference + count, reference + 2 * count, reference + 3 * count };
+
+            timer.start();
+            applyScalar(Transform(t), c, w, h);
+            timer.stop();
+            scalarTime += timer.elapsed();
+
+            img.setImage(nvtt::InputFormat_RGBA_32F, w, h, 1, input, input + count, input + 2 * count, input + 3 * count);
+
+            timer.start();
+            apply(Transform(t), img);
+            timer.stop();
+            surfaceTime += timer.elapsed();
+        }
+
+        bool identical = true;
+        for (int ch = 0; ch < 4 && identical; ch++) {
+            identical = memcmp(img.channel(ch), reference + ch * count, sizeof(float) * count) == 0;
+        }
+
+        printf("%-16s %9.2fms %9.2fms %7.2fx %s\n", s_transformNames[t], 1000 * scalarTime / iterations, 1000 * surfaceTime / iterations,
+            scalarTime / nv::max(surfaceTime, 1e-9f), identical ? "" : "MISMATCH");
+
+        if (!identical) failures++;
+    }
+
+    delete [] input;
+    delete [] reference;
+
+    return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
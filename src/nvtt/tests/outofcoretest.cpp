@@ -0,0 +1,324 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// Compresses synthetic images with the out-of-core API using a small memory budget, and checks that the output is
+// identical to the one produced by the InputOptions API with the whole image in memory. The heap usage of the first
+// case is checked against the budget too.
+
+#include <nvtt/nvtt.h>
+#include <nvcore/nvcore.h>
+
+#include <stdio.h>
+#include <stdlib.h> // atoi
+#include <math.h>
+
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h> // mallinfo
+#endif
+
+
+// Bytes allocated in the heap, or 0 when it can't be measured.
+static unsigned long long heapSize()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return (unsigned long long)info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+    return (unsigned long long)(unsigned int)info.uordblks + (unsigned int)info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Tracks the peak heap usage, sampled every time the compressor reads input or writes output.
+struct HeapMonitor
+{
+    HeapMonitor() : base(heapSize()), peak(0) {}
+
+    void sample()
+    {
+        unsigned long long size = heapSize();
+        if (size > base && size - base > peak) peak = size - base;
+    }
+
+    unsigned long long base;
+    unsigned long long peak;
+};
+
+// Smooth gradients with some high frequency detail, so that every level of the mipmap chain is different. Normal maps
+// are made of unit vectors packed in [0, 1], the filtered mipmaps are not unit length.
+struct SyntheticSource : public nvtt::ImageSource
+{
+    SyntheticSource(int w, int h, bool normalMap, HeapMonitor * monitor) : w(w), h(h), normalMap(normalMap), monitor(monitor) {}
+
+    virtual bool readRows(int y, int count, float * rgba)
+    {
+        if (monitor != NULL) monitor->sample();
+
+        for (int r = 0; r < count; r++) {
+            for (int x = 0; x < w; x++) {
+                const float u = float(x) / w;
+                const float v = float(y + r) / h;
+                const float detail = 0.5f + 0.5f * sinf(float(x * 7 + (y + r) * 13) * 0.05f);
+
+                float c[4] = { u, v, detail, 0.5f * (u + v) };
+
+                if (normalMap) {
+                    const float nx = 0.8f * (u - 0.5f) + 0.3f * (detail - 0.5f);
+                    const float ny = 0.8f * (v - 0.5f) - 0.3f * (detail - 0.5f);
+                    const float nz = sqrtf(1.0f - nx * nx - ny * ny);
+                    c[0] = 0.5f * nx + 0.5f;
+                    c[1] = 0.5f * ny + 0.5f;
+                    c[2] = 0.5f * nz + 0.5f;
+                    c[3] = 1.0f;
+                }
+
+                for (int i = 0; i < 4; i++) {
+                    rgba[(i * count + r) * w + x] = c[i];
+                }
+            }
+        }
+
+        return true;
+    }
+
+    int w, h;
+    bool normalMap;
+    HeapMonitor * monitor;
+};
+
+// Hashes the output instead of storing it, so that it doesn't count against the heap usage.
+struct HashOutputHandler : public nvtt::OutputHandler
+{
+    HashOutputHandler(HeapMonitor * monitor) : hash(14695981039346656037ULL), size(0), monitor(monitor) {}
+
+    virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+    {
+        // ignore.
+    }
+
+    virtual bool writeData(const void * data, int size)
+    {
+        if (monitor != NULL) monitor->sample();
+
+        const unsigned char * bytes = (const unsigned char *)data;
+        for (int i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+        this->size += size;
+
+        return true;
+    }
+
+    virtual void endImage()
+    {
+        // ignore.
+    }
+
+    unsigned long long hash;
+    unsigned long long size;
+    HeapMonitor * monitor;
+};
+
+struct Test
+{
+    Test(const char * name, int w, int h, int budget) : name(name), w(w), h(h), budget(budget), filter(nvtt::MipmapFilter_Box),
+        maxExtent(0), normalMap(false), format(nvtt::Format_RGBA) {}
+
+    const char * name;
+    int w, h;
+    int budget;
+    nvtt::MipmapFilter filter;
+    int maxExtent;
+    bool normalMap;
+    nvtt::Format format;
+};
+
+struct Result
+{
+    bool success;
+    unsigned long long hash;
+    unsigned long long size;
+    unsigned long long peak;
+};
+
+static void setOptions(const Test & test, nvtt::InputOptions * inputOptions, nvtt::CompressionOptions * compressionOptions)
+{
+    inputOptions->setTextureLayout(nvtt::TextureType_2D, test.w, test.h);
+    inputOptions->setMipmapFilter(test.filter);
+    if (test.maxExtent != 0) inputOptions->setMaxExtents(test.maxExtent);
+    if (test.normalMap) {
+        inputOptions->setNormalMap(true);
+        inputOptions->setNormalizeMipmaps(true);
+    }
+
+    compressionOptions->setFormat(test.format);
+    compressionOptions->setQuality(nvtt::Quality_Fastest);
+}
+
+// Out-of-core API.
+static Result compress(const Test & test)
+{
+    nvtt::InputOptions inputOptions;
+    nvtt::CompressionOptions compressionOptions;
+    setOptions(test, &inputOptions, &compressionOptions);
+
+    HeapMonitor monitor;
+    SyntheticSource source(test.w, test.h, test.normalMap, &monitor);
+    HashOutputHandler outputHandler(&monitor);
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+    compressor.setMemoryBudget(test.budget);
+
+    Result result;
+    result.success = compressor.process(inputOptions, &source, compressionOptions, outputOptions);
+    result.hash = outputHandler.hash;
+    result.size = outputHandler.size;
+    result.peak = monitor.peak;
+
+    return result;
+}
+
+// InputOptions API with the whole image.
+static Result compressInMemory(const Test & test)
+{
+    nvtt::InputOptions inputOptions;
+    nvtt::CompressionOptions compressionOptions;
+    setOptions(test, &inputOptions, &compressionOptions);
+
+    const int count = test.w * test.h;
+
+    std::vector<float> planar(count * 4);
+    SyntheticSource source(test.w, test.h, test.normalMap, NULL);
+    source.readRows(0, test.h, &planar[0]);
+
+    std::vector<float> rgba(count * 4);
+    for (int i = 0; i < count; i++) {
+        for (int c = 0; c < 4; c++) {
+            rgba[4 * i + c] = planar[c * count + i];
+        }
+    }
+    std::vector<float>().swap(planar);
+
+    inputOptions.setFormat(nvtt::InputFormat_RGBA_32F);
+    inputOptions.setMipmapData(&rgba[0], test.w, test.h);
+
+    HashOutputHandler outputHandler(NULL);
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+
+    Result result;
+    result.success = compressor.process(inputOptions, compressionOptions, outputOptions);
+    result.hash = outputHandler.hash;
+    result.size = outputHandler.size;
+    result.peak = 0;
+
+    return result;
+}
+
+// Returns the number of failures.
+static int check(const Test & test, Result * out = NULL)
+{
+    Result reference = compressInMemory(test);
+    Result result = compress(test);
+
+    printf("%s, %dx%d pixels, %d MB budget: ", test.name, test.w, test.h, test.budget);
+
+    if (out != NULL) *out = result;
+
+    if (!reference.success || !result.success) {
+        printf("compression failed\n");
+        return 1;
+    }
+    if (reference.size != result.size || reference.hash != result.hash) {
+        printf("out-of-core output differs from the in-memory output\n");
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int size = 2048;
+    int budget = 8;
+    if (argc > 1) size = atoi(argv[1]);
+    if (argc > 2) budget = atoi(argv[2]);
+
+    int failures = 0;
+
+    Result result;
+    failures += check(Test("Box", size, size + 4, budget), &result);
+
+    printf("Peak heap usage: %.1f MB out-of-core\n", result.peak / 1048576.0);
+
+    // The rows cached by the filters and the compressor scratch memory are not counted, allow a small margin for them.
+    const unsigned long long limit = (unsigned long long)budget << 20;
+    if (result.peak > limit + limit / 4) {
+        printf("Out-of-core heap usage exceeds the budget\n");
+        failures++;
+    }
+
+    // The top two levels of these don't fit in the budget, and are produced by chained row sources.
+    const int w = 600;
+    const int h = 452;
+
+    Test kaiser("Kaiser", w, h, 1);
+    kaiser.filter = nvtt::MipmapFilter_Kaiser;
+    failures += check(kaiser);
+
+    Test triangle("Triangle", w, h, 1);
+    triangle.filter = nvtt::MipmapFilter_Triangle;
+    failures += check(triangle);
+
+    // Resampled to 500x376 before the mipmaps are generated.
+    Test resize("Resize", w, h, 1);
+    resize.maxExtent = 500;
+    failures += check(resize);
+
+    Test normalMap("Normal map", w, h, 1);
+    normalMap.normalMap = true;
+    failures += check(normalMap);
+
+    Test bc1("BC1", w, h, 1);
+    bc1.format = nvtt::Format_BC1;
+    failures += check(bc1);
+
+    Test bc3("BC3", w, h, 1);
+    bc3.format = nvtt::Format_BC3;
+    failures += check(bc3);
+
+    return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
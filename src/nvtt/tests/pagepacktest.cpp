@@ -0,0 +1,336 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+
+// Compresses a synthetic image into a page pack, decodes the pack with the layout in nvimage/PagePack.h and checks that
+// each page is identical to the compressed sub image of the mipmap level, with the borders wrapped around the level.
+
+#include <nvtt/nvtt.h>
+#include <nvimage/PagePack.h>
+
+#include <stdio.h>
+#include <stdlib.h> // abs
+#include <string.h> // memcmp, memcpy
+#include <math.h>
+
+#include <vector>
+
+
+// Smooth gradients with some high frequency detail, so that every page is different.
+struct SyntheticSource : public nvtt::ImageSource
+{
+    SyntheticSource(int w, int h) : w(w), h(h) {}
+
+    float texel(int x, int y, int c) const
+    {
+        const float u = float(x) / w;
+        const float v = float(y) / h;
+        const float detail = 0.5f + 0.5f * sinf(float(x * 7 + y * 13) * 0.05f);
+
+        if (c == 0) return u;
+        if (c == 1) return v;
+        if (c == 2) return detail;
+        return 0.5f * (u + v);
+    }
+
+    virtual bool readRows(int y, int count, float * rgba)
+    {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < count; r++) {
+                for (int x = 0; x < w; x++) {
+                    rgba[(c * count + r) * w + x] = texel(x, y + r, c);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    int w, h;
+};
+
+// Stores the output in memory.
+struct MemoryOutputHandler : public nvtt::OutputHandler
+{
+    virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+    {
+        // ignore.
+    }
+
+    virtual bool writeData(const void * data, int size)
+    {
+        const unsigned char * bytes = (const unsigned char *)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        return true;
+    }
+
+    virtual void endImage()
+    {
+        // ignore.
+    }
+
+    std::vector<unsigned char> buffer;
+};
+
+// Same as the wrap functions of nv::FloatImage.
+static int wrap(int x, int w, nvtt::WrapMode wrapMode)
+{
+    if (wrapMode == nvtt::WrapMode_Clamp) {
+        return x < 0 ? 0 : (x >= w ? w - 1 : x);
+    }
+    if (wrapMode == nvtt::WrapMode_Repeat) {
+        return x >= 0 ? x % w : (x + 1) % w + w - 1;
+    }
+
+    if (w == 1) x = 0;
+    x = abs(x);
+    while (x >= w) {
+        x = abs(w + w - x - 2);
+    }
+    return x;
+}
+
+// Level with the border texels wrapped around it.
+static nvtt::Surface addBorder(const nvtt::Surface & level, int border, nvtt::WrapMode wrapMode)
+{
+    const int w = level.width();
+    const int h = level.height();
+    const int bw = w + 2 * border;
+    const int bh = h + 2 * border;
+
+    std::vector<float> rgba(bw * bh * 4);
+    for (int c = 0; c < 4; c++) {
+        const float * src = level.channel(c);
+        for (int y = 0; y < bh; y++) {
+            const int sy = wrap(y - border, h, wrapMode);
+            for (int x = 0; x < bw; x++) {
+                const int sx = wrap(x - border, w, wrapMode);
+                rgba[(c * bh + y) * bw + x] = src[sy * w + sx];
+            }
+        }
+    }
+
+    nvtt::Surface result;
+    result.setImage(nvtt::InputFormat_RGBA_32F, bw, bh, 1, &rgba[0], &rgba[bw * bh], &rgba[2 * bw * bh], &rgba[3 * bw * bh]);
+    return result;
+}
+
+struct Test
+{
+    int w, h;
+    int pageSize;
+    int borderSize;
+    nvtt::WrapMode wrapMode;
+    nvtt::Format format;
+    int budget;
+};
+
+static bool compressPack(const Test & test, std::vector<unsigned char> * pack)
+{
+    nvtt::InputOptions inputOptions;
+    inputOptions.setTextureLayout(nvtt::TextureType_2D, test.w, test.h);
+    inputOptions.setMipmapFilter(nvtt::MipmapFilter_Box);
+    inputOptions.setWrapMode(test.wrapMode);
+    inputOptions.setGamma(1.0f, 1.0f);
+
+    nvtt::CompressionOptions compressionOptions;
+    compressionOptions.setFormat(test.format);
+    compressionOptions.setQuality(nvtt::Quality_Fastest);
+
+    SyntheticSource source(test.w, test.h);
+    MemoryOutputHandler outputHandler;
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+    compressor.setMemoryBudget(test.budget);
+
+    bool success = compressor.processPages(inputOptions, &source, test.pageSize, test.borderSize, compressionOptions, outputOptions);
+    pack->swap(outputHandler.buffer);
+
+    return success;
+}
+
+static bool compressPage(const nvtt::Surface & page, const Test & test, std::vector<unsigned char> * output)
+{
+    nvtt::CompressionOptions compressionOptions;
+    compressionOptions.setFormat(test.format);
+    compressionOptions.setQuality(nvtt::Quality_Fastest);
+
+    MemoryOutputHandler outputHandler;
+
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+    outputOptions.setOutputHeader(false);
+
+    nvtt::Compressor compressor;
+    compressor.enableCudaAcceleration(false);
+
+    bool success = compressor.compress(page, 0, 0, compressionOptions, outputOptions);
+    output->swap(outputHandler.buffer);
+
+    return success;
+}
+
+template <typename T>
+static bool read(const std::vector<unsigned char> & pack, size_t offset, T * value)
+{
+    if (offset + sizeof(T) > pack.size()) return false;
+
+    memcpy(value, &pack[offset], sizeof(T));
+    value->swapBytes();
+    return true;
+}
+
+// Returns the number of pages that differ, or -1 if the pack is not valid.
+static int checkPack(const Test & test, const std::vector<unsigned char> & pack)
+{
+    nv::PagePackHeader header;
+    if (!read(pack, 0, &header)) return -1;
+
+    if (header.fourcc != nv::FOURCC_NVVT || header.version != nv::PagePackVersion) return -1;
+    if (header.width != uint(test.w) || header.height != uint(test.h)) return -1;
+    if (header.pageSize != uint(test.pageSize) || header.borderSize != uint(test.borderSize)) return -1;
+    if (header.format != uint(test.format) || header.flags != 0) return -1;
+
+    size_t offset = sizeof(header);
+
+    std::vector<nv::PagePackLevel> levels(header.mipmapCount);
+    for (uint m = 0; m < header.mipmapCount; m++) {
+        if (!read(pack, offset, &levels[m])) return -1;
+        offset += sizeof(nv::PagePackLevel);
+    }
+
+    std::vector<nv::PagePackEntry> index(header.pageCount);
+    for (uint i = 0; i < header.pageCount; i++) {
+        if (!read(pack, offset, &index[i])) return -1;
+        offset += sizeof(nv::PagePackEntry);
+    }
+
+    nvtt::Surface level;
+    {
+        SyntheticSource source(test.w, test.h);
+        std::vector<float> rgba(test.w * test.h * 4);
+        source.readRows(0, test.h, &rgba[0]);
+
+        const int size = test.w * test.h;
+        level.setImage(nvtt::InputFormat_RGBA_32F, test.w, test.h, 1, &rgba[0], &rgba[size], &rgba[2 * size], &rgba[3 * size]);
+    }
+
+    int failures = 0;
+    uint pageCount = 0;
+
+    for (uint m = 0; m < header.mipmapCount; m++) {
+        if (m != 0 && !level.buildNextMipmap(nvtt::MipmapFilter_Box)) return -1;
+
+        const nv::PagePackLevel & info = levels[m];
+        const uint pageCountX = (level.width() + test.pageSize - 1) / test.pageSize;
+        const uint pageCountY = (level.height() + test.pageSize - 1) / test.pageSize;
+
+        if (info.width != uint(level.width()) || info.height != uint(level.height())) return -1;
+        if (info.pageCountX != pageCountX || info.pageCountY != pageCountY || info.firstPage != pageCount) return -1;
+
+        const nvtt::Surface bordered = addBorder(level, test.borderSize, test.wrapMode);
+
+        for (uint py = 0; py < pageCountY; py++) {
+            for (uint px = 0; px < pageCountX; px++) {
+                const nv::PagePackEntry & entry = index[info.firstPage + py * pageCountX + px];
+
+                // The pages are stored in order, right after the index.
+                if (entry.offset != offset || entry.offset + entry.size > pack.size()) return -1;
+                offset += entry.size;
+
+                // Pages on the right and bottom edges are clipped to the level.
+                const int x0 = px * test.pageSize;
+                const int y0 = py * test.pageSize;
+                const int pw = nv::min(test.pageSize, level.width() - x0) + 2 * test.borderSize;
+                const int ph = nv::min(test.pageSize, level.height() - y0) + 2 * test.borderSize;
+
+                const nvtt::Surface page = bordered.createSubImage(x0, x0 + pw - 1, y0, y0 + ph - 1, 0, 0);
+
+                std::vector<unsigned char> expected;
+                if (page.isNull() || !compressPage(page, test, &expected)) return -1;
+
+                if (expected.size() != entry.size || memcmp(&expected[0], &pack[size_t(entry.offset)], entry.size) != 0) {
+                    failures++;
+                }
+            }
+        }
+
+        pageCount += pageCountX * pageCountY;
+    }
+
+    if (pageCount != header.pageCount || offset != pack.size()) return -1;
+
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    const nvtt::WrapMode wrapModes[] = { nvtt::WrapMode_Clamp, nvtt::WrapMode_Repeat, nvtt::WrapMode_Mirror };
+    const char * wrapModeNames[] = { "clamp", "repeat", "mirror" };
+
+    const nvtt::Format formats[] = { nvtt::Format_RGBA, nvtt::Format_BC3 };
+    const char * formatNames[] = { "RGBA", "BC3" };
+
+    const int borderSizes[] = { 0, 4 };
+
+    // The top levels don't fit in the smallest budget and are processed in stripes.
+    const int budgets[] = { 1, 64 };
+
+    int failures = 0;
+
+    for (int b = 0; b < 2; b++) {
+        for (int f = 0; f < 2; f++) {
+            for (int wm = 0; wm < 3; wm++) {
+                for (int bs = 0; bs < 2; bs++) {
+                    // Sizes that are not multiples of the page size.
+                    Test test;
+                    test.w = 517;
+                    test.h = 389;
+                    test.pageSize = 64;
+                    test.borderSize = borderSizes[bs];
+                    test.wrapMode = wrapModes[wm];
+                    test.format = formats[f];
+                    test.budget = budgets[b];
+
+                    std::vector<unsigned char> pack;
+                    const bool success = compressPack(test, &pack);
+                    const int result = success ? checkPack(test, pack) : -1;
+
+                    printf("%s, %s, border %d, %d MB budget: ", formatNames[f], wrapModeNames[wm], test.borderSize, test.budget);
+                    if (!success) printf("compression failed\n");
+                    else if (result < 0) printf("invalid pack\n");
+                    else if (result > 0) printf("%d pages differ\n", result);
+                    else printf("ok\n");
+
+                    if (!success || result != 0) failures++;
+                }
+            }
+        }
+    }
+
+    return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -301,6 +301,205 @@ enum ErrorMode {
 };
 
 
+// Transform the image to the space in which it's compressed.
+static void encodeImage(Mode mode, ImageType type, nvtt::Surface & tmp)
+{
+    if (mode == Mode_BC1) {
+        if (type == ImageType_HDR) {
+            /*for (int i = 0; i < 3; i++) {
+                tmp.scaleBias(i, 0.25f, 0);
+                tmp.clamp(i);
+            }*/
+        }
+    }
+    if (mode == Mode_BC3_YCoCg) {
+        tmp.setAlphaMode(nvtt::AlphaMode_None);
+        if (type == ImageType_HDR) {
+            /*for (int i = 0; i < 3; i++) {
+                tmp.scaleBias(i, 1.0f/4.0f, 0);
+                tmp.clamp(i);
+            }*/
+        }
+        tmp.toYCoCg();          // Y=3, Co=0, Cg=1
+        tmp.blockScaleCoCg();   // Co=0, Cg=1, Scale=2, ScaleBits = 5
+
+        tmp.scaleBias(0, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
+        tmp.scaleBias(1, 125.0f/255.0f, 125.0f/255.0f); tmp.clamp(1, 0, 250.0f/255.0f); // -1->0, 0->125, 1->250
+
+        //tmp.scaleBias(0, 0.5f, 0.5f); tmp.clamp(0);
+        //tmp.scaleBias(1, 0.5f, 0.5f); tmp.clamp(1);
+
+        tmp.clamp(2);
+        tmp.clamp(3);
+    }
+    else if (mode == Mode_BC3_RGBM) {
+        tmp.setAlphaMode(nvtt::AlphaMode_None);
+        if (type == ImageType_HDR) {
+            tmp.toRGBM(/*4*/);
+        }
+        else {
+            tmp.toRGBM();
+        }
+    }
+    else if (mode == Mode_BC3_LUVW) {
+        tmp.setAlphaMode(nvtt::AlphaMode_None);
+        if (type == ImageType_HDR) {
+            tmp.toLUVW(/*4*/);
+        }
+        else {
+            tmp.toLUVW();
+        }
+    }
+    else if (mode == Mode_BC3_RGBS) {
+        //tmp.toJPEGLS();
+        //tmp.scaleBias(0, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
+        //tmp.scaleBias(2, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
+
+        // Not helping...
+        //tmp.blockLuminanceScale(0.1f);
+        /*tmp.toYCoCg();
+        tmp.scaleBias(0, 0.5, 0.5);
+        tmp.scaleBias(1, 0.5, 0.5);
+        tmp.swizzle(0, 3, 1, 4); // Co Cg 1 Y -> Co Y Cg 1
+        tmp.copyChannel(img, 3); // Restore alpha channel for weighting.*/
+    }
+    else if (mode == Mode_BC5_Normal) {
+        tmp.transformNormals(nvtt::NormalTransform_Orthographic);
+    }
+    else if (mode == Mode_BC5_Normal_Stereographic) {
+        tmp.transformNormals(nvtt::NormalTransform_Stereographic);
+    }
+    else if (mode == Mode_BC5_Normal_Paraboloid) {
+        tmp.transformNormals(nvtt::NormalTransform_Paraboloid);
+    }
+    else if (mode == Mode_BC5_Normal_Quartic) {
+        tmp.transformNormals(nvtt::NormalTransform_Quartic);
+    }
+    /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
+        tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
+    }*/
+}
+
+// Transform the decompressed image back to the space of the input.
+static void decodeImage(Mode mode, ImageType type, nvtt::Surface & img_out)
+{
+    if (mode == Mode_BC1) {
+        if (type == ImageType_HDR) {
+            /*for (int i = 0; i < 3; i++) {
+                img_out.scaleBias(i, 4.0f, 0);
+            }*/
+        }
+    }
+    else if (mode == Mode_BC3_YCoCg) {
+        img_out.scaleBias(0, 255.0f/123, -1.0f); // 0->-1, 123->0, 246->1
+        img_out.scaleBias(1, 255.0f/125, -1.0f); // 0->-1, 125->0, 150->1
+
+        //img_out.scaleBias(0, 2.0f, -1.0f);
+        //img_out.scaleBias(1, 2.0f, -1.0f);
+        
+        img_out.fromYCoCg();
+        img_out.clamp(0);
+        img_out.clamp(1);
+        img_out.clamp(2);
+        if (type == ImageType_HDR) {
+            /*for (int i = 0; i < 3; i++) {
+                img_out.scaleBias(i, 4.0f, 0);
+            }*/
+        }
+    }
+    else if (mode == Mode_BC3_RGBM) {
+        if (type == ImageType_HDR) {
+            img_out.fromRGBM(/*4*/);
+        }
+        else {
+            img_out.fromRGBM();
+        }
+    }
+    else if (mode == Mode_BC3_LUVW) {
+        if (type == ImageType_HDR) {
+            img_out.fromLUVW(/*4*/);
+        }
+        else {
+            img_out.fromLUVW();
+        }
+    }
+    else if (mode == Mode_BC3_RGBS) {
+        //img_out.scaleBias(0, 255.0f/123, -1.0f);
+        //img_out.scaleBias(2, 255.0f/123, -1.0f);
+        //img_out.fromJPEGLS();
+        /*img_out.swizzle(0, 2, 4, 1);    // Co Y Cg 1 - > Co Cg 1 Y
+        img_out.scaleBias(0, 1.0, -0.5);
+        img_out.scaleBias(1, 1.0, -0.5);
+        img_out.fromYCoCg();*/
+    }
+    else if (mode == Mode_BC5_Normal) {
+        img_out.reconstructNormals(nvtt::NormalTransform_Orthographic);
+    }
+    else if (mode == Mode_BC5_Normal_Stereographic) {
+        img_out.reconstructNormals(nvtt::NormalTransform_Stereographic);
+    }
+    else if (mode == Mode_BC5_Normal_Paraboloid) {
+        img_out.reconstructNormals(nvtt::NormalTransform_Paraboloid);
+    }
+    else if (mode == Mode_BC5_Normal_Quartic) {
+        img_out.reconstructNormals(nvtt::NormalTransform_Quartic);
+    }
+    /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
+        tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
+    }*/
+}
+
+// PSNR and SSIM of each channel of an image.
+struct ChannelMetrics
+{
+    ChannelMetrics()
+    {
+        for (int c = 0; c < 4; c++) {
+            psnr[c] = 0;
+            ssim[c] = 0;
+        }
+    }
+
+    void compute(const nvtt::Surface & reference, const nvtt::Surface & img, int channelCount)
+    {
+        for (int c = 0; c < channelCount; c++) {
+            psnr[c] = nvtt::psnr(reference, img, c);
+            ssim[c] = nvtt::ssim(reference, img, c);
+        }
+    }
+
+    void operator+=(const ChannelMetrics & m)
+    {
+        for (int c = 0; c < 4; c++) {
+            psnr[c] += m.psnr[c];
+            ssim[c] += m.ssim[c];
+        }
+    }
+
+    void operator/=(float f)
+    {
+        for (int c = 0; c < 4; c++) {
+            psnr[c] /= f;
+            ssim[c] /= f;
+        }
+    }
+
+    void print(int mipmap, int channelCount) const
+    {
+        printf("    Mipmap %2d: \tPSNR", mipmap);
+        for (int c = 0; c < channelCount; c++) printf(" %7.3f", psnr[c]);
+        printf(" dB \tSSIM");
+        for (int c = 0; c < channelCount; c++) printf(" %.4f", ssim[c]);
+        printf("\n");
+    }
+
+    float psnr[4];
+    float ssim[4];
+};
+
+const int MaxMipmapCount = 16;
+
+
 int main(int argc, char *argv[])
 {
     MyAssertHandler assertHandler;
@@ -586,6 +785,12 @@ int main(int argc, char *argv[])
     {
         float totalTime = 0;
         float totalError = 0;
+        float totalPsnr = 0;
+        float totalSsim = 0;
+
+        // Sum of the metrics of each mipmap level, over the images that have it.
+        ChannelMetrics totalMipmapMetrics[MaxMipmapCount];
+        int mipmapImageCount[MaxMipmapCount] = { 0 };
 
         Mode mode = test.modes[t];
 
@@ -641,81 +846,7 @@ int main(int argc, char *argv[])
             }
 
             nvtt::Surface tmp = img;
-            if (mode == Mode_BC1) {
-                if (set.type == ImageType_HDR) {
-                    /*for (int i = 0; i < 3; i++) {
-                        tmp.scaleBias(i, 0.25f, 0);
-                        tmp.clamp(i);
-                    }*/
-                }
-            }
-            if (mode == Mode_BC3_YCoCg) {
-                tmp.setAlphaMode(nvtt::AlphaMode_None);
-                if (set.type == ImageType_HDR) {
-                    /*for (int i = 0; i < 3; i++) {
-                        tmp.scaleBias(i, 1.0f/4.0f, 0);
-                        tmp.clamp(i);
-                    }*/
-                }
-                tmp.toYCoCg();          // Y=3, Co=0, Cg=1
-                tmp.blockScaleCoCg();   // Co=0, Cg=1, Scale=2, ScaleBits = 5
-
-                tmp.scaleBias(0, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
-                tmp.scaleBias(1, 125.0f/255.0f, 125.0f/255.0f); tmp.clamp(1, 0, 250.0f/255.0f); // -1->0, 0->125, 1->250
-
-                //tmp.scaleBias(0, 0.5f, 0.5f); tmp.clamp(0);
-                //tmp.scaleBias(1, 0.5f, 0.5f); tmp.clamp(1);
-
-                tmp.clamp(2);
-                tmp.clamp(3);
-            }
-            else if (mode == Mode_BC3_RGBM) {
-                tmp.setAlphaMode(nvtt::AlphaMode_None);
-                if (set.type == ImageType_HDR) {
-                    tmp.toRGBM(/*4*/);
-                }
-                else {
-                    tmp.toRGBM();
-                }
-            }
-            else if (mode == Mode_BC3_LUVW) {
-                tmp.setAlphaMode(nvtt::AlphaMode_None);
-                if (set.type == ImageType_HDR) {
-                    tmp.toLUVW(/*4*/);
-                }
-                else {
-                    tmp.toLUVW();
-                }
-            }
-            else if (mode == Mode_BC3_RGBS) {
-                //tmp.toJPEGLS();
-                //tmp.scaleBias(0, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
-                //tmp.scaleBias(2, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
-
-                // Not helping...
-                //tmp.blockLuminanceScale(0.1f);
-                /*tmp.toYCoCg();
-                tmp.scaleBias(0, 0.5, 0.5);
-                tmp.scaleBias(1, 0.5, 0.5);
-                tmp.swizzle(0, 3, 1, 4); // Co Cg 1 Y -> Co Y Cg 1
-                tmp.copyChannel(img, 3); // Restore alpha channel for weighting.*/
-            }
-            else if (mode == Mode_BC5_Normal) {
-                tmp.transformNormals(nvtt::NormalTransform_Orthographic);
-            }
-            else if (mode == Mode_BC5_Normal_Stereographic) {
-                tmp.transformNormals(nvtt::NormalTransform_Stereographic);
-            }
-            else if (mode == Mode_BC5_Normal_Paraboloid) {
-                tmp.transformNormals(nvtt::NormalTransform_Paraboloid);
-            }
-            else if (mode == Mode_BC5_Normal_Quartic) {
-                tmp.transformNormals(nvtt::NormalTransform_Quartic);
-            }
-            /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
-                tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
-            }*/
-
+            encodeImage(mode, set.type, tmp);
 
             printf("Compressing: \t'%s'\n", set.fileNames[i]);
 
@@ -731,70 +862,7 @@ int main(int argc, char *argv[])
             img_out.setAlphaMode(img.alphaMode());
             img_out.setNormalMap(img.isNormalMap());
 
-            if (mode == Mode_BC1) {
-                if (set.type == ImageType_HDR) {
-                    /*for (int i = 0; i < 3; i++) {
-                        img_out.scaleBias(i, 4.0f, 0);
-                    }*/
-                }
-            }
-            else if (mode == Mode_BC3_YCoCg) {
-                img_out.scaleBias(0, 255.0f/123, -1.0f); // 0->-1, 123->0, 246->1
-                img_out.scaleBias(1, 255.0f/125, -1.0f); // 0->-1, 125->0, 150->1
-
-                //img_out.scaleBias(0, 2.0f, -1.0f);
-                //img_out.scaleBias(1, 2.0f, -1.0f);
-                
-                img_out.fromYCoCg();
-                img_out.clamp(0);
-                img_out.clamp(1);
-                img_out.clamp(2);
-                if (set.type == ImageType_HDR) {
-                    /*for (int i = 0; i < 3; i++) {
-                        img_out.scaleBias(i, 4.0f, 0);
-                    }*/
-                }
-            }
-            else if (mode == Mode_BC3_RGBM) {
-                if (set.type == ImageType_HDR) {
-                    img_out.fromRGBM(/*4*/);
-                }
-                else {
-                    img_out.fromRGBM();
-                }
-            }
-            else if (mode == Mode_BC3_LUVW) {
-                if (set.type == ImageType_HDR) {
-                    img_out.fromLUVW(/*4*/);
-                }
-                else {
-                    img_out.fromLUVW();
-                }
-            }
-            else if (mode == Mode_BC3_RGBS) {
-                //img_out.scaleBias(0, 255.0f/123, -1.0f);
-                //img_out.scaleBias(2, 255.0f/123, -1.0f);
-                //img_out.fromJPEGLS();
-                /*img_out.swizzle(0, 2, 4, 1);    // Co Y Cg 1 - > Co Cg 1 Y
-                img_out.scaleBias(0, 1.0, -0.5);
-                img_out.scaleBias(1, 1.0, -0.5);
-                img_out.fromYCoCg();*/
-            }
-            else if (mode == Mode_BC5_Normal) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Orthographic);
-            }
-            else if (mode == Mode_BC5_Normal_Stereographic) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Stereographic);
-            }
-            else if (mode == Mode_BC5_Normal_Paraboloid) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Paraboloid);
-            }
-            else if (mode == Mode_BC5_Normal_Quartic) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Quartic);
-            }
-            /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
-                tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
-            }*/
+            decodeImage(mode, set.type, img_out);
 
             nvtt::Surface diff = nvtt::diff(img, img_out, 1.0f);
 
@@ -877,6 +945,49 @@ int main(int argc, char *argv[])
             totalError += error;
             printf("  Error: \t%.4f\n", error);
 
+            // Output PSNR and mean SSIM of the color channels.
+            float psnr = nvtt::psnr(img, img_out);
+            float ssim = (nvtt::ssim(img, img_out, 0) + nvtt::ssim(img, img_out, 1) + nvtt::ssim(img, img_out, 2)) / 3.0f;
+
+            totalPsnr += psnr;
+            totalSsim += ssim;
+            printf("  PSNR:  \t%.4f dB\n", psnr);
+            printf("  SSIM:  \t%.4f\n", ssim);
+
+            // Output PSNR and SSIM of each channel for the image and its mipmaps. The mipmaps of the input are box
+            // filtered, and compressed with the same transforms as the image. The residual is only computed for the
+            // top level.
+            const int channelCount = (set.type == ImageType_RGBA) ? 4 : 3;
+
+            ChannelMetrics metrics;
+            metrics.compute(img, img_out, channelCount);
+            metrics.print(0, channelCount);
+            totalMipmapMetrics[0] += metrics;
+            mipmapImageCount[0]++;
+
+            nvtt::Surface mipmap = img;
+            for (int m = 1; m < MaxMipmapCount && mipmap.buildNextMipmap(nvtt::MipmapFilter_Box); m++)
+            {
+                if (mipmap.isNormalMap()) {
+                    mipmap.normalizeNormalMap();
+                }
+
+                nvtt::Surface mipmap_tmp = mipmap;
+                encodeImage(mode, set.type, mipmap_tmp);
+
+                context.compress(mipmap_tmp, 0, 0, compressionOptions, outputOptions);
+
+                nvtt::Surface mipmap_out = outputHandler.decompress(mode, format, decoder);
+                mipmap_out.setAlphaMode(mipmap.alphaMode());
+                mipmap_out.setNormalMap(mipmap.isNormalMap());
+                decodeImage(mode, set.type, mipmap_out);
+
+                metrics.compute(mipmap, mipmap_out, channelCount);
+                metrics.print(m, channelCount);
+                totalMipmapMetrics[m] += metrics;
+                mipmapImageCount[m]++;
+            }
+
             graphWriter << error;
             if (i != set.fileCount-1) graphWriter << ",";
 
@@ -930,10 +1041,20 @@ int main(int argc, char *argv[])
         }
 
         totalError /= set.fileCount;
+        totalPsnr /= set.fileCount;
+        totalSsim /= set.fileCount;
 
         printf("Total Results:\n");
         printf("  Total Time:            \t%.3f sec\n", totalTime);
         printf("  Average Error:         \t%.4f\n", totalError);
+        printf("  Average PSNR:          \t%.4f dB\n", totalPsnr);
+        printf("  Average SSIM:          \t%.4f\n", totalSsim);
+        printf("  Average PSNR and SSIM of each channel:\n");
+
+        for (int m = 0; m < MaxMipmapCount && mipmapImageCount[m] != 0; m++) {
+            totalMipmapMetrics[m] /= float(mipmapImageCount[m]);
+            totalMipmapMetrics[m].print(m, (set.type == ImageType_RGBA) ? 4 : 3);
+        }
 
         if (t != test.count-1) graphWriter << "|";
     }
@@ -29,17 +29,25 @@
 #include <nvimage/ImageIO.h>
 #include <nvimage/FloatImage.h>
 #include <nvimage/DirectDrawSurface.h>
+#include <nvimage/BatchImageLoader.h>
+
+#include <nvthread/nvthread.h> // hardwareThreadCount
+#include <nvthread/Thread.h>
+#include <nvthread/Mutex.h>
+#include <nvthread/ParallelFor.h>
 
 #include <nvcore/Ptr.h> // AutoPtr
 #include <nvcore/StrLib.h> // Path
 #include <nvcore/StdStream.h>
 #include <nvcore/FileSystem.h>
 #include <nvcore/Timer.h>
+#include <nvcore/Utils.h> // min, max
+#include <nvcore/Array.inl>
 
 
 struct MyOutputHandler : public nvtt::OutputHandler
 {
-    MyOutputHandler(const char * name) : total(0), progress(0), percentage(0), stream(new nv::StdOutputStream(name)) {}
+    MyOutputHandler(const char * name) : total(0), progress(0), percentage(0), stream(name != NULL ? new nv::StdOutputStream(name) : NULL) {}
     virtual ~MyOutputHandler() { delete stream; }
 
     void setTotal(int64 t)
@@ -134,245 +142,215 @@ void setColorMap(nvtt::InputOptions & inputOptions)
 
 
 
-int main(int argc, char *argv[])
+bool isDDS(const char * fileName)
 {
-    MyAssertHandler assertHandler;
-    MyMessageHandler messageHandler;
-
-    bool alpha = false;
-    bool normal = false;
-    bool color2normal = false;
-    bool wrapRepeat = false;
-    bool noMipmaps = false;
-    bool fast = false;
-    bool nocuda = false;
-    bool bc1n = false;
-    bool luminance = false;
-    nvtt::Format format = nvtt::Format_BC1;
-    bool premultiplyAlpha = false;
-    nvtt::MipmapFilter mipmapFilter = nvtt::MipmapFilter_Box;
-    bool loadAsFloat = false;
-
-    const char * externalCompressor = NULL;
-
-    bool silent = false;
-    bool dds10 = false;
+    return nv::strCaseCmp(nv::Path::extension(fileName), ".dds") == 0;
+}
 
-    nv::Path input;
-    nv::Path output;
+bool isFloatImage(const char * fileName, bool loadAsFloat)
+{
+    const char * extension = nv::Path::extension(fileName);
+    return loadAsFloat || nv::strCaseCmp(extension, ".exr") == 0 || nv::strCaseCmp(extension, ".hdr") == 0;
+}
 
 
-    // Parse arguments.
-    for (int i = 1; i < argc; i++)
+// Options that can be set for each file.
+struct Options
+{
+    Options() : alpha(false), normal(false), color2normal(false), wrapRepeat(false), noMipmaps(false), fast(false), nocuda(false),
+        bc1n(false), luminance(false), format(nvtt::Format_BC1), premultiplyAlpha(false), mipmapFilter(nvtt::MipmapFilter_Box),
+        loadAsFloat(false), externalCompressor(NULL), silent(false), dds10(false), writeBehind(false), directIO(false), streaming(false)
     {
-        // Input options.
-        if (strcmp("-color", argv[i]) == 0)
-        {
-        }
-        else if (strcmp("-alpha", argv[i]) == 0)
-        {
-            alpha = true;
-        }
-        else if (strcmp("-normal", argv[i]) == 0)
-        {
-            normal = true;
-        }
-        else if (strcmp("-tonormal", argv[i]) == 0)
-        {
-            color2normal = true;
-        }
-        else if (strcmp("-clamp", argv[i]) == 0)
-        {
-        }
-        else if (strcmp("-repeat", argv[i]) == 0)
-        {
-            wrapRepeat = true;
-        }
-        else if (strcmp("-nomips", argv[i]) == 0)
-        {
-            noMipmaps = true;
-        }
-        else if (strcmp("-premula", argv[i]) == 0)
-        {
-            premultiplyAlpha = true;
-        }
-        else if (strcmp("-mipfilter", argv[i]) == 0)
-        {
-            if (i+1 == argc) break;
-            i++;
-
-            if (strcmp("box", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Box;
-            else if (strcmp("triangle", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Triangle;
-            else if (strcmp("kaiser", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Kaiser;
-        }
-        else if (strcmp("-float", argv[i]) == 0)
-        {
-            loadAsFloat = true;
-        }
-
-        // Compression options.
-        else if (strcmp("-fast", argv[i]) == 0)
-        {
-            fast = true;
-        }
-        else if (strcmp("-nocuda", argv[i]) == 0)
-        {
-            nocuda = true;
-        }
-        else if (strcmp("-rgb", argv[i]) == 0)
-        {
-            format = nvtt::Format_RGB;
-        }
-        else if (strcmp("-lumi", argv[i]) == 0)
-        {
-            luminance = true;
-            format = nvtt::Format_RGB;
-        }
-        else if (strcmp("-bc1", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1;
-        }
-        else if (strcmp("-bc1n", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1;
-            bc1n = true;
-        }
-        else if (strcmp("-bc1a", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1a;
-        }
-        else if (strcmp("-bc2", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC2;
-        }
-        else if (strcmp("-bc3", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC3;
-        }
-        else if (strcmp("-bc3n", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC3n;
-        }
-        else if (strcmp("-bc4", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC4;
-        }
-        else if (strcmp("-bc5", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC5;
-        }
+    }
 
-        // Undocumented option. Mainly used for testing.
-        else if (strcmp("-ext", argv[i]) == 0)
-        {
-            if (i+1 < argc && argv[i+1][0] != '-') {
-                externalCompressor = argv[i+1];
-                i++;
-            }
-        }
-        else if (strcmp("-pause", argv[i]) == 0)
-        {
-            printf("Press ENTER\n"); fflush(stdout);
-            getchar();
-        }
+    bool alpha;
+    bool normal;
+    bool color2normal;
+    bool wrapRepeat;
+    bool noMipmaps;
+    bool fast;
+    bool nocuda;
+    bool bc1n;
+    bool luminance;
+    nvtt::Format format;
+    bool premultiplyAlpha;
+    nvtt::MipmapFilter mipmapFilter;
+    bool loadAsFloat;
+
+    const char * externalCompressor;
+
+    bool silent;
+    bool dds10;
+    bool writeBehind;
+    bool directIO;
+    bool streaming;
+};
 
-        // Output options
-        else if (strcmp("-silent", argv[i]) == 0)
-        {
-            silent = true;
-        }
-        else if (strcmp("-dds10", argv[i]) == 0)
-        {
-            dds10 = true;
-        }
+// Parse the option at argv[i] and its arguments. Returns false when argv[i] is not a known option.
+bool parseOption(Options & options, int argc, char * argv[], int & i)
+{
+    // Input options.
+    if (strcmp("-color", argv[i]) == 0)
+    {
+    }
+    else if (strcmp("-alpha", argv[i]) == 0)
+    {
+        options.alpha = true;
+    }
+    else if (strcmp("-normal", argv[i]) == 0)
+    {
+        options.normal = true;
+    }
+    else if (strcmp("-tonormal", argv[i]) == 0)
+    {
+        options.color2normal = true;
+    }
+    else if (strcmp("-clamp", argv[i]) == 0)
+    {
+    }
+    else if (strcmp("-repeat", argv[i]) == 0)
+    {
+        options.wrapRepeat = true;
+    }
+    else if (strcmp("-nomips", argv[i]) == 0)
+    {
+        options.noMipmaps = true;
+    }
+    else if (strcmp("-premula", argv[i]) == 0)
+    {
+        options.premultiplyAlpha = true;
+    }
+    else if (strcmp("-mipfilter", argv[i]) == 0)
+    {
+        if (i+1 == argc) return true;
+        i++;
 
-        else if (argv[i][0] != '-')
-        {
-            input = argv[i];
+        if (strcmp("box", argv[i]) == 0) options.mipmapFilter = nvtt::MipmapFilter_Box;
+        else if (strcmp("triangle", argv[i]) == 0) options.mipmapFilter = nvtt::MipmapFilter_Triangle;
+        else if (strcmp("kaiser", argv[i]) == 0) options.mipmapFilter = nvtt::MipmapFilter_Kaiser;
+    }
+    else if (strcmp("-float", argv[i]) == 0)
+    {
+        options.loadAsFloat = true;
+    }
 
-            if (i+1 < argc && argv[i+1][0] != '-') {
-                output = argv[i+1];
-            }
-            else
-            {
-                output.copy(input.str());
-                output.stripExtension();
-                output.append(".dds");
-            }
+    // Compression options.
+    else if (strcmp("-fast", argv[i]) == 0)
+    {
+        options.fast = true;
+    }
+    else if (strcmp("-nocuda", argv[i]) == 0)
+    {
+        options.nocuda = true;
+    }
+    else if (strcmp("-rgb", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_RGB;
+    }
+    else if (strcmp("-lumi", argv[i]) == 0)
+    {
+        options.luminance = true;
+        options.format = nvtt::Format_RGB;
+    }
+    else if (strcmp("-bc1", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC1;
+    }
+    else if (strcmp("-bc1n", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC1;
+        options.bc1n = true;
+    }
+    else if (strcmp("-bc1a", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC1a;
+    }
+    else if (strcmp("-bc2", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC2;
+    }
+    else if (strcmp("-bc3", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC3;
+    }
+    else if (strcmp("-bc3n", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC3n;
+    }
+    else if (strcmp("-bc4", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC4;
+    }
+    else if (strcmp("-bc5", argv[i]) == 0)
+    {
+        options.format = nvtt::Format_BC5;
+    }
 
-            break;
+    // Undocumented option. Mainly used for testing.
+    else if (strcmp("-ext", argv[i]) == 0)
+    {
+        if (i+1 < argc && argv[i+1][0] != '-') {
+            options.externalCompressor = argv[i+1];
+            i++;
         }
     }
-
-    const uint version = nvtt::version();
-    const uint major = version / 100 / 100;
-    const uint minor = (version / 100) % 100;
-    const uint rev = version % 100;
-
-
-    printf("NVIDIA Texture Tools %u.%u.%u - Copyright NVIDIA Corporation 2007\n\n", major, minor, rev);
-
-    if (input.isNull())
+    else if (strcmp("-pause", argv[i]) == 0)
     {
-        printf("usage: nvcompress [options] infile [outfile]\n\n");
-
-        printf("Input options:\n");
-        printf("  -color     \tThe input image is a color map (default).\n");
-        printf("  -alpha     \tThe input image has an alpha channel used for transparency.\n");
-        printf("  -normal    \tThe input image is a normal map.\n");
-        printf("  -tonormal  \tConvert input to normal map.\n");
-        printf("  -clamp     \tClamp wrapping mode (default).\n");
-        printf("  -repeat    \tRepeat wrapping mode.\n");
-        printf("  -nomips    \tDisable mipmap generation.\n");
-        printf("  -premula   \tPremultiply alpha into color channel.\n");
-        printf("  -mipfilter \tMipmap filter. One of the following: box, triangle, kaiser.\n");
-        printf("  -float     \tLoad as floating point image.\n\n");
-
-        printf("Compression options:\n");
-        printf("  -fast    \tFast compression.\n");
-        printf("  -nocuda  \tDo not use cuda compressor.\n");
-        printf("  -rgb     \tRGBA format\n");
-        printf("  -lumi    \tLUMINANCE format\n");
-        printf("  -bc1     \tBC1 format (DXT1)\n");
-        printf("  -bc1n    \tBC1 normal map format (DXT1nm)\n");
-        printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
-        printf("  -bc2     \tBC2 format (DXT3)\n");
-        printf("  -bc3     \tBC3 format (DXT5)\n");
-        printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
-        printf("  -bc4     \tBC4 format (ATI1)\n");
-        printf("  -bc5     \tBC5 format (3Dc/ATI2)\n\n");
-
-        printf("Output options:\n");
-        printf("  -silent  \tDo not output progress messages\n");
-        printf("  -dds10   \tUse DirectX 10 DDS format\n\n");
-
-        return EXIT_FAILURE;
+        printf("Press ENTER\n"); fflush(stdout);
+        getchar();
     }
 
-    // Make sure input file exists.
-    if (!nv::FileSystem::exists(input.str()))
+    // Output options
+    else if (strcmp("-silent", argv[i]) == 0)
+    {
+        options.silent = true;
+    }
+    else if (strcmp("-dds10", argv[i]) == 0)
     {
-        fprintf(stderr, "The file '%s' does not exist.\n", input.str());
-        return 1;
+        options.dds10 = true;
     }
+    else if (strcmp("-streaming", argv[i]) == 0)
+    {
+        options.streaming = true;
+    }
+    else if (strcmp("-writebehind", argv[i]) == 0)
+    {
+        options.writeBehind = true;
+    }
+    else if (strcmp("-directio", argv[i]) == 0)
+    {
+        options.writeBehind = true;
+        options.directIO = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
 
+// Compress a single file. Non DDS images are taken from the loader when there's one, in the order they were added.
+// Returns false on errors, after reporting them.
+bool compressFile(const Options & options, nvtt::Context & context, const char * input, const char * output, nv::BatchImageLoader * loader, double * seconds, uint64 * outputSize)
+{
     // Set input options.
     nvtt::InputOptions inputOptions;
 
-    if (nv::strCaseCmp(input.extension(), ".dds") == 0)
+    if (isDDS(input))
     {
         // Load surface.
-        nv::DirectDrawSurface dds(input.str());
+        nv::DirectDrawSurface dds(input);
         if (!dds.isValid())
         {
-            fprintf(stderr, "The file '%s' is not a valid DDS file.\n", input.str());
-            return EXIT_FAILURE;
+            fprintf(stderr, "The file '%s' is not a valid DDS file.\n", input);
+            return false;
         }
 
         if (!dds.isSupported())
         {
-            fprintf(stderr, "The file '%s' is not a supported DDS file.\n", input.str());
-            return EXIT_FAILURE;
+            fprintf(stderr, "The file '%s' is not a supported DDS file.\n", input);
+            return false;
         }
 
         uint faceCount;
@@ -411,19 +389,14 @@ int main(int argc, char *argv[])
     }
     else
     {
-        if (nv::strCaseCmp(input.extension(), ".exr") == 0 || nv::strCaseCmp(input.extension(), ".hdr") == 0)
+        if (isFloatImage(input, options.loadAsFloat))
         {
-            loadAsFloat = true;
-        }
-
-        if (loadAsFloat)
-        {
-            nv::AutoPtr<nv::FloatImage> image(nv::ImageIO::loadFloat(input.str()));
+            nv::AutoPtr<nv::FloatImage> image(loader != NULL ? loader->nextFloatImage() : nv::ImageIO::loadFloat(input));
 
             if (image == NULL)
             {
-                fprintf(stderr, "The file '%s' is not a supported image type.\n", input.str());
-                return EXIT_FAILURE;
+                fprintf(stderr, "The file '%s' is not a supported image type.\n", input);
+                return false;
             }
 
             inputOptions.setFormat(nvtt::InputFormat_RGBA_32F);
@@ -437,19 +410,19 @@ int main(int argc, char *argv[])
         else
         {
             // Regular image.
-            nv::Image image;
-            if (!image.load(input.str()))
+            nv::AutoPtr<nv::Image> image(loader != NULL ? loader->nextImage() : nv::ImageIO::load(input));
+            if (image == NULL)
             {
-                fprintf(stderr, "The file '%s' is not a supported image type.\n", input.str());
-                return 1;
+                fprintf(stderr, "The file '%s' is not a supported image type.\n", input);
+                return false;
             }
 
-            inputOptions.setTextureLayout(nvtt::TextureType_2D, image.width(), image.height());
-            inputOptions.setMipmapData(image.pixels(), image.width(), image.height());
+            inputOptions.setTextureLayout(nvtt::TextureType_2D, image->width(), image->height());
+            inputOptions.setMipmapData(image->pixels(), image->width(), image->height());
         }
     }
 
-    if (wrapRepeat)
+    if (options.wrapRepeat)
     {
         inputOptions.setWrapMode(nvtt::WrapMode_Repeat);
     }
@@ -458,7 +431,7 @@ int main(int argc, char *argv[])
         inputOptions.setWrapMode(nvtt::WrapMode_Clamp);
     }
 
-    if (alpha)
+    if (options.alpha)
     {
         inputOptions.setAlphaMode(nvtt::AlphaMode_Transparency);
     }
@@ -468,16 +441,16 @@ int main(int argc, char *argv[])
     }
 
     // Block compressed textures with mipmaps must be powers of two.
-    if (!noMipmaps && format != nvtt::Format_RGB)
+    if (!options.noMipmaps && options.format != nvtt::Format_RGB)
     {
         inputOptions.setRoundMode(nvtt::RoundMode_ToPreviousPowerOfTwo);
     }
 
-    if (normal)
+    if (options.normal)
     {
         setNormalMap(inputOptions);
     }
-    else if (color2normal)
+    else if (options.color2normal)
     {
         setColorToNormalMap(inputOptions);
     }
@@ -486,33 +459,33 @@ int main(int argc, char *argv[])
         setColorMap(inputOptions);
     }
 
-    if (noMipmaps)
+    if (options.noMipmaps)
     {
         inputOptions.setMipmapGeneration(false);
     }
 
-    /*if (premultiplyAlpha)
+    /*if (options.premultiplyAlpha)
     {
         inputOptions.setPremultiplyAlpha(true);
         inputOptions.setAlphaMode(nvtt::AlphaMode_Premultiplied);
     }*/
 
-    inputOptions.setMipmapFilter(mipmapFilter);
+    inputOptions.setMipmapFilter(options.mipmapFilter);
 
     nvtt::CompressionOptions compressionOptions;
-    compressionOptions.setFormat(format);
+    compressionOptions.setFormat(options.format);
 
-    if (format == nvtt::Format_BC2) {
+    if (options.format == nvtt::Format_BC2) {
         // Dither alpha when using BC2.
         compressionOptions.setQuantization(/*color dithering*/false, /*alpha dithering*/true, /*binary alpha*/false);
     }
-    else if (format == nvtt::Format_BC1a) {
+    else if (options.format == nvtt::Format_BC1a) {
         // Binary alpha when using BC1a.
         compressionOptions.setQuantization(/*color dithering*/false, /*alpha dithering*/true, /*binary alpha*/true, 127);
     }
-    else if (format == nvtt::Format_RGBA)
+    else if (options.format == nvtt::Format_RGBA)
     {
-        if (luminance)
+        if (options.luminance)
         {
             compressionOptions.setPixelFormat(8, 0xff, 0, 0, 0);
         }
@@ -525,7 +498,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (fast)
+    if (options.fast)
     {
         compressionOptions.setQuality(nvtt::Quality_Fastest);
     }
@@ -536,56 +509,55 @@ int main(int argc, char *argv[])
         //compressionOptions.setQuality(nvtt::Quality_Highest);
     }
 
-    if (bc1n)
+    if (options.bc1n)
     {
         compressionOptions.setColorWeights(1, 1, 0);
     }
 
-    
+
     //compressionOptions.setColorWeights(0.2126, 0.7152, 0.0722);
     //compressionOptions.setColorWeights(0.299, 0.587, 0.114);
     //compressionOptions.setColorWeights(3, 4, 2);
 
-    if (externalCompressor != NULL)
+    if (options.externalCompressor != NULL)
     {
-        compressionOptions.setExternalCompressor(externalCompressor);
+        compressionOptions.setExternalCompressor(options.externalCompressor);
     }
 
 
     MyErrorHandler errorHandler;
-    MyOutputHandler outputHandler(output.str());
-    if (outputHandler.stream->isError())
+    MyOutputHandler outputHandler(options.writeBehind ? NULL : output);
+    if (outputHandler.stream != NULL && outputHandler.stream->isError())
     {
-        fprintf(stderr, "Error opening '%s' for writting\n", output.str());
-        return EXIT_FAILURE;
+        fprintf(stderr, "Error opening '%s' for writting\n", output);
+        return false;
     }
 
-    nvtt::Context context;
-    context.enableCudaAcceleration(!nocuda);
+    outputHandler.setTotal(context.estimateSize(inputOptions, compressionOptions));
+    outputHandler.setDisplayProgress(!options.silent);
 
-    printf("CUDA acceleration ");
-    if (context.isCudaAccelerationEnabled())
+    nvtt::OutputOptions outputOptions;
+    if (options.writeBehind)
     {
-        printf("ENABLED\n\n");
+        outputOptions.setWriteBehind(true, 1024 * 1024, 4, options.directIO);
+        outputOptions.setFileName(output);
     }
     else
     {
-        printf("DISABLED\n\n");
+        outputOptions.setOutputHandler(&outputHandler);
     }
-
-    outputHandler.setTotal(context.estimateSize(inputOptions, compressionOptions));
-    outputHandler.setDisplayProgress(!silent);
-
-    nvtt::OutputOptions outputOptions;
-    //outputOptions.setFileName(output);
-    outputOptions.setOutputHandler(&outputHandler);
     outputOptions.setErrorHandler(&errorHandler);
 
-    if (dds10)
+    if (options.dds10)
     {
         outputOptions.setContainer(nvtt::Container_DDS10);
     }
 
+    if (options.streaming)
+    {
+        outputOptions.setStreamingLayout(true);
+    }
+
     // printf("Press ENTER.\n");
     // fflush(stdout);
     // getchar();
@@ -595,12 +567,483 @@ int main(int argc, char *argv[])
 
     if (!context.process(inputOptions, compressionOptions, outputOptions))
     {
-        return EXIT_FAILURE;
+        return false;
     }
+
+    // Close the output, so that the time includes the writes that are still pending.
+    outputOptions.setOutputHandler(NULL);
+    delete outputHandler.stream;
+    outputHandler.stream = NULL;
+
+
     timer.stop();
 
-    printf("\rtime taken: %.3f seconds\n", timer.elapsed());
+    *seconds = timer.elapsed();
+    *outputSize = nv::StdInputStream(output).size();
 
-    return EXIT_SUCCESS;
+    return true;
+}
+
+
+// Compresses the blocks of small images on the calling thread, so that several files are compressed at once, and
+// distributes the blocks of large images across the thread pool, that only runs one of them at a time.
+struct BatchTaskDispatcher : public nvtt::TaskDispatcher
+{
+    virtual void dispatch(nvtt::Task * task, void * context, int count)
+    {
+        // 256x256 pixels.
+        if (count < 64 * 64)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                task(context, i);
+            }
+        }
+        else
+        {
+            nv::ParallelFor parallelFor(task, context);
+            parallelFor.run(count);
+        }
+    }
+};
+
+struct BatchJob
+{
+    nv::Path input;
+    nv::Path output;
+    Options options;
+
+    bool succeeded;
+    double seconds;
+    uint64 outputSize;
+};
+
+struct Batch
+{
+    nv::Array<BatchJob> jobs;
+    bool nocuda;
+    nvtt::Cache * cache;
+
+    nv::Mutex mutex;
+    uint next;                  // Next job that is not taken by a worker.
+};
+
+// Each worker compresses whole files with its own context, until there are no jobs left.
+void batchWorker(void * arg)
+{
+    Batch * batch = (Batch *)arg;
+
+    BatchTaskDispatcher dispatcher;
+
+    nvtt::Context context;
+    context.enableCudaAcceleration(!batch->nocuda);
+    context.setTaskDispatcher(&dispatcher);
+    context.setCache(batch->cache);
+
+    for (;;)
+    {
+        batch->mutex.lock();
+        const uint i = batch->next++;
+        batch->mutex.unlock();
+
+        if (i >= batch->jobs.count()) break;
+
+        BatchJob & job = batch->jobs[i];
+        job.succeeded = compressFile(job.options, context, job.input.str(), job.output.str(), NULL, &job.seconds, &job.outputSize);
+
+        if (job.succeeded)
+        {
+            printf("%s: %.3f seconds, %.2f MB\n", job.input.str(), job.seconds, job.outputSize / (1024.0 * 1024.0));
+        }
+    }
+}
+
+// Split a line of the manifest in words. Words that contain spaces can be quoted.
+void splitLine(char * line, nv::Array<char *> & words)
+{
+    words.clear();
+
+    char * p = line;
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (*p == '\0' || *p == '#') break;
+
+        if (*p == '"')
+        {
+            p++;
+            words.append(p);
+            while (*p != '\0' && *p != '"') p++;
+        }
+        else
+        {
+            words.append(p);
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+        }
+
+        if (*p == '\0') break;
+        *p++ = '\0';
+    }
 }
 
+// Read the manifest, one file per line: input [output] [options]. The options of each line are added to the ones of
+// the command line. Empty lines and the text after a '#' are ignored.
+bool readManifest(const char * fileName, const Options & defaults, nv::Array<BatchJob> & jobs, nv::Array<char *> & strings)
+{
+    FILE * fp = fopen(fileName, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error opening manifest '%s'.\n", fileName);
+        return false;
+    }
+
+    bool result = true;
+    nv::Array<char *> words;
+    char buffer[4096];
+
+    for (int lineNumber = 1; fgets(buffer, sizeof(buffer), fp) != NULL; lineNumber++)
+    {
+        // Options may keep pointers to their arguments.
+        char * line = new char[strlen(buffer) + 1];
+        strcpy(line, buffer);
+        strings.append(line);
+
+        splitLine(line, words);
+        if (words.isEmpty()) continue;
+
+        BatchJob job;
+        job.options = defaults;
+        job.succeeded = false;
+        job.seconds = 0;
+        job.outputSize = 0;
+
+        const char * input = NULL;
+        const char * output = NULL;
+
+        for (int i = 0; i < int(words.count()); i++)
+        {
+            if (words[i][0] == '-')
+            {
+                if (!parseOption(job.options, int(words.count()), words.buffer(), i))
+                {
+                    fprintf(stderr, "%s:%d: Unknown option '%s'.\n", fileName, lineNumber, words[i]);
+                    result = false;
+                }
+            }
+            else if (input == NULL) input = words[i];
+            else if (output == NULL) output = words[i];
+            else
+            {
+                fprintf(stderr, "%s:%d: Unexpected '%s'.\n", fileName, lineNumber, words[i]);
+                result = false;
+            }
+        }
+
+        if (input == NULL) continue;
+
+        job.input = input;
+        if (output != NULL)
+        {
+            job.output = output;
+        }
+        else
+        {
+            job.output.copy(input);
+            job.output.stripExtension();
+            job.output.append(".dds");
+        }
+
+        // Progress messages of several files would be mixed.
+        job.options.silent = true;
+
+        jobs.append(job);
+    }
+
+    fclose(fp);
+
+    return result;
+}
+
+void printCacheStatistics(const nvtt::Cache & cache)
+{
+    printf("cache: %d hits, %d misses, %d evictions, %.2f MB in %d entries\n",
+        cache.hitCount(), cache.missCount(), cache.evictionCount(), cache.size(), cache.entryCount());
+}
+
+int compressManifest(const char * fileName, const Options & defaults, nvtt::Cache * cache)
+{
+    Batch batch;
+    batch.nocuda = defaults.nocuda;
+    batch.cache = cache;
+    batch.next = 0;
+
+    nv::Array<char *> strings;
+    bool result = readManifest(fileName, defaults, batch.jobs, strings);
+
+    for (uint i = 0; i < batch.jobs.count(); i++)
+    {
+        if (!nv::FileSystem::exists(batch.jobs[i].input.str()))
+        {
+            fprintf(stderr, "The file '%s' does not exist.\n", batch.jobs[i].input.str());
+            result = false;
+        }
+    }
+
+    if (result)
+    {
+        nv::Timer timer;
+        timer.start();
+
+        const uint workerCount = nv::min(nv::max(nv::hardwareThreadCount(), 1U), batch.jobs.count());
+        nv::Thread * workers = new nv::Thread[workerCount];
+        for (uint i = 0; i < workerCount; i++)
+        {
+            workers[i].start(batchWorker, &batch);
+        }
+        nv::Thread::wait(workers, workerCount);
+        delete [] workers;
+
+        timer.stop();
+
+        uint failed = 0;
+        uint64 totalSize = 0;
+        for (uint i = 0; i < batch.jobs.count(); i++)
+        {
+            if (!batch.jobs[i].succeeded) failed++;
+            totalSize += batch.jobs[i].outputSize;
+        }
+
+        const double megabytes = totalSize / (1024.0 * 1024.0);
+        printf("\n%u files, %u failed, total time taken: %.3f seconds\n", batch.jobs.count(), failed, timer.elapsed());
+        printf("output: %.2f MB, %.2f MB/s, %.1f files/s\n", megabytes, megabytes / timer.elapsed(), batch.jobs.count() / timer.elapsed());
+
+        if (cache != NULL)
+        {
+            printCacheStatistics(*cache);
+        }
+
+        result = (failed == 0);
+    }
+
+    for (uint i = 0; i < strings.count(); i++)
+    {
+        delete [] strings[i];
+    }
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    Options options;
+    bool multi = false;
+    const char * manifest = NULL;
+    const char * cachePath = NULL;
+    int cacheSize = 1024;
+
+    nv::Array<const char *> inputs;
+    const char * outputName = NULL;
+
+
+    // Parse arguments.
+    for (int i = 1; i < argc; i++)
+    {
+        if (parseOption(options, argc, argv, i))
+        {
+        }
+        else if (strcmp("-multi", argv[i]) == 0)
+        {
+            multi = true;
+        }
+        else if (strcmp("-batch", argv[i]) == 0)
+        {
+            if (i+1 < argc) {
+                manifest = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-cache", argv[i]) == 0)
+        {
+            if (i+1 < argc) {
+                cachePath = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-cachesize", argv[i]) == 0)
+        {
+            if (i+1 < argc) {
+                cacheSize = atoi(argv[i+1]);
+                i++;
+            }
+        }
+
+        else if (argv[i][0] != '-')
+        {
+            inputs.append(argv[i]);
+
+            // All the remaining file names are inputs.
+            if (multi) continue;
+
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                outputName = argv[i+1];
+            }
+
+            break;
+        }
+    }
+
+    const uint version = nvtt::version();
+    const uint major = version / 100 / 100;
+    const uint minor = (version / 100) % 100;
+    const uint rev = version % 100;
+
+
+    printf("NVIDIA Texture Tools %u.%u.%u - Copyright NVIDIA Corporation 2007\n\n", major, minor, rev);
+
+    // Unchanged textures are copied from the cache instead of being compressed again.
+    nvtt::Cache cache;
+    if (cachePath != NULL)
+    {
+        cache.setSizeLimit(cacheSize);
+        if (!cache.open(cachePath))
+        {
+            fprintf(stderr, "Can't open the cache directory '%s'.\n", cachePath);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (manifest != NULL)
+    {
+        return compressManifest(manifest, options, cachePath != NULL ? &cache : NULL);
+    }
+
+    if (inputs.isEmpty())
+    {
+        printf("usage: nvcompress [options] infile [outfile]\n");
+        printf("       nvcompress [options] -multi infile [infile ...]\n");
+        printf("       nvcompress [options] -batch manifest\n\n");
+
+        printf("Input options:\n");
+        printf("  -color     \tThe input image is a color map (default).\n");
+        printf("  -alpha     \tThe input image has an alpha channel used for transparency.\n");
+        printf("  -normal    \tThe input image is a normal map.\n");
+        printf("  -tonormal  \tConvert input to normal map.\n");
+        printf("  -clamp     \tClamp wrapping mode (default).\n");
+        printf("  -repeat    \tRepeat wrapping mode.\n");
+        printf("  -nomips    \tDisable mipmap generation.\n");
+        printf("  -premula   \tPremultiply alpha into color channel.\n");
+        printf("  -mipfilter \tMipmap filter. One of the following: box, triangle, kaiser.\n");
+        printf("  -float     \tLoad as floating point image.\n\n");
+
+        printf("Compression options:\n");
+        printf("  -fast    \tFast compression.\n");
+        printf("  -nocuda  \tDo not use cuda compressor.\n");
+        printf("  -rgb     \tRGBA format\n");
+        printf("  -lumi    \tLUMINANCE format\n");
+        printf("  -bc1     \tBC1 format (DXT1)\n");
+        printf("  -bc1n    \tBC1 normal map format (DXT1nm)\n");
+        printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
+        printf("  -bc2     \tBC2 format (DXT3)\n");
+        printf("  -bc3     \tBC3 format (DXT5)\n");
+        printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
+        printf("  -bc4     \tBC4 format (ATI1)\n");
+        printf("  -bc5     \tBC5 format (3Dc/ATI2)\n\n");
+
+        printf("Output options:\n");
+        printf("  -silent  \tDo not output progress messages\n");
+        printf("  -dds10   \tUse DirectX 10 DDS format\n");
+        printf("  -streaming\tWrite the mipmaps from smallest to largest, with an index of their offsets\n");
+        printf("  -writebehind\tWrite the output from a separate thread (no progress messages)\n");
+        printf("  -directio\tWrite behind bypassing the file system cache\n");
+        printf("  -multi   \tCompress several files, the output names are the input names with a .dds extension\n");
+        printf("  -batch   \tCompress the files listed in a manifest, one 'infile [outfile] [options]' per line\n");
+        printf("  -cache <dir>\tReuse the outputs of unchanged textures stored in the given directory\n");
+        printf("  -cachesize <MB>\tMaximum size of the cache, 1024 MB by default\n\n");
+
+        return EXIT_FAILURE;
+    }
+
+    // Make sure the input files exist.
+    for (uint i = 0; i < inputs.count(); i++)
+    {
+        if (!nv::FileSystem::exists(inputs[i]))
+        {
+            fprintf(stderr, "The file '%s' does not exist.\n", inputs[i]);
+            return 1;
+        }
+    }
+
+    nvtt::Context context;
+    context.enableCudaAcceleration(!options.nocuda);
+
+    if (cachePath != NULL)
+    {
+        context.setCache(&cache);
+    }
+
+    printf("CUDA acceleration ");
+    if (context.isCudaAccelerationEnabled())
+    {
+        printf("ENABLED\n\n");
+    }
+    else
+    {
+        printf("DISABLED\n\n");
+    }
+
+    // Decode the images on separate threads, so that the next files are loaded while the current one is compressed.
+    // DDS files are loaded with all their mipmaps when they are processed.
+    nv::BatchImageLoader loader;
+    for (uint i = 0; i < inputs.count(); i++)
+    {
+        if (!isDDS(inputs[i]))
+        {
+            loader.add(inputs[i], isFloatImage(inputs[i], options.loadAsFloat));
+        }
+    }
+
+    nv::Timer totalTimer;
+    totalTimer.start();
+
+    for (uint i = 0; i < inputs.count(); i++)
+    {
+        nv::Path output;
+        if (outputName != NULL)
+        {
+            output = outputName;
+        }
+        else
+        {
+            output.copy(inputs[i]);
+            output.stripExtension();
+            output.append(".dds");
+        }
+
+        double seconds;
+        uint64 outputSize;
+        if (!compressFile(options, context, inputs[i], output.str(), &loader, &seconds, &outputSize))
+        {
+            return EXIT_FAILURE;
+        }
+
+        printf("\rtime taken: %.3f seconds\n", seconds);
+        printf("output: %.2f MB, %.2f MB/s\n", outputSize / (1024.0 * 1024.0), outputSize / (1024.0 * 1024.0 * seconds));
+    }
+
+    if (inputs.count() > 1)
+    {
+        totalTimer.stop();
+        printf("\n%u files, total time taken: %.3f seconds\n", inputs.count(), totalTimer.elapsed());
+    }
+
+    if (cachePath != NULL)
+    {
+        printCacheStatistics(cache);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -23,6 +23,7 @@
 
 #include <nvcore/StrLib.h>
 #include <nvcore/StdStream.h>
+#include <nvcore/Utils.h> // max
 
 #include <nvimage/Image.h>
 #include <nvimage/DirectDrawSurface.h>
@@ -76,7 +77,8 @@ void initOpengl()
     glutReportErrors();
 }
 
-GLuint createTexture(nv::DirectDrawSurface & dds)
+// Only the mipmaps starting at firstMipmap are decoded.
+GLuint createTexture(nv::DirectDrawSurface & dds, uint firstMipmap)
 {
     GLuint tex;
     glGenTextures(1, &tex);
@@ -89,7 +91,7 @@ GLuint createTexture(nv::DirectDrawSurface & dds)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        const uint count = dds.mipmapCount();
+        const uint count = dds.mipmapCount() - firstMipmap;
 
         max_level = count - 1;
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
@@ -97,7 +99,7 @@ GLuint createTexture(nv::DirectDrawSurface & dds)
         for (uint i = 0; i < count; i++)
         {
             nv::Image img;
-            dds.mipmap(&img, 0, i); // face, mipmap
+            dds.mipmap(&img, 0, firstMipmap + i); // face, mipmap
 
             glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, img.width(), img.height(), 0, GL_BGRA, GL_UNSIGNED_BYTE, img.pixels());
         }
@@ -272,13 +274,15 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    win_w = w = dds.width();
-    win_h = h = dds.height();
+    glutInit(&argc, argv);
 
-    // @@ Clamp window size if texture larger than desktop?
+    // Textures larger than the desktop are displayed from the first mipmap that covers it, the larger ones are not decoded.
+    const uint screenExtent = nv::max(glutGet(GLUT_SCREEN_WIDTH), glutGet(GLUT_SCREEN_HEIGHT));
+    const uint firstMipmap = (dds.isTexture2D() && screenExtent > 0) ? dds.smallestMipmap(screenExtent) : 0;
 
+    win_w = w = dds.surfaceWidth(firstMipmap);
+    win_h = h = dds.surfaceHeight(firstMipmap);
 
-    glutInit(&argc, argv);
 
     glutInitDisplayMode( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH );
     glutInitWindowSize( win_w, win_h );
@@ -293,7 +297,7 @@ int main(int argc, char *argv[])
 
     initOpengl();
 
-    tex0 = createTexture(dds);
+    tex0 = createTexture(dds, firstMipmap);
 
     // @@ Add IMGUI, fade in and out when mouse over.
 
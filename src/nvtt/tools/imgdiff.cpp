@@ -27,7 +27,9 @@
 #include "nvmath/Vector.inl"
 
 #include "nvimage/Image.h"
+#include "nvimage/FloatImage.h"
 #include "nvimage/DirectDrawSurface.h"
+#include "nvimage/ErrorMetric.h"
 
 #include "nvcore/StrLib.h"
 #include "nvcore/StdStream.h"
@@ -232,6 +234,11 @@ int main(int argc, char *argv[])
 	Error error_total;
 	NormalError error_normal;
 
+	// Overlap of both images, for the structural similarity.
+	nv::FloatImage fimage0, fimage1;
+	fimage0.allocate(4, w, h);
+	fimage1.allocate(4, w, h);
+
 	for (uint i = 0; i < h; i++)
 	{
 		for (uint e = 0; e < w; e++)
@@ -239,6 +246,15 @@ int main(int argc, char *argv[])
 			const nv::Color32 c0(image0.pixel(e, i));
 			const nv::Color32 c1(image1.pixel(e, i));
 
+			fimage0.pixel(0, e, i, 0) = c0.r / 255.0f;
+			fimage0.pixel(1, e, i, 0) = c0.g / 255.0f;
+			fimage0.pixel(2, e, i, 0) = c0.b / 255.0f;
+			fimage0.pixel(3, e, i, 0) = c0.a / 255.0f;
+			fimage1.pixel(0, e, i, 0) = c1.r / 255.0f;
+			fimage1.pixel(1, e, i, 0) = c1.g / 255.0f;
+			fimage1.pixel(2, e, i, 0) = c1.b / 255.0f;
+			fimage1.pixel(3, e, i, 0) = c1.a / 255.0f;
+
 			double r = float(c0.r - c1.r);
 			double g = float(c0.g - c1.g);
 			double b = float(c0.b - c1.b);
@@ -289,6 +305,11 @@ int main(int argc, char *argv[])
 	printf("Luma:\n");
 	error_luma.print();
 
+	printf("Structural similarity index:\n");
+	printf("  Red:   %f\n", nv::structuralSimilarity(&fimage1, &fimage0, 0));
+	printf("  Green: %f\n", nv::structuralSimilarity(&fimage1, &fimage0, 1));
+	printf("  Blue:  %f\n", nv::structuralSimilarity(&fimage1, &fimage0, 2));
+
 	if (compareNormal)
 	{
 		printf("Normal:\n");
@@ -299,6 +320,7 @@ int main(int argc, char *argv[])
 	{
 		printf("Alpha:\n");
 		error_a.print();
+		printf("  Structural similarity index: %f\n", nv::structuralSimilarity(&fimage1, &fimage0, 3));
 	}
 
 	// @@ Write image difference.
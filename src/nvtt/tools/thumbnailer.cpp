@@ -39,7 +39,8 @@
 
 #include "cmdline.h"
 
-static bool loadImage(nv::Image & image, const char * fileName)
+// Load the image, or the smallest mipmap or JPEG scale that is at least size pixels wide or tall. Returns the size of the full image.
+static bool loadImage(nv::Image & image, const char * fileName, uint size, uint * width, uint * height)
 {
     if (nv::strCaseCmp(nv::Path::extension(fileName), ".dds") == 0)
     {
@@ -50,16 +51,22 @@ static bool loadImage(nv::Image & image, const char * fileName)
             return false;
         }
 
-        dds.mipmap(&image, 0, 0); // get first image
+        dds.mipmap(&image, 0, dds.smallestMipmap(size));
+
+        *width = dds.width();
+        *height = dds.height();
     }
     else
     {
         // Regular image.
-        if (!image.load(fileName))
+        nv::AutoPtr<nv::Image> img(nv::ImageIO::load(fileName, size, width, height));
+        if (img == NULL)
         {
                 fprintf(stderr, "The file '%s' is not a supported image type.\n", fileName);
                 return false;
         }
+
+        image.acquire(img.ptr());
     }
 
     return true;
@@ -116,12 +123,13 @@ int main(int argc, char *argv[])
     }
 
     nv::Image image;
-    if (!loadImage(image, input.str())) return 1;
+    uint width, height;
+    if (!loadImage(image, input.str(), size, &width, &height)) return 1;
 
     nv::StringBuilder widthString;
-    widthString.number(image.width());
+    widthString.number(width);
     nv::StringBuilder heightString;
-    heightString.number(image.height());
+    heightString.number(height);
 
     nv::Array<const char *> metaData;
     metaData.append("Thumb::Image::Width");